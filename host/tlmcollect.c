@@ -0,0 +1,525 @@
+/*
+ * File:   tlmcollect.c
+ * Author: Faris Shahin
+ *
+ * Collects the telemetry streams of many tank monitors at once and appends
+ * the records to a time-series store (see tlmstore.h).
+ *
+ * Usage:
+ *      tlmcollect [-b baud] [-o store] [-n batch] [-w ms] [-f ms] [-l list]
+ *                 [-v] [device...]
+ *      -o      store file, appended to (default tlm.store)
+ *      -n      records per write (default 1024)
+ *      -w      longest time a record waits for its write (default 50 ms)
+ *      -f      time between fsyncs of the store (default 1000 ms)
+ *      -l      file with more devices, one per line (tlmload -o writes one)
+ *      -v      statistics of every device at the end
+ * The devices are numbered in the order given, which is the unit number in
+ * the store. A device that hangs up is dropped; the collector stops when no
+ * device is left or on SIGINT/SIGTERM, after writing and syncing the store.
+ *
+ * One thread waits on all devices with epoll. Each device has a ring buffer
+ * the bytes are read into with readv() and the records are decoded straight
+ * from the ring into the write batch, with no copy of the frame. The batch
+ * goes to the store with one write() when it is full or its oldest record
+ * waited -w ms, and the store is synced every -f ms at most, so the cost of
+ * fdatasync() is shared by every record of that interval.
+ *
+ * Figures from tlmload on the same one core VM, 10 s runs, one pty per unit:
+ *      units  records/s        settings    receive->write      receive->sync
+ *                                          p50      p99        p50      p99
+ *      100    8000 (80/unit)   default     27 ms    51 ms      0.56 s   1.05 s
+ *      500    40000            default     13 ms    26 ms      0.52 s   1.02 s
+ *      500    40000            -w 1 -f 10  1.1 ms   1.9 ms     6.7 ms   13 ms
+ *      500    436000 (flood)   default     0.24 ms  7.2 ms     0.51 s   1.02 s
+ * No record was lost in any of them. At low rates the batches rarely fill,
+ * so the latencies are set by -w and -f rather than by the collector; the
+ * flood run is limited by tlmload sharing the core.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include "tlmcommon.h"
+#include "tlmstore.h"
+
+#define RING_SIZE       4096    //Bytes buffered per device, a power of 2
+#define RING_MASK       (RING_SIZE-1)
+#define HIST_BUCKETS    1024
+
+struct port
+{
+    int fd;
+    char * name;
+    uint8_t ring[RING_SIZE];
+    uint32_t head, tail;    //Free running, tail-head bytes are in the ring
+    int lastSeq;
+    long records, crcErrors, lost, skipped;
+};
+
+//Receive time of a run of records, to measure their latency once written
+struct pending
+{
+    int64_t time;
+    uint32_t count;
+};
+
+struct pendingList
+{
+    struct pending * items;
+    size_t count, size;
+};
+
+//Latency histogram in us: exact up to 31, then 16 steps per power of 2
+struct histogram
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    int64_t max;
+};
+
+static volatile sig_atomic_t stop = 0;
+
+static struct port * ports;
+static int portCount, portsOpen;
+
+static int storeFd;
+static struct storeRecord * batch;
+static size_t batchCount, batchSize = 1024;
+static int64_t batchOldest;
+static int64_t writeWait = 50000000, syncInterval = 1000000000;
+static int64_t lastSync;
+static int unsynced;
+static struct pendingList unwritten, notSynced;
+static struct histogram writeLatency, syncLatency;
+static long writes, syncs;
+
+static void onSignal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static int64_t monotonicNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t realtimeNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int bucketOf(int64_t us)
+{
+    if(us < 32)
+        return us < 0 ? 0 : (int)us;
+    int msb = 63 - __builtin_clzll((uint64_t)us);
+    int b = 32 + (msb-5)*16 + (int)((us >> (msb-4)) & 15);
+    return b < HIST_BUCKETS ? b : HIST_BUCKETS-1;
+}
+
+//Upper bound in us of the values in bucket b
+static int64_t bucketTop(int b)
+{
+    if(b < 32)
+        return b;
+    int msb = (b-32)/16 + 5;
+    return ((int64_t)(16 + (b-32)%16 + 1) << (msb-4)) - 1;
+}
+
+static void histogramAdd(struct histogram * h, int64_t us, uint32_t count)
+{
+    h->counts[bucketOf(us)] += count;
+    h->total += count;
+    if(us > h->max)
+        h->max = us;
+}
+
+static int64_t histogramPercentile(const struct histogram * h, double p)
+{
+    uint64_t want = (uint64_t)(h->total * p / 100.0);
+    uint64_t seen = 0;
+    for(int b = 0; b < HIST_BUCKETS; b++)
+    {
+        seen += h->counts[b];
+        if(seen > want)
+            return bucketTop(b) < h->max ? bucketTop(b) : h->max;
+    }
+    return h->max;
+}
+
+static void pendingAdd(struct pendingList * l, int64_t time, uint32_t count)
+{
+    if(l->count > 0 && l->items[l->count-1].time == time)
+    {
+        l->items[l->count-1].count += count;
+        return;
+    }
+    if(l->count == l->size)
+    {
+        l->size = l->size ? l->size*2 : 256;
+        l->items = realloc(l->items, l->size * sizeof(*l->items));
+        if(l->items == NULL)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    l->items[l->count].time = time;
+    l->items[l->count].count = count;
+    l->count++;
+}
+
+/*
+ * Move the receive times of l to the histogram h (and to next if given)
+ */
+static void pendingDone(struct pendingList * l, struct histogram * h, struct pendingList * next, int64_t now)
+{
+    for(size_t i = 0; i < l->count; i++)
+    {
+        histogramAdd(h, (now - l->items[i].time) / 1000, l->items[i].count);
+        if(next)
+            pendingAdd(next, l->items[i].time, l->items[i].count);
+    }
+    l->count = 0;
+}
+
+static void flushBatch(void)
+{
+    if(batchCount == 0)
+        return;
+    const char * p = (const char *)batch;
+    size_t left = batchCount * sizeof(*batch);
+    while(left > 0)
+    {
+        ssize_t n = write(storeFd, p, left);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            perror("store write");
+            exit(1);
+        }
+        p += n;
+        left -= n;
+    }
+    writes++;
+    batchCount = 0;
+    unsynced = 1;
+    pendingDone(&unwritten, &writeLatency, &notSynced, monotonicNs());
+}
+
+static void syncStore(void)
+{
+    if(unsynced)
+    {
+        if(fdatasync(storeFd) != 0)
+            perror("store fdatasync");
+        syncs++;
+        unsynced = 0;
+        pendingDone(&notSynced, &syncLatency, NULL, monotonicNs());
+    }
+    lastSync = monotonicNs();
+}
+
+/*
+ * Decode the whole records in the ring of port p into the batch
+ */
+static void parse(struct port * p, int unit, int64_t received, int64_t wallTime)
+{
+    const uint8_t * r = p->ring;
+    while(p->tail - p->head >= TLM_REC_SIZE)
+    {
+        uint32_t h = p->head;
+        if(r[h & RING_MASK] != TLM_SYNC)
+        {
+            p->head++;
+            p->skipped++;
+            continue;
+        }
+        uint8_t crc = 0xff;
+        for(int i = TLM_REC_SEQ; i < TLM_REC_CRC; i++)
+            crc = crc8(crc, r[(h+i) & RING_MASK]);
+        if(crc != r[(h+TLM_REC_CRC) & RING_MASK])
+        {
+            //Resync on the next sync byte
+            p->crcErrors++;
+            p->head++;
+            p->skipped++;
+            continue;
+        }
+        #define B(i) ((uint32_t)r[(h+(i)) & RING_MASK])
+        if(batchCount == 0)
+            batchOldest = received;
+        struct storeRecord * s = &batch[batchCount++];
+        s->time = wallTime;
+        s->unit = unit;
+        s->seq = B(TLM_REC_SEQ);
+        s->tank = B(TLM_REC_TANK);
+        s->ticks = B(TLM_REC_TICKS) | B(TLM_REC_TICKS+1) << 8;
+        s->level = B(TLM_REC_LEVEL) | B(TLM_REC_LEVEL+1) << 8;
+        s->liters = B(TLM_REC_LITERS) | B(TLM_REC_LITERS+1) << 8 | B(TLM_REC_LITERS+2) << 16;
+        s->flags = B(TLM_REC_FLAGS);
+        memset(s->pad, 0, sizeof(s->pad));
+        #undef B
+        p->head += TLM_REC_SIZE;
+        p->records++;
+        if(p->lastSeq >= 0)
+            p->lost += (uint8_t)(s->seq - p->lastSeq - 1);
+        p->lastSeq = s->seq;
+        pendingAdd(&unwritten, received, 1);
+        if(batchCount == batchSize)
+            flushBatch();
+    }
+}
+
+static void closePort(struct port * p, int epfd)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, p->fd, NULL);
+    close(p->fd);
+    p->fd = -1;
+    portsOpen--;
+}
+
+/*
+ * Read what port p has into its ring and decode it
+ */
+static void readPort(struct port * p, int unit, int epfd)
+{
+    uint32_t used = p->tail - p->head;
+    uint32_t start = p->tail & RING_MASK;
+    uint32_t free = RING_SIZE - used;
+    struct iovec iov[2];
+    int parts = 1;
+    iov[0].iov_base = p->ring + start;
+    iov[0].iov_len = free < RING_SIZE - start ? free : RING_SIZE - start;
+    if(iov[0].iov_len < free)
+    {
+        iov[1].iov_base = p->ring;
+        iov[1].iov_len = free - iov[0].iov_len;
+        parts = 2;
+    }
+    ssize_t n = readv(p->fd, iov, parts);
+    if(n > 0)
+    {
+        p->tail += n;
+        parse(p, unit, monotonicNs(), realtimeNs());
+    }
+    else if(n == 0 || (errno != EAGAIN && errno != EINTR))
+        closePort(p, epfd);  //Hang up (EIO on a pty whose master closed)
+}
+
+static void addPort(const char * name)
+{
+    ports = realloc(ports, (portCount+1) * sizeof(*ports));
+    if(ports == NULL)
+    {
+        perror("realloc");
+        exit(1);
+    }
+    struct port * p = &ports[portCount++];
+    memset(p, 0, sizeof(*p));
+    p->name = strdup(name);
+    p->lastSeq = -1;
+}
+
+static void readList(const char * file)
+{
+    FILE * f = fopen(file, "r");
+    char line[256];
+    if(f == NULL)
+    {
+        perror(file);
+        exit(1);
+    }
+    while(fgets(line, sizeof(line), f))
+    {
+        line[strcspn(line, "\r\n")] = 0;
+        if(line[0])
+            addPort(line);
+    }
+    fclose(f);
+}
+
+static int openStore(const char * file)
+{
+    int fd = open(file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd < 0)
+        return -1;
+    off_t size = lseek(fd, 0, SEEK_END);
+    if(size == 0)
+    {
+        struct storeHeader h;
+        memcpy(h.magic, STORE_MAGIC, sizeof(h.magic));
+        h.recordSize = sizeof(struct storeRecord);
+        h.reserved = 0;
+        if(write(fd, &h, sizeof(h)) != sizeof(h))
+            return -1;
+    }
+    else if((size - (off_t)sizeof(struct storeHeader)) % sizeof(struct storeRecord) != 0)
+    {
+        //A record cut by a crash would shift every record after it
+        fprintf(stderr, "%s: dropping a partial record at the end\n", file);
+        if(ftruncate(fd, size - (size - (off_t)sizeof(struct storeHeader)) % sizeof(struct storeRecord)) != 0)
+            return -1;
+    }
+    return fd;
+}
+
+static void writeUnits(const char * store)
+{
+    char file[1024];
+    snprintf(file, sizeof(file), "%s.units", store);
+    FILE * f = fopen(file, "w");
+    if(f == NULL)
+    {
+        perror(file);
+        return;
+    }
+    for(int i = 0; i < portCount; i++)
+        fprintf(f, "%s\n", ports[i].name);
+    fclose(f);
+}
+
+int main(int argc, char ** argv)
+{
+    long baud = 9600;
+    const char * store = "tlm.store";
+    int verbose = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "b:o:n:w:f:l:v")) != -1)
+    {
+        switch(opt)
+        {
+            case 'b': baud = atol(optarg); break;
+            case 'o': store = optarg; break;
+            case 'n': batchSize = atol(optarg); break;
+            case 'w': writeWait = atol(optarg) * 1000000LL; break;
+            case 'f': syncInterval = atol(optarg) * 1000000LL; break;
+            case 'l': readList(optarg); break;
+            case 'v': verbose = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-b baud] [-o store] [-n batch] [-w ms] [-f ms] [-l list] [-v] [device...]\n", argv[0]);
+                return 2;
+        }
+    }
+    for(int i = optind; i < argc; i++)
+        addPort(argv[i]);
+    if(baudConstant(baud) == 0 || batchSize == 0)
+    {
+        fprintf(stderr, "unsupported baud rate or batch size\n");
+        return 2;
+    }
+    if(portCount == 0 || portCount > 65535)
+    {
+        fprintf(stderr, "no devices given\n");
+        return 2;
+    }
+    batch = malloc(batchSize * sizeof(*batch));
+    storeFd = openStore(store);
+    if(batch == NULL || storeFd < 0)
+    {
+        perror(store);
+        return 1;
+    }
+    writeUnits(store);
+
+    int epfd = epoll_create1(0);
+    for(int i = 0; i < portCount; i++)
+    {
+        struct port * p = &ports[i];
+        p->fd = open(p->name, O_RDONLY | O_NOCTTY | O_NONBLOCK);
+        if(p->fd < 0 || setRaw(p->fd, baud) != 0)
+        {
+            perror(p->name);
+            return 1;
+        }
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = i };
+        if(epoll_ctl(epfd, EPOLL_CTL_ADD, p->fd, &ev) != 0)
+        {
+            perror("epoll_ctl");
+            return 1;
+        }
+    }
+    portsOpen = portCount;
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    struct epoll_event events[64];
+    int64_t first = 0, last = 0;
+    lastSync = monotonicNs();
+    while(!stop && portsOpen > 0)
+    {
+        //Wake up for the next write or sync that is due
+        int64_t now = monotonicNs();
+        int64_t due = lastSync + syncInterval;
+        if(batchCount > 0 && batchOldest + writeWait < due)
+            due = batchOldest + writeWait;
+        int timeout = due > now ? (int)((due - now + 999999) / 1000000) : 0;
+        int n = epoll_wait(epfd, events, 64, unsynced || batchCount ? timeout : -1);
+        if(n < 0 && errno != EINTR)
+        {
+            perror("epoll_wait");
+            break;
+        }
+        for(int i = 0; i < n; i++)
+        {
+            struct port * p = &ports[events[i].data.u32];
+            long before = p->records;
+            readPort(p, events[i].data.u32, epfd);
+            if(p->records != before)
+            {
+                last = monotonicNs();
+                if(first == 0)
+                    first = last;
+            }
+        }
+        now = monotonicNs();
+        if(batchCount > 0 && now - batchOldest >= writeWait)
+            flushBatch();
+        if(now - lastSync >= syncInterval)
+            syncStore();
+    }
+    flushBatch();
+    syncStore();
+    close(storeFd);
+
+    long records = 0, crcErrors = 0, lost = 0, skipped = 0;
+    for(int i = 0; i < portCount; i++)
+    {
+        struct port * p = &ports[i];
+        records += p->records;
+        crcErrors += p->crcErrors;
+        lost += p->lost;
+        skipped += p->skipped;
+        if(verbose)
+            fprintf(stderr, "%s: records %ld, crc errors %ld, lost %ld, bytes skipped %ld\n",
+                    p->name, p->records, p->crcErrors, p->lost, p->skipped);
+    }
+    double seconds = (last - first) / 1e9;
+    fprintf(stderr, "%d devices: records %ld, crc errors %ld, lost %ld, bytes skipped %ld\n",
+            portCount, records, crcErrors, lost, skipped);
+    fprintf(stderr, "%.0f records/s over %.1f s, %ld writes, %ld syncs\n",
+            seconds > 0 ? records / seconds : 0.0, seconds, writes, syncs);
+    fprintf(stderr, "receive->write us: p50 %lld p99 %lld max %lld\n",
+            (long long)histogramPercentile(&writeLatency, 50), (long long)histogramPercentile(&writeLatency, 99),
+            (long long)writeLatency.max);
+    fprintf(stderr, "receive->sync us:  p50 %lld p99 %lld max %lld\n",
+            (long long)histogramPercentile(&syncLatency, 50), (long long)histogramPercentile(&syncLatency, 99),
+            (long long)syncLatency.max);
+    return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * File:   tlmcommon.h
+ * Author: Faris Shahin
+ *
+ * Helpers shared by the host tools: the record CRC and the serial port setup.
+ */
+
+#ifndef TLMCOMMON_H
+#define TLMCOMMON_H
+
+#include <stdint.h>
+#include <termios.h>
+#include "telemetry_frame.h"
+
+/*
+ * Same CRC-8 as crc8() in utility.c (polynomial 0x31)
+ */
+static inline uint8_t crc8(uint8_t crc, uint8_t data)
+{
+    crc ^= data;
+    for(int i = 0; i < 8; i++)
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+    return crc;
+}
+
+static inline uint8_t recordCrc(const uint8_t * rec)
+{
+    uint8_t crc = 0xff;
+    for(int i = TLM_REC_SEQ; i < TLM_REC_CRC; i++)
+        crc = crc8(crc, rec[i]);
+    return crc;
+}
+
+static inline speed_t baudConstant(long baud)
+{
+    switch(baud)
+    {
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        default: return 0;
+    }
+}
+
+/*
+ * Put a terminal in raw 8N1 mode at the given baud rate
+ */
+static inline int setRaw(int fd, long baud)
+{
+    struct termios tio;
+    if(tcgetattr(fd, &tio) != 0)
+        return -1;
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, baudConstant(baud));
+    cfsetospeed(&tio, baudConstant(baud));
+    return tcsetattr(fd, TCSANOW, &tio);
+}
+
+#endif /* TLMCOMMON_H */
@@ -0,0 +1,213 @@
+/*
+ * File:   tlmdump.c
+ * Author: Faris Shahin
+ *
+ * Reads the telemetry stream of the tank monitor from a serial port and
+ * prints one line per record. Can also generate a stream on a pseudo-terminal
+ * to test a reader without the hardware.
+ *
+ * Usage:
+ *      tlmdump [-b baud] device        print the records read from device
+ *      tlmdump -g rate [-b baud] [-e n] [-c count]
+ *                                      create a pseudo-terminal, print its
+ *                                      name and send rate records/s to it,
+ *                                      damaging one byte in n if -e is given
+ * The statistics (records, CRC errors, lost records) are printed at the end
+ * of the stream or on Ctrl-C.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <termios.h>
+#include "tlmcommon.h"
+
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+/*
+ * Read records from fd until the end of the stream or a signal
+ */
+static int dump(int fd)
+{
+    uint8_t buf[4096];
+    uint8_t rec[TLM_REC_SIZE];
+    size_t have = 0;
+    long records = 0, crcErrors = 0, lost = 0, skipped = 0;
+    int lastSeq = -1;
+    ssize_t n;
+
+    while(!stop && (n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        for(ssize_t i = 0; i < n; i++)
+        {
+            if(have == 0 && buf[i] != TLM_SYNC)
+            {
+                skipped++;
+                continue;
+            }
+            rec[have++] = buf[i];
+            if(have < TLM_REC_SIZE)
+                continue;
+            if(recordCrc(rec) != rec[TLM_REC_CRC])
+            {
+                //Resync on the next sync byte inside this record
+                crcErrors++;
+                size_t j;
+                for(j = 1; j < TLM_REC_SIZE && rec[j] != TLM_SYNC; j++)
+                    ;
+                skipped += j;
+                memmove(rec, rec+j, TLM_REC_SIZE-j);
+                have = TLM_REC_SIZE-j;
+                continue;
+            }
+            have = 0;
+            records++;
+            if(lastSeq >= 0)
+                lost += (uint8_t)(rec[TLM_REC_SEQ] - lastSeq - 1);
+            lastSeq = rec[TLM_REC_SEQ];
+            printf("seq %3u tank %u ticks %5u level ", rec[TLM_REC_SEQ], rec[TLM_REC_TANK],
+                   rec[TLM_REC_TICKS] | rec[TLM_REC_TICKS+1] << 8);
+            unsigned level = rec[TLM_REC_LEVEL] | rec[TLM_REC_LEVEL+1] << 8;
+            if(level == TLM_NO_LEVEL)
+                printf("    -");
+            else
+                printf("%5u", level);
+            printf(" cm liters %8lu flags %02x%s%s%s%s%s%s%s\n",
+                   (unsigned long)rec[TLM_REC_LITERS] | (unsigned long)rec[TLM_REC_LITERS+1] << 8 |
+                   (unsigned long)rec[TLM_REC_LITERS+2] << 16, rec[TLM_REC_FLAGS],
+                   rec[TLM_REC_FLAGS] & TLM_FLAG_NO_READING ? " no-reading" : "",
+                   rec[TLM_REC_FLAGS] & TLM_FLAG_LEAK ? " leak" : "",
+                   rec[TLM_REC_FLAGS] & TLM_FLAG_LOW ? " low" : "",
+                   rec[TLM_REC_FLAGS] & TLM_FLAG_CRITICAL ? " critical" : "",
+                   rec[TLM_REC_FLAGS] & TLM_FLAG_HIGH ? " high" : "",
+                   rec[TLM_REC_FLAGS] & TLM_FLAG_FAULT ? " fault" : "",
+                   rec[TLM_REC_FLAGS] & TLM_FLAG_BOOT ? " boot" : "");
+        }
+        fflush(stdout);
+    }
+    fprintf(stderr, "records %ld, crc errors %ld, lost %ld, bytes skipped %ld\n",
+            records, crcErrors, lost, skipped);
+    return 0;
+}
+
+/*
+ * Send rate records/s on a new pseudo-terminal, paced like a UART at baud
+ */
+static int generate(long rate, long baud, long errorEvery, long count)
+{
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if(fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0)
+    {
+        perror("pty");
+        return 1;
+    }
+    printf("%s\n", ptsname(fd));
+    fflush(stdout);
+    setRaw(fd, baud);
+
+    //Time of a record on the line: 10 bits per byte
+    double lineTime = TLM_REC_SIZE * 10.0 / baud;
+    double period = 1.0 / rate;
+    if(period < lineTime)
+    {
+        fprintf(stderr, "%ld records/s don't fit in %ld baud, sending %.0f/s\n",
+                rate, baud, 1.0/lineTime);
+        period = lineTime;
+    }
+    uint8_t rec[TLM_REC_SIZE];
+    uint8_t seq = 0;
+    long sentBytes = 0;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    sleep(1);   //Give the reader time to open the other side
+    for(long i = 0; !stop && (count == 0 || i < count); i++)
+    {
+        uint8_t tank = i & 3;
+        uint16_t level = 100 + (i/4) % 50;
+        uint32_t liters = level * 15UL;
+        rec[0] = TLM_SYNC;
+        rec[TLM_REC_SEQ] = seq++;
+        rec[TLM_REC_TANK] = tank;
+        rec[TLM_REC_TICKS] = (level*2) & 0xff;
+        rec[TLM_REC_TICKS+1] = (level*2) >> 8;
+        rec[TLM_REC_LEVEL] = level & 0xff;
+        rec[TLM_REC_LEVEL+1] = level >> 8;
+        rec[TLM_REC_LITERS] = liters & 0xff;
+        rec[TLM_REC_LITERS+1] = (liters >> 8) & 0xff;
+        rec[TLM_REC_LITERS+2] = (liters >> 16) & 0xff;
+        rec[TLM_REC_FLAGS] = i < 4 ? TLM_FLAG_BOOT : 0;
+        rec[TLM_REC_CRC] = recordCrc(rec);
+        for(int j = 0; j < TLM_REC_SIZE; j++)
+        {
+            sentBytes++;
+            if(errorEvery > 0 && sentBytes % errorEvery == 0)
+                rec[j] ^= 0x10;
+        }
+        if(write(fd, rec, TLM_REC_SIZE) != TLM_REC_SIZE)
+            break;
+        next.tv_nsec += (long)(period * 1e9);
+        while(next.tv_nsec >= 1000000000L)
+        {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    tcdrain(fd);
+    sleep(1);
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    long baud = 9600, rate = 0, errorEvery = 0, count = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "b:g:e:c:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'b': baud = atol(optarg); break;
+            case 'g': rate = atol(optarg); break;
+            case 'e': errorEvery = atol(optarg); break;
+            case 'c': count = atol(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-b baud] device | -g rate [-b baud] [-e n] [-c count]\n", argv[0]);
+                return 2;
+        }
+    }
+    if(baudConstant(baud) == 0)
+    {
+        fprintf(stderr, "unsupported baud rate %ld\n", baud);
+        return 2;
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    if(rate > 0)
+        return generate(rate, baud, errorEvery, count);
+    if(optind >= argc)
+    {
+        fprintf(stderr, "no device given\n");
+        return 2;
+    }
+    int fd = open(argv[optind], O_RDONLY | O_NOCTTY);
+    if(fd < 0 || setRaw(fd, baud) != 0)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    return dump(fd);
+}
@@ -0,0 +1,222 @@
+/*
+ * File:   tlmload.c
+ * Author: Faris Shahin
+ *
+ * Load generator for tlmcollect: simulates many tank monitors, each sending
+ * its telemetry stream on its own pseudo-terminal.
+ *
+ * Usage:
+ *      tlmload [-n units] [-r rate] [-b baud] [-d seconds] [-e n] [-o list]
+ *      -n      number of units (default 100)
+ *      -r      records/s of each unit, 0 to send as fast as the ptys take
+ *              them (default 80, about what 9600 baud carries)
+ *      -d      seconds to run (default 10)
+ *      -e      damage one byte in n
+ *      -o      file to write the pty names to, for tlmcollect -l (default
+ *              stdout)
+ * The units start sending 1 second after the names are written. Each unit
+ * goes through its 4 tanks like the firmware, with levels that drift up and
+ * down. A record the pty has no room for is dropped and its sequence number
+ * skipped, like the firmware does when its UART ring is full.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "tlmcommon.h"
+
+struct unit
+{
+    int fd;
+    uint8_t seq;
+    uint8_t tank;
+    uint16_t level[4];
+    long sent, dropped;
+    uint8_t rest[TLM_REC_SIZE];     //Part of a record the pty didn't take
+    int restLen;
+};
+
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static int64_t monotonicNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Send the next record of unit u, returns 0 if the pty had no room
+ */
+static int sendRecord(struct unit * u, long errorEvery, long * sentBytes)
+{
+    uint8_t rec[TLM_REC_SIZE];
+    if(u->restLen > 0)
+    {
+        ssize_t n = write(u->fd, u->rest, u->restLen);
+        if(n > 0)
+        {
+            memmove(u->rest, u->rest+n, u->restLen-n);
+            u->restLen -= n;
+        }
+        if(u->restLen > 0)
+        {
+            u->dropped++;
+            u->seq++;
+            return 0;
+        }
+    }
+    uint8_t t = u->tank;
+    u->tank = (t+1) & 3;
+    //Drift the level by -1, 0 or +1 cm
+    u->level[t] += (rand() % 3) - 1;
+    if(u->level[t] > 300)
+        u->level[t] = 150;
+    uint32_t liters = u->level[t] * 20UL;
+    rec[0] = TLM_SYNC;
+    rec[TLM_REC_SEQ] = u->seq++;
+    rec[TLM_REC_TANK] = t;
+    rec[TLM_REC_TICKS] = (u->level[t]*58) & 0xff;
+    rec[TLM_REC_TICKS+1] = (u->level[t]*58) >> 8;
+    rec[TLM_REC_LEVEL] = u->level[t] & 0xff;
+    rec[TLM_REC_LEVEL+1] = u->level[t] >> 8;
+    rec[TLM_REC_LITERS] = liters & 0xff;
+    rec[TLM_REC_LITERS+1] = (liters >> 8) & 0xff;
+    rec[TLM_REC_LITERS+2] = (liters >> 16) & 0xff;
+    rec[TLM_REC_FLAGS] = u->sent + u->dropped < 4 ? TLM_FLAG_BOOT : 0;
+    rec[TLM_REC_CRC] = recordCrc(rec);
+    for(int j = 0; j < TLM_REC_SIZE && errorEvery > 0; j++)
+        if(++*sentBytes % errorEvery == 0)
+            rec[j] ^= 0x10;
+    ssize_t n = write(u->fd, rec, TLM_REC_SIZE);
+    if(n <= 0)
+    {
+        u->dropped++;
+        return 0;
+    }
+    if(n < TLM_REC_SIZE)
+    {
+        memcpy(u->rest, rec+n, TLM_REC_SIZE-n);
+        u->restLen = TLM_REC_SIZE-n;
+    }
+    u->sent++;
+    return 1;
+}
+
+int main(int argc, char ** argv)
+{
+    long units = 100, rate = 80, baud = 9600, seconds = 10, errorEvery = 0;
+    const char * list = NULL;
+    int opt;
+    while((opt = getopt(argc, argv, "n:r:b:d:e:o:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': units = atol(optarg); break;
+            case 'r': rate = atol(optarg); break;
+            case 'b': baud = atol(optarg); break;
+            case 'd': seconds = atol(optarg); break;
+            case 'e': errorEvery = atol(optarg); break;
+            case 'o': list = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-n units] [-r rate] [-b baud] [-d seconds] [-e n] [-o list]\n", argv[0]);
+                return 2;
+        }
+    }
+    if(baudConstant(baud) == 0 || units < 1 || rate < 0)
+    {
+        fprintf(stderr, "bad arguments\n");
+        return 2;
+    }
+    if(rate * TLM_REC_SIZE * 10 > baud)
+        fprintf(stderr, "note: %ld records/s don't fit in %ld baud, a real unit would drop records\n",
+                rate, baud);
+
+    struct unit * u = calloc(units, sizeof(*u));
+    FILE * out = list ? fopen(list, "w") : stdout;
+    if(u == NULL || out == NULL)
+    {
+        perror(list ? list : "calloc");
+        return 1;
+    }
+    for(long i = 0; i < units; i++)
+    {
+        int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if(fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0)
+        {
+            perror("pty");
+            return 1;
+        }
+        setRaw(fd, baud);
+        u[i].fd = fd;
+        for(int t = 0; t < 4; t++)
+            u[i].level[t] = 50 + rand() % 200;
+        fprintf(out, "%s\n", ptsname(fd));
+    }
+    if(list)
+        fclose(out);
+    else
+        fflush(stdout);
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    sleep(1);   //Give the collector time to open the other sides
+
+    long sentBytes = 0;
+    int64_t start = monotonicNs();
+    int64_t end = start + seconds * 1000000000LL;
+    //The units send in turn, spread evenly over the period of one unit
+    int64_t slot = rate > 0 ? 1000000000LL / rate / units : 0;
+    int64_t next = start;
+    long turn = 0;
+    while(!stop && monotonicNs() < end)
+    {
+        if(rate == 0)
+        {
+            for(long i = 0; i < units; i++)
+                sendRecord(&u[i], errorEvery, &sentBytes);
+            continue;
+        }
+        int64_t now = monotonicNs();
+        while(next <= now)
+        {
+            sendRecord(&u[turn], errorEvery, &sentBytes);
+            turn = (turn+1) % units;
+            next += slot > 0 ? slot : 1;
+        }
+        //Sleep to the next record, at least 1 ms and at most 0.5 s
+        int64_t wait = next - now;
+        wait = wait < 1000000 ? 1000000 : wait > 500000000 ? 500000000 : wait;
+        struct timespec ts = { 0, wait };
+        nanosleep(&ts, NULL);
+    }
+    double elapsed = (monotonicNs() - start) / 1e9;
+
+    long sent = 0, dropped = 0;
+    for(long i = 0; i < units; i++)
+    {
+        sent += u[i].sent;
+        dropped += u[i].dropped;
+    }
+    //Let the collector read what is left before hanging up
+    sleep(1);
+    for(long i = 0; i < units; i++)
+        close(u[i].fd);
+    fprintf(stderr, "%ld units: sent %ld records (%.0f/s), dropped %ld\n",
+            units, sent, sent / elapsed, dropped);
+    return 0;
+}
@@ -0,0 +1,507 @@
+/*
+ * File:   tlmprov.c
+ * Author: Faris Shahin
+ *
+ * Writes the tanks of a site file to tank monitors over the serial port, in
+ * one transaction per board (see include/prov_frame.h), or prints the tanks of
+ * a board as a site file.
+ *
+ * Usage:
+ *      tlmprov [-b baud] [-t ms] site device...
+ *                                      write the site to every device and
+ *                                      read it back
+ *      tlmprov [-b baud] [-t ms] -r device
+ *                                      print the tanks of device
+ *      tlmprov [-b baud] [-t ms] -H device
+ *                                      print the level log of device, oldest
+ *                                      entry first
+ *      tlmprov [-b baud] [-t ms] -L device [drop window]
+ *                                      set the leak detector of device to an
+ *                                      alarm for drop cm within window
+ *                                      minutes, then print its settings
+ * -t is how long to wait for a reply before asking again (default 200ms).
+ *
+ * A site file has one line per tank, the tanks not listed are unused:
+ *      index name length width height low critical high [sensor]
+ * with the dimensions in cm, the alarms in percent (0 is off), the sensor 0
+ * for an ultrasonic (the default) or 1 for a pressure transducer and '#'
+ * starting a comment. The boards must be on their main screen.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <termios.h>
+#include "tlmcommon.h"
+#include "prov_frame.h"
+
+#define MAX_TANKS   32      //Most tanks a site file can describe
+#define TRIES       3
+
+static uint8_t site[MAX_TANKS][1 + PROV_TANK_SIZE];    //Index and record of each tank
+static int replyWait = 200;
+
+static long msSince(const struct timespec * start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void put16(uint8_t * p, unsigned v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static unsigned get16(const uint8_t * p)
+{
+    return p[0] | p[1] << 8;
+}
+
+//The record of an unused tank, as the board stores it
+static void unusedTank(uint8_t * rec)
+{
+    memset(rec, 0, PROV_TANK_SIZE);
+    memset(&rec[PROV_TANK_NAME], ' ', 6);
+}
+
+/*
+ * Read a site file into site[], every tank not in it unused
+ * Returns:
+ *      0, or -1 after printing what's wrong
+ */
+static int readSite(const char * path)
+{
+    FILE * f = fopen(path, "r");
+    char line[256], name[16];
+    unsigned index, length, width, height, low, critical, high, sensor;
+    int lineNo = 0;
+    if(f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    for(int i = 0; i < MAX_TANKS; i++)
+    {
+        site[i][0] = i;
+        unusedTank(&site[i][1]);
+    }
+    while(fgets(line, sizeof(line), f))
+    {
+        char * hash = strchr(line, '#');
+        int fields;
+        lineNo++;
+        if(hash)
+            *hash = '\0';
+        sensor = PROV_SENSOR_ULTRASONIC;
+        fields = sscanf(line, "%u %15s %u %u %u %u %u %u %u", &index, name, &length, &width,
+                        &height, &low, &critical, &high, &sensor);
+        if(fields <= 0)
+            continue;
+        if(fields < 8 || index >= MAX_TANKS || strlen(name) > 6 ||
+           length == 0 || length > PROV_MAX_LENGTH || width == 0 || width > PROV_MAX_LENGTH ||
+           height == 0 || height > PROV_MAX_HEIGHT || low > 100 || critical > 100 || high > 100 ||
+           sensor > PROV_SENSOR_PRESSURE)
+        {
+            fprintf(stderr, "%s:%d: expected index name length width height low critical high [sensor]\n",
+                    path, lineNo);
+            fclose(f);
+            return -1;
+        }
+        for(char * c = name; *c; c++)
+            if(!isalnum((unsigned char)*c))
+            {
+                fprintf(stderr, "%s:%d: the name must be letters and digits\n", path, lineNo);
+                fclose(f);
+                return -1;
+            }
+        uint8_t * rec = &site[index][1];
+        memcpy(&rec[PROV_TANK_NAME], name, strlen(name));
+        put16(&rec[PROV_TANK_LENGTH], length);
+        put16(&rec[PROV_TANK_WIDTH], width);
+        put16(&rec[PROV_TANK_HEIGHT], height);
+        rec[PROV_TANK_LOW] = low;
+        rec[PROV_TANK_CRITICAL] = critical;
+        rec[PROV_TANK_HIGH] = high;
+        rec[PROV_TANK_SENSOR] = sensor;
+    }
+    fclose(f);
+    return 0;
+}
+
+/*
+ * Send a request and wait for its reply, skipping the telemetry records. A
+ * request with no reply is asked again after padding zeros.
+ * Parameters:
+ *      *reply - where the data of the reply is copied, PROV_MAX_DATA bytes
+ *      *replyLen - where its length is stored
+ * Returns:
+ *      The PROV_... status of the reply, or -1 if the board never answered
+ */
+static int request(int fd, uint8_t command, const uint8_t * data, uint8_t n,
+                   uint8_t * reply, uint8_t * replyLen)
+{
+    uint8_t frame[PROV_MAX_FRAME];
+    uint8_t zeros[PROV_MAX_FRAME] = {0};
+    uint8_t buf[512];
+    uint8_t crc = 0xff;
+    size_t have;
+
+    frame[0] = PROV_SYNC;
+    frame[1] = command;
+    frame[2] = n;
+    if(n)
+        memcpy(&frame[3], data, n);
+    for(int i = 1; i < n+3; i++)
+        crc = crc8(crc, frame[i]);
+    frame[n+3] = crc;
+
+    for(int tries = 0; tries < TRIES; tries++)
+    {
+        struct timespec start;
+        struct pollfd p = {fd, POLLIN, 0};
+        if(tries > 0 && write(fd, zeros, sizeof(zeros)) != sizeof(zeros))
+            return -1;
+        tcflush(fd, TCIFLUSH);
+        if(write(fd, frame, n+4) != n+4)
+            return -1;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        have = 0;
+        while(msSince(&start) < replyWait)
+        {
+            ssize_t got;
+            size_t i;
+            if(poll(&p, 1, replyWait - msSince(&start)) <= 0)
+                break;
+            got = read(fd, &buf[have], sizeof(buf) - have);
+            if(got <= 0)
+                return -1;
+            have += got;
+            for(i = 0; i + 4 < have; i++)
+            {
+                uint8_t len = buf[i+3];
+                if(buf[i] != PROV_REPLY || len > PROV_MAX_DATA)
+                    continue;
+                if(i + len + 5 > have)
+                    break;  //Not all there yet
+                crc = 0xff;
+                for(int j = 1; j < len+4; j++)
+                    crc = crc8(crc, buf[i+j]);
+                if(crc != buf[i+len+4] || buf[i+1] != command)
+                    continue;   //A telemetry record holding PROV_REPLY
+                memcpy(reply, &buf[i+4], len);
+                *replyLen = len;
+                return buf[i+2];
+            }
+            memmove(buf, &buf[i], have - i);
+            have -= i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Read the tank count and the records of all the tanks of a board
+ * Returns:
+ *      The tank count, or -1
+ */
+static int readTanks(int fd, uint8_t records[][1 + PROV_TANK_SIZE])
+{
+    uint8_t reply[PROV_MAX_DATA];
+    uint8_t len;
+    int count;
+    if(request(fd, PROV_INFO, NULL, 0, reply, &len) != PROV_OK || len != 2 || reply[0] > MAX_TANKS)
+        return -1;
+    if(reply[1] != PROV_TANK_SIZE)
+    {
+        fprintf(stderr, "the board has tank records of %u bytes, this tlmprov reads %u\n",
+                reply[1], PROV_TANK_SIZE);
+        return -1;
+    }
+    count = reply[0];
+    for(uint8_t i = 0; i < count; i++)
+    {
+        if(request(fd, PROV_READ, &i, 1, reply, &len) != PROV_OK || len != 1 + PROV_TANK_SIZE || reply[0] != i)
+            return -1;
+        memcpy(records[i], reply, len);
+    }
+    return count;
+}
+
+/*
+ * Write the site to a board and check it by reading it back
+ * Returns:
+ *      0, or 1 after printing what went wrong
+ */
+static int provision(const char * device, int fd)
+{
+    uint8_t reply[PROV_MAX_DATA];
+    uint8_t back[MAX_TANKS][1 + PROV_TANK_SIZE];
+    uint8_t len, count, setCrc = 0xff;
+    int status, changed = -1;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(request(fd, PROV_INFO, NULL, 0, reply, &len) != PROV_OK || len != 2)
+    {
+        fprintf(stderr, "%s: no answer, is the board on its main screen?\n", device);
+        return 1;
+    }
+    if(reply[1] != PROV_TANK_SIZE)
+    {
+        fprintf(stderr, "%s: tank records of %u bytes, this tlmprov writes %u\n", device, reply[1], PROV_TANK_SIZE);
+        return 1;
+    }
+    count = reply[0];
+    if(count > MAX_TANKS)
+    {
+        fprintf(stderr, "%s: %u tanks, more than this tool handles\n", device, count);
+        return 1;
+    }
+    for(int i = count; i < MAX_TANKS; i++)
+        if(site[i][1+PROV_TANK_NAME] != ' ')
+        {
+            fprintf(stderr, "%s: the board has %u tanks, tank %d can't be set\n", device, count, i);
+            return 1;
+        }
+    for(int i = 0; i < count; i++)
+        for(int j = 1; j <= PROV_TANK_SIZE; j++)
+            setCrc = crc8(setCrc, site[i][j]);
+
+    if((status = request(fd, PROV_BEGIN, &count, 1, reply, &len)) != PROV_OK)
+        goto failed;
+    for(int i = 0; i < count; i++)
+        if((status = request(fd, PROV_WRITE, site[i], 1 + PROV_TANK_SIZE, reply, &len)) != PROV_OK)
+        {
+            request(fd, PROV_ABORT, NULL, 0, reply, &len);
+            goto failed;
+        }
+    status = request(fd, PROV_COMMIT, &setCrc, 1, reply, &len);
+    if(status == PROV_OK)
+        changed = reply[0];
+    else if(status != PROV_ERR_STATE)   //The reply to a commit done was lost
+        goto failed;
+
+    if(readTanks(fd, back) != count)
+    {
+        fprintf(stderr, "%s: the tanks couldn't be read back\n", device);
+        return 1;
+    }
+    for(int i = 0; i < count; i++)
+        if(memcmp(back[i], site[i], 1 + PROV_TANK_SIZE) != 0)
+        {
+            fprintf(stderr, "%s: tank %d reads back different, the site wasn't saved\n", device, i);
+            return 1;
+        }
+    if(changed >= 0)
+        printf("%s: %u tanks, %d changed, %ld ms\n", device, count, changed, msSince(&start));
+    else
+        printf("%s: %u tanks, %ld ms\n", device, count, msSince(&start));
+    return 0;
+
+failed:
+    if(status < 0)
+        fprintf(stderr, "%s: the board stopped answering\n", device);
+    else
+        fprintf(stderr, "%s: refused with status %d\n", device, status);
+    return 1;
+}
+
+//Print the tanks of a board as a site file
+static int printSite(int fd)
+{
+    uint8_t records[MAX_TANKS][1 + PROV_TANK_SIZE];
+    int count = readTanks(fd, records);
+    if(count < 0)
+    {
+        fprintf(stderr, "no answer, is the board on its main screen?\n");
+        return 1;
+    }
+    printf("# index name length width height low critical high sensor\n");
+    for(int i = 0; i < count; i++)
+    {
+        const uint8_t * rec = &records[i][1];
+        int nameLen = 6;
+        if(rec[PROV_TANK_NAME] == ' ')
+            continue;
+        while(nameLen > 0 && rec[PROV_TANK_NAME+nameLen-1] == ' ')
+            nameLen--;
+        printf("%d %.*s %u %u %u %u %u %u %u\n", i, nameLen, (const char *)&rec[PROV_TANK_NAME],
+               get16(&rec[PROV_TANK_LENGTH]), get16(&rec[PROV_TANK_WIDTH]), get16(&rec[PROV_TANK_HEIGHT]),
+               rec[PROV_TANK_LOW], rec[PROV_TANK_CRITICAL], rec[PROV_TANK_HIGH], rec[PROV_TANK_SENSOR]);
+    }
+    return 0;
+}
+
+/*
+ * Print the level log of a board, one entry a line:
+ *      power up
+ *      leak alarm, tank
+ *      refill, tank
+ *      tank, level in percent ('?' until the first level of the tank), samples
+ */
+static int printHistory(int fd)
+{
+    static const char * const marks[] = {"power up", "leak alarm", "refill"};
+    uint8_t reply[PROV_MAX_DATA];
+    uint8_t len, start = 1;
+    int entries = 0;
+    do
+    {
+        if(request(fd, PROV_HISTORY, &start, 1, reply, &len) != PROV_OK || len % PROV_HIST_SIZE != 0)
+        {
+            fprintf(stderr, "no answer, is the board on its main screen?\n");
+            return 1;
+        }
+        start = 0;
+        for(uint8_t i = 0; i < len; i += PROV_HIST_SIZE)
+        {
+            const uint8_t * e = &reply[i];
+            unsigned kind = e[PROV_HIST_HEADER] >> 4, tank = e[PROV_HIST_HEADER] & 0x0f;
+            if(kind == 2)
+            {
+                if(tank == 0)
+                    printf("%s\n", marks[0]);
+                else if(tank < sizeof(marks)/sizeof(marks[0]))
+                    printf("%s %u\n", marks[tank], e[PROV_HIST_LEVEL]);
+                else
+                    printf("marker %u %u\n", tank, e[PROV_HIST_LEVEL]);
+            }
+            else if(e[PROV_HIST_LEVEL] == 0xff)
+                printf("%u ? %u\n", tank, e[PROV_HIST_SAMPLES]);
+            else
+                printf("%u %.1f %u\n", tank, e[PROV_HIST_LEVEL]/2.0, e[PROV_HIST_SAMPLES]);
+            entries++;
+        }
+    } while(len > 0);
+    printf("# %d entries\n", entries);
+    return 0;
+}
+
+/*
+ * Set the leak detector of a board if a drop and a window are given, then
+ * print its settings
+ * Parameters:
+ *      *drop, *window - the settings as text, or NULL to only print them
+ */
+static int leakSettings(int fd, const char * drop, const char * window)
+{
+    uint8_t data[PROV_LEAK_SIZE], reply[PROV_MAX_DATA];
+    uint8_t n = 0, len;
+    int status;
+    if(drop)
+    {
+        data[PROV_LEAK_DROP] = atoi(drop);
+        put16(&data[PROV_LEAK_WINDOW], atoi(window));
+        n = PROV_LEAK_SIZE;
+    }
+    status = request(fd, PROV_LEAK, data, n, reply, &len);
+    if(status == PROV_ERR_VALUE)
+    {
+        fprintf(stderr, "the drop must be 1 to 40 cm and the window a multiple of 5 up to 1275 minutes\n");
+        return 1;
+    }
+    if(status != PROV_OK || len != PROV_LEAK_SIZE)
+    {
+        fprintf(stderr, "no answer, is the board on its main screen?\n");
+        return 1;
+    }
+    printf("leak alarm for a drop of %u cm within %u minutes\n", reply[PROV_LEAK_DROP],
+           get16(&reply[PROV_LEAK_WINDOW]));
+    return 0;
+}
+
+static int openPort(const char * device, long baud)
+{
+    int fd = open(device, O_RDWR | O_NOCTTY);
+    if(fd < 0 || setRaw(fd, baud) != 0)
+    {
+        perror(device);
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char ** argv)
+{
+    long baud = 9600;
+    int readOnly = 0, history = 0, leak = 0, failed = 0, fd, opt;
+    while((opt = getopt(argc, argv, "b:t:rHL")) != -1)
+    {
+        switch(opt)
+        {
+            case 'b': baud = atol(optarg); break;
+            case 't': replyWait = atoi(optarg); break;
+            case 'r': readOnly = 1; break;
+            case 'H': history = 1; break;
+            case 'L': leak = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-b baud] [-t ms] site device... | -r device | -H device"
+                        " | -L device [drop window]\n", argv[0]);
+                return 2;
+        }
+    }
+    if(baudConstant(baud) == 0 || replyWait <= 0)
+    {
+        fprintf(stderr, "unsupported baud rate %ld or reply time %d\n", baud, replyWait);
+        return 2;
+    }
+    if(leak)
+    {
+        if(optind + 1 != argc && optind + 3 != argc)
+        {
+            fprintf(stderr, "give one device, and a drop and a window to set them\n");
+            return 2;
+        }
+        if((fd = openPort(argv[optind], baud)) < 0)
+            return 1;
+        failed = optind + 3 == argc ? leakSettings(fd, argv[optind+1], argv[optind+2])
+                                    : leakSettings(fd, NULL, NULL);
+        close(fd);
+        return failed;
+    }
+    if(readOnly || history)
+    {
+        if(optind + 1 != argc)
+        {
+            fprintf(stderr, "give one device\n");
+            return 2;
+        }
+        if((fd = openPort(argv[optind], baud)) < 0)
+            return 1;
+        failed = history ? printHistory(fd) : printSite(fd);
+        close(fd);
+        return failed;
+    }
+    if(optind + 2 > argc)
+    {
+        fprintf(stderr, "give a site file and at least one device\n");
+        return 2;
+    }
+    if(readSite(argv[optind]) != 0)
+        return 2;
+    for(int i = optind + 1; i < argc; i++)
+    {
+        if((fd = openPort(argv[i], baud)) < 0)
+        {
+            failed++;
+            continue;
+        }
+        failed += provision(argv[i], fd);
+        close(fd);
+    }
+    if(argc - optind > 2)
+        printf("%d of %d boards provisioned\n", argc - optind - 1 - failed, argc - optind - 1);
+    return failed != 0;
+}
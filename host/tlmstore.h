@@ -0,0 +1,41 @@
+/*
+ * File:   tlmstore.h
+ * Author: Faris Shahin
+ *
+ * Layout of the time-series store written by tlmcollect. The store is a
+ * header followed by fixed size records in the order they were received,
+ * all values in host byte order. A store only ever grows, so a reader can
+ * use any prefix of whole records even while the collector appends.
+ *
+ * Next to the store, <store>.units lists the device of each unit number,
+ * one per line.
+ */
+
+#ifndef TLMSTORE_H
+#define TLMSTORE_H
+
+#include <stdint.h>
+
+#define STORE_MAGIC         "TLMSTOR1"
+
+struct storeHeader
+{
+    char magic[8];          //STORE_MAGIC, not terminated
+    uint32_t recordSize;    //sizeof(struct storeRecord)
+    uint32_t reserved;
+};
+
+struct storeRecord
+{
+    int64_t time;           //Receive time in ns since the epoch
+    uint32_t liters;
+    uint16_t unit;          //Index of the device in <store>.units
+    uint16_t level;         //cm, TLM_NO_LEVEL if the reading failed
+    uint16_t ticks;
+    uint8_t tank;
+    uint8_t flags;          //TLM_FLAG_...
+    uint8_t seq;
+    uint8_t pad[3];
+};
+
+#endif /* TLMSTORE_H */
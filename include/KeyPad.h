@@ -10,21 +10,24 @@
 #define	KEYPAD_H
 
 // Set ports for the input pins and the output pins
+// The columns are on PORTD so RC6 and RC7 are free for the USART (see uart.h).
+// Only the column bits of PORTD are written, the LCD uses the rest of it.
 volatile uint8_t * IN_TRIS = &TRISC;
-volatile uint8_t * OUT_TRIS = &TRISC;
+volatile uint8_t * OUT_TRIS = &TRISD;
 volatile uint8_t * IN_KEYS = &PORTC;
-volatile uint8_t * OUT_KEYS = &PORTC;
+volatile uint8_t * OUT_KEYS = &PORTD;
 
 //The rows and column pins of the keypad are organized as follows (left to right):
 // COL2, ROW1, COL1, ROW4, COL3, ROW3, ROW2
 
-#define ROW2 1  //Pin number for ROW2 in the keypad
-#define ROW3 2  //Pin number for ROW3 in the keypad
-#define COL3 3  //Pin number for COL3 in the keypad
-#define ROW4 4  //Pin number for ROW4 in the keypad
-#define COL1 5  //Pin number for COL1 in the keypad
-#define ROW1 6  //Pin number for ROW1 in the keypad
-#define COL2 7  //Pin number for COL2 in the keypad
+#define ROW2 1  //Pin number for ROW2 in the keypad (RC0)
+#define ROW3 2  //Pin number for ROW3 in the keypad (RC1)
+#define ROW4 4  //Pin number for ROW4 in the keypad (RC3)
+#define ROW1 6  //Pin number for ROW1 in the keypad (RC5)
+#define COL1 1  //Pin number for COL1 in the keypad (RD0)
+#define COL2 2  //Pin number for COL2 in the keypad (RD1)
+#define COL3 3  //Pin number for COL3 in the keypad (RD2)
+#define COL_MASK ((1 << (COL1-1)) | (1 << (COL2-1)) | (1 << (COL3-1)))
 
 uint8_t Keypad[4][3] = {
     {'1', '2', '3'},
@@ -0,0 +1,68 @@
+/* 
+ * File:   alarm.h
+ * Author: Faris Shahin
+ * Comments:
+ * This file along with the associated C file raises the low, critical and
+ * high level alarms of each tank and drives the alarm output (a buzzer or a
+ * relay) and the alarm indicator on the LCD.
+ * 
+ * The thresholds are a percentage of the height of the tank, set for each
+ * tank from the options menu and stored with the tank in EEPROM. A threshold
+ * of 0 is off (a high threshold must also be over ALARM_HYST). An alarm is
+ * raised when the level reaches its threshold and cleared once the level is
+ * ALARM_HYST percent back past it, so a level sitting on the threshold
+ * doesn't toggle the output.
+ * 
+ * Alarms are evaluated on each reading as soon as it is taken, before the
+ * level filter (filter.h) which would hold a crossing back by a reading, and
+ * the output is set before the reading is displayed: view() calls
+ * AlarmService() after each tank it reads. A reading that would change the
+ * alarms of a tank must be confirmed by ALARM_CONFIRM readings in a row, so a
+ * single bad reading doesn't toggle the output; view() takes them right away,
+ * ALARM_CONFIRM_MS apart, instead of waiting for the next scan. The output
+ * changes at the first scan after the level crossed the threshold. Results
+ * of "make detect" in sim/ (detect.c), which runs the whole firmware with 4
+ * tanks and drops the level of one under its low threshold at a random time:
+ *      All sensors answer: 2.6 s on average, 4.2 s at most
+ *      The 3 other sensors hear no echo: 2.7 s, 4.2 s at most
+ *      The 3 other sensors stuck high (each scan waits out their 400ms
+ *      timeouts): 2.4 s, 4.8 s at most
+ * 
+ * ALARM_FAULT_READINGS failed readings of a tank in a row (no echo, or a
+ * level out of the tank) raise its fault alarm, which turns the output on
+ * too: a dead sensor would otherwise leave the other alarms as they were
+ * forever. It's cleared by the next good reading. From the sensor dying to
+ * the output: 11.3 s on average, 13.6 s at most.
+ * Readings are not taken while a menu is open; the alarms and the output
+ * keep their state until the next reading.
+ * 
+ * Revision History: v1.0
+ */
+
+#ifndef ALARM_H
+#define	ALARM_H
+
+//Alarm bits of a tank
+#define ALARM_LOW       0x01
+#define ALARM_CRITICAL  0x02
+#define ALARM_HIGH      0x04
+#define ALARM_FAULT     0x08    //The sensor of the tank keeps failing
+
+#define ALARM_HYST      2   //Percent the level must go back past a threshold to clear its alarm
+#define ALARM_OUTPUT    (ALARM_LOW | ALARM_CRITICAL | ALARM_HIGH | ALARM_FAULT) //Alarms that turn the output on
+#define ALARM_CONFIRM   2   //Readings in a row that change the alarms of a tank
+#define ALARM_CONFIRM_MS    60  //Between two of them, the HC-SR04 wants 60ms between pings
+#define ALARM_FAULT_READINGS    3   //Failed readings in a row that raise the fault alarm
+
+//Set the port and pin of the alarm output (active high)
+#define ALARM_PORT      PORTE
+#define ALARM_TRIS      TRISE
+#define ALARM_PIN       0
+
+void AlarmInit(void);
+void AlarmReset(uint8_t tankIndex);
+void AlarmService(void);
+uint8_t AlarmState(uint8_t tankIndex);
+uint8_t AlarmPending(uint8_t tankIndex);
+
+#endif	/* ALARM_H */
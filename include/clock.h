@@ -0,0 +1,25 @@
+/* 
+ * File:   clock.h
+ * Author: Faris Shahin
+ * Comments:
+ * Seconds counter driven by TMR2. TMR0 can't be used for this since the
+ * ultrasonic library resets it on every reading.
+ * Revision History: v1.0
+ */
+
+#ifndef CLOCK_H
+#define	CLOCK_H
+
+// TMR2 runs on the instruction clock (_XTAL_FREQ/4). Prescaler 1:16, PR2 = 249
+// and postscaler 1:10 divide it by 40000: exactly 25 interrupts per second at
+// 4MHz, 125 at 20MHz.
+#define CLOCK_T2CON         0x4E    //Postscaler 1:10, TMR2 on, prescaler 1:16
+#define CLOCK_PR2           249
+#define CLOCK_DIVIDER       (16L*(CLOCK_PR2+1)*10)
+#define CLOCK_TICKS_PER_SEC (_XTAL_FREQ/4/CLOCK_DIVIDER)
+
+void ClockInit(void);
+void ClockTick(void);
+uint32_t ClockSeconds(void);
+
+#endif	/* CLOCK_H */
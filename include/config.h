@@ -14,13 +14,73 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+
+//Crystal frequency in Hz, 4 to 20MHz in steps of 4MHz. The timers, timeouts
+//and the distance scale are all worked out from it (see clock.h and
+//ultrasonic_hcsr04.h), and a value one of them can't reach stops the build.
+//Can also be set on the compiler command line, e.g. by the simulator (sim/).
+#ifndef _XTAL_FREQ
+#define _XTAL_FREQ      4000000L
+#endif
+
+#if _XTAL_FREQ < 4000000L || _XTAL_FREQ > 20000000L || _XTAL_FREQ % 4000000L != 0
+#error "_XTAL_FREQ must be 4, 8, 12, 16 or 20MHz"
+#endif
+
+//Number of tanks. Sizes the tables of every module, the EEPROM layout (see
+//eeprom_map.h) and the sensor MUX address (see ultrasonic_hcsr04.h).
+//The data EEPROM holds the settings and logs of 8 tanks at most. Each tank
+//also takes about 77 bytes of RAM, on top of about 255 for the rest, so the
+//368 bytes of the PIC16F877A hold 4: 5 to 8 need a part with more RAM, such
+//as the pin-compatible PIC18F4520.
+#define TANK_COUNT      4
+
+#if TANK_COUNT < 1 || TANK_COUNT > 8 || (defined(_16F877A) && TANK_COUNT > 4)
+#error "TANK_COUNT must be from 1 to 4 on the PIC16F877A, 1 to 8 on a part with more RAM"
+#endif
+
+//Bits of a tank index, also the address lines of the MUX
+#if TANK_COUNT <= 4
+#define TANK_BITS       2
+#else
+#define TANK_BITS       3
+#endif
+
+//One bit per tank
+typedef uint8_t tankmask_t;
+
+#include "profile.h"
 #include "lcd.h"
+#include "screen.h"
 #include "ultrasonic_hcsr04.h"
+#include "pressure_adc.h"
+#include "sensor.h"
 #include "KeyPad.h"
 #include "utility.h"
+#include "numfmt.h"
+#include "tank.h"
 #include "sm.h"
+#include "eeprom_map.h"
+#include "eeprom_queue.h"
+#include "tank_config.h"
+#include "clock.h"
+#include "history.h"
+#include "usage.h"
+#include "filter.h"
+#include "leak.h"
+#include "refill.h"
+#include "alarm.h"
+#include "uart.h"
+#include "telemetry.h"
+#include "modbus.h"
+#include "provision.h"
+#include "store.h"
 // CONFIG
+#if _XTAL_FREQ > 4000000L
+#pragma config FOSC = HS        // Oscillator Selection bits (HS oscillator, above 4MHz)
+#else
 #pragma config FOSC = XT        // Oscillator Selection bits (XT oscillator)
+#endif
 #pragma config WDTE = OFF       // Watchdog Timer Enable bit (WDT disabled)
 #pragma config PWRTE = OFF      // Power-up Timer Enable bit (PWRT disabled)
 #pragma config BOREN = ON       // Brown-out Reset Enable bit (BOR enabled)
@@ -29,6 +89,4 @@
 #pragma config WRT = OFF        // Flash Program Memory Write Enable bits (Write protection off; all program memory may be written to by EECON control)
 #pragma config CP = OFF         // Flash Program Memory Code Protection bit (Code protection off)
 
-#define _XTAL_FREQ 4000000L
-
 #endif	/* CONFIG_H */
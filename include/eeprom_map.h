@@ -0,0 +1,81 @@
+/* 
+ * File:   eeprom_map.h
+ * Author: Faris Shahin
+ * Comments:
+ * Layout of the 256 bytes of data EEPROM. Every module that keeps data in
+ * EEPROM takes its addresses from here so regions can't overlap silently.
+ * Revision History: v1.0
+ */
+
+#ifndef EEPROM_MAP_H
+#define	EEPROM_MAP_H
+
+#define EE_SIZE             256     //Data EEPROM size of the PIC16F877A
+
+//Configuration header: magic, version, tank count, CRC of the first 3 bytes
+#define EE_HEADER_ADDR      0x00
+#define EE_HEADER_SIZE      4
+#define EE_MAGIC            0x54    //'T'
+#define EE_VERSION          6       //Version 2 added the alarm thresholds, 3 the level snapshot, 4 packed the tanks, 5 stamped the logs, 6 added the leak settings
+
+//Tank records. Each tank has a fixed slot so a record can be rewritten
+//without touching the others.
+#define EE_TANKS_ADDR       (EE_HEADER_ADDR + EE_HEADER_SIZE)
+#define EE_TANK_SLOT        (TANK_SIZE+1)   //A packed tank and its CRC (see tank_config.h)
+#define EE_TANKS_END        (EE_TANKS_ADDR + TANK_COUNT*EE_TANK_SLOT)
+
+//Daily usage estimate of each tank (see usage.h)
+#define EE_USAGE_ADDR       EE_TANKS_END
+#define EE_USAGE_SLOT       4
+#define EE_USAGE_END        (EE_USAGE_ADDR + TANK_COUNT*EE_USAGE_SLOT)
+
+//Log of the last refills (see refill.h)
+#define EE_REFILL_ADDR      EE_USAGE_END
+#define EE_REFILL_SLOT      6
+#define EE_REFILL_COUNT     7       //Number of refills kept
+#define EE_REFILL_END       (EE_REFILL_ADDR + EE_REFILL_COUNT*EE_REFILL_SLOT)
+
+//Modbus slave address and its complement (see modbus.h)
+#define EE_MODBUS_ADDR      EE_REFILL_END
+#define EE_MODBUS_END       (EE_MODBUS_ADDR + 2)
+
+//Settings of the leak detector: drop, window in steps, CRC-8 of both (see
+//leak.h)
+#define EE_LEAK_ADDR        EE_MODBUS_END
+#define EE_LEAK_END         (EE_LEAK_ADDR + 3)
+
+//Last level of each tank in half percent, shown at power up until the tanks
+//are read (see history.h)
+#define EE_SNAP_ADDR        EE_LEAK_END
+#define EE_SNAP_END         (EE_SNAP_ADDR + TANK_COUNT)
+
+//Level history log (see history.h). Takes the rest of the EEPROM up to the
+//stamp, 130 bytes (65 entries) with 4 tanks. Entries are 2 bytes so it starts
+//on an even address.
+#define EE_HIST_ADDR        ((EE_SNAP_END+1) & ~1)
+#define EE_HIST_END         EE_STAMP_ADDR
+#define EE_HIST_MIN         32      //Smallest useful log, 16 entries
+
+//Layout the usage estimates, the refill log, the snapshot and the history log
+//were written with. They move with the tank records, so they are erased when
+//the stamp isn't EE_LOG_STAMP (see TankConfigLoad()). It's the last byte so
+//it doesn't move with TANK_COUNT.
+#define EE_STAMP_ADDR       (EE_SIZE-1)
+#define EE_LOG_STAMP        (EE_VERSION<<4 | TANK_COUNT)
+
+//Layout used before the versioned header (v0), always 4 tanks. Only needed
+//for migration. The old magic byte sits inside the history log and is
+//erased on migration.
+#define EE_LEGACY_MAGIC_ADDR    0xaa
+#define EE_LEGACY_MAGIC         0x2a
+#define EE_LEGACY_SLOT_SHIFT    5
+#define EE_LEGACY_TANKS         4
+
+//With 13 bytes of configuration, 4 of usage and 1 of snapshot per tank, 8 tanks is the
+//most the 256 bytes can hold next to the logs (the range of TANK_COUNT, see config.h).
+//Only a layout that grows past that stops here.
+#if EE_HIST_END - EE_HIST_ADDR < EE_HIST_MIN
+#error "The EEPROM layout leaves no room for the history log"
+#endif
+
+#endif	/* EEPROM_MAP_H */
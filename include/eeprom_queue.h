@@ -0,0 +1,24 @@
+/* 
+ * File:   eeprom_queue.h
+ * Author: Faris Shahin
+ * Comments:
+ * Write-behind queue for the data EEPROM. Writes are queued and carried out
+ * one byte at a time from the EEPROM write complete interrupt, so the caller
+ * doesn't wait the ~4ms each byte takes. Bytes that already hold the value
+ * are not written at all.
+ * Revision History: v1.0
+ */
+
+#ifndef EEPROM_QUEUE_H
+#define	EEPROM_QUEUE_H
+
+#define EEQ_SIZE    16  //Number of bytes that can wait to be written. Must be a power of 2
+
+void EEPROMQueueInit(void);
+void EEPROMQueueWrite(uint8_t addr, uint8_t data);
+uint8_t EEPROMQueueRead(uint8_t addr);
+uint8_t EEPROMQueueBusy(void);
+void EEPROMQueueFlush(void);
+void EEPROMQueueWriteDone(void);
+
+#endif	/* EEPROM_QUEUE_H */
@@ -0,0 +1,27 @@
+/* 
+ * File:   filter.h
+ * Author: Faris Shahin
+ * Comments:
+ * Filters the liquid level readings of each tank before they are used.
+ * The HC-SR04 sometimes returns a single reading far off the real level
+ * (foam, a drop on the sensor, an echo from the tank wall).
+ * Revision History: v1.0
+ */
+
+#ifndef FILTER_H
+#define	FILTER_H
+
+#define FILTER_NONE     0   //Readings are used as they are
+#define FILTER_MEDIAN3  1   //Median of the last 3 readings. Removes single bad readings
+#define FILTER_EWMA     2   //Moving average with a weight of 1/4. Removes jitter, follows slower
+
+//Filter used by the application. Can also be set on the compiler command
+//line, the simulator (sim/) builds every filter this way to compare them.
+#ifndef LEVEL_FILTER
+#define LEVEL_FILTER    FILTER_MEDIAN3
+#endif
+
+void FilterReset(uint8_t tankIndex);
+uint16_t FilterLevel(uint8_t tankIndex, uint16_t level);
+
+#endif	/* FILTER_H */
@@ -0,0 +1,98 @@
+/* 
+ * File:   history.h
+ * Author: Faris Shahin
+ * Comments:
+ * This file along with the associated C file keeps a log of the liquid level
+ * of every tank in the free part of the EEPROM.
+ * 
+ * The log is a ring of 2-byte entries. The first byte is the header:
+ *      bits 7-6: lap number, incremented every time the ring wraps around
+ *      bits 5-4: kind of entry (HIST_KEY, HIST_DELTA or HIST_MARK)
+ *      bits 3-0: tank index (marker type for HIST_MARK)
+ * The second byte depends on the kind:
+ *      HIST_KEY:   the level of the tank in half percent (0 to 200)
+ *      HIST_DELTA: bits 7-4: samples without change before this one (0-15)
+ *                  bits 3-0: signed change of the level in half percent (-8 to 7)
+ *      HIST_MARK:  depends on the marker type (tank index for HIST_MARK_LEAK and
+ *                  HIST_MARK_REFILL)
+ * A header of 0xff is an entry that was never written.
+ * 
+ * The level of a tank is logged every HIST_INTERVAL seconds. Unchanged levels
+ * cost nothing until 16 samples have passed, small changes cost one HIST_DELTA
+ * and larger ones a HIST_KEY. Every HIST_KEY_EVERY entries of a tank is a
+ * HIST_KEY so a reader can start anywhere in the ring.
+ * 
+ * The log has HIST_SLOTS entries, what the EEPROM has left (65 with 4 tanks,
+ * 92 with 1, 29 with 8, see eeprom_map.h). The entry being written is never
+ * read, so a reader gets the last HIST_SLOTS-1. The figures below are for 4
+ * tanks, 64 entries; they scale with HIST_SLOTS-1 and the inverse of the tank
+ * count:
+ *      Level changing at every sample: 16 samples, whatever the interval
+ *      Tanks not in use (one entry per tank every 16 samples): 256 samples
+ *          15 min interval -> about 2.7 days
+ *          1 hour interval -> about 11 days
+ *          6 hour interval -> about 2 months
+ * A diesel tank in daily use is in between: with a 1 hour interval and about
+ * 4 level changes a day per tank, the log covers about 3 days.
+ * 
+ * Each entry is written once per lap (every HIST_SLOTS entries). With every
+ * level changing at every sample that's 4 entries an hour, 539 laps a year,
+ * so with 100k write cycles per byte the EEPROM lasts decades at any of these
+ * intervals.
+ * 
+ * The log, like the snapshot below, is erased when the layout of the EEPROM
+ * changes (see TankConfigLoad()).
+ * 
+ * Next to the log, a snapshot keeps the latest level of every tank (one byte
+ * each, in half percent) so it can be shown right after power up, before the
+ * tanks are read. A byte is only written when the level of its tank moved
+ * more than the deadband of the sensor, and at most every HIST_SNAP_INTERVAL
+ * seconds: even a level changing all the time takes 8760 writes a year (11
+ * years of a byte), a tank in daily use a few hundred.
+ * 
+ * Revision History: v1.0
+ */
+
+#ifndef HISTORY_H
+#define	HISTORY_H
+
+#define HIST_INTERVAL       3600    //Seconds between samples
+#define HIST_KEY_EVERY      8       //Entries of a tank between two HIST_KEY entries
+#define HIST_SNAP_INTERVAL  3600    //Seconds between updates of the level snapshot
+
+#define HIST_KEY            0
+#define HIST_DELTA          1
+#define HIST_MARK           2
+
+#define HIST_MARK_BOOT      0       //Marker written at power up
+#define HIST_MARK_LEAK      1       //A tank went in leak alarm
+#define HIST_MARK_REFILL    2       //A tank was refilled (see refill.h)
+#define HIST_UNKNOWN        0xff    //Level not known
+
+#define HIST_SLOTS          ((EE_HIST_END-EE_HIST_ADDR)/2)
+
+//State of a reader going through the log from the oldest entry to the newest
+struct historyCursor{
+    uint8_t slot;       //Next entry to read
+    uint8_t left;       //Entries left to read
+    uint8_t level[TANK_COUNT];  //Last level read for each tank
+};
+
+//One entry of the log as returned to a reader
+struct historyEntry{
+    uint8_t kind;       //HIST_KEY, HIST_DELTA or HIST_MARK
+    uint8_t tank;       //Tank index (marker type for HIST_MARK)
+    uint8_t level;      //Level after this entry in half percent, HIST_UNKNOWN before the first HIST_KEY
+                        //For HIST_MARK, the data of the marker
+    uint8_t samples;    //Number of samples this entry stands for
+};
+
+void HistoryInit(void);
+void HistoryService(void);
+void HistoryMark(uint8_t type, uint8_t data);
+uint8_t HistorySnapshot(uint8_t tankIndex);
+void HistorySnapshotClear(uint8_t tankIndex);
+void HistoryCursorStart(struct historyCursor * cur);
+uint8_t HistoryCursorNext(struct historyCursor * cur, struct historyEntry * entry);
+
+#endif	/* HISTORY_H */
@@ -0,0 +1,79 @@
+/* 
+ * File:   leak.h
+ * Author: Faris Shahin
+ * Comments:
+ * This file along with the associated C file watches each tank for liquid
+ * leaving it faster than usual (a leak or theft) with a CUSUM detector.
+ * 
+ * The filtered levels of each tank are averaged over LEAK_STEP seconds.
+ * At every step, the drop of the average since the last step is compared with
+ * the usual drop for that time of day (the baseline). The amount by which it
+ * is larger, less an allowance, is added up; a step with a smaller drop takes
+ * the sum back down, never below zero. When the sum goes over the threshold
+ * the tank is in alarm until the alarm is acknowledged. Each reading costs an
+ * addition and each step a few more per tank.
+ * 
+ * The detector is set with two values for the whole board: an alarm is raised
+ * when the level drops the set drop (cm) more than the baseline within the
+ * set window (minutes, a multiple of LEAK_STEP). They are kept in EEPROM and
+ * set over the serial port (PROV_LEAK in prov_frame.h, holding registers
+ * MODBUS_LEAK_REG in modbus.h); a board that has none set uses LEAK_DROP and
+ * LEAK_WINDOW. The allowance is half of that rate (3 cm/hour by default),
+ * so a drop slower than that above the baseline is never detected.
+ * 
+ * The baseline is learnt while the tank is not in alarm and separately for
+ * each quarter of the day, so quiet periods (nights) have a baseline of about
+ * zero and any drop in them is detected sooner. Quarters are counted from
+ * power up since there is no real time clock.
+ * 
+ * Results of "make detect" in sim/ (detect.c) with the default values
+ * ("simdetect -L drop,window" for others), with a reading every 4 s
+ * with a noise of 0.3 or 1 cm, one reading in 500 off by 30 cm, and a daily
+ * use of 0 to 3 cm/hour from 7-9h to 17-19h, which changes at other times
+ * than the quarters. False alarms are counted after a week of learning:
+ *      Tank not in use, or daily use as above: no false alarms in a year
+ *      Twice that use: 20 (0.3 cm noise) to 76 (1 cm noise) a year
+ *      Leak of 3 cm/hour (the allowance): over 9 in 10 not detected within
+ *      2 days
+ *      Leak of 6 cm/hour: 40 to 60 min on average, 7 hours at most
+ *      Leak of 15 cm/hour: 14 min on average, 30 min at most
+ *      60 cm/hour and faster (theft): 3 to 4 min on average, 19 min at most
+ * The settings trade one for the other, same run:
+ *      3 cm in 120 min: every 3 cm/hour leak detected, 10 to 42 min on
+ *      average, but 142 (0.3 cm noise) to 594 (1 cm noise) false alarms a
+ *      year with the daily use
+ *      6 cm in 30 min: no false alarms even with twice the use, but leaks
+ *      slower than 15 cm/hour are missed and those take 30 min on average
+ * A long window with a small drop has an allowance under the noise and the
+ * tank stays in alarm. Sites with a heavier or less regular use should set a
+ * larger drop.
+ * 
+ * Revision History: v1.0
+ */
+
+#ifndef LEAK_H
+#define	LEAK_H
+
+#define LEAK_STEP       300     //Seconds between two steps of the detector
+#define LEAK_WINDOW     30      //Default window in minutes
+#define LEAK_DROP       3       //Default cm more than the baseline within the window to raise an alarm
+#define LEAK_SLOTS      4       //Parts of the day with their own baseline
+#define LEAK_LEARN      6       //Baseline follows 1/2^LEAK_LEARN of each step
+
+//Range of the settings. The drop is limited so the sum of leak.c stays in 16
+//bits, the window so its steps fit in a byte.
+#define LEAK_DROP_MAX   40
+#define LEAK_WINDOW_UNIT    (LEAK_STEP/60)              //Minutes
+#define LEAK_WINDOW_MAX     (255*LEAK_WINDOW_UNIT)      //21 hours 15 min
+
+void LeakInit(void);
+void LeakReset(uint8_t tankIndex);
+void LeakService(void);
+uint8_t LeakAlarm(uint8_t tankIndex);
+void LeakAcknowledge(void);
+uint8_t LeakValid(uint8_t drop, uint16_t window);
+void LeakSetup(uint8_t drop, uint16_t window);
+uint8_t LeakDrop(void);
+uint16_t LeakWindow(void);
+
+#endif	/* LEAK_H */
@@ -0,0 +1,108 @@
+/* 
+ * File:   modbus.h
+ * Author: Faris Shahin
+ * Comments:
+ * This file along with the associated C file is a Modbus RTU slave on the
+ * USART for RS-485 networks with several boards on one bus. It's built in
+ * when SERIAL_PROTOCOL is SERIAL_MODBUS (see uart.h).
+ * 
+ * The frames are sent and received in interrupts, the requests are carried
+ * out on the main screen:
+ *      - every received byte restarts TMR1; CCP1 raises an interrupt when
+ *        3.5 characters pass without a byte (t3.5), which ends the frame. A
+ *        frame for another address is dropped there.
+ *      - ModbusService(), called by idle(), checks the CRC, carries out the
+ *        request and starts the reply. The interrupt did it before, but the
+ *        reads of the registers go 5 levels deep on the hardware stack of 8
+ *        and nothing was left for the main loop under it.
+ *      - the reply is sent by the TX interrupt and the RS-485 driver is turned
+ *        off once the last stop bit is out
+ * A request is answered after the readings of the tanks in progress, a key
+ * press or a menu are over, or not at all if MODBUS_REPLY_MS passed: the
+ * master may have given up and be talking to another board by then. The
+ * timeout of the master must be longer than MODBUS_REPLY_MS, and a board
+ * doesn't answer while a menu is open.
+ * Writes to the holding registers change the tanks when the request is
+ * carried out; they are saved to EEPROM and the estimates of the tank
+ * restarted right after the reply is started.
+ * 
+ * Characters are 8 data bits, no parity and 2 stop bits (11 bits).
+ * Functions: 3 (read holding), 4 (read input), 6 (write single register),
+ * 16 (write multiple registers). Address 0 is a broadcast: writes are done,
+ * nothing is answered.
+ * 
+ * Holding registers:
+ *      0               slave address (1 to 247), saved in EEPROM
+ *      1+9t to 9+9t    tank t (0 to TANK_COUNT-1): name (3 registers, 2
+ *                      characters each, first one in the high byte), length,
+ *                      width and height in cm (0 to 999), low, critical and
+ *                      high thresholds in percent (0 to 100)
+ *      1000, 1001      leak detector (see leak.h): drop in cm (1 to
+ *                      LEAK_DROP_MAX) and window in minutes (a multiple of
+ *                      LEAK_WINDOW_UNIT up to LEAK_WINDOW_MAX), saved in
+ *                      EEPROM. They don't move with TANK_COUNT.
+ *      1100+t          sensor of tank t, SENSOR_ULTRASONIC (0) or
+ *                      SENSOR_PRESSURE (1) (see sensor.h). Kept apart from
+ *                      the 9 registers of the tank so they don't move for
+ *                      masters written before it.
+ * Input registers:
+ *      5t to 4+5t      tank t: level in cm (0xffff if no reading), percentage,
+ *                      liters (high word, low word), flags (TLM_FLAG_... in
+ *                      telemetry_frame.h)
+ * 
+ * Reply time from the last byte of the request to the first byte of the
+ * reply, measured by simsoakmb (sim/soak.c) as the master of one board at
+ * 9600 baud, over 90 simulated days and 3.9 million requests, none left
+ * unanswered: 4.16 ms mean, which is t3.5 plus the wait for idle(), and
+ * 61 ms worst, for a request that came in during the readings of the tanks.
+ * The simulator doesn't count the instructions of the C code: building the
+ * reply on the PIC, estimated from instruction counts at 1 to 3 ms at 4MHz for
+ * a read of 20 registers (CRC of 53 bytes plus the register reads), comes on
+ * top.
+ * 
+ * Revision History: v1.0
+ */
+
+#ifndef MODBUS_H
+#define	MODBUS_H
+
+#define MODBUS_DEFAULT_ADDR 1       //Address used until one is set
+#define MODBUS_BUF          48      //Largest request or reply
+#define MODBUS_MAX_REGS     ((MODBUS_BUF-5)/2)  //Most registers in one read
+
+#define MODBUS_TANK_HOLDING 9       //Holding registers of each tank
+#define MODBUS_TANK_INPUT   5       //Input registers of each tank
+#define MODBUS_LEAK_REG     1000    //First holding register of the leak settings
+#define MODBUS_SENSOR_REG   1100    //Holding register of the sensor of tank 0
+
+//TMR1 counts instruction cycles (Fosc/4). One character is 11 bits.
+#define MODBUS_CHAR         ((_XTAL_FREQ/4)*11/UART_BAUD)
+#if UART_BAUD > 19200
+#define MODBUS_T35          ((_XTAL_FREQ/4)*1750/1000000)   //Fixed 1.75 ms above 19200 baud
+#else
+#define MODBUS_T35          (MODBUS_CHAR*7/2)
+#endif
+
+//A request waits for ModbusService() at most MODBUS_REPLY_MS, counted in
+//periods of 10 ms of TMR1
+#define MODBUS_REPLY_MS     500
+#define MODBUS_WAIT         ((_XTAL_FREQ/4)/100)
+#define MODBUS_WAITS        (MODBUS_REPLY_MS/10)
+
+//Set the port and pin of the RS-485 driver enable (DE and /RE tied together)
+#define MODBUS_DE_PORT      PORTE
+#define MODBUS_DE_TRIS      TRISE
+#define MODBUS_DE_PIN       1
+
+#if SERIAL_PROTOCOL == SERIAL_MODBUS
+void ModbusInit(void);
+tankmask_t ModbusService(void);
+void ModbusRxInterrupt(void);
+void ModbusTxInterrupt(void);
+void ModbusTimerInterrupt(void);
+#else
+#define ModbusInit()
+#define ModbusService()     0
+#endif
+
+#endif	/* MODBUS_H */
@@ -0,0 +1,19 @@
+/* 
+ * File:   numfmt.h
+ * Author: Faris Shahin
+ * Comments:
+ * Division-free number formatting for the LCD. Numbers are written right
+ * aligned into a fixed-width field of a buffer owned by the caller, so a whole
+ * LCD line can be assembled in RAM and printed with one call.
+ * Revision History: v1.0
+ */
+
+#ifndef NUMFMT_H
+#define	NUMFMT_H
+
+#define NUMFMT_PAD      ' '     //Character used for the leading positions
+#define NUMFMT_OVERFLOW '*'     //Character used when the number doesn't fit
+
+void NumFormat(uint32_t num, uint8_t * dest, uint8_t width);
+
+#endif	/* NUMFMT_H */
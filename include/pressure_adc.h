@@ -0,0 +1,51 @@
+/*
+ * File:   pressure_adc.h
+ * Author: Faris Shahin
+ * Comments:
+ * This file along with the associated C file reads hydrostatic pressure
+ * transducers through the 10-bit ADC of the PIC, the SENSOR_PRESSURE backend
+ * of sensor.h. A 4-20mA transducer at the bottom of a tank drives its loop
+ * current through a 250 ohm shunt, 1V to 5V, on the MUX channel of the tank
+ * in place of the HC-SR04. The MUX output is the echo line, RA0, which is also
+ * AN0: it's turned to an analog input for the reading and back to digital
+ * once it's over.
+ *
+ * PRESSURE_SAMPLES conversions are added up: the ADC interrupt takes each
+ * sample and starts the next conversion, PressurePoll() only tells when the
+ * reading is over. The sum is decimated to PRESSURE_BITS bits. Oversampling by 4^n
+ * gives n more bits and cuts the noise by 2^n, the noise itself dithering the
+ * steps of the ADC. PressureAdcInterrupt() must be called from the interrupt
+ * service routine in main.c when ADIF is set.
+ *
+ * Revision History: v1.0
+ */
+
+#ifndef PRESSURE_ADC_H
+#define	PRESSURE_ADC_H
+
+#define PRESSURE_SAMPLES    64      //Conversions per reading, 4^3
+#define PRESSURE_SHIFT      3       //The sum of 64 samples of 10 bits has 16 bits, 13 are kept
+#define PRESSURE_BITS       13
+#define PRESSURE_MAX        (1023U << (PRESSURE_BITS-10))   //Counts at 5V
+
+//Loop current in counts of PRESSURE_BITS, with the 250 ohm shunt and the
+//5V reference
+#define PRESSURE_ZERO       (PRESSURE_MAX/5)        //4mA, no liquid
+#define PRESSURE_FULL       PRESSURE_MAX            //20mA, PRESSURE_RANGE_MM
+#define PRESSURE_OPEN       (PRESSURE_MAX*9/50)     //Under 3.6mA the loop is open or the transducer failed
+
+#define PRESSURE_RANGE_MM   5099    //Full scale of the transducers in mm of water, 0 to 0.5 bar
+#define PRESSURE_DENSITY    840     //Density of the liquid in kg/m3, diesel, the same for all the tanks
+
+#define PRESSURE_ACQ_US     20      //Settling of the MUX and the holding capacitor before the first conversion
+#define PRESSURE_REACQ_US   12      //Holding capacitor between two conversions, waited by the interrupt above 4MHz
+#define PRESSURE_DIGITAL    0x06    //ADCON1 with PORTA all digital, set by main.c and after each reading
+
+void PressureStart(uint8_t tankIndex);
+uint8_t PressurePoll(void);
+uint16_t PressureLevel(void);
+uint8_t PressureHealth(void);
+uint16_t PressureCounts(void);
+void PressureAdcInterrupt(void);
+
+#endif	/* PRESSURE_ADC_H */
@@ -0,0 +1,60 @@
+/*
+ * File:   profile.h
+ * Author: Faris Shahin
+ * Comments:
+ * Profiler of the time the firmware spends in its slowest functions, on the
+ * board itself. A probe is PROFILE_ENTER() at the start of a function and
+ * PROFILE_EXIT() before each return; it counts the calls and adds the TMR1
+ * ticks in between to a table in RAM, keeping the longest one too. The table
+ * is shown by the diagnostics page: press '9' on the options menu (it isn't
+ * listed), '8' for the next probes, '0' to empty the table, '*' to send it on
+ * the UART and '#' to go back.
+ *
+ * With PROFILE 0 the probes, the table and the page are not built at all.
+ * With PROFILE 1 each probe costs about 60 instruction cycles: reading TMR1
+ * twice and adding to the table. TMR1 runs at 1:8, so times are in steps of
+ * 8 cycles and a call longer than 65536 ticks (524ms at 4MHz) is counted
+ * short. The Modbus build uses TMR1 for its frame timer, so the two can't be
+ * built together.
+ *
+ * Revision History: v1.0
+ */
+
+#ifndef PROFILE_H
+#define	PROFILE_H
+
+#define PROFILE             0       //1 to build the probes and the diagnostics page
+
+#define PROFILE_T1CON       0x31    //Prescaler 1:8, internal clock, TMR1 on
+#define PROFILE_TICK_CYCLES 8       //Instruction cycles of a TMR1 tick
+
+//Probes
+#define PROF_PING           0       //UltraSonicPing()
+#define PROF_VIEW           1       //view(), all tanks read and shown
+#define PROF_LCD_BYTE       2       //LCDSendByte()
+#define PROF_LCD_POS        3       //LCDSetPos()
+#define PROF_KEYPAD         4       //KeypadRead(), with the delay after a key
+#define PROF_EEPROM         5       //EEPROMQueueWrite(), with the wait for room
+#define PROF_ISR            6       //The interrupt service routine
+#define PROF_COUNT          7
+
+#if PROFILE
+
+#define PROFILE_ENTER()         uint16_t profileStart = ProfileNow()
+#define PROFILE_EXIT(probe)     ProfileRecord(probe, profileStart)
+
+void ProfileInit(void);
+uint16_t ProfileNow(void);
+void ProfileRecord(uint8_t probe, uint16_t start);
+void ProfileClear(void);
+void ProfileLine(uint8_t probe, uint8_t * line);
+void ProfileDump(void);
+
+#else
+
+#define PROFILE_ENTER()
+#define PROFILE_EXIT(probe)
+
+#endif
+
+#endif	/* PROFILE_H */
@@ -0,0 +1,125 @@
+/*
+ * File:   prov_frame.h
+ * Author: Faris Shahin
+ * Comments:
+ * Layout of the provisioning frames on the UART (see provision.h). Plain C
+ * with no MCU dependency so the host tools build frames with the same
+ * definitions.
+ *
+ * The host sends a request and waits for its reply before the next one:
+ *      request     PROV_SYNC, command, n, n bytes of data, CRC
+ *      reply       PROV_REPLY, command, PROV_... status, n, n bytes of data, CRC
+ * The CRC is the CRC-8 of the telemetry records (polynomial 0x31, initial
+ * value 0xff) of the bytes from the command to the end of the data. Replies
+ * come between the telemetry records, which a host skips: they start with
+ * TLM_SYNC. A host that gets no reply sends PROV_MAX_FRAME zeros, which end
+ * any frame the board was still receiving, and asks again.
+ *
+ * Commands (data of the request -> data of the reply):
+ *      PROV_INFO       -                   -> tank count, PROV_TANK_SIZE
+ *      PROV_READ       tank                -> tank, tank record
+ *      PROV_BEGIN      tank count          -> -
+ *      PROV_WRITE      tank, tank record   -> -
+ *      PROV_COMMIT     set CRC             -> number of tanks changed
+ *      PROV_ABORT      -                   -> -
+ *      PROV_HISTORY    from start          -> up to PROV_HIST_ENTRIES entries
+ *      PROV_LEAK       - or leak settings  -> leak settings
+ * Nothing written between PROV_BEGIN and PROV_COMMIT is used or saved until
+ * every tank was written and the set CRC matches: the CRC-8 of the records of
+ * all the tanks, in order, as PROV_READ returns them. A tank whose name starts
+ * with a space is unused and is read back as 6 spaces and zeros.
+ *
+ * PROV_HISTORY reads the level log (see history.h) from the oldest entry to
+ * the newest, a few entries per request: 1 starts from the oldest, 0 goes on
+ * where the last request stopped. A reply with no entry ends the log. Each
+ * entry is PROV_HIST_SIZE bytes:
+ *      0       bits 5-4: 0 level, 1 change, 2 marker
+ *              bits 3-0: tank index (marker type for a marker: 0 power up,
+ *              1 leak alarm, 2 refill)
+ *      1       level of the tank after the entry in half percent, 255 until
+ *              the first level of the tank; the data of a marker (tank index)
+ *      2       samples the entry stands for, 0 for a marker
+ *
+ * PROV_LEAK reads the settings of the leak detector (see leak.h), or sets
+ * them and saves them right away when the request has them. They are
+ * PROV_LEAK_SIZE bytes:
+ *      0       drop in cm, 1 to 40
+ *      1-2     window in minutes (little endian), a multiple of 5 up to 1275
+ *
+ * A tank record is PROV_TANK_SIZE bytes (values little endian). The board
+ * keeps the tanks packed (see tank.h), this is the same for every version:
+ *      0-5     name, letters and digits padded with spaces
+ *      6-7     length in cm, 1 to PROV_MAX_LENGTH
+ *      8-9     width in cm, 1 to PROV_MAX_LENGTH
+ *      10-11   height in cm, 1 to PROV_MAX_HEIGHT
+ *      12      low level alarm in percent, 0 (off) to 100
+ *      13      critical level alarm in percent, 0 (off) to 100
+ *      14      high level alarm in percent, 0 (off) to 100
+ *      15      sensor, PROV_SENSOR_ULTRASONIC or PROV_SENSOR_PRESSURE
+ * PROV_INFO gives the size of the record, which is its version: the sensor
+ * made it 16 bytes instead of 15. A host checks it before reading or writing
+ * a tank, so one built for the 15 byte record stops at a newer board instead
+ * of sending records that are a byte short.
+ *
+ * Revision History: v1.0
+ */
+
+#ifndef PROV_FRAME_H
+#define	PROV_FRAME_H
+
+#define PROV_SYNC           0x5A
+#define PROV_REPLY          0x5B
+
+//Commands
+#define PROV_INFO           0x01
+#define PROV_READ           0x02
+#define PROV_BEGIN          0x03
+#define PROV_WRITE          0x04
+#define PROV_COMMIT         0x05
+#define PROV_ABORT          0x06
+#define PROV_HISTORY        0x07
+#define PROV_LEAK           0x08
+
+//Status of a reply
+#define PROV_OK             0
+#define PROV_ERR_FRAME      1   //Bad CRC or length
+#define PROV_ERR_COMMAND    2   //Unknown command
+#define PROV_ERR_STATE      3   //No PROV_BEGIN before, or it timed out
+#define PROV_ERR_VALUE      4   //Tank index or a value of the record out of range
+#define PROV_ERR_SET        5   //Wrong tank count, a tank not written or a wrong set CRC
+
+//Tank record
+#define PROV_TANK_NAME      0
+#define PROV_TANK_LENGTH    6
+#define PROV_TANK_WIDTH     8
+#define PROV_TANK_HEIGHT    10
+#define PROV_TANK_LOW       12
+#define PROV_TANK_CRITICAL  13
+#define PROV_TANK_HIGH      14
+#define PROV_TANK_SENSOR    15
+#define PROV_TANK_SIZE      16
+
+//Sensor of a tank, the SENSOR_... of sensor.h
+#define PROV_SENSOR_ULTRASONIC  0
+#define PROV_SENSOR_PRESSURE    1
+
+#define PROV_MAX_LENGTH     9999    //Length and width, past the 999 of the keypad
+#define PROV_MAX_HEIGHT     999
+#define PROV_MAX_LITERS     40000000L   //Full tank, so liters*100 fits in 32 bits
+
+//Entry of the level log
+#define PROV_HIST_HEADER    0
+#define PROV_HIST_LEVEL     1
+#define PROV_HIST_SAMPLES   2
+#define PROV_HIST_SIZE      3
+
+//Leak settings
+#define PROV_LEAK_DROP      0
+#define PROV_LEAK_WINDOW    1
+#define PROV_LEAK_SIZE      3
+
+#define PROV_MAX_DATA       (1 + PROV_TANK_SIZE)
+#define PROV_HIST_ENTRIES   (PROV_MAX_DATA/PROV_HIST_SIZE)  //Entries of a PROV_HISTORY reply
+#define PROV_MAX_FRAME      (5 + PROV_MAX_DATA)  //A reply, a request is a byte shorter
+
+#endif	/* PROV_FRAME_H */
@@ -0,0 +1,49 @@
+/*
+ * File:   provision.h
+ * Author: Faris Shahin
+ * Comments:
+ * This file along with the associated C file lets a PC read and write all
+ * the tanks of the board over the serial port in one transaction, instead of
+ * entering each one with the keypad (see prov_frame.h for the frames and
+ * host/tlmprov for the tool that sends a site file to the boards). It's built
+ * in with the telemetry stream (SERIAL_TELEMETRY in uart.h), which then also
+ * turns the receiver on. A Modbus master writes the tanks with the holding
+ * registers instead (see modbus.h). The level log of history.h is read the
+ * same way (PROV_HISTORY, "tlmprov -H"), and the settings of the leak detector
+ * read or set (PROV_LEAK, "tlmprov -L").
+ *
+ * The bytes are collected by the RX interrupt and the frame is handled by
+ * ProvisionService() on the main screen, so a PC gets no answer while a menu
+ * is open. The readings are held from PROV_BEGIN to PROV_COMMIT: the tanks
+ * are changed in RAM as they are written, and loaded again from EEPROM if the
+ * transaction is aborted, times out or the options menu is opened. On
+ * PROV_COMMIT the changed tanks are saved and what was learnt about them is
+ * restarted, as when they are edited from the keypad.
+ *
+ * At 9600 baud a transaction of 4 tanks with the check read back takes about
+ * 0.3s (11 requests), 8 tanks about 0.5s.
+ *
+ * Revision History: v1.0
+ */
+
+#ifndef PROVISION_H
+#define	PROVISION_H
+
+#include "prov_frame.h"
+
+#define PROV_TIMEOUT        2   //Seconds without a request after which a transaction is aborted
+
+#if SERIAL_PROTOCOL == SERIAL_TELEMETRY
+void ProvisionInit(void);
+tankmask_t ProvisionService(void);
+uint8_t ProvisionBusy(void);
+void ProvisionAbort(void);
+void ProvisionRxInterrupt(void);
+#else
+#define ProvisionInit()
+#define ProvisionService()  0
+#define ProvisionBusy()     0
+#define ProvisionAbort()
+#endif
+
+#endif	/* PROVISION_H */
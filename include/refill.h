@@ -0,0 +1,72 @@
+/* 
+ * File:   refill.h
+ * Author: Faris Shahin
+ * Comments:
+ * This file along with the associated C file detects refills of each tank
+ * from its filtered levels and keeps a log of the liters delivered, so a
+ * delivery can be checked against what the supplier charged.
+ * 
+ * A refill starts when the level stays REFILL_RISE cm or more above the
+ * reference level for REFILL_CONFIRM readings in a row. The reference moves
+ * 1 cm towards the level every REFILL_CREEP seconds when it's lower and four
+ * times as often when it's higher, so it sits near the low end of the noise,
+ * follows normal use and doesn't catch up with a refill of any useful speed.
+ * The refill ends when the level hasn't gone more than 1 cm over its highest
+ * value for REFILL_PLATEAU seconds. The liters delivered are the difference of
+ * the volume at the plateau and at the reference level. Each reading costs a
+ * few comparisons.
+ * 
+ * Results of "make detect" in sim/ (detect.c), with a reading every 2 s, a
+ * noise of 0.5 to 1.5 cm and one reading in 500 off by 30 cm:
+ *      Tank not in use: no refills logged in a day up to 1 cm of noise, 2
+ *      at 1.5 cm
+ *      Refill of 100 cm at 1 to 60 cm/min: logged once for 96 to 100% of
+ *      the refills up to 1 cm of noise and 91 to 99% at 1.5 cm (the others
+ *      split in two), within 2% of the liters on average (8% at most) and
+ *      5 min of the duration (8 min at most)
+ *      Refill slower than 1 cm/min: mostly logged as a few smaller refills
+ * 
+ * The log keeps the last EE_REFILL_COUNT refills in EEPROM. A refill is also
+ * marked in the history log so it can be placed in time.
+ * 
+ * Revision History: v1.0
+ */
+
+#ifndef REFILL_H
+#define	REFILL_H
+
+#define REFILL_RISE         5       //cm over the reference level to start a refill
+#define REFILL_CONFIRM      5       //Readings in a row over it to start a refill
+#define REFILL_CREEP        300     //Seconds for the reference level to go up 1 cm (a quarter to go down)
+#define REFILL_PLATEAU      300     //Seconds without a rise to end a refill
+
+//Layout of a logged refill in EEPROM
+#define REFILL_REC_SEQ      0   //Sequence number in the upper bits, tank index in the lower TANK_BITS
+#define REFILL_REC_LITERS   1   //Liters delivered, little endian (up to 65535)
+#define REFILL_REC_TIME     3   //Duration in seconds, little endian (up to 65535)
+#define REFILL_REC_CRC      5
+#define REFILL_REC_SIZE     6
+#define REFILL_SEQ_MOD      (256>>TANK_BITS)    //Sequence numbers count from 0 to REFILL_SEQ_MOD-1
+#define REFILL_TANK_MASK    ((1<<TANK_BITS)-1)
+
+#if REFILL_SEQ_MOD < 2*EE_REFILL_COUNT
+#error "Too few sequence numbers to tell the oldest refill from the newest"
+#endif
+
+#if REFILL_REC_SIZE > EE_REFILL_SLOT
+#error "A refill doesn't fit in its slot of the EEPROM"
+#endif
+
+//A logged refill
+struct refillEvent{
+    uint8_t tank;       //Tank index
+    uint16_t liters;    //Liters delivered
+    uint16_t duration;  //Seconds from the first reading over the reference to the last rise
+};
+
+void RefillInit(void);
+void RefillReset(uint8_t tankIndex);
+void RefillService(void);
+uint8_t RefillRead(uint8_t n, struct refillEvent *event);
+
+#endif	/* REFILL_H */
@@ -0,0 +1,55 @@
+/*
+ * File:   screen.h
+ * Author: Faris Shahin
+ * Comments:
+ * This file along with the associated C file draws the screens of the menus
+ * from layouts kept in program memory. A screen is a const table of cells at
+ * positions of the LCD, ended by SCREEN_END() with the position of the cursor:
+ *      - SCREEN_TEXT(), a static text
+ *      - SCREEN_FIELD(), width characters filled by a function from the data
+ *        it shows when the screen is drawn (it may add a '\0' after them)
+ *      - SCREEN_INPUT(), width characters numSet() or nameSet() write into,
+ *        blank when the screen is drawn
+ * The cells of a screen are listed in the order of the DDRAM, lines 1, 3, 2
+ * then 4 (see lcd.c), so the cursor moves the least from one to the next.
+ *
+ * ScreenShow() knows the layout the LCD shows. The lines the new screen has in
+ * common with it are left alone and the others are written over, padded with
+ * spaces up to the end of the old text; the LCD is only cleared when it shows
+ * something unknown or when clearing it and writing the new screen is faster.
+ * ScreenRefresh() writes the fields alone, for a screen whose data changed.
+ * A screen drawn by hand (the main screen, usage, refills) starts with
+ * ScreenClear() so the next layout isn't drawn over it as if it was known.
+ *
+ * Revision History: v1.0
+ */
+
+#ifndef SCREEN_H
+#define	SCREEN_H
+
+#define SCREEN_END_CELL     0xff    //Width of the cell ending a screen
+#define SCREEN_CLEAR_CHARS  41      //LCDClearDisplay() takes as long as writing 41 characters
+
+//Position of a cell, line 1 to 4 and column 1 to 16
+#define SCREEN_AT(line, col)    ((line) << 5 | (col))
+#define SCREEN_LINE(pos)        ((pos) >> 5)
+#define SCREEN_COL(pos)         ((pos) & 0x1f)
+
+#define SCREEN_TEXT(line, col, text)            {SCREEN_AT(line, col), 0, (const uint8_t *)(text), NULL}  //Literals are char
+#define SCREEN_FIELD(line, col, width, field)   {SCREEN_AT(line, col), width, NULL, field}
+#define SCREEN_INPUT(line, col, width)          {SCREEN_AT(line, col), width, NULL, NULL}
+#define SCREEN_END(line, col)                   {SCREEN_AT(line, col), SCREEN_END_CELL, NULL, NULL}  //Line 0 to hide the cursor
+
+struct screenCell
+{
+    uint8_t pos;                    //SCREEN_AT()
+    uint8_t width;                  //Characters of a field or an input, 0 for a text
+    const uint8_t * text;           //The text, NULL for a field or an input
+    void (*field)(uint8_t * dest);  //Writes the width characters of a field at dest
+};
+
+void ScreenShow(const struct screenCell * screen);
+void ScreenRefresh(void);
+void ScreenClear(void);
+
+#endif	/* SCREEN_H */
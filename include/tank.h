@@ -0,0 +1,85 @@
+/*
+ * File:   tank.h
+ * Author: Faris Shahin
+ * Comments:
+ * This file along with the associated C file keeps the settings of the liquid
+ * tanks packed in TANK_SIZE bytes each, the same bytes in RAM and in the
+ * EEPROM record (see tank_config.h). A name character takes 6 bits (the 63
+ * symbols nameSet() allows) and each value only the bits its range needs, so a
+ * tank takes 12 bytes of RAM instead of 16, and 13 of EEPROM with the CRC of
+ * its record instead of 16. The fields are read with the accessors
+ * below; the name is only decoded to text to be shown or edited.
+ *
+ * Layout (bit 0 is bit 0 of byte 0, fields may span bytes):
+ *      bits  0-35  name, 6 characters of TANK_CHAR_BITS, a code of 0 is a space
+ *      bits 36-49  length in cm
+ *      bits 50-63  width in cm
+ *      bits 64-73  height in cm
+ *      bits 74-80  low level alarm in percent, 0 is off (see alarm.h)
+ *      bits 81-87  critical level alarm in percent
+ *      bits 88-94  high level alarm in percent
+ *      bit  95     sensor, SENSOR_ULTRASONIC or SENSOR_PRESSURE (see sensor.h)
+ * A tank whose name starts with a space is unused, all its bytes are 0.
+ *
+ * Revision History: v1.0
+ */
+
+#ifndef TANK_H
+#define	TANK_H
+
+#define TANK_NAME_CHARS     6
+#define TANK_CHAR_BITS      6
+
+//First bit and width of each field
+#define TANK_NAME_BIT       0
+#define TANK_LENGTH_BIT     36
+#define TANK_WIDTH_BIT      50
+#define TANK_DIM_BITS       14      //Length and width, up to 16383 cm
+#define TANK_HEIGHT_BIT     64      //On a byte, it's read at every measurement
+#define TANK_HEIGHT_BITS    10      //Up to 1023 cm
+#define TANK_HEIGHT_MAX     1023    //Largest height, as a number for the texts of the menus
+#define TANK_LOW_BIT        74
+#define TANK_CRITICAL_BIT   81
+#define TANK_HIGH_BIT       88
+#define TANK_ALARM_BITS     7
+#define TANK_SENSOR_BIT     95
+#define TANK_SENSOR_BITS    1
+#define TANK_SIZE           12      //96 bits
+
+uint8_t liquidTanks[TANK_COUNT][TANK_SIZE];    //TANK_COUNT is set in config.h
+
+//The bytes of a tank, the row of liquidTanks found with two shifts: XC8 calls
+//a routine to multiply by TANK_SIZE, one more level of the hardware stack
+//under every read of a tank
+#if TANK_SIZE != 12
+#error "TankBytes() is written for a TANK_SIZE of 12"
+#endif
+#define TankBytes(t)            (liquidTanks[0] + ((uint8_t)(t)<<3) + ((uint8_t)(t)<<2))
+
+uint16_t TankField(uint8_t tankIndex, uint8_t bit, uint8_t bits);
+void TankSetField(uint8_t tankIndex, uint8_t bit, uint8_t bits, uint16_t value);
+uint8_t TankNameChar(uint8_t tankIndex, uint8_t i);
+void TankSetNameChar(uint8_t tankIndex, uint8_t i, uint8_t c);
+void TankName(uint8_t tankIndex, uint8_t * name);
+void TankSetName(uint8_t tankIndex, const uint8_t * name);
+
+//The code of the first character isn't 0 (a space)
+#define TankInUse(t)            ((TankBytes(t)[0] & ((1<<TANK_CHAR_BITS)-1)) != 0)
+
+#define TankLength(t)           TankField(t, TANK_LENGTH_BIT, TANK_DIM_BITS)
+#define TankWidth(t)            TankField(t, TANK_WIDTH_BIT, TANK_DIM_BITS)
+#define TankHeight(t)           TankField(t, TANK_HEIGHT_BIT, TANK_HEIGHT_BITS)
+#define TankLow(t)              ((uint8_t)TankField(t, TANK_LOW_BIT, TANK_ALARM_BITS))
+#define TankCritical(t)         ((uint8_t)TankField(t, TANK_CRITICAL_BIT, TANK_ALARM_BITS))
+#define TankHigh(t)             ((uint8_t)TankField(t, TANK_HIGH_BIT, TANK_ALARM_BITS))
+#define TankSensor(t)           ((uint8_t)TankField(t, TANK_SENSOR_BIT, TANK_SENSOR_BITS))
+
+#define TankSetLength(t, v)     TankSetField(t, TANK_LENGTH_BIT, TANK_DIM_BITS, v)
+#define TankSetWidth(t, v)      TankSetField(t, TANK_WIDTH_BIT, TANK_DIM_BITS, v)
+#define TankSetHeight(t, v)     TankSetField(t, TANK_HEIGHT_BIT, TANK_HEIGHT_BITS, v)
+#define TankSetLow(t, v)        TankSetField(t, TANK_LOW_BIT, TANK_ALARM_BITS, v)
+#define TankSetCritical(t, v)   TankSetField(t, TANK_CRITICAL_BIT, TANK_ALARM_BITS, v)
+#define TankSetHigh(t, v)       TankSetField(t, TANK_HIGH_BIT, TANK_ALARM_BITS, v)
+#define TankSetSensor(t, v)     TankSetField(t, TANK_SENSOR_BIT, TANK_SENSOR_BITS, v)
+
+#endif	/* TANK_H */
@@ -0,0 +1,51 @@
+/* 
+ * File:   tank_config.h
+ * Author: Faris Shahin
+ * Comments:
+ * This file along with the associated C file stores the liquid tanks data in
+ * EEPROM. The data is kept behind a versioned header and each tank record is
+ * protected by its own CRC. A record is the packed tank of tank.h followed by
+ * the CRC.
+ * Revision History: v1.0
+ */
+
+#ifndef TANK_CONFIG_H
+#define	TANK_CONFIG_H
+
+//Layout of a tank record inside its slot
+#define REC_TANK        0   //TANK_SIZE bytes
+#define REC_CRC         TANK_SIZE   //CRC-8 of the bytes before it
+#define REC_SIZE        (TANK_SIZE+1)
+
+//Records of versions 1 to 3 weren't packed and had a slot of 16 bytes (all
+//values little endian)
+#define REC_V3_SLOT     16
+#define REC_V3_NAME     0   //6 characters, no '\0'
+#define REC_V3_LENGTH   6
+#define REC_V3_WIDTH    8
+#define REC_V3_HEIGHT   10
+#define REC_V3_LOW      12  //Alarm thresholds in percent
+#define REC_V3_CRITICAL 13
+#define REC_V3_HIGH     14
+#define REC_V3_CRC      15
+#define REC_V3_SIZE     16
+
+//Version 1 records had no alarm thresholds and the CRC at byte 12
+#define REC_V1_CRC      12
+
+#if REC_SIZE > EE_TANK_SLOT
+#error "A tank record doesn't fit in its slot of the EEPROM"
+#endif
+
+//Values returned by TankConfigLoad()
+#define CFG_LOADED      0   //Header and records were valid
+#define CFG_MIGRATED    1   //Data was converted from an older layout
+#define CFG_DEFAULTS    2   //Nothing valid was found, all tanks are empty
+
+uint8_t TankConfigLoad(void);
+void TankConfigSave(uint8_t tankIndex);
+void TankConfigClear(uint8_t tankIndex);
+void TankConfigRecord(uint8_t tankIndex, uint8_t * rec);
+void TankConfigRevert(uint8_t tankIndex);
+
+#endif	/* TANK_CONFIG_H */
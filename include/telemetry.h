@@ -0,0 +1,46 @@
+/* 
+ * File:   telemetry.h
+ * Author: Faris Shahin
+ * Comments:
+ * This file along with the associated C file streams the readings of the
+ * tanks on the UART as binary records (see telemetry_frame.h for the layout).
+ * Records are queued in the UART ring buffer and sent by the TX interrupt, so
+ * sending never holds up the readings. The buffer holds a record of every
+ * tank (see uart.h); a record that still doesn't fit, e.g. behind a reply to
+ * the provisioning tool, is dropped and its sequence number is skipped so the
+ * receiver sees it. With more than 5 tanks the buffer is too small for that
+ * and a record waits for room instead.
+ * 
+ * At 9600 baud (8N1, 960 bytes/s) the link carries up to 80 records/s and at
+ * 19200 up to 160, while the tanks produce at most 4 records per scan (about
+ * 1 record/s). The interrupt takes about 40 instruction cycles per byte, 4%
+ * of the CPU at 9600 baud while sending. 115200 baud can't be reached with the
+ * 4MHz crystal (see uart.h).
+ * 
+ * Revision History: v1.0
+ */
+
+#ifndef TELEMETRY_H
+#define	TELEMETRY_H
+
+#include "telemetry_frame.h"
+
+#define TLM_ALL             0   //Send every reading
+#define TLM_CHANGES         1   //Send a tank only when its level or flags change
+
+#define TELEMETRY_MODE      TLM_ALL
+#define TELEMETRY_INTERVAL  0   //Least seconds between two records of a tank, 0 for no limit
+#define TELEMETRY_KEEPALIVE 60  //Seconds after which an unchanged tank is sent anyway (TLM_CHANGES)
+
+#if SERIAL_PROTOCOL == SERIAL_TELEMETRY
+void TelemetryInit(void);
+void TelemetryService(void);
+uint16_t TelemetryDropped(void);
+#else
+//The serial port is used for something else (see uart.h)
+#define TelemetryInit()
+#define TelemetryService()
+#define TelemetryDropped()  0
+#endif
+
+#endif	/* TELEMETRY_H */
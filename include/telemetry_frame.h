@@ -0,0 +1,49 @@
+/* 
+ * File:   telemetry_frame.h
+ * Author: Faris Shahin
+ * Comments:
+ * Layout of the telemetry records sent on the UART (see telemetry.h). Plain
+ * C with no MCU dependency so the host tools read records with the same
+ * definitions.
+ * 
+ * A record is TLM_REC_SIZE bytes, all values little endian:
+ *      0       TLM_SYNC
+ *      1       sequence number, counts every record including dropped ones
+ *      2       tank index
+ *      3-4     raw echo time in TMR0 ticks (0 if the reading failed), or ADC
+ *              counts of a pressure transducer (see sensor.h)
+ *      5-6     filtered level in cm (TLM_NO_LEVEL if the reading failed)
+ *      7-9     liters in the tank
+ *      10      TLM_FLAG_... bits
+ *      11      CRC-8 of bytes 1 to 10 (polynomial 0x31, initial value 0xff)
+ * A reader that loses sync looks for the next TLM_SYNC byte whose record has
+ * a valid CRC.
+ * 
+ * Revision History: v1.0
+ */
+
+#ifndef TELEMETRY_FRAME_H
+#define	TELEMETRY_FRAME_H
+
+#define TLM_SYNC            0xA5
+#define TLM_REC_SEQ         1
+#define TLM_REC_TANK        2
+#define TLM_REC_TICKS       3
+#define TLM_REC_LEVEL       5
+#define TLM_REC_LITERS      7
+#define TLM_REC_FLAGS       10
+#define TLM_REC_CRC         11
+#define TLM_REC_SIZE        12
+
+#define TLM_NO_LEVEL        0xffff
+
+//Flags of a record
+#define TLM_FLAG_NO_READING 0x01    //The sensor didn't answer or the reading was out of range
+#define TLM_FLAG_LEAK       0x02    //Leak alarm
+#define TLM_FLAG_LOW        0x04    //Low level alarm
+#define TLM_FLAG_CRITICAL   0x08    //Critical level alarm
+#define TLM_FLAG_HIGH       0x10    //High level alarm
+#define TLM_FLAG_FAULT      0x20    //Sensor fault alarm, the readings of the tank keep failing
+#define TLM_FLAG_BOOT       0x80    //First record of the tank since power up
+
+#endif	/* TELEMETRY_FRAME_H */
@@ -0,0 +1,60 @@
+/* 
+ * File:   uart.h
+ * Author: Faris Shahin
+ * Comments:
+ * This file along with the associated C file sets up the USART and, for the
+ * telemetry stream, sends data on it without waiting: bytes are put in a ring
+ * buffer and the TX interrupt moves them to TXREG one at a time. A write that
+ * doesn't fit in the buffer is dropped whole, so callers never block and
+ * never send half a record.
+ * 
+ * The serial port carries one protocol, chosen with SERIAL_PROTOCOL when
+ * building: the telemetry stream (telemetry.h), with the provisioning
+ * requests (provision.h) on the receiver, or a Modbus RTU slave (modbus.h),
+ * which handles the USART itself.
+ * 
+ * The USART uses RC6 (TX) and RC7 (RX). The keypad columns were moved off
+ * PORTC for this (see KeyPad.h).
+ * 
+ * Revision History: v1.0
+ */
+
+#ifndef UART_H
+#define	UART_H
+
+#include "telemetry_frame.h"
+
+// Baud rate generator in high speed mode (BRGH = 1): baud = Fosc/(16*(SPBRG+1)).
+// With the 4MHz crystal, 9600 and 19200 are within 0.2%. 57600 and 115200 are
+// 8.5% off and can't be used; they need a faster crystal.
+#define SERIAL_NONE         0   //Serial port off
+#define SERIAL_TELEMETRY    1   //Binary telemetry stream
+#define SERIAL_MODBUS       2   //Modbus RTU slave on RS-485
+
+//Can be set by the build instead, as simsoak does for its Modbus run
+#ifndef SERIAL_PROTOCOL
+#define SERIAL_PROTOCOL     SERIAL_TELEMETRY
+#endif
+
+#define UART_BAUD       9600
+#define UART_SPBRG      ((_XTAL_FREQ + 8L*UART_BAUD)/(16L*UART_BAUD) - 1)
+
+// Size of the TX ring buffer, a power of 2. It holds a telemetry record of
+// every tank (one byte is always kept empty), so a scan never has to wait for
+// the UART. 64 bytes is the most: larger arrays don't fit in a RAM bank of the
+// PIC16F877A. With more than 5 tanks the telemetry waits for room instead
+// (see telemetry.c).
+#define UART_TX_NEED    (TANK_COUNT*TLM_REC_SIZE + 1)
+#if UART_TX_NEED <= 32
+#define UART_TX_SIZE    32      //The least, the diagnostics dump writes 30 byte lines
+#else
+#define UART_TX_SIZE    64
+#endif
+
+void UARTInit(void);
+#if SERIAL_PROTOCOL == SERIAL_TELEMETRY
+uint8_t UARTWrite(uint8_t * data, uint8_t len);
+void UARTTxInterrupt(void);
+#endif
+
+#endif	/* UART_H */
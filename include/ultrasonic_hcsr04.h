@@ -14,7 +14,53 @@ volatile uint8_t *US_DATA = &PORTA;
 uint8_t TRIG_PIN = 4;
 uint8_t ECHO_PIN = 1;
 
+//Address lines of the MUX/deMUX that connect one sensor at a time, as bit
+//numbers of US_DATA. TANK_BITS of them are used (see config.h).
+#define MUX_A0  1   //RA1
+#define MUX_A1  2   //RA2
+#define MUX_A2  5   //RA5, more than 4 tanks
+
+//TMR0 times the echo on the instruction clock, with the largest prescaler
+//whose tick isn't longer than US_TICK_US; its overflows are counted in
+//TMR0of. 1:64 at 4MHz (64us), 1:256 at 20MHz (51.2us).
+#define US_TICK_US      64      //About 1.1cm of distance
+#if US_TICK_US*(_XTAL_FREQ/4000L) >= 256000L
+#define US_TMR0_PS      7       //1:256
+#elif US_TICK_US*(_XTAL_FREQ/4000L) >= 128000L
+#define US_TMR0_PS      6       //1:128
+#elif US_TICK_US*(_XTAL_FREQ/4000L) >= 64000L
+#define US_TMR0_PS      5       //1:64
+#else
+#error "US_TICK_US is too short for the TMR0 prescaler"
+#endif
+#define US_OPTION_REG   (0x80 | US_TMR0_PS)    //PORTB pull ups off, TMR0 on the internal clock with the prescaler
+#define US_PRESCALE     (2 << US_TMR0_PS)
+#define US_TICK_NS      (US_PRESCALE*4000L/(_XTAL_FREQ/1000000L))
+#define US_OVERFLOW_US  (US_TICK_NS*256/1000)  //16384 at 4MHz
+
+#define US_SOUND_CM_S   34300   //Speed of sound in air at 20C
+//Distance of a tick out and back in 1/256 mm: 2810 (10.98mm) at 4MHz, 2248 at
+//20MHz. Only integers, XC8 would pull in its floating point library.
+#define US_MM_PER_TICK_Q8   ((US_TICK_NS/100*US_SOUND_CM_S*16 + 62500L)/125000L)
+
+//The distance in mm of an echo time in TMR0 ticks, as measured by
+//UltraSonicPing(), rounded. The echo time is cut down to whole ticks, so half
+//a tick is added back.
+#define UltraSonicDistance(echoTicks)   \
+    ((uint16_t)(((2*(uint32_t)(echoTicks) + 1)*US_MM_PER_TICK_Q8 + 256) >> 9))
+
+//Longest wait for the echo to start and then to end, as TMR0 overflows. 24
+//at 4MHz. The echo time is counted in 16 bits of ticks.
+#define US_TIMEOUT_MS   400
+#define US_TIMEOUT_OVERFLOWS    (US_TIMEOUT_MS*1000L/US_OVERFLOW_US)
+
 void UltraSonicInit();
-uint16_t UltraSonicPing(uint8_t * TMRCount);
+void UltraSonicSelect(uint8_t channel);
+uint16_t UltraSonicPing(volatile uint16_t * TMRCount);
+uint16_t UltraSonicTicks(void);
+void UltraSonicStart(uint8_t tankIndex);
+uint8_t UltraSonicPoll(void);
+uint16_t UltraSonicLevel(void);
+uint8_t UltraSonicHealth(void);
 
 #endif	/* ULTRASONIC_HCSR04_H */
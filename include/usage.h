@@ -0,0 +1,56 @@
+/* 
+ * File:   usage.h
+ * Author: Faris Shahin
+ * Comments:
+ * This file along with the associated C file keeps a daily summary of the
+ * liquid used from each tank, and from it estimates how many liters are used
+ * per day and how many days are left until a tank is empty. Refills are
+ * logged by refill.h.
+ * 
+ * The summary is updated with a few additions and comparisons on every
+ * reading. Only the estimate (4 bytes per tank) is kept in EEPROM, so it
+ * survives power cycles without storing any readings.
+ * 
+ * Days are counted from power up (there is no real time clock), so a day
+ * doesn't start at midnight. The day running when power is lost is dropped.
+ * 
+ * Revision History: v1.0
+ */
+
+#ifndef USAGE_H
+#define	USAGE_H
+
+#define USAGE_DAY           86400   //Seconds in a day
+// Changes of the level up to this many cm are taken as noise: 2 ticks of the
+// HC-SR04 (see ultrasonic_hcsr04.h), rounded up. A reading can flicker by one
+// tick between scans, and a tick isn't a whole number of cm, so one tick can
+// move the level by 2 cm. 3 cm at 4MHz, 2 cm at 20MHz.
+#define USAGE_DEADBAND      ((US_TICK_NS*(US_SOUND_CM_S/100) + 9999999L)/10000000L)
+// A day closes into the estimate with a weight of 1/USAGE_AVG_DAYS
+#define USAGE_AVG_DAYS      7
+#define USAGE_UNKNOWN       0xffff  //Value returned when there's no estimate yet
+#define USAGE_NO_LEVEL      0xffff  //Level before the first reading
+
+//Layout of the estimate of a tank in EEPROM
+#define USAGE_REC_RATE      0   //Liters per day, little endian
+#define USAGE_REC_DAYS      2   //Number of days in the estimate
+#define USAGE_REC_CRC       3
+#define USAGE_REC_SIZE      4
+
+//Summary of the current day for a tank. Levels are the height of the liquid
+//in cm; tanks are cuboids so liters are only calculated when needed.
+struct tankUsage{
+    uint16_t level;     //Reference level, moves when the level changes more than USAGE_DEADBAND
+    uint16_t used;      //cm of liquid used today
+    uint16_t rate;      //Estimate of the liters used per day
+    uint8_t days;       //Number of days in the estimate, up to USAGE_AVG_DAYS-1
+                        //(the weight of the estimate against a new day)
+};
+
+void UsageInit(void);
+void UsageReset(uint8_t tankIndex);
+void UsageService(void);
+uint16_t UsageDailyLiters(uint8_t tankIndex);
+uint16_t UsageDaysLeft(uint8_t tankIndex);
+
+#endif	/* USAGE_H */
@@ -12,10 +12,12 @@
 
 #include "sm.h"
 
-uint8_t * NumToStr (uint32_t num);
 uint16_t numSet(uint8_t LCDline);
 uint8_t nameSet(uint8_t * arrName, uint8_t arrSize, uint8_t LCDline);
-void readEEPROM(struct liquidTank * tank, uint8_t tankIndex);
-void writeEEPROM(struct liquidTank tank, uint8_t tankIndex);
+uint8_t crc8(uint8_t crc, uint8_t data);
+uint32_t tankLiters(uint8_t tankIndex, uint16_t height);
+uint8_t tankFlags(uint8_t tankIndex);
+void tankChanged(uint8_t tankIndex);
+void measureTank(uint8_t tankIndex);
 
 #endif	/* UTILITY_H */
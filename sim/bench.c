@@ -0,0 +1,604 @@
+/*
+ * File:   bench.c
+ * Author: Faris Shahin
+ *
+ * Benchmark of the firmware in the simulator. Boots the firmware with 4
+ * configured tanks, then measures in simulated instruction cycles (1us each at
+ * 4MHz) and in wall time on the PC:
+ *      - reset to the first display and to the first live levels, with the
+ *        sensors answering or, with -d, not answering
+ *      - a view() refresh, with all sensors answering and with one dead
+ *      - a reading of a tank with each sensor backend (see sensor.h), and the
+ *        spread of the levels it gives
+ *      - an LCD line and an LCD clear
+ *      - formatting a number with NumFormat() against the NumToStr() it
+ *        replaced (see below)
+ *      - keypresses on the main screen and the options menu, from the press
+ *        to the first byte on the LCD and to the last one
+ *      - provisioning all the tanks over the serial port at UART_BAUD, from
+ *        the first byte of the PC to the last reply (see provision.h)
+ * Simulated cycles don't depend on the PC, so a change in them is a change of
+ * the firmware. Wall times show what the simulator costs.
+ *
+ * Usage:
+ *      simbench [-n runs] [-d] [-v]
+ *      -n      runs of each measurement (default 100)
+ *      -d      no sensor answers, only the reset times are measured
+ *      -v      print the LCD after each keypress
+ */
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "config.h"
+#include "sim.h"
+
+#define SETTLED_MS      20      //No LCD byte for this long ends a screen update
+#define DEBOUNCE_MS     400     //Time after a key for the keypad delay to pass
+
+void firmwareMain(void);
+
+static int verbose = 0;
+static uint32_t writesBefore;
+static uint8_t uartIn[512];         //Bytes of the firmware not looked at yet
+static uint32_t uartHave;
+static uint8_t provCommand;         //Request waiting for its reply, 0 once it came
+static uint8_t provStatus;
+static uint8_t provData[PROV_MAX_DATA];
+static uint8_t provLen;             //Length of provData
+static uint8_t senseTank;           //Tank read by callSense()
+
+static int64_t monotonicNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Store a tank record and the header in the EEPROM, as TankConfigSave() would
+ */
+static void storeTank(uint8_t index, const char * name, uint16_t length, uint16_t width, uint16_t height)
+{
+    uint8_t rec[REC_SIZE];
+    uint8_t padded[TANK_NAME_CHARS];
+    uint8_t crc;
+    memset(padded, ' ', TANK_NAME_CHARS);
+    memcpy(padded, name, strlen(name) < TANK_NAME_CHARS ? strlen(name) : TANK_NAME_CHARS);
+    //The firmware packs the record, the tank in RAM is loaded again at reset
+    TankConfigClear(index);
+    TankSetName(index, padded);
+    TankSetLength(index, length);
+    TankSetWidth(index, width);
+    TankSetHeight(index, height);
+    TankSetLow(index, 10);
+    TankSetCritical(index, 5);
+    TankSetHigh(index, 95);
+    TankConfigRecord(index, rec);
+    for(uint8_t i = 0; i < REC_SIZE; i++)
+        SimEEPROMWrite(EE_TANKS_ADDR + index*EE_TANK_SLOT + i, rec[i]);
+
+    crc = 0xff;
+    crc = crc8(crc, EE_MAGIC);
+    crc = crc8(crc, EE_VERSION);
+    crc = crc8(crc, TANK_COUNT);
+    SimEEPROMWrite(EE_HEADER_ADDR, EE_MAGIC);
+    SimEEPROMWrite(EE_HEADER_ADDR+1, EE_VERSION);
+    SimEEPROMWrite(EE_HEADER_ADDR+2, TANK_COUNT);
+    SimEEPROMWrite(EE_HEADER_ADDR+3, crc);
+    SimEEPROMWrite(EE_STAMP_ADDR, EE_LOG_STAMP);   //The logs are of this layout
+}
+
+static uint8_t anyText(void)
+{
+    char text[SIM_LCD_COLS+1];
+    for(uint8_t row = 1; row <= SIM_LCD_ROWS; row++)
+    {
+        SimLCDLine(row, text);
+        if(strspn(text, " ") != SIM_LCD_COLS)
+            return 1;
+    }
+    return 0;
+}
+
+//The first line shows a level that was read, not the snapshot
+static uint8_t liveText(void)
+{
+    char text[SIM_LCD_COLS+1];
+    SimLCDLine(1, text);
+    return text[SIM_LCD_COLS-1] != '?' && text[SIM_LCD_COLS-1] != ' ';
+}
+
+static uint8_t lcdStarted(void)
+{
+    return SimLCDWrites() != writesBefore;
+}
+
+static uint8_t lcdSettled(void)
+{
+    return simCycles - SimLCDLastWrite() >= SimCyclesOf(SETTLED_MS);
+}
+
+static void callView(void)
+{
+    view();
+}
+
+static void callSense(void)
+{
+    SensorStart(senseTank);
+    while(SensorPoll() == SENSOR_BUSY)
+        NOP();
+}
+
+static void callLine(void)
+{
+    LCDPrintString((uint8_t *)"0123456789ABCDEF", 1, 1);
+}
+
+static void callClear(void)
+{
+    LCDClearDisplay();
+}
+
+static void report(const char * name, uint64_t cycles, double wallNs)
+{
+    printf("%-28s %10llu %10.2f %10.1f\n", name, (unsigned long long)cycles,
+           SimMs(cycles), wallNs/1000);
+}
+
+/*
+ * Look for the reply to provCommand in what the firmware sent, between the
+ * telemetry records
+ */
+static uint8_t provReplied(void)
+{
+    uint32_t start = 0, n;
+    uint8_t crc;
+    if(provCommand == 0)
+        return 1;   //Already found, SimRunUntil() asks again
+    uartHave += SimUARTRead(&uartIn[uartHave], sizeof(uartIn) - uartHave);
+    for(; start + 4 < uartHave; start++)
+    {
+        if(uartIn[start] != PROV_REPLY || uartIn[start+3] > PROV_MAX_DATA)
+            continue;
+        n = uartIn[start+3];
+        if(start + n + 5 > uartHave)
+            break;
+        crc = 0xff;
+        for(uint32_t i = 1; i < n+4; i++)
+            crc = crc8(crc, uartIn[start+i]);
+        if(crc != uartIn[start+n+4] || uartIn[start+1] != provCommand)
+            continue;
+        provStatus = uartIn[start+2];
+        memcpy(provData, &uartIn[start+4], n);
+        provLen = n;
+        uartHave = 0;
+        provCommand = 0;
+        return 1;
+    }
+    memmove(uartIn, &uartIn[start], uartHave - start);
+    uartHave -= start;
+    return 0;
+}
+
+/*
+ * Send a provisioning request and run the firmware until its reply
+ * Returns:
+ *      The status of the reply, or -1 if there was none after 2s
+ */
+static int provRequest(uint8_t command, const uint8_t * data, uint8_t n)
+{
+    uint8_t frame[PROV_MAX_FRAME];
+    uint8_t crc = 0xff;
+    frame[0] = PROV_SYNC;
+    frame[1] = command;
+    frame[2] = n;
+    memcpy(&frame[3], data, n);
+    for(uint8_t i = 1; i < n+3; i++)
+        crc = crc8(crc, frame[i]);
+    frame[n+3] = crc;
+    provCommand = command;
+    SimUARTSend(frame, n+4);
+    if(!SimRunUntil(provReplied, SimCyclesOf(2000)))
+        return -1;
+    return provStatus;
+}
+
+//A tank record of prov_frame.h
+static void provTank(uint8_t * rec, const char * name, uint16_t length, uint16_t width, uint16_t height)
+{
+    memset(rec, 0, PROV_TANK_SIZE);
+    memset(&rec[PROV_TANK_NAME], ' ', 6);
+    memcpy(&rec[PROV_TANK_NAME], name, strlen(name));
+    rec[PROV_TANK_LENGTH] = length & 0xff;
+    rec[PROV_TANK_LENGTH+1] = length >> 8;
+    rec[PROV_TANK_WIDTH] = width & 0xff;
+    rec[PROV_TANK_WIDTH+1] = width >> 8;
+    rec[PROV_TANK_HEIGHT] = height & 0xff;
+    rec[PROV_TANK_HEIGHT+1] = height >> 8;
+    rec[PROV_TANK_LOW] = 10;
+    rec[PROV_TANK_CRITICAL] = 5;
+    rec[PROV_TANK_HIGH] = 95;
+}
+
+/*
+ * Write all the tanks over the serial port as host/tlmprov does and read them
+ * back. The last tank is changed to one longer than the keypad allows, read by
+ * a pressure transducer. A record with a sensor that doesn't exist must be
+ * refused first.
+ */
+static void benchProvision(void)
+{
+    static const char * names[4] = {"DIESEL", "WATER", "GAS", "OIL2"};
+    static const uint16_t sizes[4][3] = {{200, 100, 150}, {100, 100, 200}, {300, 120, 120}, {1200, 80, 100}};
+    uint8_t recs[TANK_COUNT][1+PROV_TANK_SIZE];
+    uint8_t setCrc = 0xff;
+    uint8_t count = TANK_COUNT;
+    uint8_t changed = 0, ok = 1;
+    uint8_t bad[1+PROV_TANK_SIZE];
+    uint64_t start;
+    int64_t wall = monotonicNs();
+    char name[64];
+
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        recs[i][0] = i;
+        if(i < 4)
+            provTank(&recs[i][1], names[i], sizes[i][0], sizes[i][1], sizes[i][2]);
+        else
+            provTank(&recs[i][1], "", 0, 0, 0);
+        if(i == 3)
+            recs[i][1+PROV_TANK_SENSOR] = PROV_SENSOR_PRESSURE;
+        for(uint8_t j = 1; j <= PROV_TANK_SIZE; j++)
+            setCrc = crc8(setCrc, recs[i][j]);
+    }
+    memcpy(bad, recs[0], sizeof(bad));
+    bad[1+PROV_TANK_SENSOR] = PROV_SENSOR_PRESSURE+1;
+    uartHave = 0;
+    SimUARTRead(uartIn, 0);
+    while(SimUARTRead(uartIn, sizeof(uartIn)))
+        ;   //Telemetry sent before
+    start = simCycles;
+    ok &= provRequest(PROV_INFO, NULL, 0) == PROV_OK && provData[0] == TANK_COUNT &&
+          provData[1] == PROV_TANK_SIZE;
+    ok &= provRequest(PROV_BEGIN, &count, 1) == PROV_OK;
+    ok &= provRequest(PROV_WRITE, bad, sizeof(bad)) == PROV_ERR_VALUE;
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+        ok &= provRequest(PROV_WRITE, recs[i], sizeof(recs[i])) == PROV_OK;
+    ok &= provRequest(PROV_COMMIT, &setCrc, 1) == PROV_OK;
+    changed = provData[0];
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+        ok &= provRequest(PROV_READ, &i, 1) == PROV_OK && memcmp(provData, recs[i], sizeof(recs[i])) == 0;
+    snprintf(name, sizeof(name), "provision %d tanks, %s", TANK_COUNT, ok ? "read back" : "FAILED");
+    report(name, simCycles - start, monotonicNs() - wall);
+    if(!ok || changed != 1 || TankLength(3) != 1200 || TankSensor(3) != SENSOR_PRESSURE)
+        fprintf(stderr, "simbench: provisioning failed (%u tanks changed)\n", changed);
+}
+
+/*
+ * Read the level log over the serial port as "tlmprov -H" does. Since the
+ * power up it holds the marker of the power up and a level of each tank.
+ */
+static void benchHistory(void)
+{
+    uint8_t from = 1, ok = 1, entries = 0, levels = 0, boot = 0;
+    uint64_t start = simCycles;
+    int64_t wall = monotonicNs();
+    char name[64];
+    do
+    {
+        ok &= provRequest(PROV_HISTORY, &from, 1) == PROV_OK;
+        from = 0;
+        for(uint8_t i = 0; ok && i < provLen; i += PROV_HIST_SIZE, entries++)
+        {
+            if(provData[i+PROV_HIST_HEADER] == (HIST_MARK<<4 | HIST_MARK_BOOT))
+                boot++;
+            else if(provData[i+PROV_HIST_HEADER]>>4 == HIST_KEY)
+                levels++;
+        }
+    } while(ok && provLen > 0);
+    ok &= boot == 1 && levels == TANK_COUNT;
+    snprintf(name, sizeof(name), "level log, %u entries%s", entries, ok ? "" : ", FAILED");
+    report(name, simCycles - start, monotonicNs() - wall);
+    if(!ok)
+        fprintf(stderr, "simbench: the level log read %u markers and %u levels\n", boot, levels);
+}
+
+/*
+ * Read a tank with the backend it's set to and report the time of a reading,
+ * how far the mean level is from the real one and how much the levels spread
+ * Parameters:
+ *      name - what is read
+ *      runs - readings to take
+ *      mm - the real level
+ */
+static void benchSensor(const char * name, int runs, double mm)
+{
+    uint64_t cycles = 0;
+    int64_t start = monotonicNs();
+    double sum = 0, squares = 0, level, mean;
+    int read = 0;
+    for(int i = 0; i < runs; i++)
+    {
+        cycles += SimCall(callSense);
+        if(SensorHealth() != STORE_OK)
+            continue;
+        level = SensorLevel();
+        sum += level;
+        squares += level*level;
+        read++;
+    }
+    report(name, cycles/runs, (double)(monotonicNs() - start)/runs);
+    mean = read ? sum/read : 0;
+    if(read)
+        printf("%-28s %+10.1f mm off, %.1f mm standard deviation, %d of %d read\n", "", mean - mm,
+               sqrt(fmax(squares/read - mean*mean, 0)), read, runs);
+    else
+        printf("%-28s no reading\n", "");
+}
+
+/*
+ * Read the same level with each sensor backend: an HC-SR04 with 3mm of
+ * jitter, then a pressure transducer with 2 LSB of noise on each conversion
+ */
+static void benchSensors(int runs)
+{
+    SimSensor jittery = {SIM_PROFILE_FIXED, 120, 0, 0, 0.3, 0, 0, 0, 0};
+    senseTank = 1;          //200cm high, 80cm full
+    SimEchoSensor(1, &jittery);
+    benchSensor("ultrasonic reading, 80cm", runs, 800);
+    TankSetSensor(1, SENSOR_PRESSURE);
+    SimPressureLevel(1, 80);
+    SimPressureNoise(2);
+    benchSensor("pressure reading, 80cm", runs, 800);
+    TankSetSensor(1, SENSOR_ULTRASONIC);
+    SimPressureLevel(1, SIM_NO_TRANSDUCER);
+    SimEchoDistance(1, 120);
+}
+
+/*
+ * NumToStr() of the first version, kept to compare NumFormat() with. Its
+ * loop counter is an int here, the uint8_t of the original never ended by its
+ * own condition and wrote before the array for 5 digit numbers.
+ */
+static uint32_t divisions;      //Calls to the software divide and modulo of XC8
+
+/*
+ * Estimated PIC cycles of one 32-bit software divide or modulo call of XC8
+ * and of one compare/subtract step of NumFormat(). They are estimates, not
+ * measured: the simulator doesn't run the PIC instructions (see sim.h).
+ */
+#define DIVIDE_CYCLES_EST   300
+#define STEP_CYCLES_EST     15
+
+static uint8_t * oldNumToStr(uint32_t num)
+{
+    static uint8_t str[6];
+    int count = 5;
+    memset(str, 0, sizeof(str));
+    for(; count > 0; count--)
+    {
+        str[count-1] = (num % 10) + 0x30;
+        num /= 10;
+        divisions += 2;
+        if(num == 0)
+            break;
+    }
+    for(; count > 1; count--)
+        for(uint8_t i = 0; i <= 3; i++)
+            str[i] = str[i+1];
+    return str;
+}
+
+/*
+ * The compare/subtract steps NumFormat() takes for a number of a 5 character
+ * field: one more compare than the digit for each of the 4 digits before the
+ * last
+ */
+static uint32_t formatSteps(uint32_t num)
+{
+    static const uint32_t pow10[4] = {10000, 1000, 100, 10};
+    uint32_t steps = 0;
+    for(uint8_t i = 0; i < 4; i++)
+    {
+        steps += num/pow10[i] + 1;
+        num %= pow10[i];
+    }
+    return steps;
+}
+
+/*
+ * Format every number of a 5 character field (0 to 99999, the liters of the
+ * main screen) with both functions. The arithmetic runs on the PC and isn't
+ * counted by the simulator (see sim.h), so the work of each is given as the
+ * steps that cost cycles on the PIC: calls to the 32-bit software divide and
+ * modulo for NumToStr(), compares and subtractions for NumFormat(). The wall
+ * times compare the two on the PC.
+ */
+static void benchNumFormat(int runs)
+{
+    uint8_t field[5];
+    uint64_t steps = 0, steps16 = 0;
+    uint32_t numbers = 100000;
+    volatile uint8_t sink = 0;
+    int64_t start;
+    double oldNs, newNs;
+
+    divisions = 0;
+    start = monotonicNs();
+    for(int r = 0; r < runs/10 + 1; r++)
+        for(uint32_t n = 0; n < numbers; n++)
+            sink += oldNumToStr(n)[0];
+    oldNs = (double)(monotonicNs() - start)/((runs/10 + 1)*numbers);
+    start = monotonicNs();
+    for(int r = 0; r < runs/10 + 1; r++)
+        for(uint32_t n = 0; n < numbers; n++)
+        {
+            NumFormat(n, field, 5);
+            sink += field[0];
+        }
+    newNs = (double)(monotonicNs() - start)/((runs/10 + 1)*numbers);
+    for(uint32_t n = 0; n < numbers; n++)
+    {
+        steps += formatSteps(n);
+        if(n < 1000)
+            steps16 += formatSteps(n);
+    }
+    printf("%-28s %10.2f divide and modulo calls a number (about %.0f cycles, estimate), %.1f ns on the PC\n",
+           "NumToStr(), 0 to 99999", (double)divisions/((runs/10 + 1)*numbers),
+           (double)divisions/((runs/10 + 1)*numbers)*DIVIDE_CYCLES_EST, oldNs);
+    printf("%-28s %10.2f compare/subtract steps a number (about %.0f cycles, estimate), %.1f ns on the PC\n",
+           "NumFormat(), 0 to 99999", (double)steps/numbers,
+           (double)steps/numbers*STEP_CYCLES_EST, newNs);
+    printf("%-28s %10.2f compare/subtract steps a number (about %.0f cycles, estimate)\n",
+           "NumFormat(), 0 to 999", (double)steps16/1000, (double)steps16/1000*STEP_CYCLES_EST);
+}
+
+/*
+ * Time a firmware function called from the main screen
+ */
+static void benchCall(const char * name, void (*fn)(void), int runs)
+{
+    uint64_t cycles = 0;
+    int64_t start = monotonicNs();
+    for(int i = 0; i < runs; i++)
+        cycles = SimCall(fn);
+    report(name, cycles, (double)(monotonicNs() - start)/runs);
+}
+
+/*
+ * Press a key, let the screen update, release it and wait out the keypad delay
+ */
+static void pressKey(char key)
+{
+    SimKeyPress(key);
+    SimRunFor(SimCyclesOf(SETTLED_MS));
+    SimRunUntil(lcdSettled, SimCyclesOf(10000));
+    SimKeyRelease();
+    SimRunFor(SimCyclesOf(DEBOUNCE_MS));
+}
+
+/*
+ * Press a key in the state the firmware is in and time the screen update
+ */
+static void benchKey(char key, const char * what, int runs)
+{
+    char name[64];
+    uint64_t first = 0, done = 0;
+    int64_t wall = 0, start;
+    uint64_t pressed;
+    for(int i = 0; i < runs; i++)
+    {
+        //Keys that go to another screen are only pressed once
+        if(i > 0 && (key == '*' || key == '3'))
+            break;
+        writesBefore = SimLCDWrites();
+        start = monotonicNs();
+        SimKeyPress(key);
+        pressed = simCycles;
+        SimRunUntil(lcdStarted, SimCyclesOf(2000));
+        first = simCycles - pressed;
+        SimRunUntil(lcdSettled, SimCyclesOf(10000));
+        done = SimLCDLastWrite() - pressed;
+        wall += monotonicNs() - start;
+        SimKeyRelease();
+        SimRunFor(SimCyclesOf(DEBOUNCE_MS));
+        if(key == '0' && i < runs-1)    //Back to the view it was in
+            pressKey(key);
+    }
+    if(verbose)
+        SimLCDPrint();
+    snprintf(name, sizeof(name), "key %c %s, first byte", key, what);
+    report(name, first, 0);
+    snprintf(name, sizeof(name), "key %c %s, done", key, what);
+    report(name, done, (double)wall/runs);
+}
+
+int main(int argc, char ** argv)
+{
+    static const uint16_t distances[4] = {40, 120, 60, 90};    //cm, of each tank
+    int runs = 100;
+    int opt, dead = 0;
+    uint64_t cycles;
+    int64_t start;
+
+    while((opt = getopt(argc, argv, "n:dv")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n':
+                runs = atoi(optarg);
+                break;
+            case 'd':
+                dead = 1;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: simbench [-n runs] [-d] [-v]\n");
+                return 1;
+        }
+    }
+    if(runs < 1)
+        runs = 1;
+
+    storeTank(0, "DIESEL", 200, 100, 150);
+    storeTank(1, "WATER", 100, 100, 200);
+    storeTank(2, "GAS", 300, 120, 120);
+    storeTank(3, "OIL", 80, 80, 100);
+    SimReset();
+    for(uint8_t i = 0; i < 4; i++)
+        SimEchoDistance(i, dead ? SIM_NO_ECHO : distances[i]);
+
+    printf("simbench: %d tanks, %ld Hz, cycles are instruction cycles\n", TANK_COUNT, (long)_XTAL_FREQ);
+    printf("%-28s %10s %10s %10s\n", "", "cycles", "sim ms", "wall us");
+
+    start = monotonicNs();
+    SimStart(firmwareMain);
+    if(!SimRunUntil(anyText, SimCyclesOf(5000)))
+        fprintf(stderr, "simbench: nothing shown after 5s\n");
+    cycles = simCycles;
+    report("reset to first display", cycles, monotonicNs() - start);
+    SimRunUntil(liveText, SimCyclesOf(10000));
+    SimRunUntil(lcdSettled, SimCyclesOf(10000));
+    report(dead ? "reset to live levels, no echo" : "reset to live levels", SimLCDLastWrite(),
+           monotonicNs() - start);
+    if(verbose)
+        SimLCDPrint();
+    if(dead)
+        return SimLCDViolations() != 0;
+
+    benchCall("view() refresh", callView, runs);
+    SimEchoDistance(3, SIM_NO_ECHO);
+    benchCall("view() refresh, 1 sensor dead", callView, runs);
+    SimEchoDistance(3, 90);
+    benchCall("LCD line (16 characters)", callLine, runs*10);
+    benchCall("LCD clear", callClear, runs*10);
+    benchSensors(runs);
+    benchNumFormat(runs);
+    SimCall(callView);
+
+    benchKey('8', "next page", runs/10 + 1);
+    benchKey('2', "previous page", runs/10 + 1);
+    benchKey('0', "compact view", runs/10 + 1);
+    benchKey('*', "options", 1);
+    benchKey('3', "back to view", 1);
+    benchKey('#', "acknowledge", runs/10 + 1);
+    benchProvision();
+    benchHistory();
+    if(verbose)
+    {
+        SimRunUntil(lcdSettled, SimCyclesOf(10000));
+        SimLCDPrint();
+    }
+
+    printf("LCD bytes %u (too early %u), pings %u, EEPROM writes %u, UART bytes %u\n",
+           SimLCDWrites(), SimLCDViolations(), SimEchoPings(), SimEEPROMWrites(), SimUARTBytes());
+    return SimLCDViolations() != 0;
+}
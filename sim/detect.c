@@ -0,0 +1,607 @@
+/*
+ * File:   detect.c
+ * Author: Faris Shahin
+ *
+ * Harness of the detectors that work on the filtered levels. The code of the
+ * firmware is given simulated readings of a tank through the measurement store
+ * (see store.h), with its clock moved reading by reading, and the report
+ * gives the figures of the header of each detector:
+ *      - leak.h: false alarms a year with no use, the daily use and twice
+ *        that, and the time to detect leaks of a few rates
+ *      - refill.h: refills logged for a tank not in use, and for refills of
+ *        a few speeds how many were logged and how far the liters and the
+ *        duration are off
+ *      - alarm.h: the time from the level of a tank crossing its low
+ *        threshold to the alarm output turning on, with the whole firmware
+ *        running: all sensors answering, the other sensors hearing no echo
+ *        (a 38ms pulse) and their echo line stuck high (the 400ms timeout),
+ *        and from the sensor of the tank dying to the fault alarm
+ * Readings are whole cm as measureTank() gives them to the filter: the real
+ * level plus a normal noise, and one reading in SPIKE_CHANCE off by SPIKE_CM.
+ * They go through the level filter of the firmware (filter.h) first.
+ *
+ * Usage:
+ *      simdetect [-y years] [-n trials] [-S seed] [-L drop,window]
+ *      -y      years of readings of each false alarm scenario (default 1),
+ *              days of the tank not in use for refill.h
+ *      -n      trials of each leak rate and refill speed (default 100), a
+ *              fifth of that for each alarm case since they run the whole
+ *              firmware
+ *      -S      seed of the readings (default 1)
+ *      -L      settings of the leak detector, drop in cm and window in
+ *              minutes (default LEAK_DROP and LEAK_WINDOW of leak.h)
+ */
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "config.h"
+#include "sim.h"
+
+#define DAY_S           86400.0
+#define SPIKE_CHANCE    500     //One reading in this many is a spike
+#define SPIKE_CM        30
+
+#define LEAK_READ_S     4       //Between the readings of a tank (view() every 4.1 s)
+#define LEAK_TANK_CM    200     //Height of the tank
+#define LEAK_REFILL_CM  40      //The tank is filled back to LEAK_FULL_CM under this level
+#define LEAK_FULL_CM    180
+#define USE_CM_HOUR     3.0     //Most use a day in cm/hour, the rate of a day is 0 to this
+#define USE_FROM        7       //Use starts between this hour and 2 hours later
+#define USE_TO          17      //and ends between this hour and 2 hours later
+#define LEAK_LEARN_DAYS 7       //Days of use before the alarms are counted or the first leak
+#define LEAK_LIMIT_S    (2*DAY_S)   //A leak not detected by then is counted as missed
+#define LEAK_REST_S     DAY_S   //Daily use between two leaks
+
+#define REFILL_READ_S   2       //Between the readings of a tank
+#define REFILL_FROM_CM  30      //Level before a refill
+#define REFILL_CM       100     //Rise of a refill
+#define REFILL_QUIET_S  1800    //Level still before and after a refill
+#define TANK_LENGTH     200     //Tank of the refills, 20 liters/cm
+#define TANK_WIDTH      100
+#define TANK_HEIGHT     150
+
+#define ALARM_FAR_CM    75      //Distance of the sensor of tank 0 with its level at 50%
+#define ALARM_NEAR_CM   138     //and with its level at 8%, under the low threshold of 10%
+#define ALARM_LIMIT_MS  60000   //Longest wait for the output
+#define ALARM_ANSWER    0       //The other sensors of alarmLatency() answer
+#define ALARM_NO_ECHO   1       //hear no echo
+#define ALARM_STUCK     2       //have their echo line stuck high
+
+void firmwareMain(void);
+
+static uint64_t rng = 1;
+
+//The tank of the scenario, tank 0 of the firmware
+static double level;            //Real level in cm
+static double now;              //Seconds since the clock of the firmware started
+static double noise;            //Standard deviation of the readings in cm
+static double useScale;         //Times the daily use of USE_CM_HOUR
+static double leakRate;         //cm/hour
+static double useRate, useFrom, useTo;  //Use of the current day
+static long day = -1;
+static uint8_t leakDrop = LEAK_DROP;            //Settings of the leak detector
+static uint16_t leakWindow = LEAK_WINDOW;
+
+//xorshift64*, uniform in [0, 1)
+static double uniform(void)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (double)((rng * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+}
+
+//Standard normal, Box-Muller
+static double gaussian(void)
+{
+    double u = uniform();
+    if(u < 1e-300)
+        u = 1e-300;
+    return sqrt(-2*log(u)) * cos(2*M_PI*uniform());
+}
+
+/*
+ * Move the clock of the firmware, as TMR2 would
+ */
+static void advance(uint32_t s)
+{
+    for(uint32_t i = 0; i < s*CLOCK_TICKS_PER_SEC; i++)
+        ClockTick();
+    now += s;
+}
+
+/*
+ * Publish a reading of the real level, as measureTank() would
+ */
+static void publish(uint8_t t, double cm)
+{
+    struct measurement m = {0};
+    double raw = cm + noise*gaussian();
+    if(uniform()*SPIKE_CHANCE < 1)
+        raw += uniform() < 0.5 ? SPIKE_CM : -SPIKE_CM;
+    m.health = STORE_OK;
+    m.unfiltered = raw < 0 ? 0 : (uint16_t)raw;
+    m.level = FilterLevel(t, m.unfiltered);
+    StorePublish(t, &m);
+}
+
+/*
+ * Start the firmware modules the detectors need, with the EEPROM empty and
+ * the clock at 0
+ */
+static void start(void)
+{
+    SimReset();
+    INTCON = 0xC0;      //As main() sets it, the EEPROM queue runs from EEIF
+    EEPROMQueueInit();
+    StoreInit();
+    HistoryInit();
+    FilterReset(0);
+    TankConfigClear(0);
+    TankSetLength(0, TANK_LENGTH);
+    TankSetWidth(0, TANK_WIDTH);
+    TankSetHeight(0, TANK_HEIGHT);
+    now = 0;
+    day = -1;
+}
+
+/*
+ * One reading of the leak scenario: the daily use, the leak and the refills
+ * move the level, then LeakService() gets the reading
+ */
+static void leakReading(void)
+{
+    double hour = fmod(now, DAY_S)/3600;
+    if((long)(now/DAY_S) != day)
+    {
+        day = (long)(now/DAY_S);
+        useRate = USE_CM_HOUR*useScale*uniform();
+        useFrom = USE_FROM + 2*uniform();
+        useTo = USE_TO + 2*uniform();
+    }
+    if(hour >= useFrom && hour < useTo)
+        level -= useRate*LEAK_READ_S/3600;
+    level -= leakRate*LEAK_READ_S/3600;
+    if(level < LEAK_REFILL_CM)
+        level = LEAK_FULL_CM;
+    advance(LEAK_READ_S);
+    publish(0, level);
+    LeakService();
+}
+
+/*
+ * Start the leak detector with the settings of the run
+ */
+static void leakStart(void)
+{
+    LeakInit();
+    LeakSetup(leakDrop, leakWindow);
+}
+
+/*
+ * Count the false alarms of the leak detector
+ * Parameters:
+ *      years - years of readings
+ * Returns:
+ *      The alarms a year after the first LEAK_LEARN_DAYS, which are for the
+ *      baselines to be learnt. Each alarm is acknowledged at once.
+ */
+static double leakFalseAlarms(double years)
+{
+    long alarms = 0;
+    start();
+    leakStart();
+    level = LEAK_FULL_CM;
+    leakRate = 0;
+    while(now < (LEAK_LEARN_DAYS + years*365)*DAY_S)
+    {
+        leakReading();
+        if(LeakAlarm(0))
+        {
+            if(now >= LEAK_LEARN_DAYS*DAY_S)
+                alarms++;
+            LeakAcknowledge();
+        }
+    }
+    return alarms/years;
+}
+
+/*
+ * Time leaks of one rate from their start to the alarm, with the daily use
+ * going on. Each leak starts at a random time of the day.
+ * Parameters:
+ *      rate - the leak in cm/hour
+ *      trials - the number of leaks
+ */
+static void leakLatency(double rate, int trials)
+{
+    double sum = 0, most = 0, began, took;
+    int found = 0;
+    char name[32];
+    start();
+    leakStart();
+    level = LEAK_FULL_CM;
+    useScale = 1;
+    leakRate = 0;
+    while(now < LEAK_LEARN_DAYS*DAY_S)
+        leakReading();
+    for(int i = 0; i < trials; i++)
+    {
+        for(double rest = now + uniform()*DAY_S; now < rest; )
+            leakReading();
+        leakRate = rate;
+        began = now;
+        while(!LeakAlarm(0) && now - began < LEAK_LIMIT_S)
+            leakReading();
+        leakRate = 0;
+        if(LeakAlarm(0))
+        {
+            took = (now - began)/60;
+            sum += took;
+            if(took > most)
+                most = took;
+            found++;
+        }
+        LeakAcknowledge();
+        for(double rest = now + LEAK_REST_S; now < rest; )
+            leakReading();
+    }
+    snprintf(name, sizeof(name), "%.0f cm/hour", rate);
+    printf("  %-12s %5.1f cm %10.0f %10.0f %10d of %d\n", name, noise,
+           found ? sum/found : 0, most, trials - found, trials);
+}
+
+/*
+ * Empty the refill log and start the refill detector and the filter again,
+ * so the level of the last trial is forgotten
+ */
+static void refillClear(void)
+{
+    EEPROMQueueFlush();
+    for(uint8_t i = 0; i < EE_REFILL_COUNT*EE_REFILL_SLOT; i++)
+        SimEEPROMWrite(EE_REFILL_ADDR + i, 0xff);
+    RefillInit();
+    FilterReset(0);
+}
+
+/*
+ * One reading of the refill scenario
+ */
+static void refillReading(void)
+{
+    advance(REFILL_READ_S);
+    publish(0, level);
+    RefillService();
+}
+
+/*
+ * Returns:
+ *      The number of refills in the log, up to EE_REFILL_COUNT
+ */
+static uint8_t refillsLogged(void)
+{
+    struct refillEvent event;
+    uint8_t n = 0;
+    while(n < EE_REFILL_COUNT && RefillRead(n, &event))
+        n++;
+    return n;
+}
+
+/*
+ * Count the refills logged for a tank whose level doesn't move
+ * Parameters:
+ *      days - days of readings
+ */
+static void refillQuiet(double days)
+{
+    start();
+    refillClear();
+    level = REFILL_FROM_CM + 0.5;
+    while(now < days*DAY_S)
+        refillReading();
+    printf("  %-12s %5.1f cm %10u in %.0f days\n", "not in use", noise, refillsLogged(), days);
+}
+
+/*
+ * Refill the tank a number of times at one speed and compare the log with
+ * what was delivered
+ * Parameters:
+ *      speed - the rise of the level in cm/min
+ *      trials - the number of refills
+ */
+static void refillSpeed(double speed, int trials)
+{
+    struct refillEvent event;
+    double liters = REFILL_CM * TANK_LENGTH*TANK_WIDTH/1000.0;
+    double minutes = REFILL_CM/speed;
+    double litersOff = 0, litersMost = 0, minutesOff = 0, minutesMost = 0, off;
+    int once = 0, more = 0, none = 0;
+    char name[32];
+    start();
+    for(int i = 0; i < trials; i++)
+    {
+        refillClear();
+        level = REFILL_FROM_CM + uniform();
+        for(double until = now + REFILL_QUIET_S; now < until; )
+            refillReading();
+        for(double to = level + REFILL_CM; level < to; )
+        {
+            level = fmin(level + speed*REFILL_READ_S/60, to);
+            refillReading();
+        }
+        for(double until = now + REFILL_QUIET_S; now < until; )
+            refillReading();
+        switch(refillsLogged())
+        {
+            case 0:
+                none++;
+                continue;
+            case 1:
+                once++;
+                break;
+            default:
+                more++;
+                continue;
+        }
+        RefillRead(0, &event);
+        off = fabs(event.liters - liters)/liters*100;
+        litersOff += off;
+        litersMost = fmax(litersMost, off);
+        off = fabs(event.duration/60.0 - minutes);
+        minutesOff += off;
+        minutesMost = fmax(minutesMost, off);
+    }
+    snprintf(name, sizeof(name), "%g cm/min", speed);
+    printf("  %-12s %5.1f cm %6d %6d %6d %8.1f %6.1f %8.1f %6.1f\n", name, noise, once, more, none,
+           once ? litersOff/once : 0, litersMost, once ? minutesOff/once : 0, minutesMost);
+}
+
+/*
+ * Store a tank record and the header in the EEPROM, as TankConfigSave()
+ * would, with a low threshold of 10%
+ */
+static void storeTank(uint8_t index, const char * name, uint16_t length, uint16_t width, uint16_t height)
+{
+    uint8_t rec[REC_SIZE];
+    uint8_t padded[TANK_NAME_CHARS];
+    uint8_t crc;
+    memset(padded, ' ', TANK_NAME_CHARS);
+    memcpy(padded, name, strlen(name) < TANK_NAME_CHARS ? strlen(name) : TANK_NAME_CHARS);
+    TankConfigClear(index);
+    TankSetName(index, padded);
+    TankSetLength(index, length);
+    TankSetWidth(index, width);
+    TankSetHeight(index, height);
+    TankSetLow(index, 10);
+    TankSetCritical(index, 5);
+    TankSetHigh(index, 95);
+    TankConfigRecord(index, rec);
+    for(uint8_t i = 0; i < REC_SIZE; i++)
+        SimEEPROMWrite(EE_TANKS_ADDR + index*EE_TANK_SLOT + i, rec[i]);
+
+    crc = 0xff;
+    crc = crc8(crc, EE_MAGIC);
+    crc = crc8(crc, EE_VERSION);
+    crc = crc8(crc, TANK_COUNT);
+    SimEEPROMWrite(EE_HEADER_ADDR, EE_MAGIC);
+    SimEEPROMWrite(EE_HEADER_ADDR+1, EE_VERSION);
+    SimEEPROMWrite(EE_HEADER_ADDR+2, TANK_COUNT);
+    SimEEPROMWrite(EE_HEADER_ADDR+3, crc);
+    SimEEPROMWrite(EE_STAMP_ADDR, EE_LOG_STAMP);   //The logs are of this layout
+}
+
+/*
+ * The other sensors failing keep the output on with their fault alarms, so
+ * the alarms of tank 0 are watched: AlarmService() sets the output with them.
+ */
+static uint8_t alarmOn(void)
+{
+    return (AlarmState(0) & ALARM_LOW) != 0;
+}
+
+static uint8_t alarmOff(void)
+{
+    return !alarmOn();
+}
+
+static uint8_t faultOn(void)
+{
+    return (AlarmState(0) & ALARM_FAULT) && ((ALARM_PORT >> ALARM_PIN) & 1);
+}
+
+static uint8_t faultOff(void)
+{
+    return !(AlarmState(0) & ALARM_FAULT);
+}
+
+/*
+ * Boot the firmware with 4 tanks, once: UltraSonicInit() and the other
+ * initializations of the firmware are only meant to run once
+ */
+static void alarmBoot(void)
+{
+    SimReset();
+    storeTank(0, "DIESEL", 200, 100, 150);
+    storeTank(1, "WATER", 100, 100, 200);
+    storeTank(2, "GAS", 300, 120, 120);
+    storeTank(3, "OIL", 80, 80, 100);
+    SimReset();
+    SimEchoDistance(0, ALARM_FAR_CM);
+    SimStart(firmwareMain);
+}
+
+/*
+ * Time the low alarm of tank 0 of the running firmware. The level drops under
+ * the threshold at once, at a random time of the scan.
+ * Parameters:
+ *      others - ALARM_... for the sensors of the other tanks
+ *      trials - the number of times the level drops
+ */
+static void alarmLatency(uint8_t others, int trials)
+{
+    static const char * names[] = {"all sensors answer", "3 sensors with no echo", "3 sensors stuck high"};
+    SimSensor stuck = {SIM_PROFILE_FIXED, 50, 0, 0, 0, 0, 0, 1, 0};
+    double sum = 0, most = 0, took;
+    uint64_t crossed;
+    int missed = 0;
+    for(uint8_t t = 1; t < TANK_COUNT; t++)
+    {
+        if(others == ALARM_STUCK)
+            SimEchoSensor(t, &stuck);
+        else
+            SimEchoDistance(t, others == ALARM_NO_ECHO ? SIM_NO_ECHO : 50);
+    }
+    SimRunFor(SimCyclesOf(20000));
+    for(int i = 0; i < trials; i++)
+    {
+        SimRunFor(SimCyclesOf(5000*uniform()));
+        SimEchoDistance(0, ALARM_NEAR_CM);
+        crossed = simCycles;
+        if(!SimRunUntil(alarmOn, SimCyclesOf(ALARM_LIMIT_MS)))
+            missed++;
+        else
+        {
+            took = SimMs(simCycles - crossed)/1000;
+            sum += took;
+            if(took > most)
+                most = took;
+        }
+        SimEchoDistance(0, ALARM_FAR_CM);
+        SimRunUntil(alarmOff, SimCyclesOf(ALARM_LIMIT_MS));
+    }
+    printf("  %-26s %10.1f %10.1f %8d of %d\n", names[others],
+           trials > missed ? sum/(trials - missed) : 0, most, missed, trials);
+}
+
+/*
+ * Time the fault alarm of tank 0 of the running firmware, the other sensors
+ * answering. The sensor stops answering at a random time of the scan.
+ * Parameters:
+ *      trials - the number of times the sensor dies
+ */
+static void faultLatency(int trials)
+{
+    double sum = 0, most = 0, took;
+    uint64_t died;
+    int missed = 0;
+    for(uint8_t t = 1; t < TANK_COUNT; t++)
+        SimEchoDistance(t, 50);
+    SimEchoDistance(0, ALARM_FAR_CM);
+    SimRunUntil(faultOff, SimCyclesOf(ALARM_LIMIT_MS));
+    SimRunFor(SimCyclesOf(20000));
+    for(int i = 0; i < trials; i++)
+    {
+        SimRunFor(SimCyclesOf(5000*uniform()));
+        SimEchoDistance(0, SIM_NO_ECHO);
+        died = simCycles;
+        if(!SimRunUntil(faultOn, SimCyclesOf(ALARM_LIMIT_MS)))
+            missed++;
+        else
+        {
+            took = SimMs(simCycles - died)/1000;
+            sum += took;
+            if(took > most)
+                most = took;
+        }
+        SimEchoDistance(0, ALARM_FAR_CM);
+        SimRunUntil(faultOff, SimCyclesOf(ALARM_LIMIT_MS));
+    }
+    printf("  %-26s %10.1f %10.1f %8d of %d\n", "sensor of the tank dies",
+           trials > missed ? sum/(trials - missed) : 0, most, missed, trials);
+}
+
+int main(int argc, char ** argv)
+{
+    static const double noises[] = {0.3, 1.0};
+    static const double uses[] = {0, 1, 2};
+    static const double leaks[] = {3, 6, 15, 60, 120};
+    static const double refillNoises[] = {0.5, 1.0, 1.5};
+    static const double speeds[] = {0.5, 1, 5, 20, 60};
+    double years = 1;
+    int trials = 100;
+    int opt, drop, window;
+
+    while((opt = getopt(argc, argv, "y:n:S:L:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'y':
+                years = atof(optarg);
+                break;
+            case 'n':
+                trials = atoi(optarg);
+                break;
+            case 'S':
+                rng = strtoull(optarg, NULL, 0);
+                break;
+            case 'L':
+                if(sscanf(optarg, "%d,%d", &drop, &window) != 2 || drop < 0 || drop > 255 ||
+                   window < 0 || !LeakValid(drop, window))
+                {
+                    fprintf(stderr, "simdetect: the drop must be 1 to %d cm and the window a multiple of %d up to %d minutes\n",
+                            LEAK_DROP_MAX, LEAK_WINDOW_UNIT, LEAK_WINDOW_MAX);
+                    return 1;
+                }
+                leakDrop = drop;
+                leakWindow = window;
+                break;
+            default:
+                fprintf(stderr, "usage: simdetect [-y years] [-n trials] [-S seed] [-L drop,window]\n");
+                return 1;
+        }
+    }
+    if(years <= 0)
+        years = 1;
+    if(trials < 1)
+        trials = 1;
+    if(rng == 0)
+        rng = 1;
+
+    printf("leak.h: alarm for %u cm in %u min, a reading every %d s, 1 in %d off by %d cm, use 0 to %.0f cm/hour from %d-%d h to %d-%d h\n",
+           leakDrop, leakWindow, LEAK_READ_S, SPIKE_CHANCE, SPIKE_CM, USE_CM_HOUR, USE_FROM, USE_FROM+2, USE_TO, USE_TO+2);
+    printf("  %-12s %8s %20s\n", "use", "noise", "false alarms a year");
+    for(uint8_t u = 0; u < sizeof(uses)/sizeof(*uses); u++)
+        for(uint8_t n = 0; n < sizeof(noises)/sizeof(*noises); n++)
+        {
+            noise = noises[n];
+            useScale = uses[u];
+            printf("  %-12s %5.1f cm %20.1f\n", u == 0 ? "none" : u == 1 ? "daily" : "twice daily",
+                   noise, leakFalseAlarms(years));
+        }
+    printf("  %-12s %8s %10s %10s %16s\n", "leak", "noise", "mean min", "most min", "missed in 2 days");
+    for(uint8_t l = 0; l < sizeof(leaks)/sizeof(*leaks); l++)
+        for(uint8_t n = 0; n < sizeof(noises)/sizeof(*noises); n++)
+        {
+            noise = noises[n];
+            leakLatency(leaks[l], trials);
+        }
+
+    printf("refill.h: a reading every %d s, 1 in %d off by %d cm, refills of %d cm\n",
+           REFILL_READ_S, SPIKE_CHANCE, SPIKE_CM, REFILL_CM);
+    printf("  %-12s %8s %6s %6s %6s %8s %6s %8s %6s\n", "refill", "noise", "once", "split", "none",
+           "liters%", "most", "minutes", "most");
+    for(uint8_t n = 0; n < sizeof(refillNoises)/sizeof(*refillNoises); n++)
+    {
+        noise = refillNoises[n];
+        refillQuiet(years);
+    }
+    for(uint8_t v = 0; v < sizeof(speeds)/sizeof(*speeds); v++)
+        for(uint8_t n = 0; n < sizeof(refillNoises)/sizeof(*refillNoises); n++)
+        {
+            noise = refillNoises[n];
+            refillSpeed(speeds[v], trials);
+        }
+
+    printf("alarm.h: %d tanks, level of tank 0 from 50%% to 8%% at once, low threshold 10%%\n", TANK_COUNT);
+    printf("  %-26s %10s %10s %14s\n", "", "mean s", "most s", "no alarm in 60 s");
+    alarmBoot();
+    alarmLatency(ALARM_ANSWER, trials/5 + 1);
+    alarmLatency(ALARM_NO_ECHO, trials/5 + 1);
+    alarmLatency(ALARM_STUCK, trials/5 + 1);
+    faultLatency(trials/5 + 1);
+    return 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * File:   hcsr04.c
+ * Author: Faris Shahin
+ *
+ * Model of the HC-SR04 sensors behind the MUX, on the pins set in
+ * ultrasonic_hcsr04.h. The MUX address is read when the trigger pulse ends.
+ * The sensor then sends its burst and raises the echo line for the time the
+ * sound takes to go to the liquid and back. A sensor with no echo keeps the
+ * line high for 38ms like the real module.
+ *
+ * Each channel has a SimSensor: how its distance moves in time and the faults
+ * seen on real sites. The same model gives the pings of SimEchoPing(), which
+ * the replay harness uses without running the firmware.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "config.h"
+#include "sim.h"
+
+#define BURST_CYCLES    (460L*(_XTAL_FREQ/4000000))     //Trigger end to echo start
+#define NO_ECHO_CYCLES  (38000L*(_XTAL_FREQ/4000000))   //Echo of a sensor that heard nothing
+#define STUCK_CYCLES    (1000000L*(_XTAL_FREQ/4000000)) //Echo of a stuck sensor, longer than any timeout
+#define CM_CYCLES       (58.3*(_XTAL_FREQ/4000000))     //Echo time of 1cm (343m/s)
+#define MIN_CM          2.0     //Range of the module
+#define MAX_CM          400.0
+#define PI              3.14159265358979
+
+static const uint8_t muxPins[3] = {MUX_A0, MUX_A1, MUX_A2};
+
+static SimSensor sensors[8];   //Sensor of each MUX channel
+static uint16_t stuckLeft[8];  //Pings a stuck sensor stays stuck
+static uint64_t randomState = 1;    //State of the random generator
+static uint8_t lastTrig;
+static uint64_t echoStart[8];  //Echo of the last ping of each sensor, from start to end
+static uint64_t echoEnd[8];
+static uint32_t pings;
+
+void SimEchoReset(void)
+{
+    memset(sensors, 0, sizeof(sensors));
+    memset(stuckLeft, 0, sizeof(stuckLeft));
+    randomState = 1;
+    lastTrig = 0;
+    memset(echoStart, 0, sizeof(echoStart));
+    memset(echoEnd, 0, sizeof(echoEnd));
+    pings = 0;
+}
+
+/*
+ * Start the random faults and the jitter again from a seed, so runs with the
+ * same seed give the same pings
+ */
+void SimEchoSeed(uint64_t seed)
+{
+    randomState = seed ? seed : 1;
+}
+
+/*
+ * Set the distance a sensor measures, with no faults
+ * Parameters:
+ *      channel - the MUX channel (tank index)
+ *      cm - the distance to the liquid, SIM_NO_ECHO for a sensor that doesn't
+ *           hear an echo
+ */
+void SimEchoDistance(uint8_t channel, uint16_t cm)
+{
+    memset(&sensors[channel], 0, sizeof(SimSensor));
+    sensors[channel].distance = cm;
+    if(cm == SIM_NO_ECHO)
+        sensors[channel].dropout = 1;
+}
+
+/*
+ * Set the distance profile and the faults of a sensor
+ * Parameters:
+ *      channel - the MUX channel (tank index)
+ *      sensor - see SimSensor in sim.h
+ */
+void SimEchoSensor(uint8_t channel, const SimSensor * sensor)
+{
+    sensors[channel] = *sensor;
+    stuckLeft[channel] = 0;
+}
+
+//xorshift64*, uniform in [0, 1)
+static double uniform(void)
+{
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return ((randomState * 0x2545F4914F6CDD1DULL) >> 11) * (1.0/9007199254740992.0);
+}
+
+//Standard normal, Box-Muller
+static double gaussian(void)
+{
+    double u = uniform();
+    if(u < 1e-300)
+        u = 1e-300;
+    return sqrt(-2*log(u)) * cos(2*PI*uniform());
+}
+
+/*
+ * Get the real distance of a sensor now
+ * Parameters:
+ *      channel - the MUX channel (tank index)
+ * Returns:
+ *      The distance to the liquid in cm, without the faults and the jitter
+ */
+double SimEchoTrue(uint8_t channel)
+{
+    const SimSensor * s = &sensors[channel];
+    double t = simCycles / (_XTAL_FREQ/4.0);
+    double phase = s->period > 0 ? fmod(t, s->period)/s->period : 0;
+    double cm = s->distance;
+    switch(s->profile)
+    {
+        case SIM_PROFILE_DRAIN:     //Level goes down, then the tank is filled at once
+            cm += s->amplitude*phase;
+            break;
+        case SIM_PROFILE_REFILL:    //Level goes up, then the tank is emptied at once
+            cm += s->amplitude*(1-phase);
+            break;
+        case SIM_PROFILE_SLOSH:
+            cm += s->amplitude*sin(2*PI*phase);
+            break;
+    }
+    return cm;
+}
+
+/*
+ * Ping a sensor now
+ * Parameters:
+ *      channel - the MUX channel (tank index)
+ * Returns:
+ *      The length of the echo pulse in instruction cycles
+ */
+uint32_t SimEchoPing(uint8_t channel)
+{
+    const SimSensor * s = &sensors[channel];
+    double cm;
+
+    pings++;
+    if(stuckLeft[channel] || (s->stuck > 0 && uniform() < s->stuck))
+    {
+        stuckLeft[channel] = stuckLeft[channel] ? stuckLeft[channel]-1 : SIM_STUCK_PINGS-1;
+        return STUCK_CYCLES;
+    }
+    if(s->dropout > 0 && uniform() < s->dropout)
+        return NO_ECHO_CYCLES;
+
+    //Burst of the sensor on the other channel of the pair, heard through the MUX
+    if(s->crosstalk > 0 && uniform() < s->crosstalk)
+        cm = SimEchoTrue(channel ^ 1);
+    else
+        cm = SimEchoTrue(channel);
+    //Sound from the liquid to the sensor face and back again
+    if(s->multipath > 0 && uniform() < s->multipath)
+        cm *= 2;
+    if(s->jitter > 0)
+        cm += s->jitter*gaussian();
+
+    if(cm < MIN_CM)
+        cm = MIN_CM;
+    if(cm > MAX_CM)
+        return NO_ECHO_CYCLES;
+    return (uint32_t)(cm*CM_CYCLES);
+}
+
+/*
+ * Returns:
+ *      The MUX channel the address lines select now
+ */
+uint8_t SimMuxChannel(void)
+{
+    uint8_t channel = 0;
+    for(uint8_t i = 0; i < TANK_BITS; i++)
+        if((*US_DATA >> muxPins[i]) & 1)
+            channel |= 1 << i;
+    return channel;
+}
+
+/*
+ * Start a ping at the end of a trigger pulse and drive the echo line with the
+ * sensor the MUX selects
+ */
+void SimEchoSample(void)
+{
+    uint8_t trig = (*US_DATA >> TRIG_PIN) & 1;
+    uint8_t channel = SimMuxChannel();
+    uint8_t echo;
+
+    //A sensor ignores the trigger until its echo is over
+    if(lastTrig && !trig && simCycles >= echoEnd[channel])
+    {
+        echoStart[channel] = simCycles + BURST_CYCLES;
+        echoEnd[channel] = echoStart[channel] + SimEchoPing(channel);
+    }
+    lastTrig = trig;
+
+    echo = simCycles >= echoStart[channel] && simCycles < echoEnd[channel];
+    if((*US_TRIS >> ECHO_PIN) & 1)      //Only once the pin is an input
+        *US_DATA = (*US_DATA & ~(1 << ECHO_PIN)) | echo << ECHO_PIN;
+}
+
+/*
+ * Returns:
+ *      Cycles until the echo line of the sensor on the MUX changes, UINT64_MAX
+ *      if it won't before the next ping
+ */
+uint64_t SimEchoNext(void)
+{
+    uint8_t channel = SimMuxChannel();
+    if(simCycles < echoStart[channel])
+        return echoStart[channel] - simCycles;
+    if(simCycles < echoEnd[channel])
+        return echoEnd[channel] - simCycles;
+    return UINT64_MAX;
+}
+
+/*
+ * Returns:
+ *      The number of pings the sensors got
+ */
+uint32_t SimEchoPings(void)
+{
+    return pings;
+}
@@ -0,0 +1,181 @@
+/*
+ * File:   hd44780.c
+ * Author: Faris Shahin
+ *
+ * Model of the HD44780 LCD controller of the 16x4 display, on the pins set in
+ * lcd.h (8-bit bus). A byte is taken on the falling edge of E, which the
+ * firmware always follows with a delay, so sampling the pins at every step of
+ * the clock sees every edge.
+ *
+ * The controller needs time to carry out each instruction (37us, 1.52ms for
+ * clear and home) and 40ms after power up before the first one. The firmware
+ * never reads the busy flag and relies on its delays instead, so a byte that
+ * comes too early is counted as a violation: the real LCD would drop it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "sim.h"
+
+#define DDRAM_SIZE      80      //Two lines of 40 in 2-line mode
+#define LINE_SIZE       40
+#define POWER_UP_CYCLES (40L*(_XTAL_FREQ/4000))
+#define SHORT_CYCLES    (37L*(_XTAL_FREQ/4000000))
+#define LONG_CYCLES     (1520L*(_XTAL_FREQ/4000000))
+
+static char ddram[DDRAM_SIZE];
+static uint8_t addr;            //DDRAM address as an index of ddram
+static uint8_t increment;       //Entry mode I/D
+static uint8_t shift;           //Display shift in characters
+static uint8_t lastE;
+static uint64_t busyUntil;
+static uint64_t lastWrite;
+static uint32_t writes;
+static uint32_t violations;
+
+void SimLCDReset(void)
+{
+    memset(ddram, ' ', sizeof(ddram));
+    addr = 0;
+    increment = 1;
+    shift = 0;
+    lastE = 0;
+    busyUntil = POWER_UP_CYCLES;
+    lastWrite = 0;
+    writes = 0;
+    violations = 0;
+}
+
+/*
+ * Carry out an instruction
+ * Returns:
+ *      The cycles it takes
+ */
+static uint32_t instruction(uint8_t cmd)
+{
+    if(cmd & 0x80)              //Set DDRAM address
+    {
+        cmd &= 0x7f;
+        addr = (cmd >= 0x40) ? LINE_SIZE + (cmd - 0x40) % LINE_SIZE : cmd % LINE_SIZE;
+    }
+    else if(cmd & 0x40)         //Set CGRAM address, not modelled
+        ;
+    else if(cmd & 0x20)         //Function set
+        ;
+    else if(cmd & 0x10)         //Cursor or display shift
+    {
+        if(cmd & 0x08)
+            shift = (cmd & 0x04) ? (shift + 1) % LINE_SIZE : (shift + LINE_SIZE - 1) % LINE_SIZE;
+        else
+            addr = (cmd & 0x04) ? (addr + 1) % DDRAM_SIZE : (addr + DDRAM_SIZE - 1) % DDRAM_SIZE;
+    }
+    else if(cmd & 0x08)         //Display on/off control
+        ;
+    else if(cmd & 0x04)         //Entry mode set
+        increment = (cmd & 0x02) != 0;
+    else if(cmd & 0x02)         //Return home
+    {
+        addr = 0;
+        shift = 0;
+        return LONG_CYCLES;
+    }
+    else if(cmd & 0x01)         //Clear display
+    {
+        memset(ddram, ' ', sizeof(ddram));
+        addr = 0;
+        shift = 0;
+        increment = 1;
+        return LONG_CYCLES;
+    }
+    return SHORT_CYCLES;
+}
+
+/*
+ * Look at the pins and take a byte on the falling edge of E
+ */
+void SimLCDSample(void)
+{
+    uint8_t e = (*LCD_PORT_CTRL >> LCD_EN) & 1;
+    uint8_t data = *LCD_PORT_DATA;
+    uint32_t takes;
+
+    if(lastE && !e)
+    {
+        if(simCycles < busyUntil)
+            violations++;
+        if((*LCD_PORT_CTRL >> LCD_RS) & 1)
+        {
+            ddram[addr] = data;
+            addr = increment ? (addr + 1) % DDRAM_SIZE : (addr + DDRAM_SIZE - 1) % DDRAM_SIZE;
+            takes = SHORT_CYCLES;
+        }
+        else
+            takes = instruction(data);
+        busyUntil = simCycles + takes;
+        lastWrite = simCycles;
+        writes++;
+    }
+    lastE = e;
+}
+
+/*
+ * Get a line of the display as it is seen
+ * Parameters:
+ *      row - 1 to 4
+ *      *text - filled with SIM_LCD_COLS characters and a '\0'
+ */
+void SimLCDLine(uint8_t row, char * text)
+{
+    //Rows 1 and 3 are the first DDRAM line, 2 and 4 the second one
+    uint8_t base = (row == 2 || row == 4) ? LINE_SIZE : 0;
+    uint8_t start = (row >= 3) ? SIM_LCD_COLS : 0;
+    for(uint8_t i = 0; i < SIM_LCD_COLS; i++)
+    {
+        char c = ddram[base + (start + i + shift) % LINE_SIZE];
+        text[i] = (c >= ' ' && c <= '~') ? c : '?';
+    }
+    text[SIM_LCD_COLS] = '\0';
+}
+
+/*
+ * Returns:
+ *      The number of bytes the LCD took (instructions and characters)
+ */
+uint32_t SimLCDWrites(void)
+{
+    return writes;
+}
+
+/*
+ * Returns:
+ *      The cycle of the last byte taken
+ */
+uint64_t SimLCDLastWrite(void)
+{
+    return lastWrite;
+}
+
+/*
+ * Returns:
+ *      The number of bytes sent before the LCD was ready for them
+ */
+uint32_t SimLCDViolations(void)
+{
+    return violations;
+}
+
+/*
+ * Print the display
+ */
+void SimLCDPrint(void)
+{
+    char text[SIM_LCD_COLS+1];
+    printf("+----------------+\n");
+    for(uint8_t row = 1; row <= SIM_LCD_ROWS; row++)
+    {
+        SimLCDLine(row, text);
+        printf("|%s|\n", text);
+    }
+    printf("+----------------+\n");
+}
@@ -0,0 +1,52 @@
+/*
+ * File:   keypad.c
+ * Author: Faris Shahin
+ *
+ * Model of the 4x3 keypad matrix on the pins set in KeyPad.h. A pressed key
+ * connects its column to its row, so the row reads high while the firmware
+ * drives that column high.
+ */
+
+#include "config.h"
+#include "sim.h"
+
+static const uint8_t rowPins[4] = {ROW1, ROW2, ROW3, ROW4};
+static const uint8_t colPins[3] = {COL1, COL2, COL3};
+#define ROW_MASK ((1 << (ROW1-1)) | (1 << (ROW2-1)) | (1 << (ROW3-1)) | (1 << (ROW4-1)))
+
+static int8_t row = -1;         //Row and column of the pressed key, -1 if none
+static int8_t col = -1;
+
+/*
+ * Hold a key down until SimKeyRelease()
+ * Parameters:
+ *      key - the character printed on the key
+ */
+void SimKeyPress(char key)
+{
+    SimKeyRelease();
+    for(uint8_t j = 0; j < 4; j++)
+        for(uint8_t i = 0; i < 3; i++)
+            if(Keypad[j][i] == (uint8_t)key)
+            {
+                row = j;
+                col = i;
+            }
+}
+
+void SimKeyRelease(void)
+{
+    row = -1;
+    col = -1;
+}
+
+/*
+ * Set the rows from the columns the firmware drives
+ */
+void SimKeypadSample(void)
+{
+    uint8_t rows = *IN_KEYS & ~ROW_MASK;
+    if(row >= 0 && ((*OUT_KEYS >> (colPins[col]-1)) & 1))
+        rows |= 1 << (rowPins[row]-1);
+    *IN_KEYS = rows;
+}
@@ -0,0 +1,261 @@
+/*
+ * File:   powerloss.c
+ * Author: Faris Shahin
+ *
+ * Power loss harness of the level log (history.h). A scenario of the tanks is
+ * logged for SAMPLES samples, enough for the log to wrap around a few times:
+ *      - tank 0 still, an entry every 16 samples
+ *      - tank 1 draining 1 cm a sample, small changes
+ *      - tank 2 jumping around, a level at every sample
+ *      - the other tanks not in use
+ * It's run once to get every entry logged, reading the log after each sample.
+ * Then it's run again for each EEPROM write of that run, with the power lost
+ * right after that write (see SimPowerLoss()): the write running then, the
+ * half written entry, and every later one never reach the EEPROM. At the next
+ * power up the log must read back as the newest entries logged before the
+ * power loss, nothing torn or damaged in between, then the power up marker.
+ * The levels of changes are only compared when the log holds the level they
+ * change.
+ *
+ * A write cut off is taken as not done, the byte keeps its old value. The
+ * PIC doesn't promise that, a byte cut off can hold anything.
+ *
+ * Usage:
+ *      simpowerloss [-v]
+ *      -v      print the log read back after each power loss
+ */
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "sim.h"
+
+#define SAMPLES         100     //Samples of the scenario
+#define TANK_CM         200     //Height of the tanks
+#define MAX_ENTRIES     (SAMPLES*2*TANK_COUNT + 1)  //Most a run can log
+#define NO_LOSS         UINT32_MAX
+
+static struct historyEntry logged[MAX_ENTRIES];    //Every entry of the run without power loss
+static int loggedCount;
+static int verbose;
+
+/*
+ * Move the clock of the firmware, as TMR2 would
+ */
+static void advance(uint32_t s)
+{
+    for(uint32_t i = 0; i < s*CLOCK_TICKS_PER_SEC; i++)
+        ClockTick();
+}
+
+/*
+ * Power up the modules of the log with the tanks of the scenario. The EEPROM
+ * keeps what it holds.
+ * Parameters:
+ *      writes - the EEPROM writes that reach it before the next power loss,
+ *               NO_LOSS for none
+ */
+static void powerUp(uint32_t writes)
+{
+    SimReset();
+    if(writes != NO_LOSS)
+        SimPowerLoss(writes);
+    INTCON = 0xC0;      //As main() sets it, the EEPROM queue runs from EEIF
+    EEPROMQueueInit();
+    StoreInit();
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        TankConfigClear(i);
+        if(i > 2)
+            continue;
+        TankSetName(i, (uint8_t *)"TANK  ");
+        TankSetLength(i, 100);
+        TankSetWidth(i, 100);
+        TankSetHeight(i, TANK_CM);
+    }
+    HistoryInit();
+}
+
+/*
+ * One sample of the scenario: the levels are read, then logged after
+ * HIST_INTERVAL seconds. The EEPROM queue is written out after each one so a
+ * run doesn't depend on how long the readings take.
+ */
+static void sample(int s)
+{
+    static const uint16_t levels[3] = {100, 190, 10};
+    struct measurement m = {0};
+    m.health = STORE_OK;
+    for(uint8_t i = 0; i < TANK_COUNT && i < 3; i++)
+    {
+        if(i == 0)
+            m.level = levels[0];
+        else if(i == 1)
+            m.level = levels[1] - s%150;
+        else
+            m.level = levels[2] + (s*37)%180;
+        StorePublish(i, &m);
+    }
+    advance(HIST_INTERVAL);
+    HistoryService();
+    EEPROMQueueFlush();
+}
+
+/*
+ * Read the whole log
+ * Parameters:
+ *      *entries - where the entries go, HIST_SLOTS of them at most
+ *      *head - where the entry the log writes next is stored
+ * Returns:
+ *      The number of entries read
+ */
+static int readLog(struct historyEntry * entries, uint8_t * head)
+{
+    struct historyCursor cur;
+    int n = 0;
+    HistoryCursorStart(&cur);
+    *head = (cur.slot + HIST_SLOTS - 1) % HIST_SLOTS;
+    while(n < HIST_SLOTS && HistoryCursorNext(&cur, &entries[n]))
+        n++;
+    return n;
+}
+
+//1 if a read entry is the logged one
+static int same(const struct historyEntry * read, const struct historyEntry * log)
+{
+    if(read->kind != log->kind || read->tank != log->tank || read->samples != log->samples)
+        return 0;
+    return (read->kind == HIST_DELTA && read->level == HIST_UNKNOWN) || read->level == log->level;
+}
+
+static void printEntry(const struct historyEntry * e)
+{
+    if(e->kind == HIST_MARK)
+        printf("  mark %u %u\n", e->tank, e->level);
+    else
+        printf("  %s tank %u level %u samples %u\n", e->kind == HIST_KEY ? "key  " : "delta",
+               e->tank, e->level, e->samples);
+}
+
+/*
+ * Erase the EEPROM, as on a new chip
+ */
+static void erase(void)
+{
+    for(uint16_t i = 0; i < EE_SIZE; i++)
+        SimEEPROMWrite((uint8_t)i, 0xff);
+}
+
+/*
+ * The run without power loss: every entry logged goes to logged[], the
+ * entries of each sample taken from the end of the log by how far its head
+ * moved
+ * Returns:
+ *      The EEPROM writes of the run
+ */
+static uint32_t reference(void)
+{
+    struct historyEntry entries[HIST_SLOTS];
+    uint8_t head, last;
+    uint32_t writes;
+    int n, added;
+
+    erase();
+    writes = SimEEPROMWrites();
+    powerUp(NO_LOSS);
+    EEPROMQueueFlush();
+    loggedCount = readLog(logged, &last);
+    for(int s = 0; s < SAMPLES; s++)
+    {
+        sample(s);
+        n = readLog(entries, &head);
+        added = (head + HIST_SLOTS - last) % HIST_SLOTS;
+        last = head;
+        memcpy(&logged[loggedCount], &entries[n - added], added*sizeof(entries[0]));
+        loggedCount += added;
+    }
+    return SimEEPROMWrites() - writes;
+}
+
+/*
+ * Run the scenario with the power lost after some writes, then power up
+ * Parameters:
+ *      writes - the writes that reach the EEPROM
+ *      *from - the entries of logged[] read back at the last power loss, moved
+ *              to the ones read back now
+ * Returns:
+ *      1 if the log read back after the power up is as it should be
+ */
+static int cut(uint32_t writes, int * from)
+{
+    struct historyEntry entries[HIST_SLOTS];
+    uint8_t head;
+    uint32_t start;
+    int n, c, i, window;
+
+    erase();
+    start = SimEEPROMWrites();
+    powerUp(writes);
+    EEPROMQueueFlush();
+    for(int s = 0; s < SAMPLES && SimEEPROMWrites() - start <= writes; s++)
+        sample(s);
+    powerUp(NO_LOSS);
+    EEPROMQueueFlush();
+    n = readLog(entries, &head);
+    if(verbose)
+    {
+        printf("power lost after %u writes:\n", writes);
+        for(int i = 0; i < n; i++)
+            printEntry(&entries[i]);
+    }
+
+    //The power up marker, after the newest entries logged before
+    if(n < 1 || entries[n-1].kind != HIST_MARK || entries[n-1].tank != HIST_MARK_BOOT)
+        return 0;
+    n--;
+    for(c = *from; c <= loggedCount; c++)
+    {
+        window = c < HIST_SLOTS-2 ? c : HIST_SLOTS-2;
+        if(n != window)
+            continue;
+        for(i = 0; i < n && same(&entries[i], &logged[c - n + i]); i++)
+            ;
+        if(i == n)
+        {
+            *from = c;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t writes;
+    int opt, from = 0, failed = 0;
+    while((opt = getopt(argc, argv, "v")) != -1)
+    {
+        if(opt == 'v')
+            verbose = 1;
+        else
+        {
+            fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    writes = reference();
+    printf("simpowerloss: %d samples, %d entries logged (%d laps of %d), %u EEPROM writes\n",
+           SAMPLES, loggedCount, loggedCount/HIST_SLOTS, HIST_SLOTS, writes);
+    for(uint32_t k = 0; k < writes; k++)
+        if(!cut(k, &from))
+        {
+            fprintf(stderr, "simpowerloss: the log is wrong after a power loss after %u writes\n", k);
+            failed++;
+        }
+    printf("power lost after each of the %u writes: %d logs read back wrong\n", writes, failed);
+    return failed != 0;
+}
@@ -0,0 +1,450 @@
+/*
+ * File:   replay.c
+ * Author: Faris Shahin
+ *
+ * Replay harness of the level measurement. Pings of the sensor model
+ * (hcsr04.c) or of a recorded trace go through the steps of view() with the
+ * code of the firmware: the echo time as UltraSonicPing() measures it,
+ * UltraSonicDistance(), the range check, the level filter and tankLiters().
+ * Every filter of filter.h is run on the same pings, and the report gives for
+ * each one the readings kept, the error against the real level and how many
+ * pings a second the PC gets through.
+ *
+ * A trace is text with one ping per line, "tank N ticks T" somewhere in it.
+ * That is what tlmdump prints for each telemetry record, so a capture from a
+ * site is "tlmdump /dev/ttyUSB0 > site.txt". A line can also have "true D",
+ * the real distance in mm, which is how -w writes the pings of a scenario.
+ * Other lines are skipped. The levels of a trace with no real distances are
+ * compared to the median of the 9 readings around each one instead.
+ *
+ * Usage:
+ *      simreplay [-s scenario] [-n pings] [-t LxWxH] [-S seed] [-w trace]
+ *      simreplay -r trace [-t LxWxH]
+ *      simreplay -c
+ *      -s      run one scenario (default all of them, "-s list" lists them)
+ *      -n      pings of each scenario (default 1000000)
+ *      -t      tank dimensions in cm (default 200x100x150)
+ *      -S      seed of the faults and the jitter (default 1)
+ *      -w      write the pings of the scenario to a trace
+ *      -r      replay a trace
+ *      -c      check the echo times against UltraSonicPing() run in the
+ *              simulator
+ */
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "config.h"
+#include "sim.h"
+
+#define READ_SECONDS    4.1     //Between the readings of a tank (250 TMR0 overflows, see idle())
+#define SENSORS         2       //Tanks of a scenario, a pair so crosstalk is seen
+#define PAIR_CM         20      //The second sensor is this much further
+#define SPIKE_CM        5       //A level this far off is a spike
+#define REF_READINGS    9       //Readings of the reference of a trace with no real levels
+#define NO_TRUTH        -1
+
+void firmwareMain(void);
+
+//filter.c built once per filter, see the Makefile
+void FilterResetNone(uint8_t tankIndex);
+uint16_t FilterLevelNone(uint8_t tankIndex, uint16_t level);
+void FilterResetMedian3(uint8_t tankIndex);
+uint16_t FilterLevelMedian3(uint8_t tankIndex, uint16_t level);
+void FilterResetEwma(uint8_t tankIndex);
+uint16_t FilterLevelEwma(uint8_t tankIndex, uint16_t level);
+
+static const struct
+{
+    const char * name;
+    void (*reset)(uint8_t);
+    uint16_t (*level)(uint8_t, uint16_t);
+} filters[] = {
+    {"none", FilterResetNone, FilterLevelNone},
+    {"median3", FilterResetMedian3, FilterLevelMedian3},
+    {"ewma", FilterResetEwma, FilterLevelEwma},
+};
+#define FILTER_COUNT (sizeof(filters)/sizeof(*filters))
+
+static const struct
+{
+    const char * name;
+    SimSensor sensor;
+} scenarios[] = {
+    //                      profile             dist  ampl  period jitter multi  drop   stuck   cross
+    {"clean",       {SIM_PROFILE_FIXED,   60,   0,    0,     0,     0,     0,     0,      0}},
+    {"jitter",      {SIM_PROFILE_FIXED,   60,   0,    0,     1.5,   0,     0,     0,      0}},
+    {"drain",       {SIM_PROFILE_DRAIN,   30,   80,   21600, 0.5,   0,     0,     0,      0}},
+    {"refill",      {SIM_PROFILE_REFILL,  30,   80,   1200,  0.5,   0,     0,     0,      0}},
+    {"slosh",       {SIM_PROFILE_SLOSH,   60,   4,    7,     0.5,   0,     0,     0,      0}},
+    {"multipath",   {SIM_PROFILE_FIXED,   60,   0,    0,     0.5,   0.05,  0,     0,      0}},
+    {"dropout",     {SIM_PROFILE_FIXED,   60,   0,    0,     0.5,   0,     0.05,  0,      0}},
+    {"stuck",       {SIM_PROFILE_FIXED,   60,   0,    0,     0.5,   0,     0,     0.001,  0}},
+    {"crosstalk",   {SIM_PROFILE_FIXED,   60,   0,    0,     0.5,   0,     0,     0,      0.05}},
+    {"site",        {SIM_PROFILE_DRAIN,   30,   80,   21600, 0.8,   0.01,  0.02,  0.0005, 0.005}},
+};
+#define SCENARIO_COUNT (sizeof(scenarios)/sizeof(*scenarios))
+
+typedef struct
+{
+    uint8_t tank;
+    uint16_t ticks;         //Echo time in TMR0 ticks, 0 if the reading failed
+    int32_t trueMm;         //Real distance, NO_TRUTH if unknown
+} Ping;
+
+static Ping * pings;
+static uint16_t * levels;   //Output of a filter for each ping
+static double * truth;      //Real or reference level of each ping in cm, < 0 if none
+static long count;
+static long capacity;
+
+static int64_t monotonicNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void addPing(uint8_t tank, uint16_t ticks, int32_t trueMm)
+{
+    if(count == capacity)
+    {
+        capacity = capacity ? capacity*2 : 65536;
+        pings = realloc(pings, capacity*sizeof(Ping));
+        if(!pings)
+        {
+            fprintf(stderr, "simreplay: out of memory\n");
+            exit(1);
+        }
+    }
+    pings[count].tank = tank;
+    pings[count].ticks = ticks;
+    pings[count].trueMm = trueMm;
+    count++;
+}
+
+/*
+ * The echo time UltraSonicPing() reads for an echo pulse: TMR0 runs with
+ * US_PRESCALE and US_TIMEOUT_OVERFLOWS of its overflows is a timeout.
+ */
+static uint16_t echoTicks(uint32_t cycles)
+{
+    uint32_t ticks = cycles/US_PRESCALE;
+    if(ticks/256 >= US_TIMEOUT_OVERFLOWS)
+        return 0;
+    return ticks;
+}
+
+/*
+ * Ping the sensors of a scenario
+ */
+static void generate(const SimSensor * sensor, long n, uint64_t seed)
+{
+    SimSensor pair = *sensor;
+    pair.distance += PAIR_CM;
+    SimEchoReset();
+    SimEchoSeed(seed);
+    SimEchoSensor(0, sensor);
+    SimEchoSensor(1, &pair);
+    simCycles = 0;
+    count = 0;
+    while(count < n)
+    {
+        for(uint8_t tank = 0; tank < SENSORS && count < n; tank++)
+        {
+            int32_t trueMm = (int32_t)(SimEchoTrue(tank)*10 + 0.5);
+            addPing(tank, echoTicks(SimEchoPing(tank)), trueMm);
+        }
+        simCycles += SimCyclesOf(READ_SECONDS*1000);
+    }
+}
+
+/*
+ * Read the pings of a trace
+ */
+static int readTrace(const char * path)
+{
+    FILE * f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    char line[256];
+    unsigned tank, ticks;
+    int trueMm;
+    char * p;
+    if(!f)
+    {
+        perror(path);
+        return -1;
+    }
+    count = 0;
+    while(fgets(line, sizeof(line), f))
+    {
+        p = strstr(line, "tank ");
+        if(!p || sscanf(p, "tank %u ticks %u", &tank, &ticks) != 2 || tank >= TANK_COUNT)
+            continue;
+        p = strstr(line, "true ");
+        if(!p || sscanf(p, "true %d", &trueMm) != 1)
+            trueMm = NO_TRUTH;
+        addPing(tank, ticks, trueMm);
+    }
+    if(f != stdin)
+        fclose(f);
+    return 0;
+}
+
+static int writeTrace(const char * path)
+{
+    FILE * f = fopen(path, "w");
+    if(!f)
+    {
+        perror(path);
+        return -1;
+    }
+    for(long i = 0; i < count; i++)
+        fprintf(f, "tank %u ticks %u true %d\n", pings[i].tank, pings[i].ticks, (int)pings[i].trueMm);
+    return fclose(f);
+}
+
+//The level view() would take from a reading, before the filter
+static uint16_t rawLevel(const Ping * ping)
+{
+    uint16_t height = TankHeight(ping->tank);
+    uint16_t distVal = UltraSonicDistance(ping->ticks);
+    if(ping->ticks != 0 && distVal <= height*10)
+        return (height*10 - distVal + 5)/10;
+    return TLM_NO_LEVEL;
+}
+
+static int compareLevels(const void * a, const void * b)
+{
+    return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+/*
+ * Set the level each filter is compared to: the real one if it's known,
+ * otherwise the median of the readings around it
+ */
+static void setTruth(void)
+{
+    truth = realloc(truth, count*sizeof(double));
+    for(long i = 0; i < count; i++)
+    {
+        const Ping * ping = &pings[i];
+        uint16_t window[REF_READINGS];
+        uint8_t n = 0;
+        long j, seen;
+
+        truth[i] = -1;
+        if(ping->trueMm != NO_TRUTH)
+        {
+            truth[i] = TankHeight(ping->tank) - ping->trueMm/10.0;
+            continue;
+        }
+        //Readings of the same tank, half before and half after
+        for(j = i, seen = 0; j >= 0 && seen <= REF_READINGS/2; j--)
+            if(pings[j].tank == ping->tank)
+            {
+                seen++;
+                if(rawLevel(&pings[j]) != TLM_NO_LEVEL)
+                    window[n++] = rawLevel(&pings[j]);
+            }
+        for(j = i+1, seen = 0; j < count && seen < REF_READINGS/2; j++)
+            if(pings[j].tank == ping->tank)
+            {
+                seen++;
+                if(rawLevel(&pings[j]) != TLM_NO_LEVEL)
+                    window[n++] = rawLevel(&pings[j]);
+            }
+        if(n >= 3)
+        {
+            qsort(window, n, sizeof(*window), compareLevels);
+            truth[i] = window[n/2];
+        }
+    }
+}
+
+/*
+ * Run the pings through view() with a filter and report how it did
+ */
+static void runFilter(uint8_t f)
+{
+    long kept = 0, compared = 0, spikes = 0;
+    double sumError = 0, maxError = 0, sumLiters = 0;
+    int64_t start;
+    double seconds;
+
+    for(uint8_t tank = 0; tank < TANK_COUNT; tank++)
+        filters[f].reset(tank);
+    start = monotonicNs();
+    for(long i = 0; i < count; i++)
+    {
+        uint16_t level = rawLevel(&pings[i]);
+        if(level != TLM_NO_LEVEL)
+            level = filters[f].level(pings[i].tank, level);
+        levels[i] = level;
+    }
+    seconds = (monotonicNs() - start)/1e9;
+
+    for(long i = 0; i < count; i++)
+    {
+        double error;
+        uint8_t tank = pings[i].tank;
+        if(levels[i] == TLM_NO_LEVEL)
+            continue;
+        kept++;
+        if(truth[i] < 0)
+            continue;
+        compared++;
+        error = levels[i] > truth[i] ? levels[i] - truth[i] : truth[i] - levels[i];
+        sumError += error;
+        if(error > maxError)
+            maxError = error;
+        if(error > SPIKE_CM)
+            spikes++;
+        sumLiters += error*tankLiters(tank, 1);     //The tanks are cuboids
+    }
+    printf("  %-8s %7.2f%% %8.2f %8.1f %8.3f%% %9.1f %9.1f\n", filters[f].name,
+           count ? 100.0*kept/count : 0, compared ? sumError/compared : 0, maxError,
+           compared ? 100.0*spikes/compared : 0, compared ? sumLiters/compared : 0,
+           seconds > 0 ? count/seconds/1e6 : 0);
+}
+
+static void report(const char * name)
+{
+    levels = realloc(levels, count*sizeof(uint16_t));
+    setTruth();
+    printf("%s: %ld pings\n", name, count);
+    printf("  %-8s %8s %8s %8s %9s %9s %9s\n", "filter", "kept", "err cm", "max cm", ">5cm", "err L", "Mpings/s");
+    for(uint8_t f = 0; f < FILTER_COUNT; f++)
+        runFilter(f);
+}
+
+static void pingTank0(void)
+{
+    UltraSonicSelect(0);
+    UltraSonicPing(&TMR0of);
+}
+
+/*
+ * Compare echoTicks() with what UltraSonicPing() measures in the simulator,
+ * over the range of the sensor and for a sensor with no echo
+ */
+static int check(void)
+{
+    uint16_t worst = 0;
+    int off = 0;
+    SimReset();
+    SimStart(firmwareMain);
+    SimRunFor(SimCyclesOf(1000));
+    for(uint16_t cm = 0; cm <= 400; cm += 2)
+    {
+        uint16_t expected, measured, diff;
+        SimEchoDistance(0, cm);
+        expected = echoTicks(SimEchoPing(0));
+        SimCall(pingTank0);
+        measured = UltraSonicTicks();
+        diff = expected > measured ? expected - measured : measured - expected;
+        if(diff > worst)
+            worst = diff;
+        if(diff > 1)
+        {
+            printf("%3u cm: expected %u ticks, UltraSonicPing() %u\n", cm, expected, measured);
+            off++;
+        }
+    }
+    printf("echo times checked up to 400cm, worst difference %u ticks\n", worst);
+    return off != 0;
+}
+
+int main(int argc, char ** argv)
+{
+    const char * scenario = NULL;
+    const char * traceIn = NULL;
+    const char * traceOut = NULL;
+    long n = 1000000;
+    uint64_t seed = 1;
+    unsigned length = 200, width = 100, height = 150;
+    int opt;
+
+    while((opt = getopt(argc, argv, "s:n:t:S:w:r:c")) != -1)
+    {
+        switch(opt)
+        {
+            case 's':
+                scenario = optarg;
+                break;
+            case 'n':
+                n = atol(optarg);
+                break;
+            case 't':
+                if(sscanf(optarg, "%ux%ux%u", &length, &width, &height) != 3)
+                {
+                    fprintf(stderr, "simreplay: tank dimensions are LxWxH in cm\n");
+                    return 1;
+                }
+                break;
+            case 'S':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'w':
+                traceOut = optarg;
+                break;
+            case 'r':
+                traceIn = optarg;
+                break;
+            case 'c':
+                return check();
+            default:
+                fprintf(stderr, "usage: simreplay [-s scenario] [-n pings] [-t LxWxH] [-S seed] [-w trace]\n"
+                                "       simreplay -r trace [-t LxWxH]\n"
+                                "       simreplay -c\n");
+                return 1;
+        }
+    }
+    if(n < 1)
+        n = 1;
+    if(scenario && !strcmp(scenario, "list"))
+    {
+        for(uint8_t i = 0; i < SCENARIO_COUNT; i++)
+            printf("%s\n", scenarios[i].name);
+        return 0;
+    }
+    if(traceOut && !scenario)
+    {
+        fprintf(stderr, "simreplay: -w needs a scenario (-s)\n");
+        return 1;
+    }
+
+    for(uint8_t tank = 0; tank < TANK_COUNT; tank++)
+    {
+        TankSetLength(tank, length);
+        TankSetWidth(tank, width);
+        TankSetHeight(tank, height);
+    }
+
+    if(traceIn)
+    {
+        if(readTrace(traceIn) < 0)
+            return 1;
+        report(traceIn);
+        return 0;
+    }
+    for(uint8_t i = 0; i < SCENARIO_COUNT; i++)
+    {
+        if(scenario && strcmp(scenario, scenarios[i].name))
+            continue;
+        generate(&scenarios[i].sensor, n, seed);
+        if(traceOut && writeTrace(traceOut) < 0)
+            return 1;
+        report(scenarios[i].name);
+        if(scenario)
+            return 0;
+    }
+    if(scenario)
+    {
+        fprintf(stderr, "simreplay: no scenario %s\n", scenario);
+        return 1;
+    }
+    return 0;
+}
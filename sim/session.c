@@ -0,0 +1,396 @@
+/*
+ * File:   session.c
+ * Author: Faris Shahin
+ *
+ * Keypress latency benchmark. Boots the firmware with 3 configured tanks and
+ * replays sessions of an operator on the keypad: browsing the main screen,
+ * and opening the options, adding a tank, deleting it and going back to the
+ * overview. Each key is held until the screen it leads to is drawn, then the
+ * operator waits a random 100 to 900ms before the next one, so keys land in
+ * the keypad delay, a refresh of the levels or a menu's waits as they would
+ * on a site.
+ *
+ * The latency of a step is the simulated time from the press to the last LCD
+ * byte of the screen that shows the change. The report gives per step the
+ * median and the 99th percentile over all runs, and per session the time on
+ * the board (the sum of the latencies) and the whole time with the pauses.
+ * A step or a session whose p99 is above its limit in limits[] fails the run,
+ * so a change that slows the UI down shows up as a failed "make session".
+ *
+ * Usage:
+ *      simsession [-n runs] [-S seed] [-v]
+ *      -n      runs of each session (default 50)
+ *      -S      seed of the pauses (default 1)
+ *      -v      print the LCD after each step of the first run
+ */
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "sim.h"
+
+#define SETTLED_MS      20      //No LCD byte for this long ends a screen update
+#define STEP_LIMIT_MS   5000    //A screen not shown after this long ends the run
+#define PAUSE_MIN_MS    100     //Between the release of a key and the next press
+#define PAUSE_MAX_MS    900
+#define MAX_STEPS       48
+#define MAX_NAMES       24
+
+void firmwareMain(void);
+
+typedef struct
+{
+    char key;
+    const char * what;      //Name of the step in the report, steps with the same name are counted together
+    uint8_t row;            //Row showing the change
+    const char * text;      //What the row shows once the key was handled, NULL for any LCD byte
+} Step;
+
+typedef struct
+{
+    const char * name;
+    Step steps[MAX_STEPS];
+} Session;
+
+static const Session sessions[] = {
+    {"browse", {
+        {'0', "compact view", 1, "WATE"},
+        {'0', "compact view", 2, "WATER"},
+        {'#', "acknowledge", 0, NULL},
+        {'*', "open options", 1, "1.Add/Edit entry"},
+        {'4', "usage", 1, "DIESEL"},
+        {'8', "usage page", 0, NULL},
+        {'2', "usage page", 0, NULL},
+        {'*', "refills", 1, "No refills."},
+        {'#', "back to options", 1, "1.Add/Edit entry"},
+        {'3', "back to overview", 1, "DIESEL"},
+        {0}}},
+    {"add and delete a tank", {
+        {'*', "open options", 1, "1.Add/Edit entry"},
+        {'1', "add/edit", 1, "Enter sensor num"},
+        {'4', "digit", 3, "4"},
+        {'*', "confirm", 1, "Enter name:"},
+        {'2', "name letter", 2, "A"},
+        {'6', "name cursor", 0, NULL},
+        {'2', "name letter", 2, "AA"},
+        {'2', "name letter", 2, "AB"},
+        {'*', "confirm", 1, "Enter length cm:"},
+        {'1', "digit", 2, "1"},
+        {'2', "digit", 2, "12"},
+        {'0', "digit", 2, "120"},
+        {'*', "confirm", 1, "Enter width cm:"},
+        {'8', "digit", 2, "8"},
+        {'0', "digit", 2, "80"},
+        {'*', "confirm", 1, "Enter height cm:"},
+        {'9', "digit", 2, "9"},
+        {'0', "digit", 2, "90"},
+        {'*', "confirm", 1, "Sensor type:"},
+        {'1', "sensor type", 1, "Low alarm %:"},
+        {'1', "digit", 2, "1"},
+        {'0', "digit", 2, "10"},
+        {'*', "confirm", 1, "Critical alarm %"},
+        {'5', "digit", 2, "5"},
+        {'*', "confirm", 1, "High alarm %:"},
+        {'9', "digit", 2, "9"},
+        {'5', "digit", 2, "95"},
+        {'*', "save tank", 1, "Successful!"},
+        {'#', "back to options", 1, "1.Add/Edit entry"},
+        {'2', "delete", 2, "DIESEL"},
+        {'8', "next entry", 2, "WATER"},
+        {'8', "next entry", 2, "GAS"},
+        {'8', "next entry", 2, "AB"},
+        {'*', "delete tank", 1, "Entry deleted!"},
+        {'#', "back to options", 1, "1.Add/Edit entry"},
+        {'3', "back to overview", 1, "DIESEL"},
+        {0}}},
+};
+#define SESSIONS    (sizeof(sessions)/sizeof(*sessions))
+
+/*
+ * Most p99 in ms of each step and of the time on the board of each session.
+ * About a quarter above what the firmware takes now.
+ */
+static const struct
+{
+    const char * name;
+    double p99;
+} limits[] = {
+    {"compact view", 280},
+    {"acknowledge", 280},
+    {"usage", 280},
+    {"usage page", 280},
+    {"refills", 280},
+    {"open options", 280},
+    {"add/edit", 280},
+    {"digit", 280},
+    {"confirm", 280},
+    {"name letter", 280},
+    {"name cursor", 280},
+    {"sensor type", 280},
+    {"save tank", 280},
+    {"back to options", 340},
+    {"delete", 280},
+    {"next entry", 280},
+    {"delete tank", 280},
+    {"back to overview", 280},
+    {"browse", 880},
+    {"add and delete a tank", 2300},
+};
+#define LIMITS      (sizeof(limits)/sizeof(*limits))
+
+//Samples of a step or a session in ms
+typedef struct
+{
+    const char * name;
+    double * ms;
+    int n;
+} Samples;
+
+static Samples steps[MAX_NAMES];
+static int stepNames = 0;
+static Samples boardTimes[SESSIONS];
+static Samples wholeTimes[SESSIONS];
+static const Step * waiting;        //Step whose screen is waited for
+static uint32_t writesBefore;       //LCD bytes before its key
+static int verbose = 0;
+static uint64_t rng;
+
+//xorshift64*, the pauses don't depend on the C library
+static double uniform(void)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (double)((rng * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+}
+
+/*
+ * Store a tank record and the header in the EEPROM, as TankConfigSave() would
+ */
+static void storeTank(uint8_t index, const char * name, uint16_t length, uint16_t width, uint16_t height)
+{
+    uint8_t rec[REC_SIZE];
+    uint8_t padded[TANK_NAME_CHARS];
+    uint8_t crc;
+    memset(padded, ' ', TANK_NAME_CHARS);
+    memcpy(padded, name, strlen(name) < TANK_NAME_CHARS ? strlen(name) : TANK_NAME_CHARS);
+    //The firmware packs the record, the tank in RAM is loaded again at reset
+    TankConfigClear(index);
+    TankSetName(index, padded);
+    TankSetLength(index, length);
+    TankSetWidth(index, width);
+    TankSetHeight(index, height);
+    TankSetLow(index, 10);
+    TankSetCritical(index, 5);
+    TankSetHigh(index, 95);
+    TankConfigRecord(index, rec);
+    for(uint8_t i = 0; i < REC_SIZE; i++)
+        SimEEPROMWrite(EE_TANKS_ADDR + index*EE_TANK_SLOT + i, rec[i]);
+
+    crc = 0xff;
+    crc = crc8(crc, EE_MAGIC);
+    crc = crc8(crc, EE_VERSION);
+    crc = crc8(crc, TANK_COUNT);
+    SimEEPROMWrite(EE_HEADER_ADDR, EE_MAGIC);
+    SimEEPROMWrite(EE_HEADER_ADDR+1, EE_VERSION);
+    SimEEPROMWrite(EE_HEADER_ADDR+2, TANK_COUNT);
+    SimEEPROMWrite(EE_HEADER_ADDR+3, crc);
+    SimEEPROMWrite(EE_STAMP_ADDR, EE_LOG_STAMP);   //The logs are of this layout
+}
+
+static uint8_t shown(void)
+{
+    char text[SIM_LCD_COLS+1];
+    if(waiting->text == NULL)
+        return SimLCDWrites() != writesBefore;
+    SimLCDLine(waiting->row, text);
+    return strstr(text, waiting->text) != NULL;
+}
+
+static uint8_t lcdSettled(void)
+{
+    return simCycles - SimLCDLastWrite() >= SimCyclesOf(SETTLED_MS);
+}
+
+static void addSample(Samples * s, const char * name, double ms, int max)
+{
+    if(s->ms == NULL)
+    {
+        s->name = name;
+        s->ms = malloc(max * sizeof(double));
+    }
+    s->ms[s->n++] = ms;
+}
+
+static Samples * stepSamples(const char * name)
+{
+    for(int i = 0; i < stepNames; i++)
+        if(strcmp(steps[i].name, name) == 0)
+            return &steps[i];
+    return &steps[stepNames++];
+}
+
+/*
+ * Press the key of a step and hold it until its screen is drawn
+ * Returns:
+ *      The latency in ms, or a negative number if the screen never came
+ */
+static double runStep(const Step * step)
+{
+    uint64_t pressed;
+    waiting = step;
+    writesBefore = SimLCDWrites();
+    SimKeyPress(step->key);
+    pressed = simCycles;
+    if(!SimRunUntil(shown, SimCyclesOf(STEP_LIMIT_MS)))
+        return -1;
+    SimRunUntil(lcdSettled, SimCyclesOf(STEP_LIMIT_MS));
+    SimKeyRelease();
+    return SimMs(SimLCDLastWrite() - pressed);
+}
+
+/*
+ * Replay a session once
+ * Returns:
+ *      0, or 1 after printing the step that failed
+ */
+static int runSession(int s, int runs, int first)
+{
+    const Session * session = &sessions[s];
+    uint64_t start = simCycles;
+    double board = 0, ms;
+    for(const Step * step = session->steps; step->key; step++)
+    {
+        SimRunFor(SimCyclesOf(PAUSE_MIN_MS + uniform()*(PAUSE_MAX_MS - PAUSE_MIN_MS)));
+        if(step == session->steps)
+            start = simCycles;
+        ms = runStep(step);
+        if(ms < 0)
+        {
+            fprintf(stderr, "simsession: %s, key %c (%s): row %u never showed \"%s\"\n",
+                    session->name, step->key, step->what, step->row, step->text ? step->text : "");
+            SimLCDPrint();
+            return 1;
+        }
+        if(verbose && first)
+        {
+            printf("key %c %s, %.1f ms\n", step->key, step->what, ms);
+            SimLCDPrint();
+        }
+        addSample(stepSamples(step->what), step->what, ms, runs*MAX_STEPS);
+        board += ms;
+    }
+    addSample(&boardTimes[s], session->name, board, runs);
+    addSample(&wholeTimes[s], session->name, SimMs(SimLCDLastWrite() - start), runs);
+    return 0;
+}
+
+static int compareMs(const void * a, const void * b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+//Nearest rank percentile of sorted samples
+static double percentile(const Samples * s, double p)
+{
+    int rank = (int)(p/100 * s->n + 0.999999);
+    if(rank < 1)
+        rank = 1;
+    return s->ms[rank-1];
+}
+
+//The p99 limit of a step or a session in ms, 0 if it has none
+static double limitOf(const char * name)
+{
+    for(unsigned i = 0; i < LIMITS; i++)
+        if(strcmp(limits[i].name, name) == 0)
+            return limits[i].p99;
+    return 0;
+}
+
+/*
+ * Print a line of the report and check it against a limit
+ * Returns:
+ *      1 if the p99 is above the limit, 0 otherwise
+ */
+static int report(Samples * s, const char * name, double limit)
+{
+    double p99;
+    qsort(s->ms, s->n, sizeof(double), compareMs);
+    p99 = percentile(s, 99);
+    printf("%-38s %6d %9.2f %9.2f %9.2f", name, s->n, percentile(s, 50), p99, s->ms[s->n-1]);
+    if(limit > 0)
+        printf(" %9.0f%s", limit, p99 > limit ? "  OVER" : "");
+    printf("\n");
+    return limit > 0 && p99 > limit;
+}
+
+int main(int argc, char ** argv)
+{
+    int runs = 50;
+    int opt, failed = 0;
+    char name[64];
+
+    rng = 1;
+    while((opt = getopt(argc, argv, "n:S:v")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n':
+                runs = atoi(optarg);
+                break;
+            case 'S':
+                rng = strtoull(optarg, NULL, 0);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: simsession [-n runs] [-S seed] [-v]\n");
+                return 1;
+        }
+    }
+    if(runs < 1)
+        runs = 1;
+    if(rng == 0)
+        rng = 1;
+
+    storeTank(0, "DIESEL", 200, 100, 150);
+    storeTank(1, "WATER", 100, 100, 200);
+    storeTank(2, "GAS", 300, 120, 120);
+    SimReset();
+    SimEchoDistance(0, 40);
+    SimEchoDistance(1, 120);
+    SimEchoDistance(2, 60);
+    SimEchoDistance(3, 90);
+    SimStart(firmwareMain);
+    SimRunFor(SimCyclesOf(10000));  //Past the boot and the first live levels
+
+    for(int i = 0; i < runs && !failed; i++)
+        for(unsigned s = 0; s < SESSIONS && !failed; s++)
+            failed = runSession(s, runs, i == 0);
+    if(failed)
+        return 1;
+
+    printf("simsession: %d tanks, %ld Hz, %d runs, latencies in simulated ms\n",
+           TANK_COUNT, (long)_XTAL_FREQ, runs);
+    printf("%-38s %6s %9s %9s %9s %9s\n", "", "count", "p50", "p99", "max", "limit");
+    for(int i = 0; i < stepNames; i++)
+        failed |= report(&steps[i], steps[i].name, limitOf(steps[i].name));
+    for(unsigned s = 0; s < SESSIONS; s++)
+    {
+        snprintf(name, sizeof(name), "%s, on the board", sessions[s].name);
+        failed |= report(&boardTimes[s], name, limitOf(sessions[s].name));
+        snprintf(name, sizeof(name), "%s, with pauses", sessions[s].name);
+        report(&wholeTimes[s], name, 0);
+    }
+    printf("LCD bytes %u (too early %u), EEPROM writes %u\n",
+           SimLCDWrites(), SimLCDViolations(), SimEEPROMWrites());
+    if(failed)
+        fprintf(stderr, "simsession: a latency is above its limit\n");
+    return failed || SimLCDViolations() != 0;
+}
@@ -0,0 +1,702 @@
+/*
+ * File:   sim.c
+ * Author: Faris Shahin
+ *
+ * Core of the simulator: virtual clock, timers, interrupts, EEPROM, USART,
+ * ADC and the coroutine the firmware runs in. See sim.h.
+ *
+ * Note: The clock moves in steps that never pass the next timer flag or the
+ * end of an EEPROM write, a byte on the USART or an ADC conversion, so interrupts are raised at
+ * the cycle the PIC would raise them (plus the instruction that was running).
+ */
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include "config.h"
+#include "sim.h"
+
+#define STACK_SIZE      (256*1024)
+#define NEVER           UINT64_MAX
+
+volatile uint8_t PORTA, PORTB, PORTC, PORTD, PORTE;
+volatile uint8_t TRISA, TRISB, TRISC, TRISD, TRISE;
+volatile uint8_t TMR0, OPTION_REG, INTCON;
+volatile uint8_t PIR1, PIE1, PIR2, PIE2;
+volatile uint8_t TMR1L, TMR1H, T1CON;
+volatile uint8_t TMR2, PR2, T2CON;
+volatile uint8_t CCPR1L, CCPR1H, CCP1CON;
+volatile uint8_t ADCON0, ADCON1, ADRESH, ADRESL;
+volatile uint8_t TXSTA, RCSTA, SPBRG;
+volatile uint8_t EEADR, EECON1, EECON2;
+static volatile uint8_t eedata;
+static volatile uint8_t txreg;
+static volatile uint8_t rcreg;
+
+uint64_t simCycles = 0;
+
+void tc_int(void);                  //Interrupt function of main.c
+
+//Timers. A write of the firmware to a timer register is seen as a value other
+//than the one the simulator left, which clears the prescaler like on the PIC.
+static uint32_t tmr0Pre;            //Cycles counted by the TMR0 prescaler
+static uint8_t tmr0Last;            //TMR0 as the simulator left it
+static uint32_t tmr2Pre;
+static uint8_t tmr2Post;            //Matches counted by the TMR2 postscaler
+static uint8_t tmr2Last;
+static uint32_t tmr1Pre;
+static uint16_t tmr1Last;
+
+//EEPROM
+static uint8_t eeprom[EE_SIZE];
+static uint64_t eeDone = NEVER;     //End of the write in progress
+static uint8_t eeAddr, eeData;      //Write in progress
+static uint32_t eeWrites;
+static uint32_t eeCellWrites[EE_SIZE];  //Writes of each byte, the wear of the cell
+static uint32_t eeLoss = UINT32_MAX;    //Writes after which the power is lost, see SimPowerLoss()
+
+//USART. Bytes sent by the firmware are kept for SimUARTRead(), bytes of
+//SimUARTSend() arrive one per character time.
+#define UART_LOG        4096        //Sent bytes kept, a power of 2
+#define UART_CHAR       ((_XTAL_FREQ/4)*10/UART_BAUD)  //8 data bits, start and stop
+static uint8_t txLoaded;            //TXREG was written since the last step
+static uint64_t txDone = NEVER;     //End of the byte being sent
+static uint32_t txBytes;
+static uint8_t txLog[UART_LOG];
+static uint32_t txRead;             //Bytes of txLog taken by SimUARTRead()
+static uint8_t rxQueue[UART_LOG];
+static uint32_t rxIn, rxOut;        //Bytes given to SimUARTSend() and arrived
+static uint64_t rxNext = NEVER;     //End of the byte arriving
+
+//ADC
+static uint64_t adDone = NEVER;     //End of the conversion in progress
+
+//Coroutines: one for SimStart(), one for SimCall()
+static ucontext_t hostContext;
+static ucontext_t fwContext[2];
+static char * fwStack[2];
+static void (*fwFunction[2])(void);
+static uint8_t fwFinished[2];
+static ucontext_t * current;        //Coroutine running, NULL when the host runs
+static uint8_t currentSlot;
+static uint64_t stopAt = NEVER;
+static uint8_t (*stopWhen)(void);
+static uint8_t inInterrupt;
+static uint32_t isrCycles;          //Cycles of the interrupt not on the clock yet
+#define ISR_BATCH       64          //At most, so a loop of the interrupt polling a bit still ends
+
+/*
+ * Cycles until TMR0 overflows, NEVER if it counts something else
+ */
+static uint64_t tmr0Left(void)
+{
+    uint32_t pre = (OPTION_REG & 0x08) ? 1 : 2u << (OPTION_REG & 0x07);
+    if(OPTION_REG & 0x20)       //T0CKI pin, not simulated
+        return NEVER;
+    return (uint64_t)(256 - TMR0)*pre - tmr0Pre;
+}
+
+/*
+ * Cycles until TMR2 sets TMR2IF, NEVER if it's off
+ */
+static uint64_t tmr2Left(void)
+{
+    static const uint8_t prescale[4] = {1, 4, 16, 16};
+    uint32_t pre = prescale[T2CON & 0x03];
+    uint32_t post = ((T2CON>>3) & 0x0f) + 1;
+    uint64_t toMatch;
+    if(!(T2CON & 0x04))
+        return NEVER;
+    toMatch = (TMR2 <= PR2) ? (uint64_t)(PR2 - TMR2 + 1)*pre - tmr2Pre
+                            : (uint64_t)(256 - TMR2 + PR2 + 1)*pre - tmr2Pre;
+    return toMatch + (uint64_t)(post - 1 - tmr2Post)*(PR2+1)*pre;
+}
+
+/*
+ * Cycles until TMR1 matches CCPR1 in compare mode (the Modbus timer), NEVER
+ * if it's off or CCP1 isn't comparing
+ */
+static uint64_t tmr1Left(void)
+{
+    uint32_t tmr1, ccp, pre;
+    if((T1CON & 0x03) != 0x01 || (CCP1CON & 0x0C) != 0x08)
+        return NEVER;
+    tmr1 = (uint16_t)TMR1H << 8 | TMR1L;
+    ccp = (uint16_t)CCPR1H << 8 | CCPR1L;
+    pre = 1u << ((T1CON>>4) & 0x03);
+    if(ccp <= tmr1)
+        ccp += 0x10000;
+    return (uint64_t)(ccp - tmr1)*pre - tmr1Pre;
+}
+
+/*
+ * Move the timers by a number of cycles, at most up to the next TMR0, TMR2 or
+ * CCP1 flag
+ */
+static void runTimers(uint32_t n)
+{
+    static const uint8_t prescale[4] = {1, 4, 16, 16};
+    uint32_t pre, ticks, first;
+
+    if(TMR0 != tmr0Last)
+        tmr0Pre = 0;
+    if(!(OPTION_REG & 0x20))
+    {
+        pre = (OPTION_REG & 0x08) ? 1 : 2u << (OPTION_REG & 0x07);
+        ticks = (tmr0Pre + n) / pre;
+        tmr0Pre = (tmr0Pre + n) % pre;
+        if(TMR0 + ticks > 255)
+            INTCON |= 0x04;     //TMR0IF
+        TMR0 = (TMR0 + ticks) & 0xff;
+    }
+    tmr0Last = TMR0;
+
+    if(TMR2 != tmr2Last)
+        tmr2Pre = 0;
+    if(T2CON & 0x04)
+    {
+        pre = prescale[T2CON & 0x03];
+        ticks = (tmr2Pre + n) / pre;
+        tmr2Pre = (tmr2Pre + n) % pre;
+        first = (TMR2 <= PR2) ? PR2 - TMR2 + 1 : 256 - TMR2 + PR2 + 1;
+        if(ticks >= first)
+        {
+            tmr2Post += 1 + (ticks - first)/(PR2+1);
+            TMR2 = (ticks - first) % (PR2+1);
+            if(tmr2Post >= ((T2CON>>3) & 0x0f) + 1)
+            {
+                tmr2Post = 0;
+                PIR1 |= 0x02;   //TMR2IF
+            }
+        }
+        else
+            TMR2 += ticks;
+    }
+    tmr2Last = TMR2;
+
+    //TMR1 on the instruction clock, with the compare of CCP1 (the Modbus
+    //timer). The special event trigger, which clears TMR1, isn't simulated.
+    if(((uint16_t)TMR1H << 8 | TMR1L) != tmr1Last)
+        tmr1Pre = 0;
+    if((T1CON & 0x03) == 0x01)
+    {
+        uint32_t tmr1 = (uint16_t)TMR1H << 8 | TMR1L;
+        uint32_t ccp = (uint16_t)CCPR1H << 8 | CCPR1L;
+        if(ccp <= tmr1)
+            ccp += 0x10000;
+        pre = 1u << ((T1CON>>4) & 0x03);
+        tmr1 += (tmr1Pre + n) / pre;
+        tmr1Pre = (tmr1Pre + n) % pre;
+        if((CCP1CON & 0x0C) == 0x08 && tmr1 >= ccp)
+            PIR1 |= 0x04;       //CCP1IF
+        if(tmr1 > 0xffff)
+            PIR1 |= 0x01;       //TMR1IF
+        TMR1H = (tmr1 >> 8) & 0xff;
+        TMR1L = tmr1 & 0xff;
+    }
+    tmr1Last = (uint16_t)TMR1H << 8 | TMR1L;
+}
+
+/*
+ * Cycles of an ADC conversion (12 Tad) with the clock ADCON0 and ADCON1 select
+ */
+static uint64_t adCycles(void)
+{
+    static const uint8_t divisor[8] = {2, 8, 32, 0, 4, 16, 64, 0};  //Of Fosc, 0 for the RC oscillator
+    uint8_t adcs = (ADCON0 >> 6) | ((ADCON1 & 0x40) ? 4 : 0);
+    if(divisor[adcs] == 0)
+        return 48*(_XTAL_FREQ/4000000);     //Tad of the RC oscillator, 4us typical
+    return 3*divisor[adcs];
+}
+
+/*
+ * Start and finish EEPROM writes, bytes on the USART and ADC conversions
+ */
+static void runPeripherals(void)
+{
+    if(EECON1 & 0x01)           //RD
+    {
+        eedata = eeprom[EEADR];
+        EECON1 &= ~0x01;
+    }
+    if((EECON1 & 0x02) && eeDone == NEVER)  //WR set by the firmware
+    {
+        if(EECON1 & 0x04)       //WREN
+        {
+            eeAddr = EEADR;
+            eeData = eedata;
+            eeDone = simCycles + SIM_EE_WRITE_CYCLES;
+        }
+        else
+            EECON1 &= ~0x02;    //The write doesn't start
+    }
+    if(simCycles >= eeDone)
+    {
+        if(eeWrites < eeLoss)
+            eeprom[eeAddr] = eeData;
+        eeWrites++;
+        eeCellWrites[eeAddr]++;
+        eeDone = NEVER;
+        EECON1 &= ~0x02;
+        PIR2 |= 0x10;           //EEIF
+    }
+
+    if(txLoaded)
+    {
+        txLoaded = 0;
+        txLog[txBytes & (UART_LOG-1)] = txreg;
+        txBytes++;
+        txDone = simCycles + UART_CHAR;
+        PIR1 &= ~0x10;          //TXIF
+        TXSTA &= ~0x02;         //TRMT
+    }
+    if(simCycles >= txDone)
+        txDone = NEVER;
+    if(txDone == NEVER)
+    {
+        PIR1 |= 0x10;
+        TXSTA |= 0x02;
+    }
+
+    if(!(RCSTA & 0x10))         //Clearing CREN clears OERR
+        RCSTA &= ~0x02;
+    if(rxNext == NEVER && rxOut != rxIn)
+        rxNext = simCycles + UART_CHAR;
+    if(simCycles >= rxNext)
+    {
+        //A byte arriving with the receiver off is lost. The PIC holds 2
+        //bytes, this model one: the host waits for the replies anyway.
+        if((RCSTA & 0x90) == 0x90)
+        {
+            if(PIR1 & 0x20)
+                RCSTA |= 0x02;  //OERR
+            else
+            {
+                rcreg = rxQueue[rxOut & (UART_LOG-1)];
+                PIR1 |= 0x20;   //RCIF
+            }
+        }
+        rxOut++;
+        rxNext = rxOut != rxIn ? rxNext + UART_CHAR : NEVER;
+    }
+
+    if(!(ADCON0 & 0x01))        //Turning the ADC off stops a conversion
+    {
+        ADCON0 &= ~0x04;
+        adDone = NEVER;
+    }
+    else if((ADCON0 & 0x04) && adDone == NEVER)     //GO set by the firmware
+        adDone = simCycles + adCycles();
+    if(simCycles >= adDone)
+    {
+        uint16_t result = SimAnalogRead((ADCON0 >> 3) & 0x07);
+        if(ADCON1 & 0x80)       //ADFM, right justified
+        {
+            ADRESH = result >> 8;
+            ADRESL = result & 0xff;
+        }
+        else
+        {
+            ADRESH = result >> 2;
+            ADRESL = (result & 0x03) << 6;
+        }
+        adDone = NEVER;
+        ADCON0 &= ~0x04;
+        PIR1 |= 0x40;           //ADIF
+    }
+}
+
+/*
+ * Run the interrupt function if an enabled interrupt is pending and GIE is set,
+ * again as soon as it returns if one was raised while it ran
+ */
+static void runInterrupts(void)
+{
+    uint8_t pending;
+    while(!inInterrupt && (INTCON & 0x80))
+    {
+        pending = (INTCON & 0x20) && (INTCON & 0x04);
+        if(INTCON & 0x40)       //PEIE
+            pending |= (PIE1 & PIR1) || (PIE2 & PIR2);
+        if(!pending)
+            return;
+
+        inInterrupt = 1;
+        INTCON &= ~0x80;
+        isrCycles = SIM_ISR_CYCLES;
+        tc_int();
+        if(isrCycles)
+            SimDelay(0);
+        INTCON |= 0x80;
+        inInterrupt = 0;
+    }
+}
+
+static void sampleDevices(void)
+{
+    SimLCDSample();
+    SimKeypadSample();
+    SimEchoSample();
+}
+
+/*
+ * Cycles until the next timer flag or the end of an EEPROM write, a byte on
+ * the USART or an ADC conversion, NEVER if none is coming
+ */
+static uint64_t untilEvent(void)
+{
+    uint64_t step, left;
+    step = tmr0Left();
+    left = tmr2Left();
+    if(left < step)
+        step = left;
+    left = tmr1Left();
+    if(left < step)
+        step = left;
+    if(eeDone != NEVER && eeDone - simCycles < step)
+        step = eeDone - simCycles;
+    if(txDone != NEVER && txDone - simCycles < step)
+        step = txDone - simCycles;
+    if(rxNext != NEVER && rxNext - simCycles < step)
+        step = rxNext - simCycles;
+    if(adDone != NEVER && adDone - simCycles < step)
+        step = adDone - simCycles;
+    return step;
+}
+
+/*
+ * Move the virtual clock. Called by the firmware through the delays and
+ * every bit access.
+ * Parameters:
+ *      cycles - instruction cycles, after the ones the interrupt put off
+ */
+void SimDelay(uint32_t cycles)
+{
+    uint64_t step, left;
+    //A flag raised while GIE was clear interrupts as soon as it's set again,
+    //not after a delay or a wait. A bit access moves one cycle anyway.
+    if(cycles > 1)
+        runInterrupts();
+    cycles += isrCycles;
+    isrCycles = 0;
+    do
+    {
+        step = cycles;
+        left = untilEvent();
+        if(left < step)
+            step = left;
+        if(step == 0 && cycles)
+            step = 1;
+
+        sampleDevices();        //Pins set by the firmware change now, not after the step
+        simCycles += step;
+        cycles -= step;
+        runTimers(step);
+        runPeripherals();
+        sampleDevices();
+        runInterrupts();
+
+        if(current && !inInterrupt && (simCycles >= stopAt || (stopWhen && stopWhen())))
+            swapcontext(current, &hostContext);
+    }while(cycles);
+}
+
+/*
+ * NOP() of the firmware. The firmware only uses NOP() in loops waiting for an
+ * interrupt, a flag or a pin, so the clock moves at once to the next thing
+ * that can end the wait: an event of untilEvent() or an edge of an echo. The
+ * loop sees the change on the same cycle as if it had polled every cycle, in
+ * one step instead of thousands. The host still gets the firmware back at the
+ * time it asked for.
+ */
+void SimWait(void)
+{
+    uint64_t step, left;
+    //What the firmware just started (a conversion, a byte, the echo of a
+    //trigger pulse) is an event to wait for, an interrupt left pending may
+    //end the wait
+    runInterrupts();
+    runPeripherals();
+    sampleDevices();
+    step = untilEvent();
+    left = SimEchoNext();
+    if(left < step)
+        step = left;
+    if(current && !inInterrupt && stopAt > simCycles && stopAt - simCycles < step)
+        step = stopAt - simCycles;
+    if(step == 0 || step > UINT32_MAX)
+        step = 1;               //Nothing will happen, poll like the PIC would
+    SimDelay((uint32_t)step);
+}
+
+/*
+ * Bit access of the firmware. The ones of the interrupt function, a few flag
+ * tests and clears, move the clock together with its entry when it returns,
+ * delays or touches EEDATA, TXREG or RCREG: one step instead of one per bit.
+ */
+volatile uint8_t * SimTouch(volatile uint8_t * reg)
+{
+    if(!inInterrupt)
+        SimDelay(1);
+    else if(++isrCycles == ISR_BATCH)
+        SimDelay(0);
+    return reg;
+}
+
+volatile uint8_t * SimEEDATA(void)
+{
+    SimDelay(1);
+    return &eedata;
+}
+
+volatile uint8_t * SimTXREG(void)
+{
+    SimDelay(1);
+    txLoaded = 1;               //Only ever written by the firmware
+    return &txreg;
+}
+
+volatile uint8_t * SimRCREG(void)
+{
+    SimDelay(1);
+    PIR1 &= ~0x20;              //Only ever read by the firmware
+    return &rcreg;
+}
+
+/*
+ * Power-on reset of the registers and of the devices. The EEPROM keeps its
+ * data. The variables of the firmware are only set up once, so the firmware
+ * can only be started once per run.
+ */
+void SimReset(void)
+{
+    PORTA = PORTB = PORTC = PORTD = PORTE = 0;
+    TRISA = TRISB = TRISC = TRISD = 0xff;
+    TRISE = 0x07;
+    TMR0 = tmr0Last = 0;
+    OPTION_REG = 0xff;
+    INTCON = 0;
+    PIR1 = PIE1 = PIR2 = PIE2 = 0;
+    T1CON = T2CON = 0;
+    TMR2 = tmr2Last = 0;
+    PR2 = 0xff;
+    CCP1CON = ADCON0 = ADCON1 = 0;
+    TXSTA = 0x02;
+    RCSTA = 0;
+    EECON1 = 0;
+    TMR1H = TMR1L = 0;
+    tmr1Last = 0;
+    tmr0Pre = tmr1Pre = tmr2Pre = tmr2Post = 0;
+    eeDone = txDone = rxNext = adDone = NEVER;
+    txLoaded = 0;
+    txRead = txBytes;
+    rxOut = rxIn;
+    simCycles = 0;
+    eeLoss = UINT32_MAX;
+    SimLCDReset();
+    SimKeyRelease();
+    SimEchoReset();
+    SimPressureReset();
+}
+
+/*
+ * Erase the EEPROM (all bytes 0xff)
+ */
+static void eraseOnce(void)
+{
+    static uint8_t erased;
+    if(!erased)
+        memset(eeprom, 0xff, sizeof(eeprom));
+    erased = 1;
+}
+
+uint8_t SimEEPROMRead(uint8_t addr)
+{
+    eraseOnce();
+    return eeprom[addr];
+}
+
+void SimEEPROMWrite(uint8_t addr, uint8_t data)
+{
+    eraseOnce();
+    eeprom[addr] = data;
+}
+
+uint32_t SimEEPROMWrites(void)
+{
+    return eeWrites;
+}
+
+/*
+ * Lose the power after some more EEPROM writes: the write running then and
+ * every later one never reach the EEPROM, as if the PIC had stopped there.
+ * The firmware runs on until SimReset(), the power up, but whatever it does
+ * is lost.
+ * Parameters:
+ *      writes - the writes that still reach the EEPROM
+ */
+void SimPowerLoss(uint32_t writes)
+{
+    eeLoss = eeWrites + writes;
+}
+
+/*
+ * Returns:
+ *      The writes of the firmware to one byte of the EEPROM. The data EEPROM
+ *      of the PIC16F877A is good for 100000 writes of a byte at least.
+ */
+uint32_t SimEEPROMCellWrites(uint8_t addr)
+{
+    return eeCellWrites[addr];
+}
+
+uint32_t SimUARTBytes(void)
+{
+    return txBytes;
+}
+
+/*
+ * Send bytes to the USART of the firmware, as a PC on the serial port would.
+ * They arrive one per character time from now, after the ones sent before.
+ */
+void SimUARTSend(const uint8_t * data, uint32_t len)
+{
+    for(uint32_t i = 0; i < len && rxIn - rxOut < UART_LOG; i++)
+        rxQueue[rxIn++ & (UART_LOG-1)] = data[i];
+}
+
+/*
+ * Take the bytes the firmware sent since the last call
+ * Parameters:
+ *      *data - where the bytes are copied
+ *      max - the most bytes to take
+ * Returns:
+ *      The number of bytes taken. Only the last UART_LOG bytes are kept.
+ */
+uint32_t SimUARTRead(uint8_t * data, uint32_t max)
+{
+    uint32_t n = 0;
+    if(txBytes - txRead > UART_LOG)
+        txRead = txBytes - UART_LOG;
+    while(n < max && txRead != txBytes)
+        data[n++] = txLog[txRead++ & (UART_LOG-1)];
+    return n;
+}
+
+static void entry0(void)
+{
+    fwFunction[0]();
+    fwFinished[0] = 1;
+}
+
+static void entry1(void)
+{
+    fwFunction[1]();
+    fwFinished[1] = 1;
+}
+
+/*
+ * Run a coroutine until it stops or finishes
+ */
+static void resume(uint8_t slot)
+{
+    ucontext_t * previous = current;
+    uint8_t previousSlot = currentSlot;
+    current = &fwContext[slot];
+    currentSlot = slot;
+    swapcontext(&hostContext, current);
+    current = previous;
+    currentSlot = previousSlot;
+}
+
+/*
+ * Prepare a coroutine for a function
+ */
+static void prepare(uint8_t slot, void (*fn)(void))
+{
+    eraseOnce();
+    if(!fwStack[slot])
+        fwStack[slot] = malloc(STACK_SIZE);
+    getcontext(&fwContext[slot]);
+    fwContext[slot].uc_stack.ss_sp = fwStack[slot];
+    fwContext[slot].uc_stack.ss_size = STACK_SIZE;
+    fwContext[slot].uc_link = &hostContext;
+    makecontext(&fwContext[slot], slot ? entry1 : entry0, 0);
+    fwFunction[slot] = fn;
+    fwFinished[slot] = 0;
+}
+
+/*
+ * Start a function of the firmware, normally firmwareMain(). It runs when
+ * one of the SimRun...() functions is called.
+ */
+void SimStart(void (*fn)(void))
+{
+    prepare(0, fn);
+}
+
+/*
+ * Run the function given to SimStart() for some time
+ * Parameters:
+ *      cycles - instruction cycles to run
+ * Returns:
+ *      1 if the time passed, 0 if the function returned before
+ */
+uint8_t SimRunFor(uint64_t cycles)
+{
+    return SimRunUntil(NULL, cycles);
+}
+
+/*
+ * Run the function given to SimStart() until something happens
+ * Parameters:
+ *      done - checked after every step of the clock, returns 1 to stop
+ *      limit - most instruction cycles to run
+ * Returns:
+ *      1 if done() returned 1 (or the time passed with done NULL), 0 if the
+ *      limit was reached or the function returned
+ */
+uint8_t SimRunUntil(uint8_t (*done)(void), uint64_t limit)
+{
+    if(fwFinished[0])
+        return 0;
+    stopAt = simCycles + limit;
+    stopWhen = done;
+    resume(0);
+    stopWhen = NULL;
+    if(fwFinished[0])
+        return 0;
+    return done ? done() : 1;
+}
+
+/*
+ * Run a function of the firmware to its end, e.g. view() while the function
+ * given to SimStart() waits where it stopped
+ * Returns:
+ *      The instruction cycles it took
+ */
+uint64_t SimCall(void (*fn)(void))
+{
+    uint64_t start = simCycles;
+    uint64_t savedAt = stopAt;
+    uint8_t (*savedWhen)(void) = stopWhen;
+    stopAt = NEVER;
+    stopWhen = NULL;
+    prepare(1, fn);
+    resume(1);
+    stopAt = savedAt;
+    stopWhen = savedWhen;
+    return simCycles - start;
+}
+
+double SimMs(uint64_t cycles)
+{
+    return cycles / (_XTAL_FREQ/4000.0);
+}
+
+uint64_t SimCyclesOf(double ms)
+{
+    return (uint64_t)(ms * (_XTAL_FREQ/4000.0));
+}
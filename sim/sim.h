@@ -0,0 +1,119 @@
+/*
+ * File:   sim.h
+ * Author: Faris Shahin
+ * Comments:
+ * Simulator to run the firmware on a PC. The firmware sources are built
+ * against xc.h of this folder; the simulator provides what the
+ * PIC16F877A and the board would:
+ *      - a virtual clock in instruction cycles (Fosc/4), moved by the delays
+ *        and every bit access of the firmware, and to the next event by the
+ *        NOP() of its busy waits
+ *      - TMR0, TMR2 and their interrupts, TMR1 on the instruction clock with
+ *        the compare of CCP1, the EEPROM with its 4ms writes and EEIF, the
+ *        USART at UART_BAUD with what it sends and receives, the ADC with its
+ *        12 Tad conversions and ADIF
+ *      - an HD44780 on the LCD pins, the keypad matrix, and the HC-SR04
+ *        sensors and pressure transducers behind the MUX
+ * The firmware runs in its own coroutine. SimStart() starts a function in it
+ * (normally firmwareMain(), the main() of main.c) and SimRun...() run it until
+ * some virtual time has passed or something happened, so a test or benchmark
+ * can press keys, change levels and look at the LCD in between.
+ *
+ * Cycles only count what the delays and waits take, not the instructions of
+ * the C code in between: the simulator can't know what XC8 makes of it. On
+ * this firmware the waits (LCD, sensors, EEPROM, keypad) are most of the time.
+ *
+ * Revision History: v1.0
+ */
+
+#ifndef SIM_H
+#define	SIM_H
+
+#include <stdint.h>
+
+#define SIM_ISR_CYCLES      30      //Entering and leaving the interrupt (context save and restore)
+#define SIM_EE_WRITE_CYCLES (4L*(_XTAL_FREQ/4000))    //Data EEPROM write time, 4ms typical
+
+#define SIM_LCD_COLS        16
+#define SIM_LCD_ROWS        4
+
+#define SIM_NO_ECHO         0       //Distance of a sensor that never answers
+#define SIM_STUCK_PINGS     100     //Pings a sensor whose echo line stuck high stays so
+#define SIM_NO_TRANSDUCER   (-1.0)  //Level of a channel with no pressure transducer
+
+//How the distance of a sensor moves, see SimSensor
+#define SIM_PROFILE_FIXED   0       //Always at distance
+#define SIM_PROFILE_DRAIN   1       //From distance to distance+amplitude in period, then back at once
+#define SIM_PROFILE_REFILL  2       //From distance+amplitude to distance in period, then back at once
+#define SIM_PROFILE_SLOSH   3       //Sine of amplitude around distance with period
+
+/*
+ * A sensor and the liquid it sees. Chances are per ping, from 0 to 1.
+ */
+typedef struct
+{
+    uint8_t profile;        //SIM_PROFILE_...
+    double distance;        //cm
+    double amplitude;       //cm
+    double period;          //s
+    double jitter;          //Standard deviation of the distance in cm
+    double multipath;       //Chance of an echo that went twice to the liquid
+    double dropout;         //Chance of no echo
+    double stuck;           //Chance of the echo line sticking high for SIM_STUCK_PINGS
+    double crosstalk;       //Chance of hearing the sensor of the other channel of the pair
+} SimSensor;
+
+extern uint64_t simCycles;          //Virtual time in instruction cycles
+
+//Core (sim.c)
+void SimReset(void);
+void SimStart(void (*fn)(void));
+uint8_t SimRunFor(uint64_t cycles);
+uint8_t SimRunUntil(uint8_t (*done)(void), uint64_t limit);
+uint64_t SimCall(void (*fn)(void));
+double SimMs(uint64_t cycles);
+uint64_t SimCyclesOf(double ms);
+uint8_t SimEEPROMRead(uint8_t addr);
+void SimEEPROMWrite(uint8_t addr, uint8_t data);
+uint32_t SimEEPROMWrites(void);
+void SimPowerLoss(uint32_t writes);
+uint32_t SimEEPROMCellWrites(uint8_t addr);
+uint32_t SimUARTBytes(void);
+void SimUARTSend(const uint8_t * data, uint32_t len);
+uint32_t SimUARTRead(uint8_t * data, uint32_t max);
+
+//HD44780 (hd44780.c)
+void SimLCDReset(void);
+void SimLCDSample(void);
+void SimLCDLine(uint8_t row, char * text);
+uint32_t SimLCDWrites(void);
+uint64_t SimLCDLastWrite(void);
+uint32_t SimLCDViolations(void);
+void SimLCDPrint(void);
+
+//Keypad matrix (keypad.c)
+void SimKeyPress(char key);
+void SimKeyRelease(void);
+void SimKeypadSample(void);
+
+//HC-SR04 sensors behind the MUX (hcsr04.c)
+void SimEchoReset(void);
+void SimEchoSeed(uint64_t seed);
+void SimEchoDistance(uint8_t channel, uint16_t cm);
+void SimEchoSensor(uint8_t channel, const SimSensor * sensor);
+double SimEchoTrue(uint8_t channel);
+uint32_t SimEchoPing(uint8_t channel);
+void SimEchoSample(void);
+uint64_t SimEchoNext(void);
+uint32_t SimEchoPings(void);
+uint8_t SimMuxChannel(void);
+
+//Pressure transducers behind the MUX and the analog inputs (transducer.c)
+void SimPressureReset(void);
+void SimPressureSeed(uint64_t seed);
+void SimPressureLevel(uint8_t channel, double cm);
+void SimPressureNoise(double lsb);
+uint16_t SimAnalogRead(uint8_t input);
+uint32_t SimAnalogConversions(void);
+
+#endif	/* SIM_H */
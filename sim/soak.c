@@ -0,0 +1,1096 @@
+/*
+ * File:   soak.c
+ * Author: Faris Shahin
+ *
+ * Soak test of the firmware: months of a site in the simulator, to find what
+ * only goes wrong after a long time (wear of the EEPROM, counters that
+ * overflow, filters and clocks that drift). The tanks are used during the
+ * working hours and refilled by deliveries, from a script with some spread
+ * from one day to the next.
+ *
+ * The main loop of the firmware spins with nothing to do between two scans,
+ * so it goes through SoakGetEvent() (see the Makefile), which moves the clock
+ * from one interrupt to the next until the scan is due instead of running the
+ * loop. The readings and everything after them run cycle by cycle as usual,
+ * and the busy waits jump to their event (see SimWait()), so the simulated
+ * time advances from event to event.
+ *
+ * That is still about 0.4 simulated days a second on a PC, 90 days in about 4
+ * minutes for each of simsoak and simsoakmb, not months in seconds. The
+ * events are the interrupts of the firmware, which all still run: at 4MHz
+ * about 110 a second (61 TMR0 overflows, 25 ticks of the clock, the rest
+ * bytes on the serial port and EEPROM writes). With the scans they make about
+ * 280 steps of the simulator per simulated second, at about 100ns each.
+ * Profiled, the timers and the models of the devices take 60% of that and the
+ * firmware about 15%, with no one place to win much. Going faster would mean counting TMR0of and the clock
+ * between the scans without running the interrupt, and then the interrupt
+ * and the timing of the main loop wouldn't be soaked anymore.
+ *
+ * simsoak runs the firmware with the telemetry of telemetry.h and checks its
+ * records. simsoakmb runs it with the Modbus slave of modbus.h instead (see
+ * the Makefile), and this file is its master: it reads the input registers of
+ * a tank every POLL_S, the holding registers of one tank every hour and writes
+ * the slave address once a day, and times the replies.
+ *
+ * The report gives:
+ *      - simulated days per second of wall time
+ *      - the longest iteration of the main loop, how long the keypad isn't
+ *        looked at
+ *      - the high-water marks: the levels of the hardware stack (8 on the
+ *        PIC16F877A) taken by the main line and the interrupt, and TMR0of.
+ *        The levels are counted by the calls of the firmware (built with
+ *        -finstrument-functions), plus one in the functions of xc8Helpers[]
+ *        for the routine XC8 calls to multiply or divide. RAM is allocated by
+ *        XC8 at compile time, the stack is the only memory that grows.
+ *      - the writes to each byte of the EEPROM and how many years the busiest
+ *        ones last at that rate
+ *      - the telemetry records and the ones the firmware dropped, or the
+ *        Modbus requests, the ones not answered and the reply times
+ *      - the invariants that were violated: STACK_MARGIN levels of the stack
+ *        never used, every tank in the telemetry (or read over Modbus)
+ *        within STALE_S with a level close to the real one, no leak alarm,
+ *        every delivery in the refill log with its liters, the usage
+ *        estimate following the liters used, the clock of the firmware on
+ *        time, the configuration in the EEPROM untouched and the LCD timing.
+ *        Over Modbus every request must be answered within REPLY_S, with the
+ *        settings of the tank.
+ *
+ * Usage:
+ *      simsoak [-d days] [-S seed] [-m] [-v]
+ *      simsoakmb [-d days] [-S seed] [-m] [-v]
+ *      -d      days to simulate (default 90)
+ *      -S      seed of the daily use (default 1)
+ *      -m      print the writes of every byte of the EEPROM
+ *      -v      print a line for every simulated day
+ */
+
+#define _XOPEN_SOURCE 700
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "config.h"
+#include "sim.h"
+
+#define DAY_S           86400.0
+#define WORK_START      7       //Hours the tanks are used, from 7:00 to 19:00
+#define WORK_END        19
+#define USE_SPREAD      0.25    //The use of a day is the average of its tank +-25%
+#define REFILL_BELOW    0.25    //A delivery is ordered when a tank is below this part of its height
+#define REFILL_TO       0.90    //and fills it up to this part
+#define REFILL_HOUR     9       //Deliveries come the next day, tank 0 at this hour and the next ones an hour later
+#define FILL_CM_MIN     2.0     //Rise of the level during a delivery in cm per minute
+
+#define LEVEL_CM        3       //Largest difference of a reading to the real level
+#define STALE_S         30      //Longest time a tank may go without a telemetry record
+#define LOG_S           1800    //Time after the end of a delivery for it to be in the refill log
+#define REFILL_ERROR    0.10    //Error allowed on the liters of a logged refill
+//Error allowed on the usage estimate, in cm of the tank a day: the deadband
+//left uncounted at the end of a day and 1 cm of reading error
+#define USAGE_CM        (USAGE_DEADBAND + 1)
+#define CLOCK_S         1       //Error allowed on ClockSeconds()
+#define STACK_LEVELS    8       //Hardware stack of the PIC16F877A
+#define STACK_MARGIN    1       //Levels of it that must stay free
+#define EE_ENDURANCE    100000.0    //Writes of a byte of the data EEPROM, minimum of the datasheet
+#define EE_LIFE_YEARS   10      //Years each byte of the EEPROM must last at the rate of the soak
+#define MAX_VIOLATIONS  16      //Kinds of violations kept
+#define POLL_S          2.0     //Modbus: a tank's input registers are read at this interval, one tank after the other
+#define REPLY_S         1.0     //Modbus: longest wait for a reply, longer than MODBUS_REPLY_MS
+#define UART_CHAR_CYCLES ((_XTAL_FREQ/4)*10/UART_BAUD)  //A byte on the serial port, 10 bits as sim.c sends them
+
+void firmwareMain(void);
+void tc_int(void);
+uint8_t SoakGetEvent(void);
+
+//Functions in which XC8 calls a routine of its library to multiply, divide or
+//take the modulo (by anything but a power of 2), one more level of the stack
+//than their own calls. Kept by hand from the code of source/; file is NULL
+//for the functions that aren't static.
+static const struct
+{
+    const char * file;
+    const char * name;
+} xc8Helpers[] = {
+    {"alarm.c", "sample"}, {"leak.c", "apply"}, {"refill.c", "logRefill"},
+    {"refill.c", "readSlot"}, {"sm.c", "drawPage"}, {"sm.c", "drawRefills"},
+    {"tank_config.c", "moveModbusAddress"}, {"tank_config.c", "readRecord"},
+    {NULL, "HistoryService"}, {NULL, "LeakInit"}, {NULL, "LeakService"},
+    {NULL, "LeakSetup"}, {NULL, "LeakValid"}, {NULL, "LeakWindow"},
+    {NULL, "PressurePoll"}, {NULL, "RefillInit"}, {NULL, "RefillRead"},
+    {NULL, "TankConfigSave"}, {NULL, "UltraSonicStart"},
+    {NULL, "UsageDaysLeft"}, {NULL, "UsageService"}, {NULL, "init"},
+    {NULL, "measureTank"}, {NULL, "numSet"}, {NULL, "previousPage"},
+    {NULL, "tankLiters"},
+#if SERIAL_PROTOCOL == SERIAL_MODBUS
+    {"modbus.c", "readRegister"}, {"modbus.c", "writeRegister"},
+#else
+    {"provision.c", "writeTank"},
+#endif
+};
+#define XC8_HELPERS     (sizeof(xc8Helpers)/sizeof(*xc8Helpers))
+static uintptr_t helperFns[XC8_HELPERS];    //Their addresses, sorted
+
+static const struct
+{
+    const char * name;
+    uint16_t length, width, height;     //cm
+    uint8_t sensor;                     //SENSOR_...
+    double use;                         //cm used on an average day
+} tanks[TANK_COUNT] = {
+    {"DIESEL", 200, 100, 150, SENSOR_ULTRASONIC, 12},
+    {"WATER", 100, 100, 200, SENSOR_ULTRASONIC, 25},
+    {"GAS", 300, 120, 120, SENSOR_ULTRASONIC, 10},
+    {"OIL", 100, 80, 100, SENSOR_PRESSURE, 6},
+};
+
+//Script of a tank
+static struct
+{
+    double level;           //Real level in cm
+    double truth;           //Level the sensor shows for the scan being taken
+    double today;           //cm to use today
+    double usedToday;       //cm used so far today
+    double expected;        //Usage estimate the firmware should have in liters a day
+    uint8_t days;           //Days in it, like the firmware
+    double orderedFor;      //Time of the delivery in s, 0 if none is ordered
+    double fillFrom;        //Level the delivery started at, -1 if none is going on
+    double delivered;       //Liters of the last delivery, until it is in the refill log
+    double deliveredAt;     //End of that delivery, 0 once it was logged
+    double lastRecord;      //Time of the last telemetry record
+} script[TANK_COUNT];
+
+static struct
+{
+    const char * what;
+    uint32_t count;
+    double first;           //Time of the first one
+    char detail[96];        //What the first one was
+} violations[MAX_VIOLATIONS];
+static int violationKinds = 0;
+
+static uint64_t rng = 1;
+static int verbose = 0;
+static double scriptTime;           //Time the script has reached in s
+static long scriptDay;              //Day of scriptTime
+static double nextCheck;            //Time of the next hourly check
+static double lastScan;             //Time of the last scan, when SoakGetEvent() let it happen
+static uint32_t scans;
+
+//Main loop and high-water marks
+static uint64_t loopStart;          //Cycle the current iteration of the main loop started
+static uint64_t longestLoop;
+static double longestLoopAt;
+static int depth;                   //Calls of the firmware going on
+static int isrFrom = -1;            //depth when the interrupt came in, -1 outside of it
+static int mainPeak, isrPeak;
+static uint16_t tmr0ofPeak;
+
+#if SERIAL_PROTOCOL == SERIAL_MODBUS
+//Modbus master
+static uint8_t mbReply[MODBUS_BUF];
+static uint32_t mbHave;             //Bytes of the reply received
+static uint32_t mbWant;             //Bytes of the reply expected, 0 with no request out
+static uint8_t mbRequest[8];
+static double mbSentAt;             //Time the request was sent
+static uint64_t mbEnd;              //Cycle its last byte arrives
+static uint64_t mbStartAt;          //Cycle the reply started, 0 until then
+static uint64_t mbQuiet;            //Cycle the bus is free for the next request
+static double mbNextPoll, mbNextHolding, mbNextWrite;
+static uint8_t mbTank;              //Tank of the next read of the input registers
+static uint32_t requests, unanswered;
+static double replyTotal, replyWorst;   //ms
+#else
+//Telemetry
+static uint8_t tlm[4096];
+static uint32_t tlmHave;
+static int tlmSeq = -1;             //Sequence number of the last record, -1 before the first
+static uint32_t records;
+static uint32_t dropped;            //Sequence numbers skipped
+#endif
+
+static uint8_t configImage[EE_TANKS_END];   //Header and tanks as stored
+static uint8_t refillImage[EE_REFILL_COUNT][REFILL_REC_SIZE];   //Refills in the log
+static uint32_t deliveries, logged;
+
+//xorshift64*, the script doesn't depend on the C library
+static double uniform(void)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (double)((rng * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+}
+
+static double seconds(void)
+{
+    return simCycles / (_XTAL_FREQ/4.0);
+}
+
+static double litersPerCm(uint8_t t)
+{
+    return tanks[t].length * tanks[t].width / 1000.0;
+}
+
+static const char * timeText(double s)
+{
+    static char text[48];
+    long whole = (long)s;
+    snprintf(text, sizeof(text), "day %ld %02ld:%02ld:%02ld", whole/86400, whole/3600%24, whole/60%60, whole%60);
+    return text;
+}
+
+/*
+ * Count a violation of an invariant, keeping the first of each kind
+ */
+static void violation(const char * what, const char * format, ...)
+{
+    va_list args;
+    int i;
+    for(i = 0; i < violationKinds; i++)
+        if(strcmp(violations[i].what, what) == 0)
+            break;
+    if(i == MAX_VIOLATIONS)
+        return;
+    if(i == violationKinds)
+    {
+        violationKinds++;
+        violations[i].what = what;
+        violations[i].first = seconds();
+        va_start(args, format);
+        vsnprintf(violations[i].detail, sizeof(violations[i].detail), format, args);
+        va_end(args);
+    }
+    violations[i].count++;
+}
+
+/*
+ * Store a tank record and the header in the EEPROM, as TankConfigSave() would
+ */
+static void storeTank(uint8_t index, const char * name, uint16_t length, uint16_t width, uint16_t height, uint8_t sensor)
+{
+    uint8_t rec[REC_SIZE];
+    uint8_t padded[TANK_NAME_CHARS];
+    uint8_t crc;
+    memset(padded, ' ', TANK_NAME_CHARS);
+    memcpy(padded, name, strlen(name) < TANK_NAME_CHARS ? strlen(name) : TANK_NAME_CHARS);
+    //The firmware packs the record, the tank in RAM is loaded again at reset
+    TankConfigClear(index);
+    TankSetName(index, padded);
+    TankSetLength(index, length);
+    TankSetWidth(index, width);
+    TankSetHeight(index, height);
+    TankSetLow(index, 10);
+    TankSetCritical(index, 5);
+    TankSetHigh(index, 95);
+    TankSetSensor(index, sensor);
+    TankConfigRecord(index, rec);
+    for(uint8_t i = 0; i < REC_SIZE; i++)
+        SimEEPROMWrite(EE_TANKS_ADDR + index*EE_TANK_SLOT + i, rec[i]);
+
+    crc = 0xff;
+    crc = crc8(crc, EE_MAGIC);
+    crc = crc8(crc, EE_VERSION);
+    crc = crc8(crc, TANK_COUNT);
+    SimEEPROMWrite(EE_HEADER_ADDR, EE_MAGIC);
+    SimEEPROMWrite(EE_HEADER_ADDR+1, EE_VERSION);
+    SimEEPROMWrite(EE_HEADER_ADDR+2, TANK_COUNT);
+    SimEEPROMWrite(EE_HEADER_ADDR+3, crc);
+    SimEEPROMWrite(EE_STAMP_ADDR, EE_LOG_STAMP);   //The logs are of this layout
+}
+
+/*
+ * Put the level of a tank in front of its sensor
+ */
+static void showLevel(uint8_t t)
+{
+    SimSensor sensor = {SIM_PROFILE_FIXED, 0, 0, 0, 0.3, 0, 0, 0, 0};
+    script[t].truth = script[t].level;
+    if(tanks[t].sensor == SENSOR_PRESSURE)
+        SimPressureLevel(t, script[t].level);
+    else
+    {
+        sensor.distance = tanks[t].height - script[t].level;
+        SimEchoSensor(t, &sensor);
+    }
+}
+
+/*
+ * Close the day of the script: the estimate the firmware should now have,
+ * and how much each tank uses the new day
+ */
+static void newDay(void)
+{
+    double liters;
+    for(uint8_t t = 0; t < TANK_COUNT; t++)
+    {
+        if(scriptDay > 0)
+        {
+            //Same average as UsageService()
+            liters = script[t].usedToday * litersPerCm(t);
+            script[t].expected = (script[t].expected*script[t].days + liters)/(script[t].days + 1);
+            if(script[t].days < USAGE_AVG_DAYS-1)
+                script[t].days++;
+        }
+        script[t].usedToday = 0;
+        script[t].today = tanks[t].use * (1 + USE_SPREAD*(2*uniform() - 1));
+    }
+}
+
+/*
+ * Move the script of the tanks to a time
+ * Parameters:
+ *      now - seconds since the power up, at midnight
+ */
+static void runScript(double now)
+{
+    double dt = now - scriptTime;
+    double hour = fmod(now, DAY_S)/3600;
+    double drop;
+
+    if((long)(now/DAY_S) != scriptDay)
+    {
+        scriptDay = (long)(now/DAY_S);
+        newDay();
+    }
+    for(uint8_t t = 0; t < TANK_COUNT; t++)
+    {
+        if(script[t].fillFrom >= 0)
+        {
+            script[t].level += FILL_CM_MIN/60*dt;
+            if(script[t].level >= REFILL_TO*tanks[t].height)
+            {
+                script[t].level = REFILL_TO*tanks[t].height;
+                script[t].delivered = (script[t].level - script[t].fillFrom) * litersPerCm(t);
+                script[t].deliveredAt = now;
+                script[t].fillFrom = -1;
+                script[t].orderedFor = 0;
+            }
+        }
+        else if(hour >= WORK_START && hour < WORK_END)
+        {
+            drop = script[t].today / ((WORK_END - WORK_START)*3600.0) * dt;
+            script[t].level -= drop;
+            script[t].usedToday += drop;
+        }
+
+        if(script[t].orderedFor == 0 && script[t].level < REFILL_BELOW*tanks[t].height)
+            script[t].orderedFor = (scriptDay + 1)*DAY_S + (REFILL_HOUR + t)*3600.0;
+        else if(script[t].orderedFor > 0 && script[t].fillFrom < 0 && now >= script[t].orderedFor)
+        {
+            script[t].fillFrom = script[t].level;
+            deliveries++;
+        }
+        showLevel(t);
+    }
+    scriptTime = now;
+}
+
+#if SERIAL_PROTOCOL == SERIAL_MODBUS
+//CRC-16 of Modbus, sent low byte first
+static uint16_t crc16(const uint8_t * data, uint32_t n)
+{
+    uint16_t crc = 0xffff;
+    while(n--)
+    {
+        crc ^= *data++;
+        for(uint8_t i = 0; i < 8; i++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+    return crc;
+}
+
+/*
+ * Send a request to the board
+ * Parameters:
+ *      function - 3, 4 or 6
+ *      reg - the first register
+ *      value - the number of registers to read, or the value to write
+ *      replyLen - the bytes of the reply, with its CRC
+ */
+static void sendRequest(uint8_t function, uint16_t reg, uint16_t value, uint32_t replyLen)
+{
+    uint8_t stray[64];
+    uint16_t crc;
+    if(SimUARTRead(stray, sizeof(stray)))
+        violation("Modbus reply with no request", "0x%02x 0x%02x", stray[0], stray[1]);
+    mbRequest[0] = MODBUS_DEFAULT_ADDR;
+    mbRequest[1] = function;
+    mbRequest[2] = reg >> 8;
+    mbRequest[3] = reg & 0xff;
+    mbRequest[4] = value >> 8;
+    mbRequest[5] = value & 0xff;
+    crc = crc16(mbRequest, 6);
+    mbRequest[6] = crc & 0xff;
+    mbRequest[7] = crc >> 8;
+    SimUARTSend(mbRequest, sizeof(mbRequest));
+    mbEnd = simCycles + sizeof(mbRequest)*UART_CHAR_CYCLES;
+    mbSentAt = seconds();
+    mbStartAt = 0;
+    mbHave = 0;
+    mbWant = replyLen;
+    requests++;
+}
+
+/*
+ * Check a whole reply against the request and the script of the tanks
+ */
+static void checkReply(double now)
+{
+    uint8_t function = mbRequest[1];
+    uint16_t reg = (uint16_t)mbRequest[2]<<8 | mbRequest[3];
+    uint16_t crc = crc16(mbReply, mbHave-2);
+    uint16_t value, expected;
+    uint8_t t;
+    double ms = SimMs(mbStartAt - mbEnd);
+
+    replyTotal += ms;
+    if(ms > replyWorst)
+        replyWorst = ms;
+    if(mbReply[mbHave-2] != (crc & 0xff) || mbReply[mbHave-1] != crc >> 8)
+        violation("Modbus reply CRC", "function %u register %u", function, reg);
+    else if(mbReply[0] != MODBUS_DEFAULT_ADDR || mbReply[1] != function)
+        violation("Modbus exception", "function %u register %u: 0x%02x 0x%02x", function, reg, mbReply[1], mbReply[2]);
+    else if(function == 4)
+    {
+        t = reg / MODBUS_TANK_INPUT;
+        value = (uint16_t)mbReply[3]<<8 | mbReply[4];
+        script[t].lastRecord = now;
+        if(mbReply[12] & TLM_FLAG_NO_READING)
+            violation("reading failed", "tank %u", t);
+        else if(fabs(value - script[t].truth) > LEVEL_CM)
+            violation("level off", "tank %u read %u cm at %.1f cm", t, value, script[t].truth);
+        if(mbReply[12] & TLM_FLAG_LEAK)
+            violation("leak alarm", "tank %u, no leak in the script", t);
+    }
+    else if(function == 3)
+    {
+        //As storeTank() set them
+        t = (reg - 1) / MODBUS_TANK_HOLDING;
+        for(uint8_t i = 0; i < MODBUS_TANK_HOLDING; i++)
+        {
+            value = (uint16_t)mbReply[3+2*i]<<8 | mbReply[4+2*i];
+            switch(i)
+            {
+                case 0: case 1: case 2:
+                    expected = 0;
+                    for(uint8_t c = 2*i; c < 2*i+2; c++)
+                        expected = expected<<8 | (c < strlen(tanks[t].name) ? tanks[t].name[c] : ' ');
+                    break;
+                case 3: expected = tanks[t].length; break;
+                case 4: expected = tanks[t].width; break;
+                case 5: expected = tanks[t].height; break;
+                case 6: expected = 10; break;
+                case 7: expected = 5; break;
+                default: expected = 95; break;
+            }
+            if(value != expected)
+                violation("Modbus settings off", "tank %u register %u is %u, set to %u", t, reg+i, value, expected);
+        }
+    }
+    else if(memcmp(mbReply, mbRequest, sizeof(mbRequest)) != 0)
+        violation("Modbus write not echoed", "register %u", reg);
+}
+
+/*
+ * The master on the bus: takes the reply of the request out, or sends the
+ * next request when one is due
+ * Returns:
+ *      1 while a request is out
+ */
+static int pollMaster(double now)
+{
+    static uint8_t holdingTank;
+    if(mbWant)
+    {
+        mbHave += SimUARTRead(&mbReply[mbHave], sizeof(mbReply) - mbHave);
+        if(mbHave >= 5 && (mbReply[1] & 0x80))
+            mbWant = 5;     //An exception
+        if(mbHave >= mbWant)
+        {
+            //The last byte was just given to TXREG: it's out after a
+            //character, then t3.5 must pass before the next request
+            mbQuiet = simCycles + UART_CHAR_CYCLES*9/2;
+            checkReply(now);
+            mbWant = 0;
+        }
+        else if(now - mbSentAt > REPLY_S)
+        {
+            violation("Modbus request not answered", "function %u register %u", mbRequest[1],
+                      (uint16_t)mbRequest[2]<<8 | mbRequest[3]);
+            unanswered++;
+            mbWant = 0;
+        }
+        return mbWant != 0;
+    }
+
+    if(scans == 0 || simCycles < mbQuiet)    //No readings yet, or the bus isn't free
+        return 0;
+    for(uint8_t t = 0; t < TANK_COUNT; t++)
+        if(now - script[t].lastRecord > STALE_S)
+        {
+            violation("tank not read over Modbus", "tank %u, last read at %.0f s", t, script[t].lastRecord);
+            script[t].lastRecord = now;     //Once per STALE_S
+        }
+    if(now >= mbNextWrite)
+    {
+        sendRequest(6, 0, MODBUS_DEFAULT_ADDR, 8);
+        mbNextWrite += DAY_S;
+    }
+    else if(now >= mbNextHolding)
+    {
+        sendRequest(3, 1 + holdingTank*MODBUS_TANK_HOLDING, MODBUS_TANK_HOLDING, 5 + 2*MODBUS_TANK_HOLDING);
+        holdingTank = (holdingTank + 1) % TANK_COUNT;
+        mbNextHolding += 3600;
+    }
+    else if(now >= mbNextPoll)
+    {
+        sendRequest(4, mbTank*MODBUS_TANK_INPUT, MODBUS_TANK_INPUT, 5 + 2*MODBUS_TANK_INPUT);
+        mbTank = (mbTank + 1) % TANK_COUNT;
+        mbNextPoll = now + POLL_S;
+    }
+    else
+        return 0;
+    return 1;
+}
+#else
+/*
+ * Check the telemetry records sent since the last call. They are all of the
+ * scan that just ended, whose levels are in script[].truth.
+ */
+static void checkTelemetry(double now)
+{
+    uint32_t start = 0;
+    uint8_t crc, t;
+    uint16_t level;
+
+    tlmHave += SimUARTRead(&tlm[tlmHave], sizeof(tlm) - tlmHave);
+    while(start + TLM_REC_SIZE <= tlmHave)
+    {
+        if(tlm[start] != TLM_SYNC)
+        {
+            violation("telemetry out of sync", "byte 0x%02x where a record should start", tlm[start]);
+            start++;
+            continue;
+        }
+        crc = 0xff;
+        for(uint8_t i = TLM_REC_SEQ; i < TLM_REC_CRC; i++)
+            crc = crc8(crc, tlm[start+i]);
+        if(crc != tlm[start+TLM_REC_CRC])
+        {
+            violation("telemetry CRC", "record %u", tlm[start+TLM_REC_SEQ]);
+            start++;
+            continue;
+        }
+        //Records the firmware drops when its buffer is full skip a number
+        if(tlmSeq >= 0)
+            dropped += (uint8_t)(tlm[start+TLM_REC_SEQ] - tlmSeq - 1);
+        tlmSeq = tlm[start+TLM_REC_SEQ];
+        records++;
+
+        t = tlm[start+TLM_REC_TANK];
+        level = tlm[start+TLM_REC_LEVEL] | tlm[start+TLM_REC_LEVEL+1] << 8;
+        if(t >= TANK_COUNT)
+            violation("telemetry tank", "tank %u", t);
+        else
+        {
+            script[t].lastRecord = now;
+            if(tlm[start+TLM_REC_FLAGS] & TLM_FLAG_NO_READING)
+                violation("reading failed", "tank %u", t);
+            else if(fabs(level - script[t].truth) > LEVEL_CM)
+                violation("level off", "tank %u read %u cm at %.1f cm", t, level, script[t].truth);
+            if(tlm[start+TLM_REC_FLAGS] & TLM_FLAG_LEAK)
+                violation("leak alarm", "tank %u, no leak in the script", t);
+        }
+        start += TLM_REC_SIZE;
+    }
+    memmove(tlm, &tlm[start], tlmHave - start);
+    tlmHave -= start;
+
+    for(t = 0; t < TANK_COUNT; t++)
+        if(now - script[t].lastRecord > STALE_S)
+        {
+            violation("tank missing from telemetry", "tank %u, last record at %.0f s", t, script[t].lastRecord);
+            script[t].lastRecord = now;     //Once per STALE_S
+        }
+}
+#endif
+
+/*
+ * Look for new refills in the log of the EEPROM (see refill.h) and match them
+ * with the deliveries of the script
+ */
+static void checkRefills(double now)
+{
+    uint8_t rec[REFILL_REC_SIZE];
+    uint8_t crc, t;
+    double liters;
+
+    for(uint8_t slot = 0; slot < EE_REFILL_COUNT; slot++)
+    {
+        for(uint8_t i = 0; i < REFILL_REC_SIZE; i++)
+            rec[i] = SimEEPROMRead(EE_REFILL_ADDR + slot*EE_REFILL_SLOT + i);
+        crc = 0xff;
+        for(uint8_t i = 0; i < REFILL_REC_CRC; i++)
+            crc = crc8(crc, rec[i]);
+        //A record being written doesn't have its CRC yet
+        if(crc != rec[REFILL_REC_CRC] || memcmp(rec, refillImage[slot], REFILL_REC_SIZE) == 0)
+            continue;
+        memcpy(refillImage[slot], rec, REFILL_REC_SIZE);
+        logged++;
+        t = rec[REFILL_REC_SEQ] & REFILL_TANK_MASK;
+        liters = rec[REFILL_REC_LITERS] | rec[REFILL_REC_LITERS+1] << 8;
+        if(t >= TANK_COUNT || script[t].deliveredAt == 0)
+            violation("refill with no delivery", "tank %u, %.0f liters", t, liters);
+        else
+        {
+            if(fabs(liters - script[t].delivered) > REFILL_ERROR*script[t].delivered)
+                violation("refill liters off", "tank %u logged %.0f liters of %.0f", t, liters, script[t].delivered);
+            script[t].deliveredAt = 0;
+        }
+    }
+    for(t = 0; t < TANK_COUNT; t++)
+        if(script[t].deliveredAt > 0 && now - script[t].deliveredAt > LOG_S)
+        {
+            violation("delivery not logged", "tank %u, %.0f liters", t, script[t].delivered);
+            script[t].deliveredAt = 0;
+        }
+}
+
+/*
+ * Checks done every hour, from the main loop of the firmware
+ */
+static void checkHourly(double now)
+{
+    uint32_t clock = ClockSeconds();
+    uint16_t rate;
+
+    if(fabs((double)clock - floor(now)) > CLOCK_S)
+        violation("clock off", "ClockSeconds() %u at %.0f s", clock, now);
+
+    for(uint16_t i = 0; i < EE_TANKS_END; i++)
+        if(SimEEPROMRead(i) != configImage[i])
+        {
+            violation("configuration changed", "EEPROM 0x%02x is 0x%02x, was 0x%02x", i, SimEEPROMRead(i), configImage[i]);
+            configImage[i] = SimEEPROMRead(i);
+        }
+
+    if(SimLCDViolations() != 0)
+        violation("LCD timing", "%u bytes sent too early", SimLCDViolations());
+
+    //Once a day, when the firmware has closed the day before
+    if(fmod(now, DAY_S) >= 12*3600 && fmod(now, DAY_S) < 13*3600)
+        for(uint8_t t = 0; t < TANK_COUNT; t++)
+        {
+            if(script[t].days == 0)
+                continue;
+            rate = UsageDailyLiters(t);
+            if(rate == USAGE_UNKNOWN || fabs(rate - script[t].expected) > USAGE_CM*litersPerCm(t))
+                violation("usage estimate off", "tank %u estimate %u liters a day, used %.0f", t, rate, script[t].expected);
+        }
+}
+
+/*
+ * getEvent() of the main loop of the firmware (see the Makefile). With no key
+ * and no request on the serial port an iteration of the loop only checks
+ * whether the next scan is due, so the clock moves from event to event until
+ * it is. While a Modbus request is out the loop goes on after each event, as
+ * idle() answers it. The script of the tanks and the checks run here, in the
+ * main loop where the firmware could call ClockSeconds() and
+ * UsageDailyLiters().
+ */
+uint8_t SoakGetEvent(void)
+{
+    double now;
+
+    if(loopStart && simCycles - loopStart > longestLoop)
+    {
+        longestLoop = simCycles - loopStart;
+        longestLoopAt = seconds();
+    }
+    if(TMR0of > tmr0ofPeak)
+        tmr0ofPeak = TMR0of;
+#if SERIAL_PROTOCOL == SERIAL_MODBUS
+    while(TMR0of < SCAN_OVERFLOWS && !pollMaster(seconds()))
+        SimWait();
+    if(mbWant)
+        SimWait();
+#else
+    while(TMR0of < SCAN_OVERFLOWS && !ProvisionBusy())
+        SimWait();
+#endif
+    if(TMR0of > tmr0ofPeak)
+        tmr0ofPeak = TMR0of;
+
+    if(TMR0of >= SCAN_OVERFLOWS)
+    {
+        now = seconds();
+        lastScan = now;
+        scans++;
+#if SERIAL_PROTOCOL != SERIAL_MODBUS
+        checkTelemetry(now);
+#endif
+        checkRefills(now);
+        runScript(now);
+        if(now >= nextCheck)
+        {
+            checkHourly(now);
+            nextCheck += 3600;
+        }
+    }
+    loopStart = simCycles;
+    return getEvent();
+}
+
+/*
+ * Find the addresses of the functions of xc8Helpers[] in the symbol table of
+ * the program. The static functions follow the STT_FILE symbol of their file.
+ * Returns:
+ *      0 if one of them isn't there
+ */
+static int findHelpers(void)
+{
+    FILE * f = fopen("/proc/self/exe", "rb");
+    uint8_t * elf;
+    long size;
+    Elf64_Ehdr * eh;
+    Elf64_Shdr * sh;
+    Elf64_Sym * sym;
+    const char * names, * file = "", * name, * slash;
+    uintptr_t bias = 0;
+    size_t n;
+    uint8_t found[XC8_HELPERS] = {0};
+
+    if(f == NULL)
+        return 0;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    elf = malloc(size);
+    if(fread(elf, 1, size, f) != (size_t)size)
+        size = 0;
+    fclose(f);
+    eh = (Elf64_Ehdr *)elf;
+    if(size < (long)sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64)
+    {
+        free(elf);
+        return 0;
+    }
+    sh = (Elf64_Shdr *)(elf + eh->e_shoff);
+    for(uint16_t s = 0; s < eh->e_shnum; s++)
+    {
+        if(sh[s].sh_type != SHT_SYMTAB)
+            continue;
+        sym = (Elf64_Sym *)(elf + sh[s].sh_offset);
+        names = (const char *)(elf + sh[sh[s].sh_link].sh_offset);
+        n = sh[s].sh_size / sizeof(*sym);
+        //The program may be position independent, firmwareMain() gives the shift
+        for(size_t i = 0; i < n; i++)
+            if(strcmp(names + sym[i].st_name, "firmwareMain") == 0)
+                bias = (uintptr_t)firmwareMain - sym[i].st_value;
+        for(size_t i = 0; i < n; i++)
+        {
+            name = names + sym[i].st_name;
+            if(ELF64_ST_TYPE(sym[i].st_info) == STT_FILE)
+            {
+                slash = strrchr(name, '/');
+                file = slash ? slash + 1 : name;
+            }
+            if(ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC || strchr(name, '.'))
+                continue;   //GCC names its partial copies name.part.0 and such
+            for(size_t h = 0; h < XC8_HELPERS; h++)
+                if(strcmp(name, xc8Helpers[h].name) == 0 && !found[h]
+                   && (xc8Helpers[h].file == NULL ? ELF64_ST_BIND(sym[i].st_info) == STB_GLOBAL
+                                                  : strcmp(file, xc8Helpers[h].file) == 0))
+                {
+                    helperFns[h] = sym[i].st_value + bias;
+                    found[h] = 1;
+                }
+        }
+    }
+    free(elf);
+    for(size_t h = 0; h < XC8_HELPERS; h++)
+        if(!found[h])
+        {
+            fprintf(stderr, "simsoak: %s%s%s() of xc8Helpers[] not found\n", xc8Helpers[h].file ? xc8Helpers[h].file : "",
+                    xc8Helpers[h].file ? ":" : "", xc8Helpers[h].name);
+            return 0;
+        }
+    //Sorted for isHelper()
+    for(size_t i = 1; i < XC8_HELPERS; i++)
+        for(size_t j = i; j > 0 && helperFns[j] < helperFns[j-1]; j--)
+        {
+            uintptr_t swap = helperFns[j];
+            helperFns[j] = helperFns[j-1];
+            helperFns[j-1] = swap;
+        }
+    return 1;
+}
+
+//1 if XC8 calls a routine of its library in a function
+static int isHelper(void * fn)
+{
+    size_t low = 0, high = XC8_HELPERS;
+    while(low < high)
+    {
+        size_t mid = (low + high)/2;
+        if(helperFns[mid] == (uintptr_t)fn)
+            return 1;
+        if(helperFns[mid] < (uintptr_t)fn)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return 0;
+}
+
+/*
+ * Calls of the firmware, counted as levels of the hardware stack. main() takes
+ * none on the PIC, the interrupt one like a call. A function that calls a
+ * routine of XC8 takes one more level while it runs.
+ */
+void __cyg_profile_func_enter(void * fn, void * site)
+{
+    int levels, peak;
+    if(fn == (void *)tc_int)
+        isrFrom = depth;
+    depth++;
+    //Looked up only when the call could make a new peak, most are below it
+    peak = (isrFrom >= 0) ? isrFrom + isrPeak : mainPeak + 1;
+    if(depth + 1 > peak)
+    {
+        levels = depth + isHelper(fn);
+        if(isrFrom >= 0)
+        {
+            if(levels - isrFrom > isrPeak)
+                isrPeak = levels - isrFrom;
+        }
+        else if(levels - 1 > mainPeak)
+            mainPeak = levels - 1;
+    }
+#if SERIAL_PROTOCOL == SERIAL_MODBUS
+    //The TX interrupt sends the first byte of the reply as it's started
+    if(fn == (void *)ModbusTxInterrupt && mbWant && mbStartAt == 0)
+        mbStartAt = simCycles;
+#endif
+}
+
+void __cyg_profile_func_exit(void * fn, void * site)
+{
+    depth--;
+    if(fn == (void *)tc_int)
+        isrFrom = -1;
+}
+
+static const char * regionOf(uint16_t addr)
+{
+    if(addr < EE_TANKS_ADDR)
+        return "header";
+    if(addr < EE_TANKS_END)
+        return "tanks";
+    if(addr < EE_USAGE_END)
+        return "usage";
+    if(addr < EE_REFILL_END)
+        return "refills";
+    if(addr < EE_MODBUS_END)
+        return "modbus";
+    if(addr < EE_LEAK_END)
+        return "leak";
+    if(addr < EE_SNAP_END)
+        return "snapshot";
+    if(addr < EE_HIST_ADDR)
+        return "unused";
+    if(addr < EE_HIST_END)
+        return "history";
+    return "stamp";
+}
+
+/*
+ * Writes to the EEPROM by region, the busiest bytes and how long they last
+ * Returns:
+ *      The years the busiest byte lasts
+ */
+static double reportEEPROM(double days, int map)
+{
+    static const char * regions[] = {"header", "tanks", "usage", "refills", "modbus", "leak", "snapshot", "history", "stamp"};
+    uint32_t total = 0, most, writes;
+    uint16_t busiest[EE_SIZE];
+    uint16_t n = 0;
+    double years, shortest = INFINITY;
+
+    for(uint16_t i = 0; i < EE_SIZE; i++)
+        total += SimEEPROMCellWrites(i);
+    printf("EEPROM: %u writes, %.1f a day\n", total, total/days);
+    printf("  %-10s %6s %10s %10s %12s %10s\n", "region", "bytes", "writes", "most", "most a day", "years");
+    for(unsigned r = 0; r < sizeof(regions)/sizeof(*regions); r++)
+    {
+        uint16_t bytes = 0;
+        writes = most = 0;
+        for(uint16_t i = 0; i < EE_SIZE; i++)
+            if(strcmp(regionOf(i), regions[r]) == 0)
+            {
+                bytes++;
+                writes += SimEEPROMCellWrites(i);
+                if(SimEEPROMCellWrites(i) > most)
+                    most = SimEEPROMCellWrites(i);
+            }
+        if(bytes == 0)
+            continue;
+        years = most ? EE_ENDURANCE/(most/days)/365 : INFINITY;
+        if(years < shortest)
+            shortest = years;
+        printf("  %-10s %6u %10u %10u %12.1f %10.1f%s\n", regions[r], bytes, writes, most, most/days, years,
+               years < EE_LIFE_YEARS ? "  WEARS OUT" : "");
+    }
+
+    for(uint16_t i = 0; i < EE_SIZE; i++)
+        if(SimEEPROMCellWrites(i))
+            busiest[n++] = i;
+    for(uint16_t i = 1; i < n; i++)     //Insertion sort, most writes first
+        for(uint16_t j = i; j > 0 && SimEEPROMCellWrites(busiest[j]) > SimEEPROMCellWrites(busiest[j-1]); j--)
+        {
+            uint16_t swap = busiest[j];
+            busiest[j] = busiest[j-1];
+            busiest[j-1] = swap;
+        }
+    printf("  busiest bytes:");
+    for(uint16_t i = 0; i < n && i < 6; i++)
+        printf(" 0x%02x %s %u,", busiest[i], regionOf(busiest[i]), SimEEPROMCellWrites(busiest[i]));
+    printf("%s\n", n ? "\b " : " none");
+
+    if(map)
+    {
+        printf("  writes of each byte:\n");
+        for(uint16_t row = 0; row < EE_SIZE; row += 16)
+        {
+            printf("  %02x:", row);
+            for(uint16_t i = row; i < row + 16; i++)
+                printf(" %6u", SimEEPROMCellWrites(i));
+            printf("\n");
+        }
+    }
+    return shortest;
+}
+
+static int64_t monotonicNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char ** argv)
+{
+    double days = 90, wall, now, life;
+    int map = 0, opt;
+    int64_t start;
+
+    while((opt = getopt(argc, argv, "d:S:mv")) != -1)
+    {
+        switch(opt)
+        {
+            case 'd':
+                days = atof(optarg);
+                break;
+            case 'S':
+                rng = strtoull(optarg, NULL, 0);
+                break;
+            case 'm':
+                map = 1;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: simsoak [-d days] [-S seed] [-m] [-v]\n");
+                return 1;
+        }
+    }
+    if(!findHelpers())
+    {
+        fprintf(stderr, "simsoak: can't find the functions of xc8Helpers[] to count the stack\n");
+        return 1;
+    }
+    if(days <= 0)
+        days = 1;
+    if(rng == 0)
+        rng = 1;
+
+    for(uint8_t t = 0; t < TANK_COUNT; t++)
+        storeTank(t, tanks[t].name, tanks[t].length, tanks[t].width, tanks[t].height, tanks[t].sensor);
+    for(uint16_t i = 0; i < EE_TANKS_END; i++)
+        configImage[i] = SimEEPROMRead(i);
+    for(uint8_t slot = 0; slot < EE_REFILL_COUNT; slot++)
+        for(uint8_t i = 0; i < REFILL_REC_SIZE; i++)
+            refillImage[slot][i] = SimEEPROMRead(EE_REFILL_ADDR + slot*EE_REFILL_SLOT + i);
+    SimReset();
+    SimPressureNoise(2);
+    for(uint8_t t = 0; t < TANK_COUNT; t++)
+    {
+        script[t].level = (0.4 + 0.5*uniform()) * tanks[t].height;
+        script[t].fillFrom = -1;
+    }
+    newDay();
+    for(uint8_t t = 0; t < TANK_COUNT; t++)
+        showLevel(t);
+    nextCheck = 3600;
+#if SERIAL_PROTOCOL == SERIAL_MODBUS
+    mbNextHolding = 1800;
+    mbNextWrite = 12*3600;
+#endif
+
+    printf("simsoak: %d tanks, %ld Hz, %.0f days, %s\n", TANK_COUNT, (long)_XTAL_FREQ, days,
+           SERIAL_PROTOCOL == SERIAL_MODBUS ? "Modbus" : "telemetry");
+    start = monotonicNs();
+    SimStart(firmwareMain);
+    for(long day = 1; day <= (long)ceil(days); day++)
+    {
+        SimRunFor(SimCyclesOf(fmin(day, days)*DAY_S*1000) - simCycles);
+        now = seconds();
+        if(now - lastScan > STALE_S)
+            violation("main loop stuck", "no scan since %.0f s", lastScan);
+        if(verbose)
+        {
+            printf("%s:", timeText(now));
+            for(uint8_t t = 0; t < TANK_COUNT; t++)
+                printf(" %s %.0fcm", tanks[t].name, script[t].level);
+            printf(", %u EEPROM writes, %u refills logged\n", SimEEPROMWrites(), logged);
+        }
+    }
+    wall = (monotonicNs() - start) / 1e9;
+    now = seconds();
+
+    printf("simulated %.1f days in %.2f s, %.1f days per second\n", now/DAY_S, wall, now/DAY_S/wall);
+    printf("main loop: %u scans, longest iteration %.2f ms (%s)\n", scans, SimMs(longestLoop), timeText(longestLoopAt));
+    printf("high-water: hardware stack %d levels in the main line, %d in the interrupt, %d of %d together\n",
+           mainPeak, isrPeak, mainPeak + isrPeak, STACK_LEVELS);
+    printf("  (with a level for each routine of XC8 called by %u functions, %d must stay free)\n",
+           (unsigned)XC8_HELPERS, STACK_MARGIN);
+    printf("high-water: TMR0of %u of 65535\n", tmr0ofPeak);
+#if SERIAL_PROTOCOL == SERIAL_MODBUS
+    printf("modbus: %u requests, %u not answered, reply after %.2f ms mean, %.2f ms worst\n", requests, unanswered,
+           requests > unanswered ? replyTotal/(requests - unanswered) : 0, replyWorst);
+    printf("refills: %u delivered, %u logged\n", deliveries, logged);
+#else
+    printf("telemetry: %u records, %u dropped, refills: %u delivered, %u logged\n", records, dropped, deliveries, logged);
+#endif
+    life = reportEEPROM(now/DAY_S, map);
+
+    if(mainPeak + isrPeak > STACK_LEVELS - STACK_MARGIN)
+        violation("hardware stack", "%d levels, %d free", mainPeak + isrPeak, STACK_LEVELS - mainPeak - isrPeak);
+    if(life < EE_LIFE_YEARS)
+        violation("EEPROM wear", "the busiest byte lasts %.1f years", life);
+    if(violationKinds == 0)
+        printf("invariants: none violated\n");
+    else
+    {
+        printf("invariants violated:\n");
+        for(int i = 0; i < violationKinds; i++)
+            printf("  %-26s %8u times, first %s: %s\n", violations[i].what, violations[i].count,
+                   timeText(violations[i].first), violations[i].detail);
+    }
+    return violationKinds != 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * File:   transducer.c
+ * Author: Faris Shahin
+ *
+ * Model of the pressure transducers behind the MUX and of the analog inputs
+ * of the ADC (see pressure_adc.h). A channel with a transducer puts 1V to 5V
+ * on the MUX output, AN0, for a head of 0 to PRESSURE_RANGE_MM of water; the
+ * liquid has PRESSURE_DENSITY. A channel with no transducer (an HC-SR04 or
+ * nothing) reads 0V, like an open loop. The other analog inputs read 0V.
+ *
+ * Each conversion adds the noise of the transducer, the shunt and the ADC, a
+ * normal distribution given in LSB of the 10-bit result.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "config.h"
+#include "sim.h"
+
+#define VREF            5.0
+#define PI              3.14159265358979
+
+static double levels[16];           //Level over the transducer of each MUX channel in cm
+static double noise;                //Standard deviation of a conversion in LSB
+static uint64_t randomState = 1;
+static uint32_t conversions;
+
+void SimPressureReset(void)
+{
+    for(uint8_t i = 0; i < 16; i++)
+        levels[i] = SIM_NO_TRANSDUCER;
+    noise = 0;
+    randomState = 1;
+    conversions = 0;
+}
+
+/*
+ * Start the noise again from a seed, so runs with the same seed give the
+ * same conversions
+ */
+void SimPressureSeed(uint64_t seed)
+{
+    randomState = seed ? seed : 1;
+}
+
+/*
+ * Set the level a transducer is under
+ * Parameters:
+ *      channel - the MUX channel (tank index)
+ *      cm - the height of the liquid above the transducer, SIM_NO_TRANSDUCER
+ *           for a channel without one
+ */
+void SimPressureLevel(uint8_t channel, double cm)
+{
+    levels[channel] = cm;
+}
+
+/*
+ * Set the noise of every conversion
+ * Parameters:
+ *      lsb - standard deviation in steps of the 10-bit ADC (4.9mV)
+ */
+void SimPressureNoise(double lsb)
+{
+    noise = lsb;
+}
+
+//xorshift64*, uniform in [0, 1)
+static double uniform(void)
+{
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return ((randomState * 0x2545F4914F6CDD1DULL) >> 11) * (1.0/9007199254740992.0);
+}
+
+//Standard normal, Box-Muller
+static double gaussian(void)
+{
+    double u = uniform();
+    if(u < 1e-300)
+        u = 1e-300;
+    return sqrt(-2*log(u)) * cos(2*PI*uniform());
+}
+
+/*
+ * Convert an analog input, called by the ADC of sim.c at the end of a
+ * conversion
+ * Parameters:
+ *      input - the channel of ADCON0 (0 is AN0)
+ * Returns:
+ *      The 10-bit result
+ */
+uint16_t SimAnalogRead(uint8_t input)
+{
+    double cm, volts, code;
+
+    conversions++;
+    if(input != 0)
+        return 0;
+    cm = levels[SimMuxChannel()];
+    if(cm < 0)
+        volts = 0;
+    else
+        volts = 1 + 4*(cm*10*PRESSURE_DENSITY/1000)/PRESSURE_RANGE_MM;
+    code = volts*1024/VREF;
+    if(noise > 0)
+        code += noise*gaussian();
+    if(code < 0)
+        return 0;
+    if(code > 1023)
+        return 1023;
+    return (uint16_t)code;
+}
+
+/*
+ * Returns:
+ *      The number of ADC conversions done
+ */
+uint32_t SimAnalogConversions(void)
+{
+    return conversions;
+}
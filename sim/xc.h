@@ -0,0 +1,115 @@
+/*
+ * File:   xc.h
+ * Author: Faris Shahin
+ * Comments:
+ * Stand-in for the XC8 <xc.h> when the firmware is built on a PC for the
+ * simulator (see sim.h). The special function registers the firmware uses
+ * are plain variables, and bits are fields of them like XC8's ...bits
+ * structures, so whole-register and bit writes see the same value.
+ *
+ * Every bit access, __delay_ms(), __delay_us() and NOP() moves the virtual
+ * clock, which runs the timers, the devices and the interrupts. This is what
+ * makes the busy waits of the firmware end; NOP() jumps to the next event
+ * that can end one. EEDATA, TXREG and RCREG are also read and written
+ * through the simulator, since reading EEPROM, sending a byte and taking a
+ * received one happen when they are touched.
+ *
+ * Revision History: v1.0
+ */
+
+#ifndef SIM_XC_H
+#define	SIM_XC_H
+
+#include <stdint.h>
+
+#define SIM_SFR(name) extern volatile uint8_t name
+
+SIM_SFR(PORTA); SIM_SFR(PORTB); SIM_SFR(PORTC); SIM_SFR(PORTD); SIM_SFR(PORTE);
+SIM_SFR(TRISA); SIM_SFR(TRISB); SIM_SFR(TRISC); SIM_SFR(TRISD); SIM_SFR(TRISE);
+SIM_SFR(TMR0); SIM_SFR(OPTION_REG); SIM_SFR(INTCON);
+SIM_SFR(PIR1); SIM_SFR(PIE1); SIM_SFR(PIR2); SIM_SFR(PIE2);
+SIM_SFR(TMR1L); SIM_SFR(TMR1H); SIM_SFR(T1CON);
+SIM_SFR(TMR2); SIM_SFR(PR2); SIM_SFR(T2CON);
+SIM_SFR(CCPR1L); SIM_SFR(CCPR1H); SIM_SFR(CCP1CON);
+SIM_SFR(ADCON0); SIM_SFR(ADCON1); SIM_SFR(ADRESH); SIM_SFR(ADRESL);
+SIM_SFR(TXSTA); SIM_SFR(RCSTA); SIM_SFR(SPBRG);
+SIM_SFR(EEADR); SIM_SFR(EECON1); SIM_SFR(EECON2);
+
+//Registers with side effects
+volatile uint8_t * SimEEDATA(void);
+volatile uint8_t * SimTXREG(void);
+volatile uint8_t * SimRCREG(void);
+#define EEDATA  (*SimEEDATA())
+#define TXREG   (*SimTXREG())
+#define RCREG   (*SimRCREG())
+
+//Bit access. The register is passed through SimTouch() which moves the clock
+//one instruction cycle and returns it.
+volatile uint8_t * SimTouch(volatile uint8_t * reg);
+typedef struct{
+    unsigned b0:1, b1:1, b2:1, b3:1, b4:1, b5:1, b6:1, b7:1;
+}simBits;
+#define SIM_BIT(reg, n) (((volatile simBits *)SimTouch(&(reg)))->b##n)
+
+#define RBIF        SIM_BIT(INTCON, 0)
+#define INTF        SIM_BIT(INTCON, 1)
+#define TMR0IF      SIM_BIT(INTCON, 2)
+#define RBIE        SIM_BIT(INTCON, 3)
+#define INTE        SIM_BIT(INTCON, 4)
+#define TMR0IE      SIM_BIT(INTCON, 5)
+#define PEIE        SIM_BIT(INTCON, 6)
+#define GIE         SIM_BIT(INTCON, 7)
+
+#define TMR1IF      SIM_BIT(PIR1, 0)
+#define TMR2IF      SIM_BIT(PIR1, 1)
+#define CCP1IF      SIM_BIT(PIR1, 2)
+#define TXIF        SIM_BIT(PIR1, 4)
+#define RCIF        SIM_BIT(PIR1, 5)
+#define ADIF        SIM_BIT(PIR1, 6)
+#define TMR1IE      SIM_BIT(PIE1, 0)
+#define TMR2IE      SIM_BIT(PIE1, 1)
+#define CCP1IE      SIM_BIT(PIE1, 2)
+#define TXIE        SIM_BIT(PIE1, 4)
+#define RCIE        SIM_BIT(PIE1, 5)
+#define ADIE        SIM_BIT(PIE1, 6)
+#define EEIF        SIM_BIT(PIR2, 4)
+#define EEIE        SIM_BIT(PIE2, 4)
+
+#define TMR1ON      SIM_BIT(T1CON, 0)
+#define TMR2ON      SIM_BIT(T2CON, 2)
+#define GO_nDONE    SIM_BIT(ADCON0, 2)
+#define GO          SIM_BIT(ADCON0, 2)
+
+#define RD          SIM_BIT(EECON1, 0)
+#define WR          SIM_BIT(EECON1, 1)
+#define WREN        SIM_BIT(EECON1, 2)
+#define EEPGD       SIM_BIT(EECON1, 7)
+
+#define TX9D        SIM_BIT(TXSTA, 0)
+#define TRMT        SIM_BIT(TXSTA, 1)
+#define BRGH        SIM_BIT(TXSTA, 2)
+#define SYNC        SIM_BIT(TXSTA, 4)
+#define TXEN        SIM_BIT(TXSTA, 5)
+#define TX9         SIM_BIT(TXSTA, 6)
+#define OERR        SIM_BIT(RCSTA, 1)
+#define FERR        SIM_BIT(RCSTA, 2)
+#define CREN        SIM_BIT(RCSTA, 4)
+#define RX9         SIM_BIT(RCSTA, 6)
+#define SPEN        SIM_BIT(RCSTA, 7)
+
+#define RE0         SIM_BIT(PORTE, 0)
+#define RE1         SIM_BIT(PORTE, 1)
+#define RE2         SIM_BIT(PORTE, 2)
+
+//Delays count instruction cycles (Fosc/4) like XC8's
+void SimDelay(uint32_t cycles);
+#define __delay_us(x)   SimDelay((uint32_t)((x)*(_XTAL_FREQ/4000000.0)))
+#define __delay_ms(x)   SimDelay((uint32_t)((x)*(_XTAL_FREQ/4000.0)))
+//NOP() is only used in busy waits, it waits for the next event (see sim.c)
+void SimWait(void);
+#define NOP()           SimWait()
+
+//The interrupt function is called by the simulator
+#define __interrupt(...)
+
+#endif	/* SIM_XC_H */
@@ -28,12 +28,22 @@ void KeypadInit(void)
  *  Read the pressed button from the keypad
  *  Returns:
  *      The pressed button
+ *  Notes:
+ *  The delay that cancels multiple continuous reads of a button press is taken
+ *  on the read after the press, so the press itself is handled right away.
  */
 uint8_t KeypadRead(void)
 {
     static uint8_t rows[4] = {ROW1, ROW2, ROW3, ROW4};
     static uint8_t col[3] = {COL1, COL2, COL3};
+    static uint8_t pressed = 0; //1 if the last read returned a button
+    PROFILE_ENTER();
     
+    if(pressed)
+    {
+        pressed = 0;
+        __delay_ms(350);        //Delay to cancel multiple continuous reads of the button press
+    }
     /* Use a "moving 1" method to determine the pressed key:
      * At the start of each loop, a 1 is sent from a column.
      * Iterate through all rows and see if you read this 1
@@ -42,14 +52,17 @@ uint8_t KeypadRead(void)
     */
     for(uint8_t i=0; i<3; i++)
     {
-        *OUT_KEYS = 0x00;  //Reset OUT_KEYS
-        *OUT_KEYS = 1 << (col[i]-1);  //Send a 1 to the current indexed column
+        *OUT_KEYS &= ~COL_MASK;  //Reset the columns
+        *OUT_KEYS |= 1 << (col[i]-1);  //Send a 1 to the current indexed column
+        __delay_us(1);                  //Let the column settle before reading the rows
         for(uint8_t j=0; j<4; j++)    //Loop through all rows
             if((*IN_KEYS >> (rows[j]-1)) & 0x01)    //Check if 1 is read
             {
-                __delay_ms(350);        //Delay to cancel multiple continuous reads of the button press
+                pressed = 1;
+                PROFILE_EXIT(PROF_KEYPAD);
                 return Keypad[j][i];    //Return the pressed button
             }        
     }
+    PROFILE_EXIT(PROF_KEYPAD);
     return 0;   //Return 0 if no button is pressed
 }
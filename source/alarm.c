@@ -0,0 +1,181 @@
+/*
+ * File:   alarm.c
+ * Author: Faris Shahin
+ *
+ * Level alarms of the liquid tanks. See alarm.h.
+ */
+
+#include "config.h"
+
+static uint8_t state[TANK_COUNT];    //Alarm bits of each tank
+static uint8_t seen[TANK_COUNT];     //Threshold alarm bits the last readings would set
+static uint8_t confirm[TANK_COUNT];  //Readings in a row that gave seen, 0 if they agree with state
+static uint8_t failed[TANK_COUNT];   //Failed readings in a row, up to ALARM_FAULT_READINGS
+
+/*
+ * Turn the output on if any tank has an alarm in ALARM_OUTPUT
+ */
+static void updateOutput(void)
+{
+    uint8_t any = 0;
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+        any |= state[i];
+    if(any & ALARM_OUTPUT)
+        ALARM_PORT |= 1<<ALARM_PIN;
+    else
+        ALARM_PORT &= ~(1<<ALARM_PIN);
+}
+
+/*
+ * Check one threshold of a tank
+ * Parameters:
+ *      bit - the alarm bit of the threshold
+ *      scaled - the level of the tank times 100
+ *      set - the threshold times the height of the tank
+ *      clear - the threshold past ALARM_HYST times the height of the tank
+ *      below - 1 if the alarm is raised below the threshold, 0 if above it
+ *      *s - the alarm bits of the tank
+ */
+static void check(uint8_t bit, uint32_t scaled, uint32_t set, uint32_t clear, uint8_t below, uint8_t * s)
+{
+    if(below ? scaled <= set : scaled >= set)
+        *s |= bit;
+    else if(below ? scaled > clear : scaled < clear)
+        *s &= ~bit;
+}
+
+/*
+ * Set the alarm pin as output and clear all alarms
+ */
+void AlarmInit(void)
+{
+    ALARM_TRIS &= ~(1<<ALARM_PIN);
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        state[i] = 0;
+        confirm[i] = 0;
+        failed[i] = 0;
+    }
+    updateOutput();
+}
+
+/*
+ * Clear the alarms of a tank, e.g. when it's edited or deleted. They are
+ * raised again once the readings are still past a threshold, or still fail.
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ */
+void AlarmReset(uint8_t tankIndex)
+{
+    state[tankIndex] = 0;
+    confirm[tankIndex] = 0;
+    failed[tankIndex] = 0;
+    updateOutput();
+}
+
+/*
+ * Check the thresholds of a tank against a new reading. The alarms change
+ * once ALARM_CONFIRM readings in a row give the same new alarms.
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      level - the height of the liquid in cm, before the filter
+ * Notes:
+ * The level is compared with the thresholds without dividing: level*100
+ * against threshold*height.
+ */
+static void sample(uint8_t tankIndex, uint16_t level)
+{
+    uint16_t height = TankHeight(tankIndex);
+    uint8_t low = TankLow(tankIndex);
+    uint8_t critical = TankCritical(tankIndex);
+    uint8_t high = TankHigh(tankIndex);
+    uint32_t scaled = (uint32_t)level*100;
+    uint8_t s = state[tankIndex] & ~ALARM_FAULT;
+    
+    if(low != 0)
+        check(ALARM_LOW, scaled, (uint32_t)low*height, (uint32_t)(low+ALARM_HYST)*height, 1, &s);
+    else
+        s &= ~ALARM_LOW;
+    if(critical != 0)
+        check(ALARM_CRITICAL, scaled, (uint32_t)critical*height, (uint32_t)(critical+ALARM_HYST)*height, 1, &s);
+    else
+        s &= ~ALARM_CRITICAL;
+    if(high > ALARM_HYST)
+        check(ALARM_HIGH, scaled, (uint32_t)high*height, (uint32_t)(high-ALARM_HYST)*height, 0, &s);
+    else
+        s &= ~ALARM_HIGH;
+    
+    failed[tankIndex] = 0;
+    if(s == (state[tankIndex] & ~ALARM_FAULT))
+        confirm[tankIndex] = 0;
+    else
+    {
+        if(s != seen[tankIndex])
+        {
+            seen[tankIndex] = s;
+            confirm[tankIndex] = 0;
+        }
+        if(++confirm[tankIndex] >= ALARM_CONFIRM)
+        {
+            state[tankIndex] = s;
+            confirm[tankIndex] = 0;
+        }
+    }
+    state[tankIndex] &= ~ALARM_FAULT;
+}
+
+/*
+ * Count a failed reading of a tank, ALARM_FAULT_READINGS in a row raise the
+ * fault alarm. The threshold alarms are kept as they are.
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ */
+static void fail(uint8_t tankIndex)
+{
+    confirm[tankIndex] = 0;
+    if(failed[tankIndex] < ALARM_FAULT_READINGS && ++failed[tankIndex] == ALARM_FAULT_READINGS)
+        state[tankIndex] |= ALARM_FAULT;
+}
+
+/*
+ * Check the thresholds of the tanks read since the last call (see store.h)
+ * and update the output if an alarm changed
+ */
+void AlarmService(void)
+{
+    struct measurement m;
+    uint8_t tank;
+    uint8_t changed = 0;
+    uint8_t old;
+    while((tank = StoreNext(STORE_ALARM, &m)) != STORE_NONE)
+    {
+        old = state[tank];
+        if(m.health == STORE_OK)
+            sample(tank, m.unfiltered);
+        else
+            fail(tank);
+        changed |= old != state[tank];
+    }
+    if(changed)
+        updateOutput();
+}
+
+/*
+ *  Returns:
+ *      1 if the last reading of the tank would change its alarms and waits to
+ *      be confirmed, 0 otherwise
+ */
+uint8_t AlarmPending(uint8_t tankIndex)
+{
+    return confirm[tankIndex] != 0;
+}
+
+/*
+ *  Returns:
+ *      The alarm bits of a tank (ALARM_LOW, ALARM_CRITICAL, ALARM_HIGH and
+ *      ALARM_FAULT)
+ */
+uint8_t AlarmState(uint8_t tankIndex)
+{
+    return state[tankIndex];
+}
@@ -0,0 +1,55 @@
+/*
+ * File:   clock.c
+ * Author: Faris Shahin
+ *
+ * Seconds counter driven by TMR2.
+ *
+ * Note: ClockTick() must be called from the interrupt service routine in
+ * main.c when TMR2IF is set. Peripheral interrupts (PEIE) must be enabled.
+ */
+
+#include "config.h"
+
+#if (_XTAL_FREQ/4) % CLOCK_DIVIDER != 0 || CLOCK_TICKS_PER_SEC > 255
+#error "TMR2 can't count whole seconds with this crystal"
+#endif
+
+static uint8_t ticks = 0;
+static volatile uint32_t seconds = 0;
+
+/*
+ * Starts TMR2 and enables its interrupt
+ */
+void ClockInit(void)
+{
+    PR2 = CLOCK_PR2;
+    TMR2 = 0;
+    T2CON = CLOCK_T2CON;
+    TMR2IF = 0;
+    TMR2IE = 1;
+}
+
+/*
+ * Called from the interrupt service routine on every TMR2 interrupt
+ */
+void ClockTick(void)
+{
+    if(++ticks >= CLOCK_TICKS_PER_SEC)
+    {
+        ticks = 0;
+        seconds++;
+    }
+}
+
+/*
+ *  Returns:
+ *      The number of seconds since power up
+ */
+uint32_t ClockSeconds(void)
+{
+    uint32_t now;
+    GIE = 0;    //A 32-bit read takes several instructions
+    now = seconds;
+    GIE = 1;
+    return now;
+}
@@ -0,0 +1,220 @@
+/*
+ * File:   eeprom_queue.c
+ * Author: Faris Shahin
+ *
+ * Write-behind queue for the data EEPROM.
+ *
+ * Note: This library relies on the EEPROM write complete interrupt (EEIF).
+ * Make sure EEPROMQueueWriteDone() is called from the interrupt service
+ * routine in main.c when EEIF is set.
+ */
+
+#include "config.h"
+
+static uint8_t qAddr[EEQ_SIZE];     //Addresses waiting to be written
+static uint8_t qData[EEQ_SIZE];     //Data waiting to be written
+static volatile uint8_t qHead = 0;  //Next free entry
+static volatile uint8_t qTail = 0;  //Entry being written when the queue isn't empty
+
+/*
+ * Start writing the entry at the tail of the queue.
+ * Must be used with interrupts disabled: the 0x55/0xAA sequence must not
+ * be interrupted or the write won't start. A macro, it's at the bottom of the
+ * stack under HistoryService() and the interrupt.
+ */
+#define startWrite()    do {                                                \
+        EEADR = qAddr[qTail];                                               \
+        EEDATA = qData[qTail];                                              \
+        EEPGD = 0;          /* Point to data memory */                      \
+        WREN = 1;           /* Enable writes */                             \
+        EECON2 = 0x55;      /* Required sequence to start the write */      \
+        EECON2 = 0xAA;                                                      \
+        WR = 1;                                                             \
+        WREN = 0;           /* Doesn't affect the write which already started */ \
+    } while(0)
+
+/*
+ * Remove the entry just written and start the next one, as the EEIF interrupt
+ * does. Interrupts must be off.
+ */
+#define nextWrite()     do {                                                \
+        qTail = (qTail+1)&(EEQ_SIZE-1);                                     \
+        if(qHead != qTail)                                                  \
+            startWrite();                                                   \
+    } while(0)
+
+/*
+ * Wait one step for the queue to advance. With interrupts off the EEIF
+ * interrupt can't run, so the write that ended is retired here instead.
+ */
+#define waitQueue(gie)  do {                                                \
+        if(gie)                                                             \
+            NOP();                                                          \
+        else if(EEIF)                                                       \
+        {                                                                   \
+            EEIF = 0;                                                       \
+            nextWrite();                                                    \
+        }                                                                   \
+    } while(0)
+
+/*
+ * Initializes the queue and enables the EEPROM write complete interrupt.
+ * Peripheral interrupts must also be enabled (PEIE) for the queue to advance.
+ */
+void EEPROMQueueInit(void)
+{
+    qHead = 0;
+    qTail = 0;
+    EEIF = 0;
+    EEIE = 1;
+}
+
+/*
+ * Wait until no write is running and leave interrupts off. EEADR and EEDATA
+ * can't be touched while a write is running. The wait is done with interrupts
+ * as the caller had them (a write takes several ms and the serial port can't
+ * wait that long) and WR checked again with them off, since the interrupt
+ * starts the next queued write. A macro, so the functions below don't take
+ * another level of the hardware stack.
+ */
+#define waitWrite(gie)  do { GIE = (gie); while(WR) NOP(); GIE = 0; } while(WR)
+
+/*
+ * Queue one byte to be written to EEPROM
+ * Parameters:
+ *      addr - the EEPROM address
+ *      data - the value to write
+ * Notes:
+ * Nothing is queued if the byte already holds the value, either in EEPROM or
+ * in an entry that hasn't been written yet. If the address is already waiting
+ * in the queue, that entry is updated instead of adding a new one.
+ * The function only waits if the queue is full, until one byte is written.
+ * With interrupts off it finishes that write itself. Interrupts are left as
+ * they were.
+ */
+void EEPROMQueueWrite(uint8_t addr, uint8_t data)
+{
+    uint8_t gie = GIE;
+    uint8_t found = 0;
+    uint8_t i = qHead;
+    PROFILE_ENTER();
+    GIE = 0;
+    //Look from the newest entry to the oldest
+    while(i != qTail)
+    {
+        i = (i-1)&(EEQ_SIZE-1);
+        if(qAddr[i] == addr)
+        {
+            found = 1;
+            break;
+        }
+    }
+    if(found)
+    {
+        //Update a pending entry for the same address. The tail can't be
+        //updated since it is already being written.
+        if(qData[i] == data || i != qTail)
+        {
+            qData[i] = data;
+            GIE = gie;
+            PROFILE_EXIT(PROF_EEPROM);
+            return;
+        }
+    }
+    else
+    {
+        //Only entries of other addresses can be written during the wait
+        waitWrite(gie);
+        EEADR = addr;
+        EEPGD = 0;
+        RD = 1;
+        if(EEDATA == data)
+        {
+            GIE = gie;
+            PROFILE_EXIT(PROF_EEPROM);
+            return;
+        }
+    }
+    GIE = gie;
+    
+    //Wait for a free entry (one entry is always kept empty to tell full from empty)
+    while(((qHead+1)&(EEQ_SIZE-1)) == qTail)
+        waitQueue(gie);
+    
+    GIE = 0;
+    qAddr[qHead] = addr;
+    qData[qHead] = data;
+    i = qHead;
+    qHead = (qHead+1)&(EEQ_SIZE-1);
+    if(i == qTail)          //The queue was empty so nothing is being written
+        startWrite();
+    GIE = gie;
+    PROFILE_EXIT(PROF_EEPROM);
+}
+
+/*
+ *  Read a byte as it will be once all queued writes are done
+ *  Parameters:
+ *      addr - the EEPROM address
+ *  Returns:
+ *      The newest value queued for the address, or the value in EEPROM
+ *  Notes:
+ *  Interrupts are left as the caller had them.
+ */
+uint8_t EEPROMQueueRead(uint8_t addr)
+{
+    uint8_t gie = GIE;
+    uint8_t i = qHead;
+    uint8_t data;
+    GIE = 0;
+    //Look from the newest entry to the oldest
+    while(i != qTail)
+    {
+        i = (i-1)&(EEQ_SIZE-1);
+        if(qAddr[i] == addr)
+        {
+            data = qData[i];
+            GIE = gie;
+            return data;
+        }
+    }
+    //Entries written during the wait are in EEPROM by then
+    waitWrite(gie);
+    EEADR = addr;
+    EEPGD = 0;
+    RD = 1;
+    data = EEDATA;
+    GIE = gie;
+    return data;
+}
+
+/*
+ *  Returns:
+ *      1 if there are bytes waiting to be written, 0 otherwise
+ */
+uint8_t EEPROMQueueBusy(void)
+{
+    return qHead != qTail;
+}
+
+/*
+ *  Wait until every queued byte has been written. Only needed when the data
+ *  must be in EEPROM before continuing. Works with interrupts on or off.
+ */
+void EEPROMQueueFlush(void)
+{
+    uint8_t gie = GIE;
+    while(qHead != qTail)
+        waitQueue(gie);
+}
+
+/*
+ *  Called from the interrupt service routine when a write is complete.
+ *  Removes the written entry and starts the next one.
+ */
+void EEPROMQueueWriteDone(void)
+{
+    if(qHead == qTail)
+        return;
+    nextWrite();
+}
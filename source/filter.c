@@ -0,0 +1,76 @@
+/*
+ * File:   filter.c
+ * Author: Faris Shahin
+ *
+ * Filters the liquid level readings of each tank. The filter is selected
+ * with LEVEL_FILTER in filter.h.
+ */
+
+#include "config.h"
+
+#if LEVEL_FILTER == FILTER_MEDIAN3
+static uint16_t previous[TANK_COUNT][2];  //The 2 readings before the current one
+#elif LEVEL_FILTER == FILTER_EWMA
+static uint16_t average[TANK_COUNT];      //Average level in 1/16 cm
+#endif
+static uint8_t count[TANK_COUNT];         //Readings so far, up to 2
+
+/*
+ * Forget the readings of a tank, e.g. when its dimensions change
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ */
+void FilterReset(uint8_t tankIndex)
+{
+    count[tankIndex] = 0;
+}
+
+/*
+ * Add a reading to the filter of a tank
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      level - the height of the liquid in cm
+ * Returns:
+ *      The filtered height of the liquid in cm
+ * Notes:
+ * The first readings after a reset are returned as they are.
+ */
+uint16_t FilterLevel(uint8_t tankIndex, uint16_t level)
+{
+#if LEVEL_FILTER == FILTER_MEDIAN3
+    uint16_t a = previous[tankIndex][0];
+    uint16_t b = previous[tankIndex][1];
+    uint16_t median = level;
+    previous[tankIndex][0] = b;
+    previous[tankIndex][1] = level;
+    if(count[tankIndex] < 2)
+    {
+        count[tankIndex]++;
+        return level;
+    }
+    //Median of a, b and level
+    if(a > b)
+    {
+        uint16_t tmp = a;
+        a = b;
+        b = tmp;
+    }
+    if(level < a)
+        median = a;
+    else if(level > b)
+        median = b;
+    return median;
+#elif LEVEL_FILTER == FILTER_EWMA
+    if(count[tankIndex] == 0)
+    {
+        count[tankIndex] = 1;
+        average[tankIndex] = level<<4;
+    }
+    else
+        average[tankIndex] = average[tankIndex] - (average[tankIndex]>>2) + (level<<2);
+    return (average[tankIndex]+8)>>4;
+#else
+    (void)tankIndex;    //No state
+    return level;
+#endif
+}
@@ -0,0 +1,292 @@
+/*
+ * File:   history.c
+ * Author: Faris Shahin
+ *
+ * Log of the liquid levels kept in EEPROM. See history.h for the format.
+ *
+ * Note: Power can be lost at any time without damaging the log. The data byte
+ * of an entry is queued before its header, so an entry which wasn't fully
+ * written still has the header of the old lap. At power up the entry where the
+ * lap number changes is where writing continues, and readers never read that
+ * entry since it is the one that may be half written.
+ */
+
+#include "config.h"
+
+static uint8_t head;            //Entry to write next
+static uint8_t lap;             //Lap number of the entries being written
+static uint8_t lastLevel[TANK_COUNT]; //Last level logged for each tank
+static uint8_t pending[TANK_COUNT];   //Samples with no change which weren't logged yet
+static uint8_t sinceKey[TANK_COUNT];  //Entries of each tank since its last HIST_KEY
+static uint8_t latest[TANK_COUNT];    //Latest level measured for each tank
+static uint8_t snapped[TANK_COUNT];   //Level of each tank in the snapshot
+static uint32_t lastSample;           //Time of the last sample in seconds
+static uint32_t lastSnapshot;         //Time of the last update of the snapshot in seconds
+
+/*
+ * Queue one entry to be written at the head of the log
+ * Parameters:
+ *      header - kind and tank bits of the header (the lap is added here)
+ *      data - the second byte of the entry
+ */
+static void append(uint8_t header, uint8_t data)
+{
+    uint8_t addrs = EE_HIST_ADDR + head*2;
+    EEPROMQueueWrite(addrs+1, data);
+    EEPROMQueueWrite(addrs, (lap<<6) | header);
+    head++;
+    if(head >= HIST_SLOTS)
+    {
+        head = 0;
+        lap = (lap+1) & 0x03;
+    }
+}
+
+/*
+ * Log the level of a tank as a HIST_KEY entry
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      level - the level in half percent
+ * Notes:
+ * Samples without change that weren't logged yet are logged first as a
+ * HIST_DELTA with no change, so readers can still count the samples.
+ */
+static void logKey(uint8_t tankIndex, uint8_t level)
+{
+    if(pending[tankIndex])
+        append(HIST_DELTA<<4 | tankIndex, (pending[tankIndex]-1)<<4);
+    append(HIST_KEY<<4 | tankIndex, level);
+    pending[tankIndex] = 0;
+    sinceKey[tankIndex] = 0;
+    lastLevel[tankIndex] = level;
+}
+
+/*
+ * Finds where writing continues in the log and logs the power up.
+ * Must be called after TankConfigLoad() so any EEPROM conversion is queued.
+ */
+void HistoryInit(void)
+{
+    uint8_t header;
+    head = 0;
+    lap = 0;
+    header = EEPROMQueueRead(EE_HIST_ADDR);
+    if(header != 0xff)
+    {
+        //Find the first entry which wasn't written in the same lap as the first one
+        lap = header>>6;
+        for(head = 1; head < HIST_SLOTS; head++)
+        {
+            header = EEPROMQueueRead(EE_HIST_ADDR + head*2);
+            if(header == 0xff || (header>>6) != lap)
+                break;
+        }
+        if(head >= HIST_SLOTS)  //The last entry of the ring was the last written
+        {
+            head = 0;
+            lap = (lap+1) & 0x03;
+        }
+    }
+    
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        lastLevel[i] = HIST_UNKNOWN;
+        latest[i] = HIST_UNKNOWN;
+        pending[i] = 0;
+        sinceKey[i] = 0;
+        snapped[i] = HistorySnapshot(i);
+    }
+    //Make the first call to HistoryService() take a sample and update the
+    //snapshot right away
+    lastSample = ClockSeconds() - HIST_INTERVAL;
+    lastSnapshot = ClockSeconds() - HIST_SNAP_INTERVAL;
+    HistoryMark(HIST_MARK_BOOT, 0);
+}
+
+/*
+ * Take the levels of the tanks read since the last call (see store.h), then
+ * log a sample of every tank if HIST_INTERVAL seconds have passed since the
+ * last one and update the snapshot every HIST_SNAP_INTERVAL seconds. Returns
+ * right away otherwise.
+ * A tank's snapshot is only written when its level moved more than the
+ * deadband of the sensor (USAGE_DEADBAND, see usage.h), so the noise of a
+ * still tank never wears the EEPROM.
+ * A failed reading keeps the last level, so a sample is still logged for the
+ * tank and the time between samples stays the same.
+ */
+void HistoryService(void)
+{
+    uint32_t now = ClockSeconds();
+    int16_t change;
+    uint8_t deadband;
+    struct measurement m;
+    uint8_t tank;
+    
+    while((tank = StoreNext(STORE_HISTORY, &m)) != STORE_NONE)
+        if(m.health == STORE_OK && TankHeight(tank) != 0)   //A tank being set up over Modbus can have no height yet
+            latest[tank] = ((uint32_t)m.level*200)/TankHeight(tank);
+    
+    if(now - lastSnapshot >= HIST_SNAP_INTERVAL)
+    {
+        lastSnapshot = now;
+        for(uint8_t i = 0; i < TANK_COUNT; i++)
+        {
+            if(latest[i] == HIST_UNKNOWN || TankHeight(i) == 0)
+                continue;
+            //The deadband in half percent of the tank, rounded up
+            deadband = (USAGE_DEADBAND*200 + TankHeight(i) - 1)/TankHeight(i);
+            change = (int16_t)latest[i] - snapped[i];
+            if(snapped[i] != HIST_UNKNOWN && change <= deadband && change >= -deadband)
+                continue;
+            snapped[i] = latest[i];
+            EEPROMQueueWrite(EE_SNAP_ADDR+i, latest[i]);
+        }
+    }
+    
+    if(now - lastSample < HIST_INTERVAL)
+        return;
+    lastSample = now;
+    
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        if(!TankInUse(i) || latest[i] == HIST_UNKNOWN)
+            continue;
+        if(lastLevel[i] == HIST_UNKNOWN)
+        {
+            logKey(i, latest[i]);
+            continue;
+        }
+        
+        change = (int16_t)latest[i] - lastLevel[i];
+        if(change == 0 && pending[i] < 15)
+        {
+            pending[i]++;   //Logged later with the next change
+            continue;
+        }
+        if(change < -8 || change > 7 || sinceKey[i] >= HIST_KEY_EVERY-1)
+            logKey(i, latest[i]);
+        else
+        {
+            append(HIST_DELTA<<4 | i, pending[i]<<4 | (change & 0x0f));
+            pending[i] = 0;
+            sinceKey[i]++;
+            lastLevel[i] = latest[i];
+        }
+    }
+}
+
+/*
+ * Log an event with a HIST_MARK entry
+ * Parameters:
+ *      type - the marker type (HIST_MARK_...)
+ *      data - the data of the marker
+ */
+void HistoryMark(uint8_t type, uint8_t data)
+{
+    append(HIST_MARK<<4 | type, data);
+}
+
+/*
+ * Read the level of a tank kept in the snapshot
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ * Returns:
+ *      The level in half percent as it was at most HIST_SNAP_INTERVAL seconds
+ *      before the last power down, give or take the deadband of the sensor,
+ *      or HIST_UNKNOWN
+ */
+uint8_t HistorySnapshot(uint8_t tankIndex)
+{
+    uint8_t level = EEPROMQueueRead(EE_SNAP_ADDR+tankIndex);
+    if(level > 200)     //Never written, cleared or damaged
+        return HIST_UNKNOWN;
+    return level;
+}
+
+/*
+ * Forget the level of a tank, e.g. when its dimensions change and the level in
+ * half percent doesn't mean the same anymore
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ */
+void HistorySnapshotClear(uint8_t tankIndex)
+{
+    latest[tankIndex] = HIST_UNKNOWN;
+    snapped[tankIndex] = HIST_UNKNOWN;
+    EEPROMQueueWrite(EE_SNAP_ADDR+tankIndex, HIST_UNKNOWN);
+}
+
+/*
+ * Start reading the log from the oldest entry
+ * Parameters:
+ *      *cur - the reader's cursor
+ * Notes:
+ * Entries written while reading may be missed or, if the log wraps around
+ * meanwhile, read twice. Read the whole log in one go.
+ */
+void HistoryCursorStart(struct historyCursor * cur)
+{
+    cur->slot = head+1;
+    if(cur->slot >= HIST_SLOTS)
+        cur->slot = 0;
+    cur->left = HIST_SLOTS-1;
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+        cur->level[i] = HIST_UNKNOWN;
+}
+
+/*
+ * Read the next entry of the log
+ * Parameters:
+ *      *cur - the reader's cursor
+ *      *entry - filled with the entry
+ * Returns:
+ *      1 if an entry was read, 0 when there are no more entries
+ */
+uint8_t HistoryCursorNext(struct historyCursor * cur, struct historyEntry * entry)
+{
+    uint8_t addrs, header, data, tank;
+    int8_t change;
+    while(cur->left)
+    {
+        addrs = EE_HIST_ADDR + cur->slot*2;
+        header = EEPROMQueueRead(addrs);
+        data = EEPROMQueueRead(addrs+1);
+        cur->left--;
+        cur->slot++;
+        if(cur->slot >= HIST_SLOTS)
+            cur->slot = 0;
+        
+        if(header == 0xff)  //Never written
+            continue;
+        entry->kind = (header>>4) & 0x03;
+        tank = header & 0x0f;
+        entry->tank = tank;
+        if(entry->kind == HIST_MARK)
+        {
+            entry->level = data;
+            entry->samples = 0;
+            return 1;
+        }
+        if(tank >= TANK_COUNT)  //Damaged entry
+            continue;
+        if(entry->kind == HIST_KEY)
+        {
+            cur->level[tank] = data;
+            entry->samples = 1;
+        }
+        else if(entry->kind == HIST_DELTA)
+        {
+            change = data & 0x0f;
+            if(change > 7)
+                change -= 16;
+            if(cur->level[tank] != HIST_UNKNOWN)
+                cur->level[tank] += change;
+            entry->samples = (data>>4)+1;
+        }
+        else                //Damaged entry
+            continue;
+        entry->level = cur->level[tank];
+        return 1;
+    }
+    return 0;
+}
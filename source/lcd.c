@@ -10,6 +10,26 @@
  */
 
 #include "config.h"
+
+//Put a byte on the data lines and pulse E. LCDSendNibble() and LCDSendByte()
+//share it so LCDSendByte(), at the bottom of every LCD call, calls nothing.
+#define strobe(nibble)  do {                                                \
+        *LCD_PORT_DATA = (nibble);                                          \
+        *LCD_PORT_CTRL |= 1 << LCD_EN;      /* E pin - LCD Enable */        \
+        __delay_us(1);                                                      \
+        *LCD_PORT_CTRL &= ~(1 << LCD_EN);   /* E pin - LCD Disable */       \
+        __delay_us(50);                     /* min. 37us */                 \
+    } while(0)
+
+//Select the register and send a byte. LCDSendByte() and LCDSetPos() share it
+//so LCDSetPos(), under every string printed, calls nothing either.
+#define sendByte(reg, byte)  do {                                           \
+        /* RS pin - Register Select */                                      \
+        *LCD_PORT_CTRL = (reg) ? (*LCD_PORT_CTRL | (1 << LCD_RS)) : (*LCD_PORT_CTRL & ~(1 << LCD_RS)); \
+        *LCD_PORT_CTRL &= ~(1 << LCD_RW);   /* RW pin to write mode */      \
+        strobe(byte);                                                       \
+    } while(0)
+
 int8_t current_pos = 0;
 // ---
 void LCDInitialize() {
@@ -38,7 +58,6 @@ void LCDInitialize() {
     // I/D: Cursor/blink moves to right and DDRAM address is increased by 1
     // SH: Shifting entire display is performed
     LCDSendNibble(lcdEntryMode);
-    __delay_ms(30);
 }
 
 // Clear display
@@ -60,7 +79,7 @@ void LCDReturnHome(void) {
  */
 void LCDDisplayToggle(uint8_t time, uint8_t n) {
     // Blink LCD n times
-    for(n; n > 0; n--) {
+    for(; n > 0; n--) {
         LCDDisplayOff();
         for(uint8_t i = time; i > 0; i--) {
             __delay_ms(100);
@@ -147,23 +166,17 @@ void LCDSendNibble(uint8_t nibble) {
     //*LCD_PORT_DATA = (unsigned)((nibble & 0b00000100) >> 2) ? (*LCD_PORT_DATA | (1 << LCD_D6)) : (*LCD_PORT_DATA & ~(1 << LCD_D6));
     //*LCD_PORT_DATA = (unsigned)((nibble & 0b00001000) >> 3) ? (*LCD_PORT_DATA | (1 << LCD_D7)) : (*LCD_PORT_DATA & ~(1 << LCD_D7));
     
-    *LCD_PORT_DATA = nibble;
-    // Send nibble to LCD.
-    *LCD_PORT_CTRL |= 1 << LCD_EN;  // E pin - LCD Enable
-    __delay_us(1);
-    *LCD_PORT_CTRL &= ~(1 << LCD_EN);  // E pin - LCD Disable
-    __delay_us(50); // min. 37us
+    strobe(nibble);
 }
 
 // Send byte to lcd
 void LCDSendByte(uint8_t reg, uint8_t byte) {
-    *LCD_PORT_CTRL = reg ? (*LCD_PORT_CTRL | (1 << LCD_RS)) : (*LCD_PORT_CTRL & ~(1 << LCD_RS));  // RS pin - Register Select
-    
-    *LCD_PORT_CTRL &= ~(1 << LCD_RW);  // RW pin to write mode
-    LCDSendNibble(byte);
+    PROFILE_ENTER();
+    sendByte(reg, byte);
     // Commented part for use in 4-bit mode (Faris Shahin)
     //LCDSendNibble(byte >> 4);
     //LCDSendNibble(byte & 0x0f);
+    PROFILE_EXIT(PROF_LCD_BYTE);
 }
 
 /*
@@ -186,6 +199,7 @@ void LCDSendByte(uint8_t reg, uint8_t byte) {
 void LCDSetPos(uint8_t x, uint8_t y) {
     int8_t addr = 0;
     uint8_t new_pos = 0;
+    PROFILE_ENTER();
     switch(y)
     {
         case 1:
@@ -211,13 +225,30 @@ void LCDSetPos(uint8_t x, uint8_t y) {
   //For some reason, the command to set the address in the
   //LCD memory isn't working properly. Hence, a shifitng method
   //is used to change the position as a workaround (Faris Shahin)
+  //The cursor goes the shorter way around, 79 wraps to 0
+  //The shifts are sent here with sendByte() rather than by
+  //LCDShiftCursorRight() and LCDShiftCursorLeft(), or LCDSendByte(), which
+  //would take one more level of the stack. PROF_LCD_BYTE doesn't count them.
+    if(addr > 40)
+        addr -= 80;
+    else if(addr < -40)
+        addr += 80;
     if(addr > 0)
+    {
+        lcdCursorDisplayShift &= ~ShiftCursor;
+        lcdCursorDisplayShift |= ShiftToRight;
         for(int8_t i=0; i<addr; i++)
-            LCDShiftCursorRight();
+            sendByte(0, lcdCursorDisplayShift);
+    }
     else if(addr <0)
+    {
+        lcdCursorDisplayShift &= ~ShiftCursor;
+        lcdCursorDisplayShift &= ~ShiftToLeft;
         for(int8_t i=0; i>addr; i--)
-            LCDShiftCursorLeft();
+            sendByte(0, lcdCursorDisplayShift);
+    }
     current_pos = new_pos;
+    PROFILE_EXIT(PROF_LCD_POS);
 }
 
 // Print one character to LCD
@@ -254,6 +285,6 @@ void LCDPrintString(uint8_t *string, uint8_t y, uint8_t x) {
  */
 void LCDClearLine(uint8_t y)
 {
-    LCDPrintString("                ", y, 1);
+    LCDPrintString((uint8_t *)"                ", y, 1);
     LCDSetPos(1, y);    
 }
@@ -0,0 +1,236 @@
+/*
+ * File:   leak.c
+ * Author: Faris Shahin
+ *
+ * CUSUM leak and theft detector. See leak.h.
+ */
+
+#include "config.h"
+
+#define NO_LEVEL    0xffff  //No reading yet
+
+static uint32_t levelSum[TANK_COUNT];            //Sum of the filtered levels since the last step in cm
+static uint8_t levelCount[TANK_COUNT];           //Number of levels in levelSum
+static uint16_t stepLevel[TANK_COUNT];           //Average level of the last step in 1/16 cm
+static int16_t sum[TANK_COUNT];                  //CUSUM in 1/256 cm
+static int16_t baseline[TANK_COUNT][LEAK_SLOTS]; //Usual drop per step in 1/256 cm
+static tankmask_t alarm = 0;                     //One bit per tank
+static uint32_t lastStep;                        //Time of the last step in seconds
+static uint8_t setDrop;                          //Drop of the settings in cm
+static uint8_t setSteps;                         //Window of the settings in steps
+static int16_t allowance;                        //Allowance per step in 1/256 cm
+static int16_t threshold;                        //Sum raising the alarm in 1/256 cm
+
+/*
+ * Work out the values of the detector from the settings
+ * Parameters:
+ *      drop - the drop in cm
+ *      steps - the window in steps
+ */
+static void apply(uint8_t drop, uint8_t steps)
+{
+    setDrop = drop;
+    setSteps = steps;
+    allowance = ((uint16_t)drop*256)/steps/2;
+    threshold = (uint16_t)drop*256/2;
+}
+
+/*
+ * Clears the detectors of all tanks and loads the settings from EEPROM, or
+ * LEAK_DROP and LEAK_WINDOW if none were saved. The baselines start at zero.
+ */
+void LeakInit(void)
+{
+    uint8_t drop = EEPROMQueueRead(EE_LEAK_ADDR);
+    uint8_t steps = EEPROMQueueRead(EE_LEAK_ADDR+1);
+    if(EEPROMQueueRead(EE_LEAK_ADDR+2) != crc8(crc8(0xff, drop), steps) ||
+       !LeakValid(drop, (uint16_t)steps*LEAK_WINDOW_UNIT))
+    {
+        drop = LEAK_DROP;
+        steps = LEAK_WINDOW/LEAK_WINDOW_UNIT;
+    }
+    apply(drop, steps);
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        LeakReset(i);
+        for(uint8_t j = 0; j < LEAK_SLOTS; j++)
+            baseline[i][j] = 0;
+    }
+    alarm = 0;
+    lastStep = ClockSeconds();
+}
+
+/*
+ * Restart the detector of a tank, e.g. when its dimensions change
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ */
+void LeakReset(uint8_t tankIndex)
+{
+    levelSum[tankIndex] = 0;
+    levelCount[tankIndex] = 0;
+    stepLevel[tankIndex] = NO_LEVEL;
+    sum[tankIndex] = 0;
+    alarm &= ~(1<<tankIndex);
+}
+
+/*
+ * Give the latest filtered level of a tank to the detector
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      level - the height of the liquid in cm
+ * Notes:
+ * The levels are averaged until the next step. Comparing averages instead of
+ * single readings takes the 1 cm steps of the sensor and most of its noise
+ * out of the detector.
+ */
+static void sample(uint8_t tankIndex, uint16_t level)
+{
+    if(levelCount[tankIndex] < 255)
+    {
+        levelSum[tankIndex] += level;
+        levelCount[tankIndex]++;
+    }
+}
+
+/*
+ * Add the tanks read since the last call (see store.h) to their averages,
+ * then take a step of the detector of every tank if LEAK_STEP seconds have
+ * passed since the last one. Returns right away otherwise.
+ * A new alarm is also written to the history log.
+ */
+void LeakService(void)
+{
+    uint32_t now = ClockSeconds();
+    uint8_t slot;
+    uint16_t level;
+    int16_t drop;
+    int16_t * base;
+    struct measurement m;
+    uint8_t tank;
+    
+    while((tank = StoreNext(STORE_LEAK, &m)) != STORE_NONE)
+        if(m.health == STORE_OK)
+            sample(tank, m.level);
+    
+    if(now - lastStep < LEAK_STEP)
+        return;
+    lastStep = now;
+    slot = (now % USAGE_DAY) / (USAGE_DAY/LEAK_SLOTS);
+    
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        if(levelCount[i] == 0)
+            continue;
+        level = (levelSum[i]<<4) / levelCount[i];
+        levelSum[i] = 0;
+        levelCount[i] = 0;
+        if(stepLevel[i] == NO_LEVEL)
+        {
+            stepLevel[i] = level;
+            continue;
+        }
+        //Limit the change to 100 cm so it fits in 16 bits once scaled (a fast
+        //refill can raise the level a lot between two steps)
+        drop = (int16_t)stepLevel[i] - (int16_t)level;
+        if(drop > 1600)
+            drop = 1600;
+        else if(drop < -1600)
+            drop = -1600;
+        drop *= 16;
+        stepLevel[i] = level;
+        base = &baseline[i][slot];
+        
+        sum[i] += drop - *base - allowance;
+        if(sum[i] < 0)
+            sum[i] = 0;
+        if(sum[i] > threshold)
+        {
+            sum[i] = threshold;     //Keeps the sum from growing without limit
+            if(!(alarm & (1<<i)))
+            {
+                alarm |= 1<<i;
+                HistoryMark(HIST_MARK_LEAK, i);
+            }
+        }
+        //Learn the baseline while nothing suspicious is happening. Refills
+        //(the level going up more than the 1 cm of noise) aren't part of the
+        //usual drop.
+        if(sum[i] < threshold/2 && drop >= -256)
+            *base += (drop - *base) / (1<<LEAK_LEARN);
+    }
+}
+
+/*
+ *  Returns:
+ *      1 if the tank is in alarm, 0 otherwise
+ */
+uint8_t LeakAlarm(uint8_t tankIndex)
+{
+    return (alarm>>tankIndex) & 0x01;
+}
+
+/*
+ *  Clear the alarms of all tanks. A tank which is still losing liquid goes
+ *  back in alarm after about the window of the settings.
+ */
+void LeakAcknowledge(void)
+{
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+        sum[i] = 0;
+    alarm = 0;
+}
+
+/*
+ * Check settings of the detector
+ * Parameters:
+ *      drop - the drop in cm
+ *      window - the window in minutes
+ * Returns:
+ *      1 if the drop is 1 to LEAK_DROP_MAX and the window a multiple of
+ *      LEAK_WINDOW_UNIT up to LEAK_WINDOW_MAX, 0 otherwise
+ */
+uint8_t LeakValid(uint8_t drop, uint16_t window)
+{
+    return drop >= 1 && drop <= LEAK_DROP_MAX && window >= LEAK_WINDOW_UNIT &&
+           window <= LEAK_WINDOW_MAX && window % LEAK_WINDOW_UNIT == 0;
+}
+
+/*
+ * Change the settings of the detector and queue them for EEPROM. The sums
+ * start over, the baselines and the alarms are kept.
+ * Parameters:
+ *      drop - the drop in cm
+ *      window - the window in minutes
+ * Notes:
+ * The settings must have been checked with LeakValid(). A power loss before
+ * the 3 bytes are written leaves a wrong CRC: the defaults are loaded.
+ */
+void LeakSetup(uint8_t drop, uint16_t window)
+{
+    uint8_t steps = window/LEAK_WINDOW_UNIT;
+    apply(drop, steps);
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+        sum[i] = 0;
+    EEPROMQueueWrite(EE_LEAK_ADDR, drop);
+    EEPROMQueueWrite(EE_LEAK_ADDR+1, steps);
+    EEPROMQueueWrite(EE_LEAK_ADDR+2, crc8(crc8(0xff, drop), steps));
+}
+
+/*
+ *  Returns:
+ *      The drop of the settings in cm
+ */
+uint8_t LeakDrop(void)
+{
+    return setDrop;
+}
+
+/*
+ *  Returns:
+ *      The window of the settings in minutes
+ */
+uint16_t LeakWindow(void)
+{
+    return (uint16_t)setSteps*LEAK_WINDOW_UNIT;
+}
@@ -1,77 +1,139 @@
-/*
- * File:   main.c
- * Author: Faris Shahin
- *
- * Revision: v1.0
- */
-
-#include "config.h"
-
-// define a structure for the state machine
-typedef struct {
-    uint8_t ST;             //Represents the current state
-    uint8_t EV;             //Represents the event that occurred
-    uint8_t (*FN)(void);    //Represents the function which will be called
-} smTransition;
-
-void main(void)
-{
-    //Initialize MCU registers which will be used
-    ADCON1 = 0x06;      //Set PORTA as digital for use with ultrasonic module
-    OPTION_REG = 0x85;  //PORTB pull ups disabled, TMR0 internal clk, 64 prescalar
-    INTCON = 0x80;      //Set Global Interrupt Enable bit
-    TRISA = 0x00;       //Set PORTA as output
-    CCP1CON = 0x00;     //Disable Capture/Compare/PWM
-    RCSTA = 0x00;       //Disable serial port and all associated functions of serial communication
-    
-    //Initialize all modules
-    LCDInitialize();
-    UltraSonicInit();
-    KeypadInit();
-    
-    //Set the behavior of the state machine
-    smTransition transitions[] = {
-    {ST_IDLE, EV_KEY_NONE, &idle},
-    {ST_IDLE, EV_KEY_STAR, &options},
-    {ST_OPTIONS, EV_KEY_ONE, &addEditEntry},
-    {ST_OPTIONS, EV_KEY_TWO, &deleteEntry},
-    {ST_OPTIONS, EV_KEY_THREE, &view},
-    {ST_VIEW, EV_KEY_NONE, &idle},
-    {ST_ADD_EDIT, EV_KEY_HASH, &options},
-    {ST_DEL, EV_KEY_HASH, &options}
-    };
-    
-    uint8_t stCount = sizeof(transitions)/sizeof(*transitions);
-    
-    //initialize the state machine and set the event to "any"
-    uint8_t currentState = init();
-    uint8_t event = EV_ANY;
-    
-    while(1)
-    {
-        //Infinite loop to go through the states in the state machine
-        event = getEvent();
-        for(uint8_t i = 0; i < stCount; i++)
-            if(currentState == transitions[i].ST)
-            {
-                if(event == transitions[i].EV)
-                {
-                    currentState = (transitions[i].FN)();
-                    break;
-                }
-            }
-    }
-}
-
-/*
- * Interrupt service routine. Only checks TMR0 interrupt flag and increments a 
- * counter if the flag is set (sets only when TMR0 overflows)
- */
-void __interrupt() tc_int(void)
-{
-    if (TMR0IF)
-    {
-        TMR0of++;
-        TMR0IF = 0;
-    }
+/*
+ * File:   main.c
+ * Author: Faris Shahin
+ *
+ * Revision: v1.0
+ */
+
+#include "config.h"
+
+// define a structure for the state machine
+typedef struct {
+    uint8_t ST;             //Represents the current state
+    uint8_t EV;             //Represents the event that occurred
+    uint8_t (*FN)(void);    //Represents the function which will be called
+} smTransition;
+
+void main(void)
+{
+    //Initialize MCU registers which will be used
+    ADCON1 = PRESSURE_DIGITAL;  //Set PORTA as digital for use with ultrasonic module
+    OPTION_REG = US_OPTION_REG; //PORTB pull ups disabled, TMR0 internal clk, prescaler of ultrasonic_hcsr04.h
+    INTCON = 0xC0;      //Set Global and Peripheral Interrupt Enable bits
+    TRISA = 0x00;       //Set PORTA as output
+    CCP1CON = 0x00;     //Disable Capture/Compare/PWM
+    
+    //Initialize all modules
+    LCDInitialize();
+    UltraSonicInit();
+    KeypadInit();
+    EEPROMQueueInit();
+    ClockInit();
+    UARTInit();
+    ProvisionInit();
+#if PROFILE
+    ProfileInit();
+#endif
+    
+    //Set the behavior of the state machine
+    smTransition transitions[] = {
+    {ST_IDLE, EV_KEY_NONE, &idle},
+    {ST_IDLE, EV_KEY_STAR, &options},
+    {ST_IDLE, EV_KEY_HASH, &acknowledge},
+    {ST_IDLE, EV_KEY_TWO, &previousPage},
+    {ST_IDLE, EV_KEY_EIGHT, &nextPage},
+    {ST_IDLE, EV_KEY_ZERO, &toggleCompact},
+    {ST_OPTIONS, EV_KEY_ONE, &addEditEntry},
+    {ST_OPTIONS, EV_KEY_TWO, &deleteEntry},
+    {ST_OPTIONS, EV_KEY_THREE, &view},
+    {ST_OPTIONS, EV_KEY_FOUR, &usage},
+    {ST_VIEW, EV_KEY_NONE, &view},
+    {ST_ADD_EDIT, EV_KEY_HASH, &options},
+    {ST_DEL, EV_KEY_HASH, &options},
+    {ST_USAGE, EV_KEY_HASH, &options},
+    {ST_USAGE, EV_KEY_STAR, &refills},
+    {ST_USAGE, EV_KEY_TWO, &usagePreviousPage},
+    {ST_USAGE, EV_KEY_EIGHT, &usageNextPage},
+    {ST_REFILLS, EV_KEY_HASH, &options},
+    {ST_REFILLS, EV_KEY_TWO, &refillsPreviousPage},
+    {ST_REFILLS, EV_KEY_EIGHT, &refillsNextPage},
+#if PROFILE
+    {ST_OPTIONS, EV_KEY_NINE, &diagnostics},
+    {ST_DIAG, EV_KEY_EIGHT, &diagnosticsPage},
+    {ST_DIAG, EV_KEY_ZERO, &diagnosticsClear},
+    {ST_DIAG, EV_KEY_STAR, &diagnosticsDump},
+    {ST_DIAG, EV_KEY_HASH, &options},
+#endif
+    };
+    
+    uint8_t stCount = sizeof(transitions)/sizeof(*transitions);
+    
+    //initialize the state machine and set the event to "any"
+    uint8_t currentState = init();
+    uint8_t event = EV_ANY;
+    
+    while(1)
+    {
+        //Infinite loop to go through the states in the state machine.
+        //The view state takes no key, the keypad is read again in idle.
+        event = (currentState == ST_VIEW) ? EV_KEY_NONE : getEvent();
+        for(uint8_t i = 0; i < stCount; i++)
+            if(currentState == transitions[i].ST)
+            {
+                if(event == transitions[i].EV)
+                {
+                    currentState = (transitions[i].FN)();
+                    break;
+                }
+            }
+    }
+}
+
+/*
+ * Interrupt service routine. Checks TMR0 interrupt flag and increments a 
+ * counter if the flag is set (sets only when TMR0 overflows).
+ * Also counts the seconds with TMR2, moves the EEPROM write queue to the
+ * next byte when a write is done, takes the samples of a pressure transducer
+ * and runs the serial protocol.
+ */
+void __interrupt() tc_int(void)
+{
+    PROFILE_ENTER();
+    if (TMR0IF)
+    {
+        TMR0of++;
+        TMR0IF = 0;
+    }
+    if (TMR2IF)
+    {
+        TMR2IF = 0;
+        ClockTick();
+    }
+    if (EEIF)
+    {
+        EEIF = 0;
+        EEPROMQueueWriteDone();
+    }
+    if (ADIE && ADIF)   //ADIF is set by every conversion, only the readings of pressure_adc.c enable it
+    {
+        ADIF = 0;
+        PressureAdcInterrupt();
+    }
+#if SERIAL_PROTOCOL == SERIAL_TELEMETRY
+    if (RCIF)           //Cleared by reading RCREG
+        ProvisionRxInterrupt();
+    if (TXIE && TXIF)   //TXIF can't be cleared, it follows TXREG
+        UARTTxInterrupt();
+#elif SERIAL_PROTOCOL == SERIAL_MODBUS
+    if (CCP1IF)         //First, a byte received now belongs to the next frame
+    {
+        CCP1IF = 0;
+        ModbusTimerInterrupt();
+    }
+    if (RCIF)           //Cleared by reading RCREG
+        ModbusRxInterrupt();
+    if (TXIE && TXIF)
+        ModbusTxInterrupt();
+#endif
+    PROFILE_EXIT(PROF_ISR);
 }
\ No newline at end of file
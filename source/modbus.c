@@ -0,0 +1,542 @@
+/*
+ * File:   modbus.c
+ * Author: Faris Shahin
+ *
+ * Modbus RTU slave. See modbus.h.
+ *
+ * Note: the interrupt service routine in main.c must call
+ * ModbusTimerInterrupt() when CCP1IF is set, ModbusRxInterrupt() when RCIF is
+ * set and ModbusTxInterrupt() when both TXIE and TXIF are set, in that order.
+ */
+
+#include "config.h"
+
+#if SERIAL_PROTOCOL == SERIAL_MODBUS
+
+#if MODBUS_T35 > 65535L
+#error "t3.5 doesn't fit in TMR1 with this crystal and UART_BAUD"
+#endif
+
+#if MODBUS_WAIT > 65535L
+#error "The wait for the main loop doesn't fit in TMR1 with this crystal"
+#endif
+
+#define MB_RECEIVE  0   //Receiving a request
+#define MB_SEND     1   //Sending the reply
+#define MB_DRAIN    2   //The last bytes of the reply are still going out
+#define MB_READY    3   //A request for this board waits for ModbusService()
+#define MB_ANSWER   4   //ModbusService() is carrying it out
+
+//CRC-16 table split in low and high bytes so it stays in program memory
+//as two tables of 256 bytes
+static const uint8_t crcTableLo[256] = {
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+    0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40
+};
+
+static const uint8_t crcTableHi[256] = {
+    0x00, 0xC0, 0xC1, 0x01, 0xC3, 0x03, 0x02, 0xC2, 0xC6, 0x06, 0x07, 0xC7,
+    0x05, 0xC5, 0xC4, 0x04, 0xCC, 0x0C, 0x0D, 0xCD, 0x0F, 0xCF, 0xCE, 0x0E,
+    0x0A, 0xCA, 0xCB, 0x0B, 0xC9, 0x09, 0x08, 0xC8, 0xD8, 0x18, 0x19, 0xD9,
+    0x1B, 0xDB, 0xDA, 0x1A, 0x1E, 0xDE, 0xDF, 0x1F, 0xDD, 0x1D, 0x1C, 0xDC,
+    0x14, 0xD4, 0xD5, 0x15, 0xD7, 0x17, 0x16, 0xD6, 0xD2, 0x12, 0x13, 0xD3,
+    0x11, 0xD1, 0xD0, 0x10, 0xF0, 0x30, 0x31, 0xF1, 0x33, 0xF3, 0xF2, 0x32,
+    0x36, 0xF6, 0xF7, 0x37, 0xF5, 0x35, 0x34, 0xF4, 0x3C, 0xFC, 0xFD, 0x3D,
+    0xFF, 0x3F, 0x3E, 0xFE, 0xFA, 0x3A, 0x3B, 0xFB, 0x39, 0xF9, 0xF8, 0x38,
+    0x28, 0xE8, 0xE9, 0x29, 0xEB, 0x2B, 0x2A, 0xEA, 0xEE, 0x2E, 0x2F, 0xEF,
+    0x2D, 0xED, 0xEC, 0x2C, 0xE4, 0x24, 0x25, 0xE5, 0x27, 0xE7, 0xE6, 0x26,
+    0x22, 0xE2, 0xE3, 0x23, 0xE1, 0x21, 0x20, 0xE0, 0xA0, 0x60, 0x61, 0xA1,
+    0x63, 0xA3, 0xA2, 0x62, 0x66, 0xA6, 0xA7, 0x67, 0xA5, 0x65, 0x64, 0xA4,
+    0x6C, 0xAC, 0xAD, 0x6D, 0xAF, 0x6F, 0x6E, 0xAE, 0xAA, 0x6A, 0x6B, 0xAB,
+    0x69, 0xA9, 0xA8, 0x68, 0x78, 0xB8, 0xB9, 0x79, 0xBB, 0x7B, 0x7A, 0xBA,
+    0xBE, 0x7E, 0x7F, 0xBF, 0x7D, 0xBD, 0xBC, 0x7C, 0xB4, 0x74, 0x75, 0xB5,
+    0x77, 0xB7, 0xB6, 0x76, 0x72, 0xB2, 0xB3, 0x73, 0xB1, 0x71, 0x70, 0xB0,
+    0x50, 0x90, 0x91, 0x51, 0x93, 0x53, 0x52, 0x92, 0x96, 0x56, 0x57, 0x97,
+    0x55, 0x95, 0x94, 0x54, 0x9C, 0x5C, 0x5D, 0x9D, 0x5F, 0x9F, 0x9E, 0x5E,
+    0x5A, 0x9A, 0x9B, 0x5B, 0x99, 0x59, 0x58, 0x98, 0x88, 0x48, 0x49, 0x89,
+    0x4B, 0x8B, 0x8A, 0x4A, 0x4E, 0x8E, 0x8F, 0x4F, 0x8D, 0x4D, 0x4C, 0x8C,
+    0x44, 0x84, 0x85, 0x45, 0x87, 0x47, 0x46, 0x86, 0x82, 0x42, 0x43, 0x83,
+    0x41, 0x81, 0x80, 0x40
+};
+
+static uint8_t buf[MODBUS_BUF];     //Request being received, then its reply
+static uint8_t len;                 //Bytes in buf
+static uint8_t pos;                 //Next byte of the reply to send
+static volatile uint8_t state;
+static uint8_t bad;                 //The request being received is damaged
+static uint8_t waits;               //MODBUS_WAIT periods the request waited
+static uint8_t address;             //Slave address
+static tankmask_t dirty;            //One bit per tank written
+static uint8_t dirtyAddr;           //1 if the slave address was written
+static uint8_t leakDrop;            //Leak settings (see leak.h), as written
+static uint16_t leakWindow;
+static uint8_t dirtyLeak;           //1 if the leak settings were written
+
+/*
+ * Calculate the Modbus CRC-16 of a frame
+ * Parameters:
+ *      *data - the frame
+ *      n - the number of bytes
+ * Returns:
+ *      The CRC, sent low byte first
+ */
+static uint16_t crc16(uint8_t * data, uint8_t n)
+{
+    uint8_t lo = 0xff, hi = 0xff, idx;
+    while(n--)
+    {
+        idx = lo ^ *data++;
+        lo = hi ^ crcTableLo[idx];
+        hi = crcTableHi[idx];
+    }
+    return (uint16_t)hi<<8 | lo;
+}
+
+//Restart TMR1 so CCP1 raises an interrupt after a number of cycles. A macro,
+//the interrupts call nothing.
+#define startTimer(cycles)  do {                                            \
+        TMR1ON = 0;                                                         \
+        TMR1H = 0;                                                          \
+        TMR1L = 0;                                                          \
+        CCPR1H = (uint16_t)(cycles) >> 8;                                   \
+        CCPR1L = (uint16_t)(cycles) & 0xff;                                 \
+        CCP1IF = 0;                                                         \
+        TMR1ON = 1;                                                         \
+    } while(0)
+
+/*
+ *  Returns:
+ *      1 if the character can be used in a tank name (see nameSet())
+ */
+static uint8_t nameChar(uint8_t c)
+{
+    return c == ' ' || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9');
+}
+
+/*
+ * Read a register
+ * Parameters:
+ *      function - 3 for a holding register, 4 for an input register
+ *      reg - the register address
+ *      *value - where the value is stored
+ * Returns:
+ *      1 if the register exists, 0 otherwise
+ */
+static uint8_t readRegister(uint8_t function, uint16_t reg, uint16_t * value)
+{
+    uint8_t t, offset;
+    const struct measurement * m;
+    if(function == 4)
+    {
+        if(reg >= TANK_COUNT*MODBUS_TANK_INPUT)
+            return 0;
+        t = reg / MODBUS_TANK_INPUT;
+        offset = reg % MODBUS_TANK_INPUT;
+        m = StoreRead(t);  //Whole even if the main loop was publishing the tank
+        //The snapshot shown at power up wasn't read, so it's not sent
+        if(!TankInUse(t) || (m->health != STORE_OK && offset < 4))
+        {
+            *value = (offset == 0) ? TLM_NO_LEVEL : 0;
+            return 1;
+        }
+        switch(offset)
+        {
+            case 0: *value = m->level; break;
+            case 1: *value = m->percent; break;
+            case 2: *value = m->liters >> 16; break;
+            case 3: *value = m->liters & 0xffff; break;
+            default: *value = tankFlags(t) | (m->health != STORE_OK ? TLM_FLAG_NO_READING : 0); break;
+        }
+        return 1;
+    }
+    
+    if(reg == 0)
+    {
+        *value = address;
+        return 1;
+    }
+    if(reg == MODBUS_LEAK_REG || reg == MODBUS_LEAK_REG+1)
+    {
+        *value = (reg == MODBUS_LEAK_REG) ? leakDrop : leakWindow;
+        return 1;
+    }
+    if(reg >= MODBUS_SENSOR_REG && reg < MODBUS_SENSOR_REG+TANK_COUNT)
+    {
+        *value = TankSensor(reg - MODBUS_SENSOR_REG);
+        return 1;
+    }
+    reg--;
+    if(reg >= TANK_COUNT*MODBUS_TANK_HOLDING)
+        return 0;
+    t = reg / MODBUS_TANK_HOLDING;
+    offset = reg % MODBUS_TANK_HOLDING;
+    switch(offset)
+    {
+        case 0: case 1: case 2:
+            *value = (uint16_t)TankNameChar(t, 2*offset)<<8 | TankNameChar(t, 2*offset+1);
+            break;
+        case 3: *value = TankLength(t); break;
+        case 4: *value = TankWidth(t); break;
+        case 5: *value = TankHeight(t); break;
+        case 6: *value = TankLow(t); break;
+        case 7: *value = TankCritical(t); break;
+        default: *value = TankHigh(t); break;
+    }
+    return 1;
+}
+
+/*
+ * Check or do a write to a holding register
+ * Parameters:
+ *      reg - the register address
+ *      value - the value to write
+ *      apply - 0 to only check the write, 1 to do it
+ * Returns:
+ *      0 if the write is (or would be) done, otherwise the exception code:
+ *      2 if the register doesn't exist, 3 if the value is out of range
+ */
+static uint8_t writeRegister(uint16_t reg, uint16_t value, uint8_t apply)
+{
+    uint8_t t, offset;
+    if(reg == 0)
+    {
+        if(value < 1 || value > 247)
+            return 3;
+        if(apply)
+        {
+            address = value;
+            dirtyAddr = 1;
+        }
+        return 0;
+    }
+    if(reg == MODBUS_LEAK_REG)
+    {
+        if(value < 1 || value > LEAK_DROP_MAX)
+            return 3;
+        if(apply)
+        {
+            leakDrop = value;
+            dirtyLeak = 1;
+        }
+        return 0;
+    }
+    if(reg == MODBUS_LEAK_REG+1)
+    {
+        if(value < LEAK_WINDOW_UNIT || value > LEAK_WINDOW_MAX || value % LEAK_WINDOW_UNIT != 0)
+            return 3;
+        if(apply)
+        {
+            leakWindow = value;
+            dirtyLeak = 1;
+        }
+        return 0;
+    }
+    if(reg >= MODBUS_SENSOR_REG && reg < MODBUS_SENSOR_REG+TANK_COUNT)
+    {
+        if(value >= SENSOR_TYPES)
+            return 3;
+        if(apply)
+        {
+            t = reg - MODBUS_SENSOR_REG;
+            TankSetSensor(t, value);
+            dirty |= 1<<t;
+        }
+        return 0;
+    }
+    reg--;
+    if(reg >= TANK_COUNT*MODBUS_TANK_HOLDING)
+        return 2;
+    t = reg / MODBUS_TANK_HOLDING;
+    offset = reg % MODBUS_TANK_HOLDING;
+    if(offset <= 2 && !(nameChar(value >> 8) && nameChar(value & 0xff)))
+        return 3;
+    if(offset >= 3 && offset <= 5 && value > 999)
+        return 3;
+    if(offset >= 6 && value > 100)
+        return 3;
+    if(!apply)
+        return 0;
+    
+    switch(offset)
+    {
+        case 0: case 1: case 2:
+            TankSetNameChar(t, 2*offset, value >> 8);
+            TankSetNameChar(t, 2*offset+1, value & 0xff);
+            break;
+        case 3: TankSetLength(t, value); break;
+        case 4: TankSetWidth(t, value); break;
+        case 5: TankSetHeight(t, value); break;
+        case 6: TankSetLow(t, value); break;
+        case 7: TankSetCritical(t, value); break;
+        default: TankSetHigh(t, value); break;
+    }
+    dirty |= 1<<t;
+    return 0;
+}
+
+/*
+ * Turn the request in buf into an exception reply
+ * Returns:
+ *      The length of the reply without its CRC
+ */
+static uint8_t exception(uint8_t code)
+{
+    buf[1] |= 0x80;
+    buf[2] = code;
+    return 3;
+}
+
+/*
+ * Loads the slave address and sets up the USART receiver, TMR1 with CCP1 for
+ * the frame timing and the RS-485 driver enable pin. Called after LeakInit().
+ */
+void ModbusInit(void)
+{
+    uint8_t a = EEPROMQueueRead(EE_MODBUS_ADDR);
+    uint8_t check = ~a;     //Saved with the address
+    if(a >= 1 && a <= 247 && EEPROMQueueRead(EE_MODBUS_ADDR+1) == check)
+        address = a;
+    else
+        address = MODBUS_DEFAULT_ADDR;
+    leakDrop = LeakDrop();
+    leakWindow = LeakWindow();
+    dirtyLeak = 0;
+    MODBUS_DE_TRIS &= ~(1<<MODBUS_DE_PIN);
+    MODBUS_DE_PORT &= ~(1<<MODBUS_DE_PIN);
+    TX9D = 1;           //The 9th bit is always 1: a second stop bit
+    TX9 = 1;
+    T1CON = 0x00;       //Internal clock, prescaler 1:1, stopped
+    CCP1CON = 0x0A;     //Compare mode, interrupt on match
+    CCP1IE = 1;
+    state = MB_RECEIVE;
+    len = 0;
+    bad = 0;
+    CREN = 1;
+    RCIE = 1;
+}
+
+/*
+ * Carry out the request waiting, if there's one, and start its reply. Called
+ * by idle(), so requests are answered on the main screen.
+ * Returns:
+ *      The tanks written, one bit each. The caller runs tankChanged() on them
+ *      (it's too deep to call from here), as when they are edited from the
+ *      keypad.
+ * Notes:
+ * The leak settings are given to the detector, which saves them, and a new
+ * slave address is saved here.
+ * The request is carried out in this function rather than in one it calls:
+ * the reads of the registers are 3 levels deep below it.
+ */
+tankmask_t ModbusService(void)
+{
+    uint8_t function;
+    uint16_t start, count, value, crc;
+    uint8_t n = 0, code = 0;
+    tankmask_t d;
+
+    GIE = 0;
+    if(state == MB_READY)
+    {
+        TMR1ON = 0;
+        state = MB_ANSWER;
+    }
+    GIE = 1;
+    if(state != MB_ANSWER)
+        return 0;
+
+    function = buf[1];
+    start = (uint16_t)buf[2]<<8 | buf[3];
+    count = (uint16_t)buf[4]<<8 | buf[5];
+    crc = crc16(buf, len-2);
+    if(buf[len-2] != (crc & 0xff) || buf[len-1] != crc >> 8)
+        buf[0] = 0;     //Damaged, not answered as a broadcast isn't
+    else switch(function)
+    {
+        case 3:
+        case 4:
+            if(len != 8 || count == 0 || count > MODBUS_MAX_REGS)
+                code = 3;
+            for(uint8_t i = 0; !code && i < count; i++)
+            {
+                if(!readRegister(function, start+i, &value))
+                {
+                    code = 2;
+                    break;
+                }
+                buf[3+2*i] = value >> 8;
+                buf[4+2*i] = value & 0xff;
+            }
+            buf[2] = count*2;
+            n = 3 + count*2;
+            break;
+        case 6:
+            if(len != 8)
+                code = 3;
+            else
+                code = writeRegister(start, count, 0);  //count is the value here
+            if(!code)
+                writeRegister(start, count, 1);
+            n = 6;      //The reply is the request
+            break;
+        case 16:
+            if(count == 0 || buf[6] != count*2 || len != 9+buf[6])
+                code = 3;
+            //Check every register first so a bad one leaves all unchanged
+            for(uint8_t apply = 0; !code && apply < 2; apply++)
+                for(uint8_t i = 0; !code && i < count; i++)
+                {
+                    value = (uint16_t)buf[7+2*i]<<8 | buf[8+2*i];
+                    code = writeRegister(start+i, value, apply);
+                }
+            n = 6;      //Address, function, start and count
+            break;
+        default:
+            code = 1;
+    }
+    if(code)
+        n = exception(code);
+    if(buf[0] == 0)     //Broadcasts aren't answered
+        n = 0;
+
+    if(n == 0)
+    {
+        len = 0;
+        state = MB_RECEIVE;
+    }
+    else
+    {
+        crc = crc16(buf, n);
+        buf[n] = crc & 0xff;
+        buf[n+1] = crc >> 8;
+        len = n+2;
+        pos = 0;
+        state = MB_SEND;
+        MODBUS_DE_PORT |= 1<<MODBUS_DE_PIN;
+        TXIE = 1;
+    }
+
+    if(dirtyAddr)
+    {
+        EEPROMQueueWrite(EE_MODBUS_ADDR, address);
+        EEPROMQueueWrite(EE_MODBUS_ADDR+1, ~address);
+        dirtyAddr = 0;
+    }
+    if(dirtyLeak)
+    {
+        LeakSetup(leakDrop, leakWindow);
+        dirtyLeak = 0;
+    }
+    d = dirty;
+    dirty = 0;
+    return d;
+}
+
+/*
+ * Called from the interrupt service routine for every received byte
+ */
+void ModbusRxInterrupt(void)
+{
+    uint8_t data;
+    if(OERR)
+    {
+        CREN = 0;   //Clears the overrun
+        CREN = 1;
+        bad = 1;
+    }
+    if(FERR)        //Must be read before RCREG
+        bad = 1;
+    data = RCREG;
+    if(state != MB_RECEIVE)
+        return;
+    if(len < MODBUS_BUF)
+        buf[len++] = data;
+    else
+        bad = 1;
+    startTimer(MODBUS_T35);
+}
+
+/*
+ * Called from the interrupt service routine when TXREG is empty during a reply
+ */
+void ModbusTxInterrupt(void)
+{
+    TXREG = buf[pos++];
+    if(pos == len)
+    {
+        //The byte before this one may still be shifting out
+        TXIE = 0;
+        state = MB_DRAIN;
+        startTimer(2*MODBUS_CHAR);
+    }
+}
+
+/*
+ * Called from the interrupt service routine when CCP1 matches TMR1: either a
+ * request ended (t3.5 without a byte), one waited MODBUS_WAIT more for
+ * ModbusService() or a reply should be out
+ */
+void ModbusTimerInterrupt(void)
+{
+    TMR1ON = 0;
+    if(state == MB_DRAIN)
+    {
+        if(!TRMT)
+        {
+            startTimer(MODBUS_CHAR/4);
+            return;
+        }
+        MODBUS_DE_PORT &= ~(1<<MODBUS_DE_PIN);
+        state = MB_RECEIVE;
+        len = 0;
+        return;
+    }
+    if(state == MB_READY)
+    {
+        //Too late to answer, the master has given up on it
+        if(++waits >= MODBUS_WAITS)
+        {
+            state = MB_RECEIVE;
+            len = 0;
+        }
+        else
+            startTimer(MODBUS_WAIT);
+        return;
+    }
+    if(state != MB_RECEIVE)
+        return;
+
+    //Requests to other boards are dropped here, the CRC is checked by
+    //ModbusService()
+    if(!bad && len >= 4 && (buf[0] == address || buf[0] == 0))
+    {
+        state = MB_READY;
+        waits = 0;
+        startTimer(MODBUS_WAIT);
+    }
+    else
+        len = 0;
+    bad = 0;
+}
+
+#endif	/* SERIAL_PROTOCOL == SERIAL_MODBUS */
@@ -0,0 +1,103 @@
+/*
+ * File:   numfmt.c
+ * Author: Faris Shahin
+ *
+ * Division-free number formatting for the LCD.
+ *
+ * Note: The PIC16 has no divide instruction, so every '/10' and '%10' on a
+ * uint32_t is a call to a software division routine. The digits here are
+ * found by subtracting powers of ten instead, which only needs compares and
+ * subtractions: at most 9 of them per digit.
+ */
+
+#include "config.h"
+
+//Powers of ten from 10^9 down to 10^1. 10^0 is handled by the last digit.
+static const uint32_t pow10Long[9] = {
+    1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10
+};
+
+//Same as above for values that fit in 16 bits (10^4 down to 10^1)
+static const uint16_t pow10Short[4] = {10000, 1000, 100, 10};
+
+/*
+ * Write a number right aligned into a fixed-width field
+ * Parameters:
+ *      num - the number to write
+ *      *dest - the first character of the field inside the caller's buffer
+ *      width - the number of characters in the field (1 to 10)
+ * Notes:
+ * A width of 0 writes nothing. Wider fields than 10 are padded on the left,
+ * a uint32_t never has more than 10 digits.
+ * Exactly width characters are written and no '\0' is added, so the field can
+ * sit in the middle of an LCD line. Leading zeros are replaced by NUMFMT_PAD.
+ * A number which needs more than width digits fills the field with
+ * NUMFMT_OVERFLOW instead of showing wrong digits.
+ * Numbers that fit in 16 bits (all percentages and most tanks) take a
+ * cheaper path since a 16-bit compare/subtract is half the work on an 8-bit
+ * core.
+ */
+void NumFormat(uint32_t num, uint8_t * dest, uint8_t width)
+{
+    uint8_t digit;
+    uint8_t leading = 1;    //Still writing leading zeros
+    uint8_t i;
+
+    if(width == 0)
+        return;
+    for(; width > 10; width--)
+        *dest++ = NUMFMT_PAD;
+
+    //Check that the number fits in the field
+    if(width < 10 && num >= pow10Long[9-width])
+    {
+        for(i = 0; i < width; i++)
+            dest[i] = NUMFMT_OVERFLOW;
+        return;
+    }
+
+    //Fields wider than 5 characters with a 16-bit number are padded first
+    //so the rest can use the short table
+    if(num <= 0xffff)
+    {
+        uint16_t shortNum = (uint16_t)num;
+        for(; width > 5; width--)
+            *dest++ = NUMFMT_PAD;
+        for(i = 5-width; i < 4; i++)
+        {
+            digit = '0';
+            while(shortNum >= pow10Short[i])
+            {
+                shortNum -= pow10Short[i];
+                digit++;
+            }
+            if(digit == '0' && leading)
+                *dest++ = NUMFMT_PAD;
+            else
+            {
+                leading = 0;
+                *dest++ = digit;
+            }
+        }
+        *dest = '0' + (uint8_t)shortNum;
+        return;
+    }
+
+    for(i = 10-width; i < 9; i++)
+    {
+        digit = '0';
+        while(num >= pow10Long[i])
+        {
+            num -= pow10Long[i];
+            digit++;
+        }
+        if(digit == '0' && leading)
+            *dest++ = NUMFMT_PAD;
+        else
+        {
+            leading = 0;
+            *dest++ = digit;
+        }
+    }
+    *dest = '0' + (uint8_t)num;
+}
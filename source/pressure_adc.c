@@ -0,0 +1,129 @@
+/*
+ * File:   pressure_adc.c
+ * Author: Faris Shahin
+ *
+ * Pressure transducers read by the ADC. See pressure_adc.h.
+ *
+ * Note: PressureAdcInterrupt() must be called from the interrupt service
+ * routine in main.c when ADIF is set.
+ */
+
+#include "config.h"
+
+//A Tad of at least 1.6us
+#if _XTAL_FREQ <= 5000000L
+#define ADCON0_ON       0x41    //Fosc/8, AN0, ADC on
+#else
+#define ADCON0_ON       0x81    //Fosc/32, AN0, ADC on
+#endif
+#define ADCON1_AN0      0x8E    //Right justified, AN0 analog, the rest of PORTA digital
+
+static volatile uint16_t sum;       //Samples added up so far
+static volatile uint8_t left;       //Samples still to take, 0 once the reading is over
+static uint16_t height;             //Height of the tank being read in cm
+static uint16_t counts;             //Decimated sum of the last reading
+static uint16_t level;              //Level of the last reading in mm
+static uint8_t health;
+
+/*
+ * Connect the transducer of a tank to the ADC and start the conversions
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ */
+void PressureStart(uint8_t tankIndex)
+{
+    height = TankHeight(tankIndex);
+    UltraSonicSelect(tankIndex);    //Same MUX channel as a sensor would be on
+    ADCON1 = ADCON1_AN0;
+    ADCON0 = ADCON0_ON;
+    sum = 0;
+    left = PRESSURE_SAMPLES;
+    ADIF = 0;
+    ADIE = 1;
+    __delay_us(PRESSURE_ACQ_US);
+    GO = 1;
+}
+
+/*
+ * Called from the interrupt service routine at the end of a conversion. It
+ * takes the sample and starts the next conversion, so the samples are taken
+ * back to back whatever the main line does. At 4MHz the next one starts at
+ * once: entering the interrupt takes longer than the holding capacitor needs
+ * behind the 250 ohm shunt. Faster crystals wait PRESSURE_REACQ_US for it.
+ */
+void PressureAdcInterrupt(void)
+{
+    sum += (uint16_t)ADRESH << 8 | ADRESL;
+    if(--left)
+    {
+#if _XTAL_FREQ > 4000000L
+        __delay_us(PRESSURE_REACQ_US);
+#endif
+        GO = 1;
+        return;
+    }
+    ADIE = 0;
+    ADCON0 = 0;                     //ADC off
+    ADCON1 = PRESSURE_DIGITAL;      //The echo line is digital again
+}
+
+/*
+ * Check whether the reading is over and work the level out once it is
+ * Returns:
+ *      SENSOR_BUSY or SENSOR_DONE
+ */
+uint8_t PressurePoll(void)
+{
+    uint32_t mm;
+    if(left)
+        return SENSOR_BUSY;
+    counts = sum >> PRESSURE_SHIFT;
+    level = 0;
+    if(counts < PRESSURE_OPEN)
+        health = STORE_NO_ECHO;
+    else if(counts >= PRESSURE_FULL)
+        health = STORE_OUT_OF_RANGE;    //The ADC is saturated
+    else
+    {
+        //Noise around 4mA reads as an empty tank
+        mm = counts > PRESSURE_ZERO ? counts - PRESSURE_ZERO : 0;
+        mm = mm*PRESSURE_RANGE_MM/(PRESSURE_FULL-PRESSURE_ZERO);    //Head of water
+        mm = mm*1000/PRESSURE_DENSITY;                              //Head of the liquid
+        if(mm > height*10)
+            health = STORE_OUT_OF_RANGE;
+        else
+        {
+            health = STORE_OK;
+            level = mm;
+        }
+    }
+    return SENSOR_DONE;
+}
+
+/*
+ * Returns:
+ *      The level of the last reading in mm above the transducer
+ */
+uint16_t PressureLevel(void)
+{
+    return level;
+}
+
+/*
+ * Returns:
+ *      STORE_OK, STORE_NO_ECHO if the loop current was under 3.6mA or
+ *      STORE_OUT_OF_RANGE if the level was above the tank or the transducer
+ */
+uint8_t PressureHealth(void)
+{
+    return health;
+}
+
+/*
+ * Returns:
+ *      The decimated ADC counts of the last reading (0 to PRESSURE_MAX)
+ */
+uint16_t PressureCounts(void)
+{
+    return counts;
+}
@@ -0,0 +1,164 @@
+/*
+ * File:   profile.c
+ * Author: Faris Shahin
+ *
+ * Profiler of the time spent in the probed functions. See profile.h.
+ *
+ * Note: ProfileInit() must be called before the first probe, and only when
+ * nothing else uses TMR1.
+ */
+
+#include "config.h"
+
+#if PROFILE
+
+#if SERIAL_PROTOCOL == SERIAL_MODBUS
+#error "PROFILE uses TMR1, which the Modbus build needs for its frame timer"
+#endif
+
+//TMR1 ticks to microseconds
+#define TICKS_US(t) ((uint32_t)(t)*PROFILE_TICK_CYCLES/(_XTAL_FREQ/4000000L))
+
+static const uint8_t names[PROF_COUNT][5] = {
+    "PING", "VIEW", "LCDB", "LCDP", "KEYS", "EEPR", "ISR "
+};
+
+static struct profileEntry{
+    uint16_t calls;
+    uint32_t ticks;     //Sum of the TMR1 ticks of all calls
+    uint16_t max;       //Ticks of the longest call
+}table[PROF_COUNT];
+
+/*
+ * Starts TMR1 as the time base of the probes and empties the table
+ */
+void ProfileInit(void)
+{
+    T1CON = PROFILE_T1CON;
+    ProfileClear();
+}
+
+/*
+ * Returns:
+ *      The TMR1 count
+ * Notes:
+ * The high byte is read again to catch the low byte rolling over between
+ * the two reads.
+ */
+uint16_t ProfileNow(void)
+{
+    uint8_t high, low;
+    do
+    {
+        high = TMR1H;
+        low = TMR1L;
+    }while(high != TMR1H);
+    return ((uint16_t)high << 8) | low;
+}
+
+/*
+ * Add a call to the table. Used by PROFILE_EXIT().
+ * Parameters:
+ *      probe - PROF_...
+ *      start - TMR1 count at the start of the call
+ */
+void ProfileRecord(uint8_t probe, uint16_t start)
+{
+    uint16_t ticks = ProfileNow() - start;
+    struct profileEntry * entry = &table[probe];
+    entry->calls++;
+    entry->ticks += ticks;
+    if(ticks > entry->max)
+        entry->max = ticks;
+}
+
+/*
+ * Forget all the calls so far
+ */
+void ProfileClear(void)
+{
+    GIE = 0;    //The ISR probe could be half written
+    for(uint8_t i = 0; i < PROF_COUNT; i++)
+    {
+        table[i].calls = 0;
+        table[i].ticks = 0;
+        table[i].max = 0;
+    }
+    GIE = 1;
+}
+
+//Write a time in a field of 6 characters: in us up to 99999, then in ms with
+//an 'm' after it. The field always starts with a space.
+static void formatTime(uint32_t us, uint8_t * dest)
+{
+    if(us < 100000)
+        NumFormat(us, dest, 6);
+    else
+    {
+        NumFormat(us/1000, dest, 5);
+        dest[5] = 'm';
+    }
+}
+
+//Copy of an entry that the ISR probe can't change while it's read
+static void readEntry(uint8_t probe, struct profileEntry * entry)
+{
+    GIE = 0;
+    *entry = table[probe];
+    GIE = 1;
+}
+
+/*
+ * Assemble the LCD line of a probe as "NNNNAAAAAAMMMMMM" (name, average and
+ * longest call in us, or in ms when followed by 'm')
+ * Parameters:
+ *      probe - PROF_...
+ *      *line - 17 characters, filled with the line and a '\0'
+ */
+void ProfileLine(uint8_t probe, uint8_t * line)
+{
+    struct profileEntry entry;
+    readEntry(probe, &entry);
+    for(uint8_t i = 0; i < 4; i++)
+        line[i] = names[probe][i];
+    if(entry.calls == 0)
+    {
+        for(uint8_t i = 4; i < 16; i++)
+            line[i] = (i == 9 || i == 15) ? '-' : ' ';
+    }
+    else
+    {
+        //Only a division per line, and only on this page
+        formatTime(TICKS_US(entry.ticks/entry.calls), &line[4]);
+        formatTime(TICKS_US(entry.max), &line[10]);
+    }
+    line[16] = '\0';
+}
+
+/*
+ * Send the table on the UART as text, one line per probe: name, calls, total
+ * and longest call in us. Readers of the telemetry stream skip the lines
+ * since they have no valid records.
+ */
+void ProfileDump(void)
+{
+#if SERIAL_PROTOCOL == SERIAL_TELEMETRY
+    struct profileEntry entry;
+    uint8_t line[30];
+    for(uint8_t probe = 0; probe < PROF_COUNT; probe++)
+    {
+        readEntry(probe, &entry);
+        for(uint8_t i = 0; i < 4; i++)
+            line[i] = names[probe][i];
+        NumFormat(entry.calls, &line[4], 6);
+        NumFormat(TICKS_US(entry.ticks), &line[10], 10);
+        NumFormat(TICKS_US(entry.max), &line[20], 8);
+        line[28] = '\r';
+        line[29] = '\n';
+        while(!UARTWrite(line, sizeof(line)))
+            NOP();  //Wait for the previous lines to go out
+    }
+#endif
+}
+
+#endif	/* PROFILE */
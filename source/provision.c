@@ -0,0 +1,367 @@
+/*
+ * File:   provision.c
+ * Author: Faris Shahin
+ *
+ * Reading and writing the tanks over the serial port. See provision.h.
+ *
+ * Note: ProvisionRxInterrupt() must be called from the interrupt service
+ * routine in main.c when RCIF is set.
+ */
+
+#include "config.h"
+
+#if SERIAL_PROTOCOL == SERIAL_TELEMETRY
+
+#if PROV_MAX_LENGTH >= 1L<<TANK_DIM_BITS || PROV_MAX_HEIGHT >= 1<<TANK_HEIGHT_BITS
+#error "The packed tanks of tank.h can't hold the dimensions prov_frame.h allows"
+#endif
+#if PROV_SENSOR_ULTRASONIC != SENSOR_ULTRASONIC || PROV_SENSOR_PRESSURE != SENSOR_PRESSURE || SENSOR_TYPES != 2
+#error "The sensors of prov_frame.h don't match sensor.h"
+#endif
+
+static uint8_t rx[PROV_MAX_FRAME];  //Request being received
+static volatile uint8_t rxLen;      //Bytes in rx
+static volatile uint8_t ready;      //1 once rx holds a whole request, until it's handled
+static uint8_t open;                //1 between PROV_BEGIN and PROV_COMMIT
+static tankmask_t written;          //One bit per tank written in the transaction
+static tankmask_t changed;          //One bit per tank that isn't what's in EEPROM anymore
+static uint32_t lastRequest;        //Time of the last request in seconds
+static struct historyCursor cursor; //Reader of the level log for PROV_HISTORY
+
+/*
+ * Turn the receiver on. Called after UARTInit().
+ */
+void ProvisionInit(void)
+{
+    rxLen = 0;
+    ready = 0;
+    open = 0;
+    CREN = 1;
+    RCIE = 1;
+}
+
+/*
+ * Called from the interrupt service routine for every received byte
+ */
+void ProvisionRxInterrupt(void)
+{
+    uint8_t data;
+    if(OERR)
+    {
+        CREN = 0;   //Clears the overrun, the frame is lost
+        CREN = 1;
+        rxLen = 0;
+    }
+    if(FERR)        //Must be read before RCREG
+        rxLen = 0;
+    data = RCREG;
+    if(ready)       //The host waits for the reply before it sends more
+        return;
+    if(rxLen == 0 && data != PROV_SYNC)
+        return;
+    if(rxLen == 2 && data > PROV_MAX_DATA)
+    {
+        rxLen = 0;
+        return;
+    }
+    rx[rxLen++] = data;
+    if(rxLen > 2 && rxLen == rx[2] + 4)
+        ready = 1;
+}
+
+//Load the tanks changed in the transaction again from EEPROM and end it. A
+//macro so TankConfigRevert() is called one level higher on the stack.
+#define rollBack()  do {                                                    \
+        for(uint8_t t = 0; t < TANK_COUNT; t++)                             \
+            if(changed & (1<<t))                                            \
+                TankConfigRevert(t);                                        \
+        changed = 0;                                                        \
+        open = 0;                                                           \
+    } while(0)
+
+//Send a reply, waiting for room in the UART buffer
+static void reply(uint8_t command, uint8_t status, uint8_t * data, uint8_t n)
+{
+    uint8_t frame[PROV_MAX_FRAME];
+    uint8_t crc = 0xff;
+    frame[0] = PROV_REPLY;
+    frame[1] = command;
+    frame[2] = status;
+    frame[3] = n;
+    for(uint8_t i = 0; i < n; i++)
+        frame[4+i] = data[i];
+    for(uint8_t i = 1; i < n+4; i++)
+        crc = crc8(crc, frame[i]);
+    frame[n+4] = crc;
+    while(!UARTWrite(frame, n+5))
+        NOP();  //The telemetry records before it are going out
+}
+
+/*
+ * Build the record of prov_frame.h of a tank
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      *rec - PROV_TANK_SIZE bytes to fill
+ */
+static void tankRecord(uint8_t tankIndex, uint8_t * rec)
+{
+    uint16_t v;
+    for(uint8_t i = 0; i < TANK_NAME_CHARS; i++)
+        rec[PROV_TANK_NAME+i] = TankNameChar(tankIndex, i);
+    v = TankLength(tankIndex);
+    rec[PROV_TANK_LENGTH] = v & 0xff;
+    rec[PROV_TANK_LENGTH+1] = v >> 8;
+    v = TankWidth(tankIndex);
+    rec[PROV_TANK_WIDTH] = v & 0xff;
+    rec[PROV_TANK_WIDTH+1] = v >> 8;
+    v = TankHeight(tankIndex);
+    rec[PROV_TANK_HEIGHT] = v & 0xff;
+    rec[PROV_TANK_HEIGHT+1] = v >> 8;
+    rec[PROV_TANK_LOW] = TankLow(tankIndex);
+    rec[PROV_TANK_CRITICAL] = TankCritical(tankIndex);
+    rec[PROV_TANK_HIGH] = TankHigh(tankIndex);
+    rec[PROV_TANK_SENSOR] = TankSensor(tankIndex);
+}
+
+/*
+ * Check a tank record of a PROV_WRITE and put it in liquidTanks
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      *rec - PROV_TANK_SIZE bytes
+ * Returns:
+ *      PROV_OK or PROV_ERR_VALUE (liquidTanks is left untouched in that case)
+ */
+static uint8_t writeTank(uint8_t tankIndex, uint8_t * rec)
+{
+    uint8_t old[TANK_SIZE];
+    uint16_t length = rec[PROV_TANK_LENGTH] | (uint16_t)rec[PROV_TANK_LENGTH+1]<<8;
+    uint16_t width = rec[PROV_TANK_WIDTH] | (uint16_t)rec[PROV_TANK_WIDTH+1]<<8;
+    uint16_t height = rec[PROV_TANK_HEIGHT] | (uint16_t)rec[PROV_TANK_HEIGHT+1]<<8;
+    uint8_t c;
+
+    for(uint8_t i = 0; i < TANK_SIZE; i++)
+        old[i] = TankBytes(tankIndex)[i];
+    if(rec[PROV_TANK_NAME] == ' ')
+        TankConfigClear(tankIndex);
+    else
+    {
+        for(uint8_t i = 0; i < 6; i++)
+        {
+            c = rec[PROV_TANK_NAME+i];
+            if(!(c == ' ' || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')))
+                return PROV_ERR_VALUE;
+        }
+        if(length == 0 || length > PROV_MAX_LENGTH || width == 0 || width > PROV_MAX_LENGTH ||
+           height == 0 || height > PROV_MAX_HEIGHT || rec[PROV_TANK_LOW] > 100 ||
+           rec[PROV_TANK_CRITICAL] > 100 || rec[PROV_TANK_HIGH] > 100 ||
+           rec[PROV_TANK_SENSOR] >= SENSOR_TYPES)
+            return PROV_ERR_VALUE;
+        //Same as tankLiters(), which isn't given the new tank yet
+        if((uint32_t)(length/10)*width/100*height > PROV_MAX_LITERS)
+            return PROV_ERR_VALUE;
+
+        TankSetName(tankIndex, &rec[PROV_TANK_NAME]);
+        TankSetLength(tankIndex, length);
+        TankSetWidth(tankIndex, width);
+        TankSetHeight(tankIndex, height);
+        TankSetLow(tankIndex, rec[PROV_TANK_LOW]);
+        TankSetCritical(tankIndex, rec[PROV_TANK_CRITICAL]);
+        TankSetHigh(tankIndex, rec[PROV_TANK_HIGH]);
+        TankSetSensor(tankIndex, rec[PROV_TANK_SENSOR]);
+    }
+
+    for(uint8_t i = 0; i < TANK_SIZE; i++)
+        if(TankBytes(tankIndex)[i] != old[i])
+            changed |= 1<<tankIndex;
+    written |= 1<<tankIndex;
+    return PROV_OK;
+}
+
+/*
+ * Read the next entries of the level log for a PROV_HISTORY reply
+ * Parameters:
+ *      *out - where the entries go, PROV_HIST_ENTRIES*PROV_HIST_SIZE bytes
+ * Returns:
+ *      The length of the entries, 0 at the end of the log
+ */
+static uint8_t readHistory(uint8_t * out)
+{
+    struct historyEntry entry;
+    uint8_t n = 0;
+    while(n < PROV_HIST_ENTRIES*PROV_HIST_SIZE && HistoryCursorNext(&cursor, &entry))
+    {
+        out[n+PROV_HIST_HEADER] = entry.kind<<4 | entry.tank;
+        out[n+PROV_HIST_LEVEL] = entry.level;
+        out[n+PROV_HIST_SAMPLES] = entry.samples;
+        n += PROV_HIST_SIZE;
+    }
+    return n;
+}
+
+/*
+ * Handle the request received, if there's one. Called on the main screen.
+ * A transaction with no request for PROV_TIMEOUT seconds is rolled back.
+ * Returns:
+ *      The tanks changed by a PROV_COMMIT, one bit each, 0 otherwise. The
+ *      caller runs tankChanged() on them (it's too deep to call from here)
+ *      and the main screen should read them.
+ */
+tankmask_t ProvisionService(void)
+{
+    uint8_t command = rx[1];
+    uint8_t n = rx[2];
+    uint8_t * data = &rx[3];
+    uint8_t crc = 0xff;
+    uint8_t status = PROV_OK;
+    uint8_t out[PROV_MAX_DATA];
+    uint8_t outLen = 0;
+    uint16_t window;
+    uint8_t setCrc = 0xff;
+    tankmask_t saved = 0;
+
+    if(!ready)
+    {
+        if(open && ClockSeconds() - lastRequest >= PROV_TIMEOUT)
+            rollBack();
+        return 0;
+    }
+    lastRequest = ClockSeconds();
+
+    for(uint8_t i = 1; i < n+3; i++)
+        crc = crc8(crc, rx[i]);
+    if(crc != rx[n+3])
+        status = PROV_ERR_FRAME;
+    else switch(command)
+    {
+        case PROV_INFO:
+            out[0] = TANK_COUNT;
+            out[1] = PROV_TANK_SIZE;
+            outLen = 2;
+            break;
+        case PROV_READ:
+            if(n != 1)
+                status = PROV_ERR_FRAME;
+            else if(data[0] >= TANK_COUNT)
+                status = PROV_ERR_VALUE;
+            else
+            {
+                out[0] = data[0];
+                tankRecord(data[0], &out[1]);
+                outLen = 1 + PROV_TANK_SIZE;
+            }
+            break;
+        case PROV_BEGIN:
+            if(n != 1)
+                status = PROV_ERR_FRAME;
+            else if(data[0] != TANK_COUNT)
+                status = PROV_ERR_SET;
+            else
+            {
+                if(open)
+                    rollBack();
+                open = 1;
+                written = 0;
+                changed = 0;
+            }
+            break;
+        case PROV_WRITE:
+            if(n != 1 + PROV_TANK_SIZE)
+                status = PROV_ERR_FRAME;
+            else if(!open)
+                status = PROV_ERR_STATE;
+            else if(data[0] >= TANK_COUNT)
+                status = PROV_ERR_VALUE;
+            else
+                status = writeTank(data[0], &data[1]);
+            break;
+        case PROV_COMMIT:
+            if(n != 1)
+                status = PROV_ERR_FRAME;
+            else if(!open)
+                status = PROV_ERR_STATE;
+            else
+            {
+                //Every tank must be written and the set CRC, over the
+                //records as PROV_READ sends them, must match
+                for(uint8_t i = 0; i < TANK_COUNT; i++)
+                {
+                    tankRecord(i, out);
+                    for(uint8_t j = 0; j < PROV_TANK_SIZE; j++)
+                        setCrc = crc8(setCrc, out[j]);
+                }
+                if(written != (tankmask_t)((1L<<TANK_COUNT)-1) || setCrc != data[0])
+                {
+                    rollBack();
+                    status = PROV_ERR_SET;
+                    break;
+                }
+                saved = changed;
+                out[0] = 0;     //The number of tanks changed
+                for(uint8_t i = 0; i < TANK_COUNT; i++)
+                    if(saved & (1<<i))
+                        out[0]++;
+                changed = 0;
+                open = 0;
+                outLen = 1;
+            }
+            break;
+        case PROV_ABORT:
+            if(open)
+                rollBack();
+            break;
+        case PROV_HISTORY:
+            if(n != 1)
+                status = PROV_ERR_FRAME;
+            else
+            {
+                if(data[0])
+                    HistoryCursorStart(&cursor);
+                outLen = readHistory(out);
+            }
+            break;
+        case PROV_LEAK:
+            window = (uint16_t)data[PROV_LEAK_WINDOW+1]<<8 | data[PROV_LEAK_WINDOW];
+            if(n != 0 && n != PROV_LEAK_SIZE)
+                status = PROV_ERR_FRAME;
+            else if(n != 0 && !LeakValid(data[PROV_LEAK_DROP], window))
+                status = PROV_ERR_VALUE;
+            else
+            {
+                if(n != 0)
+                    LeakSetup(data[PROV_LEAK_DROP], window);
+                out[PROV_LEAK_DROP] = LeakDrop();
+                out[PROV_LEAK_WINDOW] = LeakWindow() & 0xff;
+                out[PROV_LEAK_WINDOW+1] = LeakWindow() >> 8;
+                outLen = PROV_LEAK_SIZE;
+            }
+            break;
+        default:
+            status = PROV_ERR_COMMAND;
+    }
+
+    reply(command, status, out, status == PROV_OK ? outLen : 0);
+    rxLen = 0;
+    ready = 0;      //The interrupt takes bytes again
+    return saved;
+}
+
+/*
+ * Returns:
+ *      1 while a transaction is open, the tanks must not be read then
+ */
+uint8_t ProvisionBusy(void)
+{
+    return open;
+}
+
+/*
+ * Roll back the open transaction, if there's one, e.g. when the main screen
+ * is left
+ */
+void ProvisionAbort(void)
+{
+    if(open)
+        rollBack();
+}
+
+#endif	/* SERIAL_PROTOCOL == SERIAL_TELEMETRY */
@@ -0,0 +1,227 @@
+/*
+ * File:   refill.c
+ * Author: Faris Shahin
+ *
+ * Refill detection and delivered liters log. See refill.h.
+ */
+
+#include "config.h"
+
+#define IDLE        0               //Counts up to REFILL_CONFIRM while the level is over the reference
+#define RISING      REFILL_CONFIRM  //A refill is going on
+#define NO_LEVEL    0xffff          //No reading yet
+
+//Detector of a tank. Times are the lower 16 bits of ClockSeconds(), which is
+//enough for differences of up to 18 hours.
+struct tankRefill{
+    uint8_t state;      //IDLE to RISING
+    uint16_t ref;       //Reference level in cm, the level before the refill while RISING
+    uint16_t peak;      //Highest level of the refill in cm
+    uint16_t start;     //Time the refill started
+    uint16_t mark;      //Time the reference last went up, time of the last rise while RISING
+};
+
+static struct tankRefill tanks[TANK_COUNT];
+static uint16_t now;        //Time of the current scan of the tanks
+static uint8_t nextSlot;    //Slot of the log the next refill goes to
+static uint8_t nextSeq;     //Sequence number of the next refill
+
+/*
+ * Read a logged refill
+ * Parameters:
+ *      slot - the slot of the log
+ *      *event - where the refill is stored
+ * Returns:
+ *      The sequence number of the refill, or REFILL_SEQ_MOD if the slot is
+ *      empty or damaged
+ */
+static uint8_t readSlot(uint8_t slot, struct refillEvent *event)
+{
+    uint8_t addrs = EE_REFILL_ADDR + slot*EE_REFILL_SLOT;
+    uint8_t rec[REFILL_REC_SIZE];
+    uint8_t crc = 0xff;
+    for(uint8_t i = 0; i < REFILL_REC_SIZE; i++)
+        rec[i] = EEPROMQueueRead(addrs+i);
+    for(uint8_t i = 0; i < REFILL_REC_CRC; i++)
+        crc = crc8(crc, rec[i]);
+    event->tank = rec[REFILL_REC_SEQ] & REFILL_TANK_MASK;
+    if(crc != rec[REFILL_REC_CRC] || event->tank >= TANK_COUNT)
+        return REFILL_SEQ_MOD;
+    event->liters = rec[REFILL_REC_LITERS] | (uint16_t)rec[REFILL_REC_LITERS+1]<<8;
+    event->duration = rec[REFILL_REC_TIME] | (uint16_t)rec[REFILL_REC_TIME+1]<<8;
+    return rec[REFILL_REC_SEQ] >> TANK_BITS;
+}
+
+/*
+ * Log a refill in the next slot
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      liters - the liters delivered
+ *      duration - the duration of the refill in seconds
+ */
+static void logRefill(uint8_t tankIndex, uint16_t liters, uint16_t duration)
+{
+    uint8_t addrs = EE_REFILL_ADDR + nextSlot*EE_REFILL_SLOT;
+    uint8_t rec[REFILL_REC_SIZE];
+    uint8_t crc = 0xff;
+    rec[REFILL_REC_SEQ] = nextSeq<<TANK_BITS | tankIndex;
+    rec[REFILL_REC_LITERS] = liters & 0xff;
+    rec[REFILL_REC_LITERS+1] = liters >> 8;
+    rec[REFILL_REC_TIME] = duration & 0xff;
+    rec[REFILL_REC_TIME+1] = duration >> 8;
+    for(uint8_t i = 0; i < REFILL_REC_CRC; i++)
+        crc = crc8(crc, rec[i]);
+    rec[REFILL_REC_CRC] = crc;
+    for(uint8_t i = 0; i < REFILL_REC_SIZE; i++)
+        EEPROMQueueWrite(addrs+i, rec[i]);
+    
+    if(++nextSlot == EE_REFILL_COUNT)
+        nextSlot = 0;
+    nextSeq = (nextSeq+1) % REFILL_SEQ_MOD;
+}
+
+/*
+ * Finds where the log continues and clears the detectors of all tanks.
+ * The newest refill is the one not followed by the next sequence number. A
+ * damaged refill (power lost while writing it) is overwritten by the next one.
+ */
+void RefillInit(void)
+{
+    struct refillEvent event;
+    uint8_t seq, following;
+    nextSlot = 0;
+    nextSeq = 0;
+    for(uint8_t i = 0; i < EE_REFILL_COUNT; i++)
+    {
+        seq = readSlot(i, &event);
+        if(seq == REFILL_SEQ_MOD)
+            continue;
+        following = readSlot((i+1) % EE_REFILL_COUNT, &event);
+        if(following != (seq+1) % REFILL_SEQ_MOD)
+        {
+            nextSlot = (i+1) % EE_REFILL_COUNT;
+            nextSeq = (seq+1) % REFILL_SEQ_MOD;
+            break;
+        }
+    }
+    
+    now = ClockSeconds();
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+        RefillReset(i);
+}
+
+/*
+ * Restart the detector of a tank, e.g. when its dimensions change. A refill
+ * that is going on is dropped.
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ */
+void RefillReset(uint8_t tankIndex)
+{
+    tanks[tankIndex].state = IDLE;
+    tanks[tankIndex].ref = NO_LEVEL;
+}
+
+/*
+ * Give the latest filtered level of a tank to the detector
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      level - the height of the liquid in cm
+ * Returns:
+ *      1 if a refill ended and was logged, 0 otherwise
+ */
+static uint8_t sample(uint8_t tankIndex, uint16_t level)
+{
+    struct tankRefill * r = &tanks[tankIndex];
+    uint32_t liters;
+    uint8_t logged = 0;
+    
+    if(r->state == RISING)
+    {
+        if(level > r->peak + 1)
+        {
+            r->peak = level;
+            r->mark = now;
+        }
+        else if((uint16_t)(now - r->mark) >= REFILL_PLATEAU)
+        {
+            //The level has settled. A rise that fell back was a splash or a
+            //bad echo and isn't logged.
+            if(level >= r->ref + REFILL_RISE)
+            {
+                liters = tankLiters(tankIndex, level) - tankLiters(tankIndex, r->ref);
+                logRefill(tankIndex, liters > 0xffff ? 0xffff : liters, r->mark - r->start);
+                logged = 1;
+            }
+            r->state = IDLE;
+            r->ref = level;
+            r->mark = now;
+        }
+        return logged;
+    }
+    
+    if(r->ref == NO_LEVEL)
+    {
+        r->ref = level;
+        r->mark = now;
+    }
+    else if(level >= r->ref + REFILL_RISE)
+    {
+        if(r->state == IDLE)
+            r->start = now;
+        if(++r->state == RISING)
+        {
+            r->peak = level;
+            r->mark = now;
+        }
+    }
+    else
+    {
+        r->state = IDLE;
+        if(level > r->ref && (uint16_t)(now - r->mark) >= REFILL_CREEP)
+        {
+            r->ref++;
+            r->mark = now;
+        }
+        else if(level < r->ref && (uint16_t)(now - r->mark) >= REFILL_CREEP/4)
+        {
+            r->ref--;
+            r->mark = now;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Give the tanks read since the last call (see store.h) to the detector. The
+ * clock is read once for all of them. A logged refill is also marked in the
+ * history log, from here rather than from logRefill() to save a level of the
+ * hardware stack.
+ */
+void RefillService(void)
+{
+    struct measurement m;
+    uint8_t tank;
+    now = ClockSeconds();
+    while((tank = StoreNext(STORE_REFILL, &m)) != STORE_NONE)
+        if(m.health == STORE_OK && sample(tank, m.level))
+            HistoryMark(HIST_MARK_REFILL, tank);
+}
+
+/*
+ * Read a refill from the log
+ * Parameters:
+ *      n - 0 for the newest refill, 1 for the one before it and so on
+ *      *event - where the refill is stored
+ * Returns:
+ *      1 if the refill was read, 0 if there's no such refill in the log
+ */
+uint8_t RefillRead(uint8_t n, struct refillEvent *event)
+{
+    uint8_t slot, seq;
+    if(n >= EE_REFILL_COUNT)
+        return 0;
+    slot = (nextSlot + EE_REFILL_COUNT - 1 - n) % EE_REFILL_COUNT;
+    seq = (nextSeq + REFILL_SEQ_MOD - 1 - n) % REFILL_SEQ_MOD;
+    return readSlot(slot, event) == seq;
+}
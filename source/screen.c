@@ -0,0 +1,211 @@
+/*
+ * File:   screen.c
+ * Author: Faris Shahin
+ *
+ * Draws the screens of the menus from their layouts (see screen.h).
+ *
+ * Note: Every character and every cursor shift is a byte to the LCD with a
+ * 50us wait, and a clear takes 2ms. Going from one menu screen to the next,
+ * most lines are the same or get shorter, so writing over the lines that
+ * change is cheaper than clearing the LCD and writing all of them again.
+ */
+
+#include "config.h"
+
+static const struct screenCell * shown;    //Layout on the LCD, NULL if it's unknown
+
+/*
+ * Find the cells of a screen on a line
+ * Parameters:
+ *      *cell - the first cell of the screen
+ *      line - 1 to 4
+ * Returns:
+ *      The first cell on the line, or the end of the screen if there's none
+ */
+static const struct screenCell * firstOn(const struct screenCell * cell, uint8_t line)
+{
+    while(cell->width != SCREEN_END_CELL && SCREEN_LINE(cell->pos) != line)
+        cell++;
+    return cell;
+}
+
+/*
+ * Find the columns the cells of a screen take on a line
+ * Parameters:
+ *      *cell - the first cell of the screen
+ *      line - 1 to 4
+ *      *from - set to the column of the first cell, 17 if there's none
+ * Returns:
+ *      The column after the last cell, 0 if there's none
+ */
+static uint8_t lineSpan(const struct screenCell * cell, uint8_t line, uint8_t * from)
+{
+    uint8_t to = 0;
+    const uint8_t * c;
+    cell = firstOn(cell, line);
+    *from = (cell->width == SCREEN_END_CELL) ? 17 : SCREEN_COL(cell->pos);
+    for(; cell->width != SCREEN_END_CELL && SCREEN_LINE(cell->pos) == line; cell++)
+    {
+        to = SCREEN_COL(cell->pos) + cell->width;
+        if(cell->text)
+            for(c = cell->text; *c; c++)
+                to++;
+    }
+    return to;
+}
+
+/*
+ * Check if two screens show the same static texts on a line
+ * Parameters:
+ *      *a, *b - the first cells of the screens
+ *      line - 1 to 4
+ * Returns:
+ *      1 if the line can be left as it is, 0 if it has to be written
+ */
+static uint8_t sameLine(const struct screenCell * a, const struct screenCell * b, uint8_t line)
+{
+    const uint8_t * x;
+    const uint8_t * y;
+    a = firstOn(a, line);
+    b = firstOn(b, line);
+    for(; a->width != SCREEN_END_CELL && SCREEN_LINE(a->pos) == line; a++, b++)
+    {
+        if(b->width == SCREEN_END_CELL || b->pos != a->pos || !a->text || !b->text)
+            return 0;       //Fields and inputs are always written
+        for(x = a->text, y = b->text; *x && *x == *y; x++, y++)
+            ;
+        if(*x != *y)
+            return 0;
+    }
+    return b->width == SCREEN_END_CELL || SCREEN_LINE(b->pos) != line;
+}
+
+/*
+ * Put a screen on the LCD
+ * Parameters:
+ *      *screen - its layout, in program memory
+ * Notes:
+ * The lines are written in the order of the DDRAM. A line that changes is
+ * assembled in RAM from the first to the last column either screen uses on it
+ * and printed with one call, the spaces in between costing no more than the
+ * cursor shifts that would skip them.
+ */
+void ScreenShow(const struct screenCell * screen)
+{
+    static const uint8_t lineOrder[4] = {1, 3, 2, 4};
+    uint8_t text[17];           //A line assembled before printing it, text[0] is column 1
+    uint8_t same = 0;           //Bit n set if line n is left as it is
+    uint16_t overwrite = 0;     //Characters to write over the lines that change
+    uint16_t redraw = SCREEN_CLEAR_CHARS;   //Same after clearing the LCD
+    uint8_t from, to, oldFrom, oldTo, line;
+    const struct screenCell * cell;
+    const struct screenCell * end;  //Holds the position of the cursor
+    const uint8_t * c;
+    uint8_t * dest;
+
+    if(shown)
+        for(line = 1; line <= 4; line++)
+        {
+            to = lineSpan(screen, line, &from);
+            oldTo = lineSpan(shown, line, &oldFrom);
+            if(to)
+                redraw += to - from;
+            if(sameLine(shown, screen, line))
+                same |= 1 << line;
+            else if(to || oldTo)
+                overwrite += (to > oldTo ? to : oldTo) - (from < oldFrom ? from : oldFrom);
+        }
+
+    for(cell = screen; cell->width != SCREEN_END_CELL; cell++)
+        ;
+    end = cell;
+    if(!SCREEN_LINE(end->pos) && (lcdDisplayControl & CursorOn))
+    {
+        LCDCursorBlinkOff();
+        LCDCursorOff();
+    }
+    if(!shown || redraw < overwrite)
+    {
+        LCDClearDisplay();
+        shown = NULL;
+        same = 0;
+    }
+
+    for(uint8_t l = 0; l < 4; l++)
+    {
+        line = lineOrder[l];
+        if(same & 1 << line)
+            continue;
+        to = lineSpan(screen, line, &from);
+        if(shown)
+        {
+            //Blank what's left of the old text
+            oldTo = lineSpan(shown, line, &oldFrom);
+            if(oldTo > to)
+                to = oldTo;
+            if(oldFrom < from)
+                from = oldFrom;
+        }
+        if(!to)
+            continue;
+
+        for(uint8_t i = from-1; i < to-1; i++)
+            text[i] = ' ';
+        for(cell = firstOn(screen, line); cell->width != SCREEN_END_CELL && SCREEN_LINE(cell->pos) == line; cell++)
+        {
+            dest = &text[SCREEN_COL(cell->pos)-1];
+            if(cell->text)
+                for(c = cell->text; *c; c++)
+                    *dest++ = *c;
+            else if(cell->field)
+            {
+                cell->field(dest);
+                dest[cell->width] = ' ';    //In case it ended the field, a cell may follow
+            }
+        }
+        text[to-1] = '\0';
+        LCDPrintString(&text[from-1], line, from);
+    }
+
+    if(SCREEN_LINE(end->pos))
+    {
+        LCDSetPos(SCREEN_COL(end->pos), SCREEN_LINE(end->pos));
+        if(!(lcdDisplayControl & CursorOn))
+        {
+            LCDCursorOn();
+            LCDCursorBlinkOn();
+        }
+    }
+    shown = screen;
+}
+
+/*
+ * Write the fields of the screen on the LCD again, after their data changed.
+ * The static texts aren't touched.
+ */
+void ScreenRefresh(void)
+{
+    uint8_t text[17];
+    const struct screenCell * cell;
+    if(!shown)
+        return;
+    for(cell = shown; cell->width != SCREEN_END_CELL; cell++)
+        if(cell->field)
+        {
+            cell->field(text);
+            text[cell->width] = '\0';
+            LCDPrintString(text, SCREEN_LINE(cell->pos), SCREEN_COL(cell->pos));
+        }
+    if(SCREEN_LINE(cell->pos))
+        LCDSetPos(SCREEN_COL(cell->pos), SCREEN_LINE(cell->pos));
+}
+
+/*
+ * Clear the LCD for a screen drawn by hand. The next ScreenShow() doesn't
+ * know what's on it and clears it again.
+ */
+void ScreenClear(void)
+{
+    LCDClearDisplay();
+    shown = NULL;
+}
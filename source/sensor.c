@@ -0,0 +1,92 @@
+/*
+ * File:   sensor.c
+ * Author: Faris Shahin
+ *
+ * Level sensors of the tanks behind one interface. See sensor.h.
+ */
+
+#include "config.h"
+
+static uint8_t active = SENSOR_ULTRASONIC;  //Backend of the last reading
+
+/*
+ * Start a reading of the sensor of a tank, with the backend of the tank
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ */
+void SensorStart(uint8_t tankIndex)
+{
+    active = TankSensor(tankIndex);
+    switch(active)
+    {
+        case SENSOR_PRESSURE:
+            PressureStart(tankIndex);
+            break;
+        default:
+            UltraSonicStart(tankIndex);
+            break;
+    }
+}
+
+/*
+ * Returns:
+ *      SENSOR_BUSY while the reading is being taken, SENSOR_DONE once it's over
+ */
+uint8_t SensorPoll(void)
+{
+    switch(active)
+    {
+        case SENSOR_PRESSURE:
+            return PressurePoll();
+        default:
+            return UltraSonicPoll();
+    }
+}
+
+/*
+ * Returns:
+ *      The level of the last reading in mm above the bottom of the tank. Only
+ *      valid if its health is STORE_OK.
+ */
+uint16_t SensorLevel(void)
+{
+    switch(active)
+    {
+        case SENSOR_PRESSURE:
+            return PressureLevel();
+        default:
+            return UltraSonicLevel();
+    }
+}
+
+/*
+ * Returns:
+ *      The health of the last reading: STORE_OK, STORE_NO_ECHO or
+ *      STORE_OUT_OF_RANGE
+ */
+uint8_t SensorHealth(void)
+{
+    switch(active)
+    {
+        case SENSOR_PRESSURE:
+            return PressureHealth();
+        default:
+            return UltraSonicHealth();
+    }
+}
+
+/*
+ * Returns:
+ *      The raw value of the last reading: the echo time in TMR0 ticks or the
+ *      decimated ADC counts of a pressure transducer
+ */
+uint16_t SensorRaw(void)
+{
+    switch(active)
+    {
+        case SENSOR_PRESSURE:
+            return PressureCounts();
+        default:
+            return UltraSonicTicks();
+    }
+}
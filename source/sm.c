@@ -1,349 +1,971 @@
-#include "config.h"
-
-/*
- * Initializes the data of the liquid tanks and the size of the user name array.
- * Returns:
- *      The next state to be executed (hardcoded as view())
- * Notes:
- * The function checks the EEPROM if there are already data present there from
- * previous uses of the system. If such data exists, it is read from EEPROM.
- * Otherwise, the data of the liquid tanks is initialized to be zero/empty.
- */
-uint8_t init()
-{
-    arrSize = (sizeof(liquidTanks[0].name)-1)/sizeof(uint8_t); //Exclude \0 in calculation
-
-    //Check if liquid tanks are initialized
-    if(eeprom_read(0xaa)!= 0x2a)
-    {
-        for(uint8_t i=0; i<4; i++)
-        {
-            for(uint8_t j=0; j<=arrSize; j++)
-                liquidTanks[i].name[j] = ' ';
-            liquidTanks[i].name[6] = '\0';
-            liquidTanks[i].height = 0;
-            liquidTanks[i].width = 0;
-            liquidTanks[i].length = 0;
-            writeEEPROM(liquidTanks[i],i);
-
-        }
-        eeprom_write(0xaa, 0x2a);
-    }
-    else
-        for(uint8_t i=0; i<4; i++)
-            readEEPROM(&liquidTanks[i],i);
-
-        return view();
-}
-
-/*
- * The idle state. The system takes readings from the ultrasonic(s) after
- * around 5 seconds.
- * Returns:
- *      The next state; idle by default or view() after around 5 seconds
- */
-uint8_t idle (void)
-{
-    if(TMR0of >= 250)  //Take readings after around 5 seconds
-    {
-        TMR0of = 0;
-        return view();
-    }
-    return ST_IDLE;
-}
-
-/*
- * The view state where the data of the liquid tanks is displayed on the LCD
- * screen
- * Returns:
- *       The next state to be executed (hardcoded as idle())
- */
-uint8_t view(void)
-{
-    uint16_t distVal;    //Used to store the distance
-    uint8_t lineNum = 1; //Used to indicate the current line on the LCD
-    uint8_t count = 0;
-    uint32_t numLiters; //Used to store the liters currently contained in a tank in numerical format
-    uint32_t totalLiters;   //Used to store the total liters a liquid tank can contain
-    uint8_t percLiters; //Used to store the percentage of liters currently contained in a tank
-    LCDClearDisplay();
-    for(count; count <4; count++)   //Loop through the liquid tanks
-    {
-        if (liquidTanks[count].name[0] != ' ')
-        {
-            switch (count)
-            //Set the ultrasonic sensor from which to read
-            {
-                case 0:
-                    PORTA &= 0xf9;
-                    break;
-                case 1:
-                    PORTA &= 0xfb;
-                    PORTA |= 0x02;
-                    break;
-                case 2:
-                    PORTA &= 0xfd;
-                    PORTA |= 0x04;
-                    break;
-                case 3:
-                    PORTA |= 0x06;
-                    break;   
-            }
-            distVal = UltraSonicPing(&TMR0of);  //Read from the ultrasonic
-            if(distVal != 0 && distVal <= liquidTanks[count].height)
-            {
-                //For some reason, having the equation in one lines doesn't seem to work.
-                //Causes might be related to the size of variables.
-                //Casting everything to uint32_t didn't solve it.
-                numLiters = liquidTanks[count].length/10;
-                numLiters = (numLiters*liquidTanks[count].width)/100;
-                totalLiters = numLiters * liquidTanks[count].height;
-                numLiters = numLiters*(liquidTanks[count].height-distVal);
-                percLiters = (numLiters*100)/totalLiters;                
-            }
-            else
-            {
-                numLiters = 0;
-                percLiters = 0;
-            }
-            //Print the data to the LCD screen
-            LCDPrintString(liquidTanks[count].name, lineNum, 1);
-            LCDPrintString(NumToStr(numLiters),lineNum,8);
-            LCDPrintString("L|", lineNum,12);
-            LCDPrintString(NumToStr(percLiters), lineNum,14);
-            LCDPrintChar('%', lineNum, 16);
-            lineNum++;
-        }
-    }
-    
-    //If there's no data stored in liquidTanks structure, display a message
-    if(count == 4 && lineNum == 1)
-    {
-    //From the way the LCD array is organized, writing in the next order
-    //should be slightly faster (1st line, then 3rd, then 2nd, then 4th)
-        LCDPrintString("No Data.", 1 ,1);
-        LCDPrintString("options.",3,1);
-        LCDPrintString("Press * for",2,1);        
-    }
-    //Enable timer0 interrupt to continuously read from the ultrasonics around 5s in idle state
-    TMR0IE = 1;
-    
-    return ST_IDLE;
-}
-
-/*
- * The options state where the user is presented with a number of options to
- * choose from.
- * Returns:
- *      The next state to be executed (hardcoded as options())
- */
-uint8_t options(void)
-{
-    //From the way the LCD array is organized, writing in the next order
-    //should be slightly faster (1st line, then 3rd, then 2nd, then 4th)
-    LCDClearDisplay();
-    LCDPrintString("1.Add/Edit entry",1,1);
-    LCDPrintString("3.Exit",3,1);
-    LCDPrintString("2.Delete entry",2,1);
-
-    return ST_OPTIONS;
-}
-
-/*
- * The add/edit state where the user can add a new entry or edit an existing one
- * Returns:
- *      The next state to be executed (hardcoded as addEditState())
- */
-uint8_t addEditEntry (void)
-{
-    uint8_t sensor = 10;
-    uint8_t returnVal = 0;
-    
-    while(sensor > 4)
-    {
-        LCDClearDisplay();
-        LCDPrintString("Enter sensor num", 1 ,1);
-        LCDPrintString("from 1 to 4:",2,1);
-        LCDPrintString("*: Confirm",4,1);
-        LCDSetPos(1,3);
-        LCDCursorOn();
-        LCDCursorBlinkOn();
-        sensor = numSet(3);
-        if(sensor>4)    //In case the application is modified to use less or more sensors, do the necessary changes here
-        {
-            LCDClearDisplay();
-            LCDCursorBlinkOff();
-            LCDCursorOff();
-            LCDPrintString("Number should be",1,1);
-            LCDPrintString("from 1 to 4!",2,1);
-            __delay_ms(2500);
-        }
-    }
-
-    while(returnVal != 1)
-    {
-        LCDClearDisplay();
-        LCDPrintString("Enter name: ",1,1);
-        LCDPrintString("2/8: Up/Down",3,1);
-        LCDPrintString(liquidTanks[sensor-1].name,2,1);
-        LCDPrintString("4/6: Left/Right",4,1);    
-        LCDSetPos(1,2);
-        returnVal = nameSet(liquidTanks[sensor-1].name, arrSize,2);
-        if(returnVal == 2)
-        {
-            LCDClearDisplay();
-            LCDPrintString("ERROR: Name must",1,1);
-            LCDPrintString("space.",3,1);
-            LCDPrintString("not start with a",2,1);
-            __delay_ms(2500);
-        }
-    }    
-    
-    LCDClearDisplay();
-    LCDPrintString("Enter length cm:",1,1);
-    LCDPrintString("#: Reset",3,1);
-    LCDPrintString("*: Confirm",4,1);
-    LCDSetPos(1,2);
-    liquidTanks[sensor-1].length = numSet(2);
-    
-    LCDClearDisplay();
-    LCDPrintString("Enter width cm:",1,1);
-    LCDPrintString("#: Reset",3,1);
-    LCDPrintString("*: Confirm",4,1);
-    LCDSetPos(1,2);
-    liquidTanks[sensor-1].width = numSet(2);
-    
-    LCDClearDisplay();
-    LCDPrintString("Enter height cm:",1,1);
-    LCDPrintString("#: Reset",3,1);
-    LCDPrintString("*: Confirm",4,1);
-    LCDSetPos(1,2);
-    liquidTanks[sensor-1].height = numSet(2);
-    
-    LCDCursorBlinkOff();
-    LCDCursorOff();
-    LCDClearDisplay();
-    LCDPrintString("Successful!",1,1);
-    LCDPrintString("continue.",3,1);
-    LCDPrintString("Press '#' to",2,1);
-    
-    //Update EEPROM
-    writeEEPROM(liquidTanks[sensor-1], sensor-1);
-    
-    return ST_ADD_EDIT;
-}
-
-/*
- * The state where the user can delete an entry.
- * Returns:
- *      The next state to be executed (hardcoded as deleteEntry()) 
- */
-uint8_t deleteEntry(void)
-{
-    uint8_t index;
-    uint8_t empty = 0;
-    uint8_t keypress = '8';
-    //Check to see if the liquid tanks data is empty
-    for(index = 0; index <4; index ++)
-    {
-        if(liquidTanks[index].length == 0)
-            empty++;
-    }
-    if(empty == 4 && index == 4)
-    {
-        LCDClearDisplay();
-        LCDPrintString("No entries to", 1, 1);
-        LCDPrintString("Press '#' key to",3,1);
-        LCDPrintString("delete.", 2, 1);
-        LCDPrintString("continue.", 4, 1);
-        return ST_DEL;
-    }
-    index = 0;
-    LCDClearDisplay();
-    LCDPrintString("Choose entry:",1,1);
-    LCDPrintString("2/8: Up/Down",3,1);
-    LCDPrintString("*: Select",4,1);
-    while(keypress != '*')
-    {
-        //Go through entries until you find a valid one
-        while(liquidTanks[index].name[0] == ' ')
-        {
-            if(keypress == '8')
-            {
-                index++;
-                if (index >= 4)
-                    index = 0;
-            }
-            if(keypress == '2')
-            {
-                index--;        //uint8 underflows to 255
-                if(index > 200)
-                    index = 3;
-            }
-        }
- 
-        LCDClearLine(2);
-        //KeypadRead always returns a value.
-        //A delay is added to lower the visual effect of clearing the lines continuously
-        LCDPrintString(liquidTanks[index].name, 2,1);
-        __delay_ms(500);
-        
-        keypress = KeypadRead();
-        if(keypress == '8')
-            {
-                index++;
-                if (index >= 4)
-                    index = 0;
-            }
-        if(keypress == '2')
-        {
-            index--;        //uint8 underflows to 255
-            if(index > 200)
-                index = 3;
-        }
-    }
-    //Entry is selected. Reset entry to empty/0
-    liquidTanks[index].height = 0;
-    liquidTanks[index].length = 0;
-    liquidTanks[index].width = 0;
-    for(uint8_t i=0; i<=arrSize; i++)
-            liquidTanks[index].name[i] = ' ';
-    LCDClearDisplay();
-    LCDPrintString("Entry deleted!",1,1);
-    LCDPrintString("continue.",3,1);
-    LCDPrintString("Press '#' key to",2,1);
-    
-    //update EEPROM
-    writeEEPROM(liquidTanks[index], index);
-    return ST_DEL;
-}
-
-/*
- *  A function to get events derived from pressing the keypad.
- *  Returns:
- *      The event mapped to the pressed key
- */
-uint8_t getEvent(void)
-{
-    uint8_t keypress = 0;
-    keypress = KeypadRead();
-    switch(keypress)
-    {
-        case '1':
-            return EV_KEY_ONE;
-        case '2':
-            return EV_KEY_TWO;
-        case '3':
-            return EV_KEY_THREE;
-        case '4':
-            return EV_KEY_FOUR;
-        case '*':
-            return EV_KEY_STAR;
-        case '#':
-            return EV_KEY_HASH;
-        case 0:
-            return EV_KEY_NONE;
-        default:
-            return EV_ANY;
-    }     
+#include "config.h"
+
+//A number as text, for TANK_COUNT in the prompts
+#define TEXT(x)         #x
+#define NUM_TEXT(x)     TEXT(x)
+
+#define VIEW_LINES      4   //Lines of the LCD
+#define VIEW_HOLD       3   //Scans a page chosen with the keypad stays before the pages scroll again
+#define NO_PAGE         0xff    //The main screen isn't on the LCD
+
+static uint8_t page = 0;        //Page of the main screen shown
+static uint8_t drawnPage = NO_PAGE; //Page on the LCD, after wrapping
+static uint8_t compactView = 0; //1 to show 2 tanks per line
+static uint8_t hold = 0;        //Scans left before the pages scroll again
+static uint8_t listPage = 0;    //Page of the usage or refills screen shown
+static uint8_t listPages = 0;   //Pages of that screen when it was drawn
+static uint8_t tank;            //Tank the menus add, edit or delete
+
+static void drawPage(void);
+static void tankNameField(uint8_t * dest);
+static void ultrasonicMark(uint8_t * dest);
+static void pressureMark(uint8_t * dest);
+
+//Screens of the menus (see screen.h). Texts on more than one screen are kept
+//once.
+static const uint8_t confirmText[] = "*: Confirm";
+static const uint8_t resetText[] = "#: Reset";
+static const uint8_t upDownText[] = "2/8: Up/Down";
+static const uint8_t continueText[] = "continue.";
+static const uint8_t pressHashText[] = "Press '#' to";
+static const uint8_t pressHashKeyText[] = "Press '#' key to";
+static const uint8_t noDataText[] = "No Data.";
+static const uint8_t outOfRangeText[] = "Number should be";
+
+static const struct screenCell noTanksScreen[] = {
+    SCREEN_TEXT(1, 1, noDataText),
+    SCREEN_TEXT(3, 1, "options."),
+    SCREEN_TEXT(2, 1, "Press * for"),
+    SCREEN_END(0, 0)
+};
+static const struct screenCell noUsageScreen[] = {
+    SCREEN_TEXT(1, 1, noDataText),
+    SCREEN_TEXT(3, 1, continueText),
+    SCREEN_TEXT(2, 1, pressHashText),
+    SCREEN_END(0, 0)
+};
+static const struct screenCell noRefillsScreen[] = {
+    SCREEN_TEXT(1, 1, "No refills."),
+    SCREEN_TEXT(3, 1, continueText),
+    SCREEN_TEXT(2, 1, pressHashText),
+    SCREEN_END(0, 0)
+};
+static const struct screenCell optionsScreen[] = {
+    SCREEN_TEXT(1, 1, "1.Add/Edit entry"),
+    SCREEN_TEXT(3, 1, "3.Exit"),
+    SCREEN_TEXT(2, 1, "2.Delete entry"),
+    SCREEN_TEXT(4, 1, "4.Usage"),
+    SCREEN_END(0, 0)
+};
+static const struct screenCell tankNumberScreen[] = {
+    SCREEN_TEXT(1, 1, "Enter sensor num"),
+    SCREEN_INPUT(3, 1, 4),
+    SCREEN_TEXT(2, 1, "from 1 to " NUM_TEXT(TANK_COUNT) ":"),
+    SCREEN_TEXT(4, 1, confirmText),
+    SCREEN_END(3, 1)
+};
+static const struct screenCell tankNumberErrorScreen[] = {
+    SCREEN_TEXT(1, 1, outOfRangeText),
+    SCREEN_TEXT(2, 1, "from 1 to " NUM_TEXT(TANK_COUNT) "!"),
+    SCREEN_END(0, 0)
+};
+static const struct screenCell nameScreen[] = {
+    SCREEN_TEXT(1, 1, "Enter name: "),
+    SCREEN_TEXT(3, 1, upDownText),
+    SCREEN_INPUT(2, 1, TANK_NAME_CHARS),
+    SCREEN_TEXT(4, 1, "4/6: Left/Right"),
+    SCREEN_END(2, 1)
+};
+static const struct screenCell nameErrorScreen[] = {
+    SCREEN_TEXT(1, 1, "ERROR: Name must"),
+    SCREEN_TEXT(3, 1, "space."),
+    SCREEN_TEXT(2, 1, "not start with a"),
+    SCREEN_END(0, 0)
+};
+static const struct screenCell lengthScreen[] = {
+    SCREEN_TEXT(1, 1, "Enter length cm:"),
+    SCREEN_TEXT(3, 1, resetText),
+    SCREEN_INPUT(2, 1, 4),
+    SCREEN_TEXT(4, 1, confirmText),
+    SCREEN_END(2, 1)
+};
+static const struct screenCell widthScreen[] = {
+    SCREEN_TEXT(1, 1, "Enter width cm:"),
+    SCREEN_TEXT(3, 1, resetText),
+    SCREEN_INPUT(2, 1, 4),
+    SCREEN_TEXT(4, 1, confirmText),
+    SCREEN_END(2, 1)
+};
+static const struct screenCell heightScreen[] = {
+    SCREEN_TEXT(1, 1, "Enter height cm:"),
+    SCREEN_TEXT(3, 1, resetText),
+    SCREEN_INPUT(2, 1, 4),
+    SCREEN_TEXT(4, 1, confirmText),
+    SCREEN_END(2, 1)
+};
+static const struct screenCell sensorScreen[] = {
+    SCREEN_TEXT(1, 1, "Sensor type:"),
+    SCREEN_TEXT(3, 1, "2: Pressure"),
+    SCREEN_FIELD(3, 16, 1, pressureMark),
+    SCREEN_TEXT(2, 1, "1: Ultrasonic"),
+    SCREEN_FIELD(2, 16, 1, ultrasonicMark),
+    SCREEN_END(0, 0)
+};
+static const struct screenCell lowScreen[] = {
+    SCREEN_TEXT(1, 1, "Low alarm %:"),
+    SCREEN_TEXT(3, 1, "0: Off, #: Reset"),
+    SCREEN_INPUT(2, 1, 4),
+    SCREEN_TEXT(4, 1, confirmText),
+    SCREEN_END(2, 1)
+};
+static const struct screenCell criticalScreen[] = {
+    SCREEN_TEXT(1, 1, "Critical alarm %"),
+    SCREEN_TEXT(3, 1, "0: Off, #: Reset"),
+    SCREEN_INPUT(2, 1, 4),
+    SCREEN_TEXT(4, 1, confirmText),
+    SCREEN_END(2, 1)
+};
+static const struct screenCell highScreen[] = {
+    SCREEN_TEXT(1, 1, "High alarm %:"),
+    SCREEN_TEXT(3, 1, "0: Off, #: Reset"),
+    SCREEN_INPUT(2, 1, 4),
+    SCREEN_TEXT(4, 1, confirmText),
+    SCREEN_END(2, 1)
+};
+static const struct screenCell heightErrorScreen[] = {
+    SCREEN_TEXT(1, 1, outOfRangeText),
+    SCREEN_TEXT(2, 1, "from 1 to " NUM_TEXT(TANK_HEIGHT_MAX) "!"),
+    SCREEN_END(0, 0)
+};
+static const struct screenCell percentErrorScreen[] = {
+    SCREEN_TEXT(1, 1, outOfRangeText),
+    SCREEN_TEXT(2, 1, "from 0 to 100!"),
+    SCREEN_END(0, 0)
+};
+static const struct screenCell savedScreen[] = {
+    SCREEN_TEXT(1, 1, "Successful!"),
+    SCREEN_TEXT(3, 1, continueText),
+    SCREEN_TEXT(2, 1, pressHashText),
+    SCREEN_END(0, 0)
+};
+static const struct screenCell noEntriesScreen[] = {
+    SCREEN_TEXT(1, 1, "No entries to"),
+    SCREEN_TEXT(3, 1, pressHashKeyText),
+    SCREEN_TEXT(2, 1, "delete."),
+    SCREEN_TEXT(4, 1, continueText),
+    SCREEN_END(0, 0)
+};
+static const struct screenCell chooseScreen[] = {
+    SCREEN_TEXT(1, 1, "Choose entry:"),
+    SCREEN_TEXT(3, 1, upDownText),
+    SCREEN_FIELD(2, 1, TANK_NAME_CHARS, tankNameField),
+    SCREEN_TEXT(4, 1, "*: Select"),
+    SCREEN_END(0, 0)
+};
+static const struct screenCell deletedScreen[] = {
+    SCREEN_TEXT(1, 1, "Entry deleted!"),
+    SCREEN_TEXT(3, 1, continueText),
+    SCREEN_TEXT(2, 1, pressHashKeyText),
+    SCREEN_END(0, 0)
+};
+
+/*
+ * Initializes the data of the liquid tanks and the size of the user name array.
+ * Returns:
+ *      The next state to be executed (hardcoded as ST_VIEW)
+ * Notes:
+ * The data of the liquid tanks is loaded from EEPROM. Tanks with no valid data
+ * (first use of the system or a damaged record) are initialized to be
+ * zero/empty. Any EEPROM writes this causes are done in the background.
+ * The levels of the snapshot (see history.h) are put in the store (see
+ * store.h) and shown as soon as the tanks are loaded, marked with '?' instead
+ * of '%', and replaced when the tanks are read at the end. Measured from
+ * reset in the simulator at 4MHz (simbench, -d for no echo), the snapshot is
+ * on the LCD after 56ms, 50ms of it being the power up wait of the LCD, and
+ * the levels read after 94ms, or 228ms with 4 sensors that don't answer.
+ * Before the snapshot the LCD stayed blank until those readings.
+ */
+uint8_t init()
+{
+    uint8_t level;
+    struct measurement m;
+    arrSize = TANK_NAME_CHARS;
+
+    StoreInit();
+    //The snapshot is only valid for the layout and tanks it was taken with
+    if(TankConfigLoad() == CFG_LOADED)
+        for(uint8_t i = 0; i < TANK_COUNT; i++)
+        {
+            level = HistorySnapshot(i);
+            if(level == HIST_UNKNOWN)
+                continue;
+            m.ticks = 0;
+            m.level = ((uint32_t)level*TankHeight(i)+100)/200;
+            m.unfiltered = TLM_NO_LEVEL;
+            m.liters = tankLiters(i, m.level);
+            m.percent = level/2;
+            m.health = STORE_SNAPSHOT;
+            StoreSeed(i, &m);
+        }
+    drawPage();
+    
+    HistoryInit();
+    UsageInit();
+    LeakInit();
+    RefillInit();
+    AlarmInit();
+    TelemetryInit();
+    ModbusInit();
+
+    return ST_VIEW;
+}
+
+/*
+ * The idle state. The system takes readings from the sensors every SCAN_MS.
+ * If the tanks don't fit on one page, every reading shows the next page
+ * unless one was chosen with the keypad a short while ago.
+ * Requests from the serial port (see provision.h and modbus.h) are handled
+ * here too; the readings wait while the tanks are being provisioned and are
+ * taken at once after they changed.
+ * Returns:
+ *      The next state; idle by default or view after SCAN_MS
+ */
+uint8_t idle (void)
+{
+    uint16_t overflows;
+    tankmask_t written = ProvisionService() | ModbusService();
+    if(written)
+    {
+        //Called from here, one level of the stack above the services
+        for(uint8_t i = 0; i < TANK_COUNT; i++)
+            if(written & (1<<i))
+                tankChanged(i);
+        return ST_VIEW;
+    }
+    GIE = 0;    //A 16-bit read takes two instructions
+    overflows = TMR0of;
+    GIE = 1;
+    if(overflows >= SCAN_OVERFLOWS && !ProvisionBusy())   //Take readings after around 4 seconds
+    {
+        TMR0of = 0;
+        if(hold)
+            hold--;
+        else
+            page++;     //Wraps to the first page in drawPage()
+        return ST_VIEW;
+    }
+    return ST_IDLE;
+}
+
+/*
+ * Get the character shown after the percentage of a tank on the main screen
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ * Returns:
+ *      'F' sensor fault, 'X' critical level, '!' leak, '^' high level, 'v' low
+ *      level, or '%'
+ */
+static uint8_t alarmChar(uint8_t tankIndex)
+{
+    uint8_t alarms = AlarmState(tankIndex);
+    if(alarms & ALARM_FAULT)
+        return 'F';
+    if(alarms & ALARM_CRITICAL)
+        return 'X';
+    if(LeakAlarm(tankIndex))
+        return '!';
+    if(alarms & ALARM_HIGH)
+        return '^';
+    if(alarms & ALARM_LOW)
+        return 'v';
+    return '%';
+}
+
+/*
+ * Let the user enter an alarm threshold of a tank
+ * Parameters:
+ *      *screen - the screen asking for the threshold
+ * Returns:
+ *      The threshold in percent from 0 (off) to 100
+ */
+static uint8_t alarmSet(const struct screenCell * screen)
+{
+    uint16_t value = 101;
+    while(value > 100)
+    {
+        ScreenShow(screen);
+        value = numSet(2);
+        if(value > 100)
+        {
+            ScreenShow(percentErrorScreen);
+            __delay_ms(2500);
+        }
+    }
+    return value;
+}
+
+/*
+ * Let the user enter the height of the tank being edited. The height field
+ * (see tank.h) holds up to TANK_HEIGHT_MAX, a larger value is asked again
+ * rather than saved as a different height. 0 is asked again too: the level
+ * in percent is divided by the height.
+ * Returns:
+ *      The height in cm from 1 to TANK_HEIGHT_MAX
+ */
+static uint16_t heightSet(void)
+{
+    uint16_t value = 0;
+    while(value == 0 || value > TANK_HEIGHT_MAX)
+    {
+        ScreenShow(heightScreen);
+        value = numSet(2);
+        if(value == 0 || value > TANK_HEIGHT_MAX)
+        {
+            ScreenShow(heightErrorScreen);
+            __delay_ms(2500);
+        }
+    }
+    return value;
+}
+
+/*
+ * Let the user choose the sensor of the tank being edited (see sensor.h). The
+ * one it has now is marked with '<'.
+ * Returns:
+ *      SENSOR_ULTRASONIC or SENSOR_PRESSURE
+ */
+static uint8_t sensorSet(void)
+{
+    uint8_t keypress = 0;
+    ScreenShow(sensorScreen);
+    while(keypress != '1' && keypress != '2')
+        keypress = KeypadRead();
+    return keypress == '2' ? SENSOR_PRESSURE : SENSOR_ULTRASONIC;
+}
+
+//Fields of the screens, from the tank the menus are on
+static void tankNameField(uint8_t * dest)
+{
+    TankName(tank, dest);
+}
+
+static void ultrasonicMark(uint8_t * dest)
+{
+    *dest = TankSensor(tank) == SENSOR_PRESSURE ? ' ' : '<';
+}
+
+static void pressureMark(uint8_t * dest)
+{
+    *dest = TankSensor(tank) == SENSOR_PRESSURE ? '<' : ' ';
+}
+
+/*
+ * Count the tanks in use
+ * Returns:
+ *      The number of tanks with a name
+ */
+static uint8_t tanksInUse(void)
+{
+    uint8_t n = 0;
+    for(uint8_t count = 0; count < TANK_COUNT; count++)
+        if(TankInUse(count))
+            n++;
+    return n;
+}
+
+/*
+ * Draw the page of the main screen from the values of the last scan. Only the
+ * tanks of the page are formatted and the sensors aren't read, so flipping a
+ * page takes about 12ms (clearing the LCD, 64 characters and 8 cursor shifts).
+ * A page shows 4 tanks as "NNNNNNLLLLLLPPP%" (name, liters, percentage) or,
+ * in the compact mode, 8 tanks as two "NNNNPPP%" (short name, percentage).
+ * The first version printed "L|" after the liters. The '|' was dropped to make
+ * room for 5 digit liters and "100%".
+ * The values are the latest in the store (see store.h). A tank in alarm
+ * shows its most urgent alarm instead of '%', a tank not read yet shows '?'
+ * with the level of the snapshot, or dashes if there's none.
+ */
+static void drawPage(void)
+{
+    //Lines are printed in the order 1, 3, 2, 4 which needs the fewest cursor
+    //shifts (see lcd.c)
+    static const uint8_t lineOrder[VIEW_LINES] = {1, 3, 2, 4};
+    uint8_t onPage[VIEW_LINES*2];   //Tanks of the page in the order they're shown
+    uint8_t perLine = compactView ? 2 : 1;
+    uint8_t perPage = VIEW_LINES*perLine;
+    uint8_t skip;
+    uint8_t n = 0;
+    uint8_t line[17];   //Used to assemble a full LCD line before printing it
+    uint8_t * dest;
+    const struct measurement * m;
+    
+    if(tanksInUse() == 0)
+    {
+        ScreenShow(noTanksScreen);
+        return;
+    }
+    ScreenClear();
+    if(page >= (tanksInUse()+perPage-1)/perPage)   //Past the last page
+        page = 0;
+    drawnPage = page;
+    
+    skip = page*perPage;
+    for(uint8_t count = 0; count < TANK_COUNT && n < perPage; count++)
+    {
+        if(!TankInUse(count))
+            continue;
+        if(skip)
+            skip--;
+        else
+            onPage[n++] = count;
+    }
+    
+    for(uint8_t l = 0; l < VIEW_LINES; l++)
+    {
+        for(uint8_t t = 0; t < perLine; t++)
+        {
+            uint8_t slot = (lineOrder[l]-1)*perLine + t;
+            uint8_t count;
+            dest = &line[t*8];
+            if(slot >= n)   //Blank after the last tank
+            {
+                for(uint8_t i = 0; i < 16/perLine; i++)
+                    dest[i] = ' ';
+                continue;
+            }
+            count = onPage[slot];
+            m = StoreRead(count);
+            TankName(count, dest);  //The characters after the name are written below
+            if(compactView)
+            {
+                if(m->health == STORE_UNKNOWN)
+                    for(uint8_t i = 4; i < 7; i++)
+                        dest[i] = '-';
+                else
+                    NumFormat(m->percent, &dest[4], 3);
+                dest[7] = m->health <= STORE_SNAPSHOT ? '?' : alarmChar(count);
+            }
+            else
+            {
+                if(m->health == STORE_UNKNOWN)
+                    for(uint8_t i = 6; i < 15; i++)
+                        dest[i] = (i < 9) ? ' ' : '-';
+                else
+                {
+                    NumFormat(m->liters, &dest[6], 5);
+                    NumFormat(m->percent, &dest[12], 3);
+                }
+                dest[11] = 'L';
+                dest[15] = m->health <= STORE_SNAPSHOT ? '?' : alarmChar(count);
+            }
+        }
+        line[16] = '\0';
+        LCDPrintString(line, lineOrder[l], 1);
+    }
+}
+
+/*
+ * The view state where the liquid tanks are read and the data of the tanks
+ * is displayed on the LCD screen
+ * Returns:
+ *       The next state to be executed (hardcoded as idle())
+ * Notes:
+ * Each reading is published to the store (see store.h) and every module
+ * takes the tanks that were read from there. The page is only drawn again if
+ * a tank was read, the page changed or the LCD shows another screen.
+ * The other states return ST_VIEW rather than calling it, so the main loop
+ * calls it and its calls start one level lower on the hardware stack.
+ */
+uint8_t view(void)
+{
+    struct measurement m;
+    uint8_t redraw;
+    PROFILE_ENTER();
+    for(uint8_t count = 0; count < TANK_COUNT; count++) //Loop through the liquid tanks
+    {
+        if (TankInUse(count))
+        {
+            measureTank(count);
+            AlarmService();     //First so the output isn't held up by the rest
+            for(uint8_t r = 1; r < ALARM_CONFIRM && AlarmPending(count); r++)
+            {
+                __delay_ms(ALARM_CONFIRM_MS);
+                measureTank(count);
+                AlarmService();
+            }
+            //The UART buffer holds a record of every tank, it sends them
+            //during the next pings
+            TelemetryService();
+        }
+    }
+    
+    redraw = page != drawnPage;
+    while(StoreNext(STORE_DISPLAY, &m) != STORE_NONE)
+        redraw = 1;
+    if(redraw)
+        drawPage();
+    
+    //Log the levels if it's time for a new sample, close the day if it's over
+    //and check for leaks and refills
+    HistoryService();
+    UsageService();
+    LeakService();
+    RefillService();
+    
+    //Enable timer0 interrupt to count SCAN_MS in idle state
+    TMR0IE = 1;
+    
+    PROFILE_EXIT(PROF_VIEW);
+    return ST_IDLE;
+}
+
+/*
+ * Shows the next page of the main screen when '8' is pressed
+ * Returns:
+ *       The next state to be executed (hardcoded as idle())
+ */
+uint8_t nextPage(void)
+{
+    page++;     //Wraps to the first page in drawPage()
+    hold = VIEW_HOLD;
+    drawPage();
+    return ST_IDLE;
+}
+
+/*
+ * Shows the previous page of the main screen when '2' is pressed
+ * Returns:
+ *       The next state to be executed (hardcoded as idle())
+ */
+uint8_t previousPage(void)
+{
+    uint8_t perPage = compactView ? 2*VIEW_LINES : VIEW_LINES;
+    if(page == 0)
+        page = (tanksInUse()+perPage-1)/perPage;
+    if(page != 0)
+        page--;
+    hold = VIEW_HOLD;
+    drawPage();
+    return ST_IDLE;
+}
+
+/*
+ * Switches the main screen between 1 and 2 tanks per line when '0' is pressed
+ * Returns:
+ *       The next state to be executed (hardcoded as idle())
+ */
+uint8_t toggleCompact(void)
+{
+    compactView ^= 1;
+    page = 0;
+    hold = VIEW_HOLD;
+    drawPage();
+    return ST_IDLE;
+}
+
+/*
+ * Acknowledges the leak alarms when '#' is pressed on the main screen
+ * Returns:
+ *       The next state to be executed (hardcoded as ST_VIEW)
+ */
+uint8_t acknowledge(void)
+{
+    LeakAcknowledge();
+    return ST_VIEW;
+}
+
+/*
+ * Shows a page of the usage screen, VIEW_LINES tanks as "NNNNNNLLLLLLDDDd"
+ * (name, liters per day, days left). Unknown values are shown as dashes.
+ */
+static void drawUsage(void)
+{
+    uint8_t lineNum = 1; //Used to indicate the current line on the LCD
+    uint8_t skip;
+    uint16_t value;
+    uint8_t line[17];   //Used to assemble a full LCD line before printing it
+    listPages = (tanksInUse()+VIEW_LINES-1)/VIEW_LINES;
+    if(listPages == 0)
+    {
+        ScreenShow(noUsageScreen);
+        return;
+    }
+    ScreenClear();
+    if(listPage >= listPages)   //Past the last page
+        listPage = 0;
+    skip = listPage*VIEW_LINES;
+    for(uint8_t count = 0; count < TANK_COUNT && lineNum <= VIEW_LINES; count++)
+    {
+        if (!TankInUse(count))
+            continue;
+        if(skip)
+        {
+            skip--;
+            continue;
+        }
+        TankName(count, line);
+        value = UsageDailyLiters(count);
+        if(value == USAGE_UNKNOWN)
+            for(uint8_t i = 6; i < 11; i++)
+                line[i] = (i < 9) ? ' ' : '-';
+        else
+            NumFormat(value, &line[6], 5);
+        line[11] = 'L';
+        value = UsageDaysLeft(count);
+        if(value == USAGE_UNKNOWN)
+            for(uint8_t i = 12; i < 15; i++)
+                line[i] = '-';
+        else
+            NumFormat(value, &line[12], 3);
+        line[15] = 'd';
+        line[16] = '\0';
+        LCDPrintString(line, lineNum, 1);
+        lineNum++;
+    }
+}
+
+/*
+ * The usage state where the estimate of the liters used per day and of the
+ * days left until each tank is empty is displayed on the LCD screen, from
+ * the first page
+ * Returns:
+ *       The next state to be executed (hardcoded as usage())
+ */
+uint8_t usage(void)
+{
+    listPage = 0;
+    drawUsage();
+    return ST_USAGE;
+}
+
+/*
+ * Shows the next page of the usage screen when '8' is pressed
+ * Returns:
+ *       The next state to be executed (hardcoded as usage())
+ */
+uint8_t usageNextPage(void)
+{
+    listPage++;     //Wraps to the first page in drawUsage()
+    drawUsage();
+    return ST_USAGE;
+}
+
+/*
+ * Shows the previous page of the usage screen when '2' is pressed
+ * Returns:
+ *       The next state to be executed (hardcoded as usage())
+ */
+uint8_t usagePreviousPage(void)
+{
+    if(listPage == 0)
+        listPage = listPages;
+    if(listPage != 0)
+        listPage--;
+    drawUsage();
+    return ST_USAGE;
+}
+
+/*
+ * Shows a page of the refills screen, VIEW_LINES refills, newest first, as
+ * "NNNNNNLLLLLLMMMm" (name, liters delivered, duration in minutes)
+ */
+static void drawRefills(void)
+{
+    uint8_t lineNum = 1; //Used to indicate the current line on the LCD
+    struct refillEvent event;
+    uint8_t line[17];   //Used to assemble a full LCD line before printing it
+    uint8_t n = 0;
+    while(n < EE_REFILL_COUNT && RefillRead(n, &event))
+        n++;
+    listPages = (n+VIEW_LINES-1)/VIEW_LINES;
+    if(listPages == 0)
+    {
+        ScreenShow(noRefillsScreen);
+        return;
+    }
+    ScreenClear();
+    if(listPage >= listPages)   //Past the last page
+        listPage = 0;
+    n = listPage*VIEW_LINES;
+    while(lineNum <= VIEW_LINES && RefillRead(n, &event))
+    {
+        TankName(event.tank, line);
+        NumFormat(event.liters, &line[6], 5);
+        line[11] = 'L';
+        NumFormat((event.duration+30)/60, &line[12], 3);
+        line[15] = 'm';
+        line[16] = '\0';
+        LCDPrintString(line, lineNum, 1);
+        lineNum++;
+        n++;
+    }
+}
+
+/*
+ * The refills state where the last refills are shown, newest first, when '*'
+ * is pressed on the usage screen, from the first page
+ * Returns:
+ *      The next state to be executed (hardcoded as refills())
+ */
+uint8_t refills(void)
+{
+    listPage = 0;
+    drawRefills();
+    return ST_REFILLS;
+}
+
+/*
+ * Shows the next page of the refills screen when '8' is pressed
+ * Returns:
+ *      The next state to be executed (hardcoded as refills())
+ */
+uint8_t refillsNextPage(void)
+{
+    listPage++;     //Wraps to the first page in drawRefills()
+    drawRefills();
+    return ST_REFILLS;
+}
+
+/*
+ * Shows the previous page of the refills screen when '2' is pressed
+ * Returns:
+ *      The next state to be executed (hardcoded as refills())
+ */
+uint8_t refillsPreviousPage(void)
+{
+    if(listPage == 0)
+        listPage = listPages;
+    if(listPage != 0)
+        listPage--;
+    drawRefills();
+    return ST_REFILLS;
+}
+
+#if PROFILE
+static uint8_t diagPage = 0;   //First probe shown on the diagnostics page
+
+//Show the probes of the current diagnostics page, one per line
+static void drawDiagnostics(void)
+{
+    uint8_t line[17];   //Used to assemble a full LCD line before printing it
+    ScreenClear();
+    for(uint8_t i = 0; i < 4 && diagPage+i < PROF_COUNT; i++)
+    {
+        ProfileLine(diagPage+i, line);
+        LCDPrintString(line, i+1, 1);
+    }
+}
+
+/*
+ * The diagnostics state, when '9' is pressed on the options menu. Shows the
+ * average and longest time of each probe in us (see profile.h).
+ * Returns:
+ *       The next state to be executed (hardcoded as diagnostics())
+ */
+uint8_t diagnostics(void)
+{
+    diagPage = 0;
+    drawDiagnostics();
+    return ST_DIAG;
+}
+
+/*
+ * Shows the next probes when '8' is pressed on the diagnostics page
+ * Returns:
+ *       The next state to be executed (hardcoded as diagnostics())
+ */
+uint8_t diagnosticsPage(void)
+{
+    diagPage += 4;
+    if(diagPage >= PROF_COUNT)
+        diagPage = 0;
+    drawDiagnostics();
+    return ST_DIAG;
+}
+
+/*
+ * Empties the table when '0' is pressed on the diagnostics page
+ * Returns:
+ *       The next state to be executed (hardcoded as diagnostics())
+ */
+uint8_t diagnosticsClear(void)
+{
+    ProfileClear();
+    drawDiagnostics();
+    return ST_DIAG;
+}
+
+/*
+ * Sends the table on the UART when '*' is pressed on the diagnostics page
+ * Returns:
+ *       The next state to be executed (hardcoded as diagnostics())
+ */
+uint8_t diagnosticsDump(void)
+{
+    ProfileDump();
+    return ST_DIAG;
+}
+#endif
+
+/*
+ * The options state where the user is presented with a number of options to
+ * choose from.
+ * Returns:
+ *      The next state to be executed (hardcoded as options())
+ */
+uint8_t options(void)
+{
+    ScreenShow(optionsScreen);
+    drawnPage = NO_PAGE;
+    ProvisionAbort();   //The menus use the tanks
+
+    return ST_OPTIONS;
+}
+
+/*
+ * The add/edit state where the user can add a new entry or edit an existing one
+ * Returns:
+ *      The next state to be executed (hardcoded as addEditState())
+ */
+uint8_t addEditEntry (void)
+{
+    uint16_t sensor = 0;
+    uint8_t returnVal = 0;
+    uint8_t name[TANK_NAME_CHARS+1];    //Edited here, the tank only keeps it packed
+    
+    while(sensor < 1 || sensor > TANK_COUNT)
+    {
+        ScreenShow(tankNumberScreen);
+        sensor = numSet(3);
+        if(sensor < 1 || sensor > TANK_COUNT)
+        {
+            ScreenShow(tankNumberErrorScreen);
+            __delay_ms(2500);
+        }
+    }
+    tank = sensor-1;
+
+    TankName(tank, name);
+    while(returnVal != 1)
+    {
+        ScreenShow(nameScreen);
+        LCDPrintString(name,2,1);
+        LCDSetPos(1,2);
+        returnVal = nameSet(name, arrSize,2);
+        if(returnVal == 2)
+        {
+            ScreenShow(nameErrorScreen);
+            __delay_ms(2500);
+        }
+    }    
+    TankSetName(tank, name);
+    
+    ScreenShow(lengthScreen);
+    TankSetLength(tank, numSet(2));
+    ScreenShow(widthScreen);
+    TankSetWidth(tank, numSet(2));
+    TankSetHeight(tank, heightSet());
+    TankSetSensor(tank, sensorSet());
+    
+    TankSetLow(tank, alarmSet(lowScreen));
+    TankSetCritical(tank, alarmSet(criticalScreen));
+    TankSetHigh(tank, alarmSet(highScreen));
+    
+    ScreenShow(savedScreen);
+    
+    //Update EEPROM
+    tankChanged(tank);
+    
+    return ST_ADD_EDIT;
+}
+
+/*
+ * The state where the user can delete an entry.
+ * Returns:
+ *      The next state to be executed (hardcoded as deleteEntry()) 
+ * Notes:
+ * Only the name is written when the user goes through the entries, the rest
+ * of the screen stays.
+ */
+uint8_t deleteEntry(void)
+{
+    uint8_t keypress = 0;
+    //Check to see if the liquid tanks data is empty
+    if(tanksInUse() == 0)
+    {
+        ScreenShow(noEntriesScreen);
+        return ST_DEL;
+    }
+    for(tank = 0; tank < TANK_COUNT-1 && !TankInUse(tank); tank++)
+        ;
+    ScreenShow(chooseScreen);
+    while(keypress != '*')
+    {
+        //KeypadRead always returns a value, and waits after a key
+        keypress = KeypadRead();
+        if(keypress != '8' && keypress != '2')
+            continue;
+        //Go through entries until you find a valid one, there's at least one
+        for(uint8_t n = 0; n < TANK_COUNT; n++)
+        {
+            if(keypress == '8')
+            {
+                tank++;
+                if (tank >= TANK_COUNT)
+                    tank = 0;
+            }
+            else
+            {
+                tank--;         //uint8 underflows to 255
+                if(tank > 200)
+                    tank = TANK_COUNT-1;
+            }
+            if(TankInUse(tank))
+                break;
+        }
+        ScreenRefresh();
+    }
+    //Entry is selected. Reset entry to empty/0
+    TankConfigClear(tank);
+    ScreenShow(deletedScreen);
+    
+    //update EEPROM
+    tankChanged(tank);
+    return ST_DEL;
+}
+
+/*
+ *  A function to get events derived from pressing the keypad.
+ *  Returns:
+ *      The event mapped to the pressed key
+ */
+uint8_t getEvent(void)
+{
+    uint8_t keypress = 0;
+    keypress = KeypadRead();
+    switch(keypress)
+    {
+        case '1':
+            return EV_KEY_ONE;
+        case '2':
+            return EV_KEY_TWO;
+        case '3':
+            return EV_KEY_THREE;
+        case '4':
+            return EV_KEY_FOUR;
+        case '8':
+            return EV_KEY_EIGHT;
+        case '9':
+            return EV_KEY_NINE;
+        case '0':
+            return EV_KEY_ZERO;
+        case '*':
+            return EV_KEY_STAR;
+        case '#':
+            return EV_KEY_HASH;
+        case 0:
+            return EV_KEY_NONE;
+        default:
+            return EV_ANY;
+    }     
 }
\ No newline at end of file
@@ -0,0 +1,126 @@
+/*
+ * File:   store.c
+ * Author: Faris Shahin
+ *
+ * Latest measurement of each tank. See store.h.
+ *
+ * Note: StoreInit() must be called before the first StoreSeed() or
+ * StorePublish(). Only StoreRead() may be called from the interrupt.
+ */
+
+#include "config.h"
+
+static struct measurement slots[TANK_COUNT+1];
+static volatile uint8_t current[TANK_COUNT];    //Slot of each tank
+static uint8_t spare;                           //Slot the next reading is written to
+static tankmask_t fresh[STORE_CONSUMERS];       //One bit per tank published and not taken yet
+
+/*
+ * Give each tank a slot with no measurement
+ */
+void StoreInit(void)
+{
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        current[i] = i;
+        slots[i].health = STORE_UNKNOWN;
+        slots[i].level = TLM_NO_LEVEL;
+        slots[i].unfiltered = TLM_NO_LEVEL;
+        slots[i].seq = 0;
+    }
+    spare = TANK_COUNT;
+    for(uint8_t c = 0; c < STORE_CONSUMERS; c++)
+        fresh[c] = 0;
+}
+
+//Write a measurement to the spare slot and switch the tank to it
+static void swap(uint8_t tankIndex, struct measurement * m)
+{
+    uint8_t slot = spare;
+    slots[slot] = *m;
+    spare = current[tankIndex];
+    current[tankIndex] = slot;  //A single byte, the interrupt sees the old slot or the new one
+}
+
+/*
+ * Forget the measurement of a tank, e.g. when its dimensions change. A reading
+ * published before isn't given to the consumers anymore.
+ */
+void StoreClear(uint8_t tankIndex)
+{
+    struct measurement m;
+    m.ticks = 0;
+    m.level = TLM_NO_LEVEL;
+    m.unfiltered = TLM_NO_LEVEL;
+    m.liters = 0;
+    m.percent = 0;
+    m.health = STORE_UNKNOWN;
+    StoreSeed(tankIndex, &m);
+    for(uint8_t c = 0; c < STORE_CONSUMERS; c++)
+        fresh[c] &= ~(1<<tankIndex);
+}
+
+/*
+ * Publish a new reading of a tank to all the consumers
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      *m - the measurement, its seq is set here
+ */
+void StorePublish(uint8_t tankIndex, struct measurement * m)
+{
+    m->seq = slots[current[tankIndex]].seq + 1;
+    swap(tankIndex, m);
+    for(uint8_t c = 0; c < STORE_CONSUMERS; c++)
+        fresh[c] |= 1<<tankIndex;
+}
+
+/*
+ * Set the measurement of a tank without giving it to the consumers, for a
+ * value that wasn't read now (the snapshot of the levels at power up)
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      *m - the measurement, its seq is set here
+ */
+void StoreSeed(uint8_t tankIndex, struct measurement * m)
+{
+    m->seq = slots[current[tankIndex]].seq;
+    swap(tankIndex, m);
+}
+
+/*
+ * Returns:
+ *      The latest measurement of a tank. It stays valid until the next
+ *      StorePublish() of the tank, for the whole of an interrupt.
+ */
+const struct measurement * StoreRead(uint8_t tankIndex)
+{
+    return &slots[current[tankIndex]];
+}
+
+/*
+ * Take the next tank published since the consumer last took it
+ * Parameters:
+ *      consumer - STORE_...
+ *      *m - where the measurement is copied
+ * Returns:
+ *      The index of the tank, or STORE_NONE if the consumer has taken all
+ * Notes:
+ * A tank published twice before it's taken is only given once, with the
+ * latest measurement; the seq tells how many readings were missed.
+ */
+uint8_t StoreNext(uint8_t consumer, struct measurement * m)
+{
+    tankmask_t f = fresh[consumer];
+    if(f == 0)
+        return STORE_NONE;
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        if(f & (1<<i))
+        {
+            fresh[consumer] = f & ~(1<<i);
+            *m = slots[current[i]];
+            return i;
+        }
+    }
+    return STORE_NONE;
+}
@@ -0,0 +1,141 @@
+/*
+ * File:   tank.c
+ * Author: Faris Shahin
+ *
+ * Packed settings of the liquid tanks. See tank.h.
+ *
+ * Note: The PIC16 shifts one bit per instruction, so a field is moved by at
+ * most 7 bits after its bytes are gathered, never by its position. A field
+ * can span 3 bytes, so they are gathered in a uint32_t and the shifts and
+ * masks are 32-bit: each bit shifted is 4 rotates of the PIC16. That is the
+ * price of the smaller tanks, paid at every read of a field.
+ */
+
+#include "config.h"
+
+#if TANK_HEIGHT_MAX != (1<<TANK_HEIGHT_BITS)-1
+#error "TANK_HEIGHT_MAX doesn't match TANK_HEIGHT_BITS"
+#endif
+
+/*
+ * Read a field of a tank
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      bit - the first bit of the field (TANK_..._BIT)
+ *      bits - its width, up to 16
+ * Returns:
+ *      The value of the field
+ */
+uint16_t TankField(uint8_t tankIndex, uint8_t bit, uint8_t bits)
+{
+    const uint8_t * p = &TankBytes(tankIndex)[bit>>3];
+    uint8_t shift = bit & 7;
+    uint8_t n = (shift + bits + 7) >> 3;    //Bytes the field is in, 1 to 3
+    uint32_t v = 0;
+    while(n--)
+        v = v<<8 | p[n];
+    return (v >> shift) & ((1UL<<bits)-1);
+}
+
+/*
+ * Write a field of a tank
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      bit - the first bit of the field (TANK_..._BIT)
+ *      bits - its width, up to 16
+ *      value - the value, the largest the field holds if it's bigger (e.g. a
+ *              height of 4 digits typed on the keypad)
+ */
+void TankSetField(uint8_t tankIndex, uint8_t bit, uint8_t bits, uint16_t value)
+{
+    uint8_t * p = &TankBytes(tankIndex)[bit>>3];
+    uint8_t shift = bit & 7;
+    uint8_t n = (shift + bits + 7) >> 3;
+    uint32_t mask = (1UL<<bits)-1;
+    uint32_t v;
+    if(value > mask)
+        value = mask;
+    v = (uint32_t)value << shift;
+    mask <<= shift;
+    for(uint8_t i = 0; i < n; i++)
+    {
+        p[i] = (p[i] & ~(uint8_t)mask) | ((uint8_t)v & (uint8_t)mask);
+        mask >>= 8;
+        v >>= 8;
+    }
+}
+
+//Character of a name code, in the order of nameSet(): space, A-Z, a-z then
+//0-9. '?' wasn't written by this firmware.
+#define nameChar(code)  ((code) == 0 ? ' ' : (code) <= 26 ? 'A' - 1 + (code) :       \
+                         (code) <= 52 ? 'a' - 27 + (code) :                         \
+                         (code) <= 62 ? '0' - 53 + (code) : '?')
+
+//Code of a character, 0 (a space) for one nameSet() doesn't allow
+#define nameCode(c)     ((c) >= 'A' && (c) <= 'Z' ? (c) - 'A' + 1 :                 \
+                         (c) >= 'a' && (c) <= 'z' ? (c) - 'a' + 27 :                \
+                         (c) >= '0' && (c) <= '9' ? (c) - '0' + 53 : 0)
+
+//First bit of character i of the name, i*TANK_CHAR_BITS with shifts as in
+//TankBytes()
+#if TANK_CHAR_BITS != 6
+#error "nameBit() is written for a TANK_CHAR_BITS of 6"
+#endif
+#define nameBit(i)      (TANK_NAME_BIT + ((uint8_t)(i)<<2) + ((uint8_t)(i)<<1))
+
+/*
+ * Returns:
+ *      Character i of the name of a tank (0 to TANK_NAME_CHARS-1)
+ */
+uint8_t TankNameChar(uint8_t tankIndex, uint8_t i)
+{
+    uint8_t code = TankField(tankIndex, nameBit(i), TANK_CHAR_BITS);
+    return nameChar(code);
+}
+
+/*
+ * Set character i of the name of a tank. A character nameSet() doesn't allow
+ * is stored as a space.
+ */
+void TankSetNameChar(uint8_t tankIndex, uint8_t i, uint8_t c)
+{
+    TankSetField(tankIndex, nameBit(i), TANK_CHAR_BITS, nameCode(c));
+}
+
+/*
+ * Decode the name of a tank
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      *name - array of TANK_NAME_CHARS+1 bytes, a '\0' is added
+ * Notes:
+ * The fields are read here rather than through TankNameChar(), which would
+ * take one more level of the stack under the screens that show a name.
+ */
+void TankName(uint8_t tankIndex, uint8_t * name)
+{
+    uint8_t code;
+    for(uint8_t i = 0; i < TANK_NAME_CHARS; i++)
+    {
+        code = TankField(tankIndex, nameBit(i), TANK_CHAR_BITS);
+        name[i] = nameChar(code);
+    }
+    name[TANK_NAME_CHARS] = '\0';
+}
+
+/*
+ * Encode the name of a tank
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      *name - TANK_NAME_CHARS characters, padded with spaces
+ * Notes:
+ * The fields are written here as in TankName().
+ */
+void TankSetName(uint8_t tankIndex, const uint8_t * name)
+{
+    uint8_t c;
+    for(uint8_t i = 0; i < TANK_NAME_CHARS; i++)
+    {
+        c = name[i];
+        TankSetField(tankIndex, nameBit(i), TANK_CHAR_BITS, nameCode(c));
+    }
+}
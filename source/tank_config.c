@@ -0,0 +1,297 @@
+/*
+ * File:   tank_config.c
+ * Author: Faris Shahin
+ *
+ * Stores the liquid tanks data in EEPROM.
+ *
+ * Note: All writes go through the EEPROM write-behind queue, so saving a tank
+ * returns right away and only the bytes that changed are written.
+ */
+
+#include "config.h"
+
+/*
+ * Build the EEPROM image of a tank record
+ * Parameters:
+ *      tankIndex: the index of the liquid tank
+ *      *rec: array of REC_SIZE bytes to fill
+ */
+void TankConfigRecord(uint8_t tankIndex, uint8_t * rec)
+{
+    uint8_t crc = 0xff;
+    for(uint8_t i = 0; i < TANK_SIZE; i++)
+        rec[REC_TANK+i] = TankBytes(tankIndex)[i];
+    for(uint8_t i = 0; i < REC_CRC; i++)
+        crc = crc8(crc, rec[i]);
+    rec[REC_CRC] = crc;
+}
+
+/*
+ * Read a tank record from EEPROM into liquidTanks
+ * Parameters:
+ *      tankIndex: the index of the liquid tank
+ * Returns:
+ *      1 if the record is valid, 0 if its CRC doesn't match (liquidTanks is
+ *      left untouched in that case)
+ */
+static uint8_t readRecord(uint8_t tankIndex)
+{
+    uint8_t rec[REC_SIZE];
+    uint8_t addrs = EE_TANKS_ADDR + tankIndex*EE_TANK_SLOT;
+    uint8_t crc = 0xff;
+    for(uint8_t i = 0; i < REC_SIZE; i++)
+        rec[i] = EEPROMQueueRead(addrs+i);
+    for(uint8_t i = 0; i < REC_CRC; i++)
+        crc = crc8(crc, rec[i]);
+    if(crc != rec[REC_CRC])
+        return 0;
+    for(uint8_t i = 0; i < TANK_SIZE; i++)
+        TankBytes(tankIndex)[i] = rec[REC_TANK+i];
+    return 1;
+}
+
+/*
+ * Read a tank record of versions 1 to 3, before the tanks were packed
+ * Parameters:
+ *      tankIndex: the index of the liquid tank
+ * Returns:
+ *      1 if the record is valid, 0 if its CRC doesn't match (liquidTanks is
+ *      left untouched in that case)
+ * Notes:
+ * A version 1 record (not rewritten yet after an update) is also accepted,
+ * with its alarms off. The CRC is checked at both places in one pass.
+ */
+static uint8_t readUnpackedRecord(uint8_t tankIndex)
+{
+    uint8_t rec[REC_V3_SIZE];
+    uint8_t addrs = EE_TANKS_ADDR + tankIndex*REC_V3_SLOT;
+    uint8_t crc = 0xff;
+    uint8_t v1 = 0;
+    for(uint8_t i = 0; i < REC_V3_SIZE; i++)
+        rec[i] = EEPROMQueueRead(addrs+i);
+    for(uint8_t i = 0; i < REC_V3_CRC; i++)
+    {
+        if(i == REC_V1_CRC)
+            v1 = (crc == rec[REC_V1_CRC]);
+        crc = crc8(crc, rec[i]);
+    }
+    if(crc != rec[REC_V3_CRC])
+    {
+        if(!v1)
+            return 0;
+        rec[REC_V3_LOW] = 0;
+        rec[REC_V3_CRITICAL] = 0;
+        rec[REC_V3_HIGH] = 0;
+    }
+    
+    TankConfigClear(tankIndex);
+    if(rec[REC_V3_NAME] == ' ')
+        return 1;
+    TankSetName(tankIndex, &rec[REC_V3_NAME]);
+    TankSetLength(tankIndex, rec[REC_V3_LENGTH] | (uint16_t)rec[REC_V3_LENGTH+1]<<8);
+    TankSetWidth(tankIndex, rec[REC_V3_WIDTH] | (uint16_t)rec[REC_V3_WIDTH+1]<<8);
+    TankSetHeight(tankIndex, rec[REC_V3_HEIGHT] | (uint16_t)rec[REC_V3_HEIGHT+1]<<8);
+    TankSetLow(tankIndex, rec[REC_V3_LOW]);
+    TankSetCritical(tankIndex, rec[REC_V3_CRITICAL]);
+    TankSetHigh(tankIndex, rec[REC_V3_HIGH]);
+    return 1;
+}
+
+/*
+ * Read a tank stored with the layout used before the versioned header
+ * Parameters:
+ *      tankIndex: the index of the liquid tank
+ * Notes:
+ * The old layout used a 32-byte slot per tank: 8 bytes of name then length,
+ * width and height with the high byte first. The old writeEEPROM() cast to
+ * uint8_t before shifting so the high bytes were always saved as 0, and the
+ * old readEEPROM() only kept the low bytes. Dimensions of 256 cm and above
+ * can't be recovered.
+ */
+static void readLegacyRecord(uint8_t tankIndex)
+{
+    uint8_t addrs = tankIndex<<EE_LEGACY_SLOT_SHIFT;
+    uint8_t name[TANK_NAME_CHARS];
+    for(uint8_t i = 0; i < TANK_NAME_CHARS; i++)
+        name[i] = EEPROMQueueRead(addrs+i);
+    TankConfigClear(tankIndex);
+    if(name[0] == ' ')
+        return;
+    TankSetName(tankIndex, name);
+    TankSetLength(tankIndex, EEPROMQueueRead(addrs+9));
+    TankSetWidth(tankIndex, EEPROMQueueRead(addrs+11));
+    TankSetHeight(tankIndex, EEPROMQueueRead(addrs+13));
+}
+
+/*
+ * Copy the Modbus address (see modbus.h) of a version 1 to 3 layout to where
+ * it is now. It moved with the end of the tank records, which were bigger.
+ * Parameters:
+ *      count: the tank count of the old layout
+ * Notes:
+ * Whatever is there is copied, ModbusInit() checks it.
+ */
+static void moveModbusAddress(uint8_t count)
+{
+    uint8_t old = EE_TANKS_ADDR + count*(REC_V3_SLOT+EE_USAGE_SLOT) + EE_REFILL_COUNT*EE_REFILL_SLOT;
+    uint8_t a = EEPROMQueueRead(old);
+    uint8_t c = EEPROMQueueRead(old+1);
+    EEPROMQueueWrite(EE_MODBUS_ADDR, a);
+    EEPROMQueueWrite(EE_MODBUS_ADDR+1, c);
+}
+
+/*
+ * Queue the configuration header for writing
+ * Notes:
+ * The stamp of the logs is cleared before it, so the logs of the old layout
+ * are erased even if power is lost before eraseLogs() is done.
+ */
+static void writeHeader(void)
+{
+    uint8_t crc = 0xff;
+    EEPROMQueueWrite(EE_STAMP_ADDR, 0xff);
+    crc = crc8(crc, EE_MAGIC);
+    crc = crc8(crc, EE_VERSION);
+    crc = crc8(crc, TANK_COUNT);
+    EEPROMQueueWrite(EE_HEADER_ADDR, EE_MAGIC);
+    EEPROMQueueWrite(EE_HEADER_ADDR+1, EE_VERSION);
+    EEPROMQueueWrite(EE_HEADER_ADDR+2, TANK_COUNT);
+    EEPROMQueueWrite(EE_HEADER_ADDR+3, crc);
+}
+
+/*
+ * Erase everything kept after the tank records but the Modbus address: the
+ * usage estimates, the refill log, the leak settings (back to the defaults of
+ * leak.h), the snapshot and the history log. The stamp
+ * is written last, so a power loss before the end erases them again at the
+ * next power up.
+ */
+static void eraseLogs(void)
+{
+    for(uint16_t addrs = EE_USAGE_ADDR; addrs < EE_STAMP_ADDR; addrs++)
+        if(addrs < EE_MODBUS_ADDR || addrs >= EE_MODBUS_END)
+            EEPROMQueueWrite((uint8_t)addrs, 0xff);
+    //A stamp still queued by writeHeader() would be updated in place, ahead
+    //of the bytes above
+    EEPROMQueueFlush();
+    EEPROMQueueWrite(EE_STAMP_ADDR, EE_LOG_STAMP);
+}
+
+/*
+ * Reset a liquid tank to empty (RAM only)
+ * Parameters:
+ *      tankIndex: the index of the liquid tank
+ */
+void TankConfigClear(uint8_t tankIndex)
+{
+    for(uint8_t i = 0; i < TANK_SIZE; i++)
+        TankBytes(tankIndex)[i] = 0;  //All spaces and zeros
+}
+
+/*
+ * Load the liquid tanks data from EEPROM
+ * Returns:
+ *      CFG_LOADED, CFG_MIGRATED or CFG_DEFAULTS (see tank_config.h)
+ * Notes:
+ * A record with a wrong CRC (e.g. power was lost while it was being written)
+ * is loaded as an empty tank. Nothing has to be written for it: it reads as
+ * empty until the tank is saved again.
+ * Data in the old layout is converted and written back in the new layout.
+ * The header is queued first so a power loss during the conversion leaves a
+ * valid header with some empty tanks rather than garbage.
+ * Version 1 records are loaded with their alarms off. Version 3 records are
+ * the same as version 2, only the history log moved to make room for the level
+ * snapshot. Records of versions 1 to 3 are packed and rewritten in the smaller
+ * slots of version 4, which moves everything after them: the Modbus address
+ * is copied. Version 5 and 6 records are the same as version 4. All the
+ * records are read before the first one is rewritten, but a power loss before
+ * the queue is written out leaves the tanks not rewritten yet empty.
+ * If the firmware was built with another TANK_COUNT, the tanks both counts
+ * have are kept (their slots don't move) and the others start empty.
+ * What is kept after the tank records moves with them, so the usage
+ * estimates, the refill log, the leak settings, the snapshot and the history
+ * log are erased when they weren't written with this layout (EE_LOG_STAMP,
+ * see eeprom_map.h): after any conversion, a change of TANK_COUNT or on a new
+ * chip. They start over.
+ */
+uint8_t TankConfigLoad(void)
+{
+    uint8_t header[EE_HEADER_SIZE];
+    uint8_t crc = 0xff;
+    uint8_t kept;
+    uint8_t result = CFG_MIGRATED;
+    for(uint8_t i = 0; i < EE_HEADER_SIZE; i++)
+        header[i] = EEPROMQueueRead(EE_HEADER_ADDR+i);
+    for(uint8_t i = 0; i < EE_HEADER_SIZE-1; i++)
+        crc = crc8(crc, header[i]);
+    
+    if(crc == header[3] && header[0] == EE_MAGIC && header[1] >= 1 && header[1] <= EE_VERSION)
+    {
+        kept = header[2] < TANK_COUNT ? header[2] : TANK_COUNT;
+        for(uint8_t i = 0; i < TANK_COUNT; i++)
+            if(i >= kept || !(header[1] >= 4 ? readRecord(i) : readUnpackedRecord(i)))
+                TankConfigClear(i);
+        if(header[1] == EE_VERSION && header[2] == TANK_COUNT)
+            result = CFG_LOADED;
+        else
+        {
+            if(header[1] < 4)
+                moveModbusAddress(header[2]);
+            writeHeader();
+            for(uint8_t i = 0; i < TANK_COUNT; i++)
+                TankConfigSave(i);
+        }
+    }
+    else if(EEPROMQueueRead(EE_LEGACY_MAGIC_ADDR) == EE_LEGACY_MAGIC)
+    {
+        //Every old record must be in RAM before the new layout overwrites it.
+        //The old magic byte is erased with the logs.
+        for(uint8_t i = 0; i < TANK_COUNT; i++)
+            if(i < EE_LEGACY_TANKS)
+                readLegacyRecord(i);
+            else
+                TankConfigClear(i);
+        writeHeader();
+        for(uint8_t i = 0; i < TANK_COUNT; i++)
+            TankConfigSave(i);
+    }
+    else
+    {
+        for(uint8_t i = 0; i < TANK_COUNT; i++)
+            TankConfigClear(i);
+        writeHeader();
+        result = CFG_DEFAULTS;
+    }
+    
+    if(EEPROMQueueRead(EE_STAMP_ADDR) != EE_LOG_STAMP)
+        eraseLogs();
+    return result;
+}
+
+/*  
+ * Save a liquid tank to EEPROM
+ * Parameters:
+ *      tankIndex: the index of the liquid tank
+ * Notes:
+ * The record is compared with what is already stored and only the bytes that
+ * differ are queued. Returns without waiting for the writes.
+ */
+void TankConfigSave(uint8_t tankIndex)
+{
+    uint8_t rec[REC_SIZE];
+    uint8_t addrs = EE_TANKS_ADDR + tankIndex*EE_TANK_SLOT;
+    TankConfigRecord(tankIndex, rec);
+    for(uint8_t i = 0; i < REC_SIZE; i++)
+        EEPROMQueueWrite(addrs+i, rec[i]);
+}
+
+/*
+ * Load a liquid tank from EEPROM again, dropping what was changed in RAM only
+ * Parameters:
+ *      tankIndex: the index of the liquid tank
+ */
+void TankConfigRevert(uint8_t tankIndex)
+{
+    if(!readRecord(tankIndex))
+        TankConfigClear(tankIndex);
+}
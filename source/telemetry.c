@@ -0,0 +1,123 @@
+/*
+ * File:   telemetry.c
+ * Author: Faris Shahin
+ *
+ * Binary telemetry stream on the UART. See telemetry.h.
+ */
+
+#include "config.h"
+
+#if SERIAL_PROTOCOL == SERIAL_TELEMETRY
+
+static uint8_t seq;                 //Sequence number of the next record
+static tankmask_t sent;             //One bit per tank, set once a record of the tank is sent
+static uint16_t lastTime[TANK_COUNT];   //Lower 16 bits of ClockSeconds() when each tank was last sent
+#if TELEMETRY_MODE == TLM_CHANGES
+static uint16_t lastLevel[TANK_COUNT];  //Level last sent
+static uint8_t lastFlags[TANK_COUNT];   //Flags last sent
+#endif
+static uint16_t dropped;            //Records that didn't fit in the UART buffer
+
+/*
+ * Start the stream. The first record of each tank has TLM_FLAG_BOOT set.
+ */
+void TelemetryInit(void)
+{
+    seq = 0;
+    sent = 0;
+    dropped = 0;
+}
+
+/*
+ * Send a record for a reading of a tank, unless the rate limit or the
+ * change-only mode holds it back
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      ticks - the raw echo time of the reading
+ *      level - the filtered height of the liquid in cm, or TLM_NO_LEVEL if the
+ *              reading failed
+ *      liters - the liters in the tank
+ */
+static void sample(uint8_t tankIndex, uint16_t ticks, uint16_t level, uint32_t liters)
+{
+    uint8_t rec[TLM_REC_SIZE];
+    uint8_t flags = tankFlags(tankIndex);
+    uint8_t crc = 0xff;
+    uint16_t now = ClockSeconds();
+    
+    if(level == TLM_NO_LEVEL)
+        flags |= TLM_FLAG_NO_READING;
+    
+    if(sent & (1<<tankIndex))
+    {
+#if TELEMETRY_INTERVAL
+        if((uint16_t)(now - lastTime[tankIndex]) < TELEMETRY_INTERVAL)
+            return;
+#endif
+#if TELEMETRY_MODE == TLM_CHANGES
+        if(level == lastLevel[tankIndex] && flags == lastFlags[tankIndex] &&
+           (uint16_t)(now - lastTime[tankIndex]) < TELEMETRY_KEEPALIVE)
+            return;
+#endif
+    }
+    else
+        flags |= TLM_FLAG_BOOT;
+    
+    rec[0] = TLM_SYNC;
+    rec[TLM_REC_SEQ] = seq++;
+    rec[TLM_REC_TANK] = tankIndex;
+    rec[TLM_REC_TICKS] = ticks & 0xff;
+    rec[TLM_REC_TICKS+1] = ticks >> 8;
+    rec[TLM_REC_LEVEL] = level & 0xff;
+    rec[TLM_REC_LEVEL+1] = level >> 8;
+    rec[TLM_REC_LITERS] = liters & 0xff;
+    rec[TLM_REC_LITERS+1] = (liters >> 8) & 0xff;
+    rec[TLM_REC_LITERS+2] = (liters >> 16) & 0xff;
+    rec[TLM_REC_FLAGS] = flags;
+    for(uint8_t i = TLM_REC_SEQ; i < TLM_REC_CRC; i++)
+        crc = crc8(crc, rec[i]);
+    rec[TLM_REC_CRC] = crc;
+    
+#if UART_TX_NEED > UART_TX_SIZE
+    //The buffer can't hold a record of every tank, wait for the interrupt to
+    //make room (about 1ms per byte at 9600 baud)
+    while(!UARTWrite(rec, TLM_REC_SIZE))
+        NOP();
+#else
+    //A dropped record keeps its sequence number used. The tank is tried again
+    //at its next reading.
+    if(!UARTWrite(rec, TLM_REC_SIZE))
+    {
+        dropped++;
+        return;
+    }
+#endif
+    sent |= 1<<tankIndex;
+    lastTime[tankIndex] = now;
+#if TELEMETRY_MODE == TLM_CHANGES
+    lastLevel[tankIndex] = level;
+    lastFlags[tankIndex] = flags & ~TLM_FLAG_BOOT;
+#endif
+}
+
+/*
+ * Send the tanks read since the last call (see store.h), failed readings too
+ */
+void TelemetryService(void)
+{
+    struct measurement m;
+    uint8_t tank;
+    while((tank = StoreNext(STORE_TELEMETRY, &m)) != STORE_NONE)
+        sample(tank, m.ticks, m.level, m.liters);
+}
+
+/*
+ *  Returns:
+ *      The number of records dropped because the UART buffer was full
+ */
+uint16_t TelemetryDropped(void)
+{
+    return dropped;
+}
+
+#endif	/* SERIAL_PROTOCOL == SERIAL_TELEMETRY */
@@ -0,0 +1,86 @@
+/*
+ * File:   uart.c
+ * Author: Faris Shahin
+ *
+ * USART setup and interrupt driven transmitter. See uart.h.
+ *
+ * Note: UARTTxInterrupt() must be called from the interrupt service routine in
+ * main.c when both TXIE and TXIF are set (TXIF is set whenever TXREG is empty).
+ */
+
+#include "config.h"
+
+#if UART_SPBRG > 255 || UART_SPBRG < 0
+#error "UART_BAUD can't be reached with this crystal"
+#endif
+#if (_XTAL_FREQ/(16L*(UART_SPBRG+1)))*100 > UART_BAUD*103L || (_XTAL_FREQ/(16L*(UART_SPBRG+1)))*100 < UART_BAUD*97L
+#error "UART_BAUD is more than 3% off with this crystal"
+#endif
+
+#if SERIAL_PROTOCOL == SERIAL_TELEMETRY
+static uint8_t txBuf[UART_TX_SIZE];
+static volatile uint8_t txHead = 0;    //Next free place, only moved by UARTWrite()
+static volatile uint8_t txTail = 0;    //Next byte to send, only moved by the interrupt
+#endif
+
+/*
+ * Sets the baud rate and enables the transmitter. The TX interrupt is only
+ * enabled while there's something to send.
+ */
+void UARTInit(void)
+{
+#if SERIAL_PROTOCOL == SERIAL_NONE
+    RCSTA = 0x00;       //Serial port disabled
+#else
+    TRISC |= 0xC0;      //RC6 and RC7 must be inputs for the USART to drive them
+    SPBRG = UART_SPBRG;
+    TXSTA = 0x24;       //8 bits, transmitter enabled, asynchronous, high speed
+    RCSTA = 0x80;       //Serial port enabled, receiver disabled
+    TXIE = 0;
+#endif
+}
+
+#if SERIAL_PROTOCOL == SERIAL_TELEMETRY
+/*
+ * Queue bytes for sending
+ * Parameters:
+ *      *data - the bytes to send
+ *      len - the number of bytes, less than UART_TX_SIZE
+ * Returns:
+ *      1 if the bytes were queued, 0 if there wasn't room for all of them (none
+ *      is queued in that case)
+ */
+uint8_t UARTWrite(uint8_t * data, uint8_t len)
+{
+    uint8_t head = txHead;
+    uint8_t used = (head - txTail) & (UART_TX_SIZE-1);
+    if(len > UART_TX_SIZE-1-used)
+        return 0;
+    for(uint8_t i = 0; i < len; i++)
+    {
+        txBuf[head] = data[i];
+        head = (head+1) & (UART_TX_SIZE-1);
+    }
+    txHead = head;  //The interrupt only sees the bytes once they are all in
+    TXIE = 1;
+    return 1;
+}
+
+/*
+ * Called from the interrupt service routine when TXREG is empty. Sends the
+ * next byte and turns the interrupt off once the buffer is empty.
+ */
+void UARTTxInterrupt(void)
+{
+    uint8_t tail = txTail;
+    if(tail != txHead)
+    {
+        TXREG = txBuf[tail];
+        tail = (tail+1) & (UART_TX_SIZE-1);
+        txTail = tail;
+    }
+    if(tail == txHead)
+        TXIE = 0;
+}
+
+#endif	/* SERIAL_PROTOCOL == SERIAL_TELEMETRY */
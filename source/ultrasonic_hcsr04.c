@@ -1,71 +1,184 @@
-/*
- * File:   ultrasonic_hcsr04.c
- * Author: Faris
- * 
- * Library for HC-SR04 ultrasonic
- * 
- * Note: This library relies on timers to properly work. Make sure you have
- * configured the timer you wish to use correctly in main.c and do the
- * necessary changes in this library.
- */
-
-#include "config.h"
-
-/*
- * Initiates the pins connected to the ultrasonic.
- * Pin numbers are selected in the header file.
- * Echo pin is configured as input. Trigger pin is configured as output.
- */
-void UltraSonicInit()
-{
-    //PIN indexing in PIC microcontroller is zero-based
-   TRIG_PIN--;
-   ECHO_PIN--;
-   *US_TRIS &= ~(1<<TRIG_PIN);  //Set the trigger as output
-   *US_TRIS |= 1<< ECHO_PIN;    //Set the echo as input
-}
-
-/*
- *  Function that takes the ultrasonic reading
- *  Parameters:
- *      *TMRCount: A pointer to a timer overflow counter
- *  Returns:
- *      Distance in centimeters measured by the ultrasonic
- */
-uint16_t UltraSonicPing(uint8_t * TMRCount)
-{
-    uint16_t tmp = 0;
-    *TMRCount = 1;              //Reset the timer overflow counter back to 1
-    *US_DATA |= 1<<TRIG_PIN;    //Send the trigger signal
-    __delay_us(10);             //Wait for 10us
-    *US_DATA &= ~(1<<TRIG_PIN); //Reset the trigger signal. This concludes the trigger sequence
-    
-    TMR0IE = 1;                 //Enable TMR0 interrupt. If a different timer is used, do the necessary modification here
-    TMR0 = 0;                   //Set TMR0 to 0
-    
-    //Wait for the echo signal
-    while(!((*US_DATA>>ECHO_PIN)&0x01) && *TMRCount < 25);
-    //If too much time passed without echo, return 0 to distance
-    if(*TMRCount >= 25)
-    {
-        return 0;
-    }
-    TMR0 = 0;
-    *TMRCount = 1;
-    //Determine the echo signal time (high-input signal time)
-    while((*US_DATA>>ECHO_PIN)&0x01 && *TMRCount < 25);
-    tmp = TMR0;
-    TMR0IE = 0; //Disable TMR) interrupt
-    
-    //If too much time passed while still processing, return 0 to distance
-    if(*TMRCount >= 25)
-    {
-        return 0;
-    }
-    //Return the calculated distance
-    // Distance = (TMR0 * overflow times) * (1/internal clock) * prescaler * speed of sound in air
-    // Speed of sound in air = 3400cm/s
-    // In this project, the used crystal has a frequency of 4MHz -> Internal clock = 4MHz/4 (check PIC datasheet)
-    // prescalar is set to 1:64
-    return tmp * (*TMRCount) * 1.152;
-}
\ No newline at end of file
+/*
+ * File:   ultrasonic_hcsr04.c
+ * Author: Faris
+ * 
+ * Library for HC-SR04 ultrasonic
+ * 
+ * Note: This library relies on timers to properly work. Make sure you have
+ * configured the timer you wish to use correctly in main.c and do the
+ * necessary changes in this library.
+ */
+
+#include "config.h"
+
+#if US_TIMEOUT_OVERFLOWS > 255 || US_TIMEOUT_OVERFLOWS < 2
+#error "US_TIMEOUT_MS doesn't fit the echo time of TMR0 with this crystal"
+#endif
+
+static uint16_t ticks = 0;  //Echo time of the last reading
+static uint16_t level = 0;  //Level of the last UltraSonicStart() in mm
+static uint8_t health = STORE_UNKNOWN;
+
+//Address lines to set for a MUX channel
+#define MUX_SELECT(ch)  ((((ch)&1) ? 1<<MUX_A0 : 0) | (((ch)&2) ? 1<<MUX_A1 : 0) | \
+                         (((ch)&4) ? 1<<MUX_A2 : 0))
+#define MUX_CHANNELS    (1<<TANK_BITS)
+#define MUX_MASK        MUX_SELECT(MUX_CHANNELS-1)
+
+static const uint8_t muxSelect[MUX_CHANNELS] = {
+    MUX_SELECT(0), MUX_SELECT(1), MUX_SELECT(2), MUX_SELECT(3),
+#if MUX_CHANNELS > 4
+    MUX_SELECT(4), MUX_SELECT(5), MUX_SELECT(6), MUX_SELECT(7),
+#endif
+#if MUX_CHANNELS > 8
+    MUX_SELECT(8), MUX_SELECT(9), MUX_SELECT(10), MUX_SELECT(11),
+    MUX_SELECT(12), MUX_SELECT(13), MUX_SELECT(14), MUX_SELECT(15),
+#endif
+};
+
+/*
+ * Initiates the pins connected to the ultrasonic.
+ * Pin numbers are selected in the header file.
+ * Echo pin is configured as input. Trigger pin is configured as output.
+ */
+void UltraSonicInit()
+{
+    //PIN indexing in PIC microcontroller is zero-based
+   TRIG_PIN--;
+   ECHO_PIN--;
+   *US_TRIS &= ~(1<<TRIG_PIN);  //Set the trigger as output
+   *US_TRIS |= 1<< ECHO_PIN;    //Set the echo as input
+}
+
+/*
+ *  Connects the sensor of a tank through the MUX
+ *  Parameters:
+ *      channel: the MUX channel, which is the index of the tank
+ */
+void UltraSonicSelect(uint8_t channel)
+{
+    *US_DATA = (*US_DATA & ~MUX_MASK) | muxSelect[channel];
+}
+
+/*
+ *  Function that takes the ultrasonic reading
+ *  Parameters:
+ *      *TMRCount: A pointer to a timer overflow counter
+ *  Returns:
+ *      The echo time in TMR0 ticks, 0 if the reading failed
+ *  Notes:
+ *  The echo time is the overflows of TMR0 times 256 plus TMR0, in ticks of
+ *  US_TICK_NS. A wait longer than US_TIMEOUT_MS is a failed reading.
+ */
+uint16_t UltraSonicPing(volatile uint16_t * TMRCount)
+{
+    uint16_t tmp = 0;
+    uint16_t overflows;
+    PROFILE_ENTER();
+    ticks = 0;
+    *TMRCount = 0;              //Reset the timer overflow counter
+    *US_DATA |= 1<<TRIG_PIN;    //Send the trigger signal
+    __delay_us(10);             //Wait for 10us
+    *US_DATA &= ~(1<<TRIG_PIN); //Reset the trigger signal. This concludes the trigger sequence
+    
+    TMR0IE = 1;                 //Enable TMR0 interrupt. If a different timer is used, do the necessary modification here
+    TMR0 = 0;                   //Set TMR0 to 0
+    
+    //Wait for the echo signal. The NOP() of the waits is also where the
+    //simulator (sim/) moves its clock.
+    while(!((*US_DATA>>ECHO_PIN)&0x01) && *TMRCount < US_TIMEOUT_OVERFLOWS)
+        NOP();
+    //If too much time passed without echo, return 0 to distance
+    if(*TMRCount >= US_TIMEOUT_OVERFLOWS)
+    {
+        PROFILE_EXIT(PROF_PING);
+        return 0;
+    }
+    TMR0 = 0;
+    *TMRCount = 0;
+    //Determine the echo signal time (high-input signal time)
+    while((*US_DATA>>ECHO_PIN)&0x01 && *TMRCount < US_TIMEOUT_OVERFLOWS)
+        NOP();
+    //Read again if TMR0 overflowed in between
+    do
+    {
+        overflows = *TMRCount;
+        tmp = TMR0;
+    }while(overflows != *TMRCount);
+    TMR0IE = 0; //Disable TMR) interrupt
+    
+    //If too much time passed while still processing, return 0 to distance
+    if(overflows >= US_TIMEOUT_OVERFLOWS)
+    {
+        PROFILE_EXIT(PROF_PING);
+        return 0;
+    }
+    ticks = overflows*256 + tmp;
+    PROFILE_EXIT(PROF_PING);
+    return ticks;
+}
+
+/*
+ *  Returns:
+ *      The echo time of the last reading in TMR0 ticks (as used for the
+ *      distance), or 0 if the reading failed
+ */
+uint16_t UltraSonicTicks(void)
+{
+    return ticks;
+}
+
+/*
+ *  Reads the sensor of a tank, the SENSOR_ULTRASONIC backend of sensor.h. The
+ *  ping is timed by busy waits, so the reading is over when this returns.
+ *  Parameters:
+ *      tankIndex - the index of the liquid tank
+ */
+void UltraSonicStart(uint8_t tankIndex)
+{
+    uint16_t height = TankHeight(tankIndex);
+    uint16_t distVal;
+
+    UltraSonicSelect(tankIndex);
+    //The 32-bit multiply of the distance is a routine of XC8, here it's a
+    //level above the bottom of the stack rather than below UltraSonicPing()
+    distVal = UltraSonicDistance(UltraSonicPing(&TMR0of));
+    level = 0;
+    if(ticks == 0)
+        health = STORE_NO_ECHO;
+    else if(distVal > height*10)
+        health = STORE_OUT_OF_RANGE;
+    else
+    {
+        health = STORE_OK;
+        level = height*10 - distVal;    //The distance is in mm
+    }
+}
+
+/*
+ *  Returns:
+ *      SENSOR_DONE, UltraSonicStart() waited for the echo
+ */
+uint8_t UltraSonicPoll(void)
+{
+    return SENSOR_DONE;
+}
+
+/*
+ *  Returns:
+ *      The level of the last reading in mm above the bottom of the tank
+ */
+uint16_t UltraSonicLevel(void)
+{
+    return level;
+}
+
+/*
+ *  Returns:
+ *      STORE_OK, STORE_NO_ECHO or STORE_OUT_OF_RANGE if the distance was 0 or
+ *      deeper than the tank
+ */
+uint8_t UltraSonicHealth(void)
+{
+    return health;
+}
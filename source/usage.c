@@ -0,0 +1,180 @@
+/*
+ * File:   usage.c
+ * Author: Faris Shahin
+ *
+ * Daily usage summary and days-to-empty estimate. See usage.h.
+ */
+
+#include "config.h"
+
+static struct tankUsage tanks[TANK_COUNT];
+static uint32_t dayStart;   //Time the current day started in seconds
+
+/*
+ * Queue the estimate of a tank for writing to EEPROM
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ */
+static void saveEstimate(uint8_t tankIndex)
+{
+    uint8_t addrs = EE_USAGE_ADDR + tankIndex*USAGE_REC_SIZE;
+    uint8_t rec[USAGE_REC_SIZE];
+    uint8_t crc = 0xff;
+    rec[USAGE_REC_RATE] = tanks[tankIndex].rate & 0xff;
+    rec[USAGE_REC_RATE+1] = tanks[tankIndex].rate >> 8;
+    rec[USAGE_REC_DAYS] = tanks[tankIndex].days;
+    for(uint8_t i = 0; i < USAGE_REC_CRC; i++)
+        crc = crc8(crc, rec[i]);
+    rec[USAGE_REC_CRC] = crc;
+    for(uint8_t i = 0; i < USAGE_REC_SIZE; i++)
+        EEPROMQueueWrite(addrs+i, rec[i]);
+}
+
+/*
+ * Start a new day for a tank
+ */
+static void startDay(uint8_t tankIndex)
+{
+    tanks[tankIndex].used = 0;
+}
+
+/*
+ * Loads the estimates from EEPROM. A damaged estimate starts from scratch.
+ */
+void UsageInit(void)
+{
+    uint8_t addrs, crc;
+    uint8_t rec[USAGE_REC_SIZE];
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        addrs = EE_USAGE_ADDR + i*USAGE_REC_SIZE;
+        crc = 0xff;
+        for(uint8_t j = 0; j < USAGE_REC_SIZE; j++)
+            rec[j] = EEPROMQueueRead(addrs+j);
+        for(uint8_t j = 0; j < USAGE_REC_CRC; j++)
+            crc = crc8(crc, rec[j]);
+        tanks[i].level = USAGE_NO_LEVEL;
+        startDay(i);
+        if(crc == rec[USAGE_REC_CRC] && rec[USAGE_REC_DAYS] <= USAGE_AVG_DAYS)
+        {
+            tanks[i].rate = rec[USAGE_REC_RATE] | (uint16_t)rec[USAGE_REC_RATE+1]<<8;
+            tanks[i].days = rec[USAGE_REC_DAYS];
+        }
+        else
+        {
+            tanks[i].rate = 0;
+            tanks[i].days = 0;
+        }
+    }
+    dayStart = ClockSeconds();
+}
+
+/*
+ * Forget the summary and the estimate of a tank. Used when a tank is edited
+ * or deleted since the old estimate doesn't apply anymore.
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ */
+void UsageReset(uint8_t tankIndex)
+{
+    tanks[tankIndex].level = USAGE_NO_LEVEL;
+    startDay(tankIndex);
+    tanks[tankIndex].rate = 0;
+    tanks[tankIndex].days = 0;
+    saveEstimate(tankIndex);
+}
+
+/*
+ * Add a reading to the summary of the current day
+ * Parameters:
+ *      tankIndex - the index of the liquid tank
+ *      level - the height of the liquid in cm
+ * Notes:
+ * The reference level only moves when the level is more than USAGE_DEADBAND
+ * away from it, and then by the whole difference. A reading flickering by a
+ * tick is not counted as use and refill, while a slow drop is still counted
+ * in full.
+ */
+static void sample(uint8_t tankIndex, uint16_t level)
+{
+    struct tankUsage * u = &tanks[tankIndex];
+    if(u->level == USAGE_NO_LEVEL)
+    {
+        u->level = level;
+        startDay(tankIndex);
+        return;
+    }
+    if(level + USAGE_DEADBAND < u->level)
+    {
+        u->used += u->level - level;
+        u->level = level;
+    }
+    else if(level > u->level + USAGE_DEADBAND)
+        u->level = level;   //Refills aren't counted here, see refill.h
+}
+
+/*
+ * Add the tanks read since the last call (see store.h) to the day, then
+ * close the day if USAGE_DAY seconds have passed since it started: the
+ * liters used are added to the estimate of each tank, which is saved to
+ * EEPROM, and a new day starts. Returns right away otherwise.
+ */
+void UsageService(void)
+{
+    uint32_t used;
+    struct measurement m;
+    uint8_t tank;
+    
+    while((tank = StoreNext(STORE_USAGE, &m)) != STORE_NONE)
+        if(m.health == STORE_OK)
+            sample(tank, m.level);
+    if(ClockSeconds() - dayStart < USAGE_DAY)
+        return;
+    dayStart += USAGE_DAY;
+    
+    for(uint8_t i = 0; i < TANK_COUNT; i++)
+    {
+        if(!TankInUse(i) || tanks[i].level == USAGE_NO_LEVEL)
+            continue;
+        used = tankLiters(i, tanks[i].used);
+        if(used > 0xfffe)
+            used = 0xfffe;
+        //Plain average of the days so far for the first USAGE_AVG_DAYS days.
+        //After that an exponential average: each new day weighs
+        //1/USAGE_AVG_DAYS and the older days fade out, there is no window.
+        used = ((uint32_t)tanks[i].rate*tanks[i].days + used)/(tanks[i].days+1);
+        tanks[i].rate = used;
+        if(tanks[i].days < USAGE_AVG_DAYS-1)
+            tanks[i].days++;
+        saveEstimate(i);
+        startDay(i);
+    }
+}
+
+/*
+ *  Returns:
+ *      The estimate of the liters used per day from a tank, or USAGE_UNKNOWN
+ *      if no day has been completed yet
+ */
+uint16_t UsageDailyLiters(uint8_t tankIndex)
+{
+    if(tanks[tankIndex].days == 0)
+        return USAGE_UNKNOWN;
+    return tanks[tankIndex].rate;
+}
+
+/*
+ *  Returns:
+ *      The estimate of the days left until a tank is empty, or USAGE_UNKNOWN
+ *      if there's no estimate or no liquid is being used
+ */
+uint16_t UsageDaysLeft(uint8_t tankIndex)
+{
+    uint32_t days;
+    if(tanks[tankIndex].days == 0 || tanks[tankIndex].rate == 0 || tanks[tankIndex].level == USAGE_NO_LEVEL)
+        return USAGE_UNKNOWN;
+    days = tankLiters(tankIndex, tanks[tankIndex].level)/tanks[tankIndex].rate;
+    if(days >= USAGE_UNKNOWN)
+        days = USAGE_UNKNOWN-1;
+    return days;
+}